@@ -89,6 +89,9 @@ static void view_size_allocated_cb (GtkWidget *widget,
     GtkChamplainEmbed *view);
 static void view_realize_cb (GtkWidget *widget,
     GtkChamplainEmbed *view);
+static void view_scale_factor_cb (GtkWidget *widget,
+    GParamSpec *pspec,
+    GtkChamplainEmbed *view);
 static gboolean embed_focus_cb (GtkChamplainEmbed *embed,
     GdkEvent *event);
 static gboolean stage_key_press_cb (ClutterActor *actor,
@@ -195,6 +198,20 @@ gtk_champlain_embed_class_init (GtkChamplainEmbedClass *klass)
 }
 
 
+/* Lets the view load tiles matching the density of the monitor */
+static void
+update_scale_factor (GtkChamplainEmbed *embed)
+{
+#if GTK_CHECK_VERSION (3, 10, 0)
+  GtkChamplainEmbedPrivate *priv = embed->priv;
+
+  if (priv->view != NULL)
+    champlain_view_set_scale_factor (priv->view,
+        MAX (1, gtk_widget_get_scale_factor (priv->clutter_embed)));
+#endif
+}
+
+
 static void
 set_view (GtkChamplainEmbed *embed,
     ChamplainView *view)
@@ -211,6 +228,7 @@ set_view (GtkChamplainEmbed *embed,
   clutter_actor_set_size (CLUTTER_ACTOR (priv->view), priv->width, priv->height);
 
   clutter_actor_add_child (stage, CLUTTER_ACTOR (priv->view));
+  update_scale_factor (embed);
 }
 
 
@@ -233,6 +251,10 @@ gtk_champlain_embed_init (GtkChamplainEmbed *embed)
       "realize",
       G_CALLBACK (view_realize_cb),
       embed);
+  g_signal_connect (priv->clutter_embed,
+      "notify::scale-factor",
+      G_CALLBACK (view_scale_factor_cb),
+      embed);
   g_signal_connect (priv->clutter_embed,
       "button-press-event",
       G_CALLBACK (mouse_button_cb),
@@ -368,6 +390,17 @@ view_realize_cb (GtkWidget *widget,
 
   /* Setup mouse cursor to a hand */
   gdk_window_set_cursor (gtk_widget_get_window (priv->clutter_embed), priv->cursor_hand_open);
+
+  update_scale_factor (view);
+}
+
+
+static void
+view_scale_factor_cb (G_GNUC_UNUSED GtkWidget *widget,
+    G_GNUC_UNUSED GParamSpec *pspec,
+    GtkChamplainEmbed *view)
+{
+  update_scale_factor (view);
 }
 
 
@@ -29,6 +29,7 @@
 struct _ChamplainErrorTileRendererPrivate
 {
   ClutterContent *error_canvas;
+  cairo_surface_t *error_surface;
   guint tile_size;
 };
 
@@ -99,6 +100,8 @@ champlain_error_tile_renderer_dispose (GObject *object)
       priv->error_canvas = NULL;
     }
 
+  g_clear_pointer (&priv->error_surface, cairo_surface_destroy);
+
   G_OBJECT_CLASS (champlain_error_tile_renderer_parent_class)->dispose (object);
 }
 
@@ -151,6 +154,7 @@ champlain_error_tile_renderer_init (ChamplainErrorTileRenderer *self)
   self->priv = priv;
 
   priv->error_canvas = NULL;
+  priv->error_surface = NULL;
 }
 
 
@@ -180,17 +184,15 @@ set_data (ChamplainRenderer *renderer, const guint8 *data, guint size)
 }
 
 
-static gboolean
-redraw_tile (ClutterCanvas *canvas,
-    cairo_t *cr,
-    gint w,
-    gint h,
-    ChamplainTile *tile)
+static cairo_surface_t *
+create_error_surface (gint size)
 {
+  cairo_surface_t *surface;
   cairo_pattern_t *pat;
-  gint size = w;
-  
-  champlain_exportable_set_surface (CHAMPLAIN_EXPORTABLE (tile), cairo_get_target (cr));
+  cairo_t *cr;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, size, size);
+  cr = cairo_create (surface);
 
   /* draw a linear gray to white pattern */
   pat = cairo_pattern_create_linear (size / 2.0, 0.0, size, size / 2.0);
@@ -211,7 +213,23 @@ redraw_tile (ClutterCanvas *canvas,
   cairo_move_to (cr, 50, 24);
   cairo_line_to (cr, 24, 50);
   cairo_stroke (cr);
-  
+
+  cairo_destroy (cr);
+
+  return surface;
+}
+
+
+static gboolean
+redraw_tile (ClutterCanvas *canvas,
+    cairo_t *cr,
+    gint w,
+    gint h,
+    cairo_surface_t *error_surface)
+{
+  cairo_set_source_surface (cr, error_surface, 0, 0);
+  cairo_paint (cr);
+
   return TRUE;
 }
 
@@ -240,12 +258,18 @@ render (ChamplainRenderer *renderer, ChamplainTile *tile)
 
   if (!priv->error_canvas)
     {
+      /* all error tiles share one surface, drawn only once */
+      priv->error_surface = create_error_surface (size);
       priv->error_canvas = clutter_canvas_new ();
       clutter_canvas_set_size (CLUTTER_CANVAS (priv->error_canvas), size, size);
-      g_signal_connect (priv->error_canvas, "draw", G_CALLBACK (redraw_tile), tile);
+      g_signal_connect_data (priv->error_canvas, "draw", G_CALLBACK (redraw_tile),
+          cairo_surface_reference (priv->error_surface),
+          (GClosureNotify) cairo_surface_destroy, 0);
       clutter_content_invalidate (priv->error_canvas);
     }
 
+  champlain_exportable_set_surface (CHAMPLAIN_EXPORTABLE (tile), priv->error_surface);
+
   actor = clutter_actor_new ();
   clutter_actor_set_size (actor, size, size);
   clutter_actor_set_content (actor, priv->error_canvas);
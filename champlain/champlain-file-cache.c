@@ -24,37 +24,117 @@
  * #ChamplainFileCache is a cache that stores and retrieves tiles from the
  * file system. Tiles most frequently loaded gain in "popularity". This popularity
  * is taken into account when purging the cache.
+ *
+ * Several processes can use the same cache directory at the same time when
+ * the #ChamplainFileCache:shared property is set. In that mode the database
+ * uses write-ahead logging so readers don't block the writer, waits for locks
+ * held by other processes instead of failing, and the purge runs as a single
+ * transaction. Tile files are always written to a temporary file first and
+ * renamed into place so readers never see a partially written tile.
+ *
+ * Tiles can be recompressed in the background with
+ * champlain_file_cache_recompress_on_idle() to fit more of them within the
+ * size limit. PNG tiles with 8 bit RGB(A) or grey samples are re-encoded
+ * losslessly at the highest compression level, palette and 16 bit ones are
+ * left alone, and other tile data is deflated; a tile is only rewritten when
+ * the result is smaller. The format of every tile is recorded in the database and
+ * tiles are decoded transparently when loaded.
+ *
+ * The popularity of a tile is multiplied by the weight of its zoom level when
+ * choosing which tiles to purge, see champlain_file_cache_set_zoom_weight().
+ * By default the overview zoom levels up to 8 weigh more than the others as
+ * they are shared by all views and losing them is felt immediately. Tiles
+ * inside the regions passed to champlain_file_cache_pin_region() are never
+ * purged.
+ *
+ * The tiles of a region can be exported to a single MBTiles file with
+ * champlain_file_cache_export_region() and loaded into the cache of another
+ * machine with champlain_file_cache_import_pack() or, without blocking the
+ * main loop, champlain_file_cache_import_pack_async().
  */
 
 #define DEBUG_FLAG CHAMPLAIN_DEBUG_CACHE
 #include "champlain-debug.h"
 
 #include "champlain-file-cache.h"
+#include "champlain-image-decoder.h"
+#include "champlain-private.h"
+#include "champlain-file-cache-private.h"
 
 #include <sqlite3.h>
 #include <errno.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+
+/* How long to wait for a lock held by another process in shared mode */
+#define SHARED_BUSY_TIMEOUT_MS 5000
+
+/* Tiles older than this, in seconds, are validated with the server again */
+#define TILE_MAX_AGE (7 * 24 * 60 * 60)
+
+/* Zoom levels whose weight can be changed; the others weigh 1 */
+#define WEIGHTED_ZOOM_LEVELS 32
+#define OVERVIEW_MAX_ZOOM 8
+#define OVERVIEW_ZOOM_WEIGHT 4.0
+
+/* Number of tiles written between two commits when importing a pack */
+#define IMPORT_BATCH_SIZE 4096
+
+/* Deflated tiles start with this header so they can be told apart from
+   the data received from the tile source without a database lookup */
+#define DEFLATE_MAGIC "CHZ1"
+#define DEFLATE_MAGIC_LEN 4
+
+/* Values of the 'format' column of the tiles table */
+typedef enum
+{
+  TILE_FORMAT_ORIGINAL = 0,   /* as received, not examined yet */
+  TILE_FORMAT_DEFLATE = 1,    /* DEFLATE_MAGIC followed by zlib data */
+  TILE_FORMAT_EXAMINED = 2    /* re-encoded or left as is when nothing was gained */
+} TileFormat;
 
 struct _ChamplainFileCachePrivate
 {
   guint size_limit;
   gchar *cache_dir;
+  gboolean shared;
 
   sqlite3 *db;
   sqlite3_stmt *stmt_select;
   sqlite3_stmt *stmt_update;
+
+  guint recompress_source_id;
+  gboolean recompress_running;
+  sqlite3_int64 recompress_rowid;
+  GCancellable *recompress_cancellable;
+
+  gdouble zoom_weights[WEIGHTED_ZOOM_LEVELS];
+  GSList *pinned_regions;
+  guint last_pin_id;
 };
 
+typedef struct
+{
+  guint id;
+  ChamplainBoundingBox *bbox;
+  guint min_zoom;
+  guint max_zoom;
+} PinnedRegion;
+
 G_DEFINE_TYPE_WITH_PRIVATE (ChamplainFileCache, champlain_file_cache, CHAMPLAIN_TYPE_TILE_CACHE)
 
 enum
 {
   PROP_0,
   PROP_SIZE_LIMIT,
-  PROP_CACHE_DIR
+  PROP_CACHE_DIR,
+  PROP_SHARED
 };
 
 
@@ -64,9 +144,17 @@ static gchar *get_filename (ChamplainFileCache *file_cache,
     ChamplainTile *tile);
 static gboolean tile_is_expired (ChamplainFileCache *file_cache,
     ChamplainTile *tile);
-static void delete_tile (ChamplainFileCache *file_cache,
+static void delete_tile_row (ChamplainFileCache *file_cache,
     const gchar *filename);
+static void delete_tile_file (const gchar *filename);
 static gboolean create_cache_dir (const gchar *dir_name);
+static void pinned_region_free (PinnedRegion *region);
+static void eviction_rank_func (sqlite3_context *context,
+    int argc,
+    sqlite3_value **argv);
+static void decayed_popularity_func (sqlite3_context *context,
+    int argc,
+    sqlite3_value **argv);
 
 static void fill_tile (ChamplainMapSource *map_source,
     ChamplainTile *tile);
@@ -98,6 +186,10 @@ champlain_file_cache_get_property (GObject *object,
       g_value_set_string (value, champlain_file_cache_get_cache_dir (file_cache));
       break;
 
+    case PROP_SHARED:
+      g_value_set_boolean (value, champlain_file_cache_get_shared (file_cache));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -125,6 +217,10 @@ champlain_file_cache_set_property (GObject *object,
       priv->cache_dir = g_strdup (g_value_get_string (value));
       break;
 
+    case PROP_SHARED:
+      priv->shared = g_value_get_boolean (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -134,6 +230,21 @@ champlain_file_cache_set_property (GObject *object,
 static void
 champlain_file_cache_dispose (GObject *object)
 {
+  ChamplainFileCachePrivate *priv = CHAMPLAIN_FILE_CACHE (object)->priv;
+
+  if (priv->recompress_source_id)
+    {
+      g_source_remove (priv->recompress_source_id);
+      priv->recompress_source_id = 0;
+    }
+
+  if (priv->recompress_cancellable)
+    {
+      g_cancellable_cancel (priv->recompress_cancellable);
+      g_object_unref (priv->recompress_cancellable);
+      priv->recompress_cancellable = NULL;
+    }
+
   G_OBJECT_CLASS (champlain_file_cache_parent_class)->dispose (object);
 }
 
@@ -175,6 +286,7 @@ champlain_file_cache_finalize (GObject *object)
   finalize_sql (file_cache);
 
   g_free (priv->cache_dir);
+  g_slist_free_full (priv->pinned_regions, (GDestroyNotify) pinned_region_free);
 
   G_OBJECT_CLASS (champlain_file_cache_parent_class)->finalize (object);
 }
@@ -219,10 +331,23 @@ init_cache (ChamplainFileCache *file_cache)
       return;
     }
 
-  sqlite3_exec (priv->db,
-      "PRAGMA synchronous=OFF;"
-      "PRAGMA auto_vacuum=INCREMENTAL;",
-      NULL, NULL, &error_msg);
+  if (priv->shared)
+    {
+      sqlite3_busy_timeout (priv->db, SHARED_BUSY_TIMEOUT_MS);
+
+      /* WAL lets readers in other processes proceed while one of them
+         writes; NORMAL is the safe synchronous level for WAL */
+      sqlite3_exec (priv->db,
+          "PRAGMA journal_mode=WAL;"
+          "PRAGMA synchronous=NORMAL;"
+          "PRAGMA auto_vacuum=INCREMENTAL;",
+          NULL, NULL, &error_msg);
+    }
+  else
+    sqlite3_exec (priv->db,
+        "PRAGMA synchronous=OFF;"
+        "PRAGMA auto_vacuum=INCREMENTAL;",
+        NULL, NULL, &error_msg);
   if (error_msg != NULL)
     {
       DEBUG ("Set PRAGMA: %s", error_msg);
@@ -235,7 +360,8 @@ init_cache (ChamplainFileCache *file_cache)
       "filename TEXT PRIMARY KEY, "
       "etag TEXT, "
       "popularity INT DEFAULT 1, "
-      "size INT DEFAULT 0)",
+      "size INT DEFAULT 0, "
+      "format INT DEFAULT 0)",
       NULL, NULL, &error_msg);
   if (error_msg != NULL)
     {
@@ -244,6 +370,18 @@ init_cache (ChamplainFileCache *file_cache)
       return;
     }
 
+  /* Used by the purge to order the tiles */
+  sqlite3_create_function (priv->db, "eviction_rank", 2, SQLITE_UTF8,
+      file_cache, eviction_rank_func, NULL, NULL);
+  sqlite3_create_function (priv->db, "decayed_popularity", 3, SQLITE_UTF8,
+      file_cache, decayed_popularity_func, NULL, NULL);
+
+  /* Caches created by older versions lack the format column; this fails
+     harmlessly when the column exists already */
+  sqlite3_exec (priv->db,
+      "ALTER TABLE tiles ADD COLUMN format INT DEFAULT 0",
+      NULL, NULL, NULL);
+
   error = sqlite3_prepare_v2 (priv->db,
         "SELECT etag FROM tiles WHERE filename = ?", -1,
         &priv->stmt_select, NULL);
@@ -336,6 +474,22 @@ champlain_file_cache_class_init (ChamplainFileCacheClass *klass)
         G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_CACHE_DIR, pspec);
 
+  /**
+   * ChamplainFileCache:shared:
+   *
+   * Whether the cache directory is shared with other processes. When set,
+   * the database is opened in write-ahead logging mode and waits for locks
+   * held by other processes instead of failing.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_boolean ("shared",
+        "Shared",
+        "Whether the cache is shared with other processes",
+        FALSE,
+        G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_SHARED, pspec);
+
   tile_cache_class->store_tile = store_tile;
   tile_cache_class->refresh_tile_time = refresh_tile_time;
   tile_cache_class->on_tile_filled = on_tile_filled;
@@ -348,15 +502,26 @@ static void
 champlain_file_cache_init (ChamplainFileCache *file_cache)
 {
   ChamplainFileCachePrivate *priv = champlain_file_cache_get_instance_private (file_cache);
+  guint i;
 
   file_cache->priv = priv;
 
   priv->cache_dir = NULL;
   priv->size_limit = 100000000;
   priv->cache_dir = NULL;
+  priv->shared = FALSE;
   priv->db = NULL;
   priv->stmt_select = NULL;
   priv->stmt_update = NULL;
+  priv->recompress_source_id = 0;
+  priv->recompress_running = FALSE;
+  priv->recompress_rowid = 0;
+  priv->recompress_cancellable = g_cancellable_new ();
+  priv->pinned_regions = NULL;
+  priv->last_pin_id = 0;
+
+  for (i = 0; i < WEIGHTED_ZOOM_LEVELS; i++)
+    priv->zoom_weights[i] = i <= OVERVIEW_MAX_ZOOM ? OVERVIEW_ZOOM_WEIGHT : 1.0;
 }
 
 
@@ -427,6 +592,25 @@ champlain_file_cache_get_cache_dir (ChamplainFileCache *file_cache)
 }
 
 
+/**
+ * champlain_file_cache_get_shared:
+ * @file_cache: a #ChamplainFileCache
+ *
+ * Checks whether the cache was opened for use by several processes.
+ *
+ * Returns: the value of the #ChamplainFileCache:shared property
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_file_cache_get_shared (ChamplainFileCache *file_cache)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), FALSE);
+
+  return file_cache->priv->shared;
+}
+
+
 /**
  * champlain_file_cache_set_size_limit:
  * @file_cache: a #ChamplainFileCache
@@ -450,27 +634,213 @@ champlain_file_cache_set_size_limit (ChamplainFileCache *file_cache,
 
 
 static gchar *
-get_filename (ChamplainFileCache *file_cache,
-    ChamplainTile *tile)
+build_tile_filename (const gchar *cache_dir,
+    const gchar *source_id,
+    guint zoom_level,
+    guint x,
+    guint y,
+    guint scale_factor)
+{
+  gchar *filename;
+
+  /* HiDPI tiles get the usual "@2x" suffix */
+  if (scale_factor > 1)
+    filename = g_strdup_printf ("%s" G_DIR_SEPARATOR_S
+          "%s" G_DIR_SEPARATOR_S
+          "%d" G_DIR_SEPARATOR_S
+          "%d" G_DIR_SEPARATOR_S "%d@%dx.png",
+          cache_dir,
+          source_id,
+          zoom_level,
+          x,
+          y,
+          scale_factor);
+  else
+    filename = g_strdup_printf ("%s" G_DIR_SEPARATOR_S
+          "%s" G_DIR_SEPARATOR_S
+          "%d" G_DIR_SEPARATOR_S
+          "%d" G_DIR_SEPARATOR_S "%d.png",
+          cache_dir,
+          source_id,
+          zoom_level,
+          x,
+          y);
+  return filename;
+}
+
+
+static gchar *
+get_filename_for_coords (ChamplainFileCache *file_cache,
+    guint zoom_level,
+    guint x,
+    guint y,
+    guint scale_factor)
 {
   ChamplainFileCachePrivate *priv = file_cache->priv;
 
   g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), NULL);
-  g_return_val_if_fail (CHAMPLAIN_IS_TILE (tile), NULL);
   g_return_val_if_fail (priv->cache_dir, NULL);
 
-  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (file_cache);
-
-  gchar *filename = g_strdup_printf ("%s" G_DIR_SEPARATOR_S
-        "%s" G_DIR_SEPARATOR_S
-        "%d" G_DIR_SEPARATOR_S
-        "%d" G_DIR_SEPARATOR_S "%d.png",
-        priv->cache_dir,
-        champlain_map_source_get_id (map_source),
-        champlain_tile_get_zoom_level (tile),
-        champlain_tile_get_x (tile),
-        champlain_tile_get_y (tile));
-  return filename;
+  return build_tile_filename (priv->cache_dir,
+      champlain_map_source_get_id (CHAMPLAIN_MAP_SOURCE (file_cache)),
+      zoom_level, x, y, scale_factor);
+}
+
+
+static gchar *
+get_filename (ChamplainFileCache *file_cache,
+    ChamplainTile *tile)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_TILE (tile), NULL);
+
+  return get_filename_for_coords (file_cache,
+      champlain_tile_get_zoom_level (tile),
+      champlain_tile_get_x (tile),
+      champlain_tile_get_y (tile),
+      champlain_tile_get_scale_factor (tile));
+}
+
+
+static GBytes *
+convert_contents (GConverter *converter,
+    const gchar *contents,
+    gsize length,
+    GCancellable *cancellable,
+    GError **error)
+{
+  GOutputStream *memory_stream;
+  GOutputStream *stream;
+  GBytes *bytes = NULL;
+
+  memory_stream = g_memory_output_stream_new_resizable ();
+  stream = g_converter_output_stream_new (memory_stream, converter);
+
+  /* closing the converter stream closes the memory stream as well */
+  if (g_output_stream_write_all (stream, contents, length, NULL, cancellable, error) &&
+      g_output_stream_close (stream, cancellable, error))
+    bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (memory_stream));
+
+  g_object_unref (stream);
+  g_object_unref (memory_stream);
+
+  return bytes;
+}
+
+
+static gboolean
+contents_are_deflated (const gchar *contents,
+    gsize length)
+{
+  return length >= DEFLATE_MAGIC_LEN &&
+         memcmp (contents, DEFLATE_MAGIC, DEFLATE_MAGIC_LEN) == 0;
+}
+
+
+/*
+ * Turns the contents of a tile file back into the data received from the
+ * tile source. Takes ownership of the passed contents. Returns FALSE and
+ * sets the contents to NULL if they couldn't be decoded.
+ */
+static gboolean
+decode_contents (gchar **contents,
+    gsize *length,
+    GError **error)
+{
+  GZlibDecompressor *decompressor;
+  GBytes *bytes;
+
+  if (!contents_are_deflated (*contents, *length))
+    return TRUE;
+
+  decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
+  bytes = convert_contents (G_CONVERTER (decompressor),
+        *contents + DEFLATE_MAGIC_LEN, *length - DEFLATE_MAGIC_LEN,
+        NULL, error);
+  g_object_unref (decompressor);
+  g_free (*contents);
+
+  if (!bytes)
+    {
+      *contents = NULL;
+      *length = 0;
+      return FALSE;
+    }
+
+  *contents = g_bytes_unref_to_data (bytes, length);
+  return TRUE;
+}
+
+
+static void
+load_tile_contents_thread (GTask *task,
+    G_GNUC_UNUSED gpointer source_object,
+    gpointer task_data,
+    G_GNUC_UNUSED GCancellable *cancellable)
+{
+  const gchar *filename = task_data;
+  GError *error = NULL;
+  GStatBuf file_stat;
+  gchar *contents;
+  gsize length;
+
+  /* An expired tile taken from the memory cache would be displayed without
+     being validated with the server */
+  if (g_stat (filename, &file_stat) == 0 &&
+      file_stat.st_mtime < g_get_real_time () / G_USEC_PER_SEC - TILE_MAX_AGE)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+          "%s has expired", filename);
+      return;
+    }
+
+  if (g_file_get_contents (filename, &contents, &length, &error) &&
+      decode_contents (&contents, &length, &error))
+    g_task_return_pointer (task, g_bytes_new_take (contents, length),
+        (GDestroyNotify) g_bytes_unref);
+  else
+    g_task_return_error (task, error);
+}
+
+
+/*
+ * Reads the stored contents of the tile at the given coordinates in a worker
+ * thread. Used by the memory cache to warm itself up on startup without
+ * going through the renderer; expired tiles fail to load, they have to go
+ * through fill_tile() to be validated.
+ */
+void
+champlain_file_cache_load_tile_contents_async (ChamplainFileCache *file_cache,
+    guint zoom_level,
+    guint x,
+    guint y,
+    guint scale_factor,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+  g_return_if_fail (scale_factor >= 1);
+
+  GTask *task;
+
+  task = g_task_new (file_cache, cancellable, callback, user_data);
+  g_task_set_source_tag (task, champlain_file_cache_load_tile_contents_async);
+  g_task_set_task_data (task,
+      get_filename_for_coords (file_cache, zoom_level, x, y, scale_factor),
+      g_free);
+  g_task_run_in_thread (task, load_tile_contents_thread);
+  g_object_unref (task);
+}
+
+
+GBytes *
+champlain_file_cache_load_tile_contents_finish (ChamplainFileCache *file_cache,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, file_cache), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
 }
 
 
@@ -488,8 +858,7 @@ tile_is_expired (ChamplainFileCache *file_cache,
   if (modified_time)
     {
       g_get_current_time (&now);
-      g_time_val_add (&now, (-24ul * 60ul * 60ul * 1000ul * 1000ul * 7ul)); /* Cache expires in 7 days */
-      validate_cache = modified_time->tv_sec < now.tv_sec;
+      validate_cache = modified_time->tv_sec < now.tv_sec - TILE_MAX_AGE;
     }
 
   DEBUG ("%p is %s expired", tile, (validate_cache ? "" : "not"));
@@ -630,7 +999,8 @@ file_loaded_cb (GFile *file,
   ChamplainMapSource *map_source = user_data->map_source;
   ChamplainRenderer *renderer;
 
-  ok = g_file_load_contents_finish (file, res, &contents, &length, NULL, &error);
+  ok = g_file_load_contents_finish (file, res, &contents, &length, NULL, &error) &&
+    decode_contents (&contents, &length, &error);
 
   if (!ok)
     {
@@ -741,6 +1111,55 @@ refresh_tile_time (ChamplainTileCache *tile_cache,
 }
 
 
+/* Replaces the file through a temporary file, so that readers never see a
+   partial tile, but without the fsync() G_FILE_SET_CONTENTS_CONSISTENT does
+   when the file exists: a tile lost in a crash is only downloaded again */
+static gboolean
+write_tile_file (const gchar *filename,
+    const gchar *contents,
+    gsize length,
+    GError **error)
+{
+  gchar *tmp_filename;
+  gint fd;
+  gboolean ret = FALSE;
+
+  tmp_filename = g_strconcat (filename, ".XXXXXX", NULL);
+  fd = g_mkstemp_full (tmp_filename, O_RDWR, 0600);
+  if (fd == -1)
+    {
+      gint saved_errno = errno;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+          "Unable to create a temporary file for '%s': %s",
+          filename, g_strerror (saved_errno));
+      g_free (tmp_filename);
+      return FALSE;
+    }
+  g_close (fd, NULL);
+
+  if (g_file_set_contents_full (tmp_filename, contents, length,
+          G_FILE_SET_CONTENTS_NONE, 0600, error))
+    {
+      if (g_rename (tmp_filename, filename) == 0)
+        ret = TRUE;
+      else
+        {
+          gint saved_errno = errno;
+
+          g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+              "Unable to replace '%s': %s", filename, g_strerror (saved_errno));
+        }
+    }
+
+  if (!ret)
+    g_unlink (tmp_filename);
+  g_free (tmp_filename);
+
+  return ret;
+}
+
+
 static void
 store_tile (ChamplainTileCache *tile_cache,
     ChamplainTile *tile,
@@ -758,17 +1177,10 @@ store_tile (ChamplainTileCache *tile_cache,
   gchar *path = NULL;
   gchar *filename = NULL;
   GError *gerror = NULL;
-  GFile *file;
-  GFileOutputStream *ostream;
-  gsize bytes_written;
 
   DEBUG ("Update of %p", tile);
 
   filename = get_filename (file_cache, tile);
-  file = g_file_new_for_path (filename);
-
-  /* If the file exists, delete it */
-  g_file_delete (file, NULL, NULL);
 
   /* If needed, create the cache's dirs */
   path = g_path_get_dirname (filename);
@@ -782,25 +1194,14 @@ store_tile (ChamplainTileCache *tile_cache,
         }
     }
 
-  ostream = g_file_create (file, G_FILE_CREATE_PRIVATE, NULL, &gerror);
-  if (!ostream)
-    {
-      DEBUG ("GFileOutputStream creation failed: %s", gerror->message);
-      g_error_free (gerror);
-      goto store_next;
-    }
-
   /* Write the cache */
-  if (!g_output_stream_write_all (G_OUTPUT_STREAM (ostream), contents, size, &bytes_written, NULL, &gerror))
+  if (!write_tile_file (filename, contents, size, &gerror))
     {
       DEBUG ("Writing file contents failed: %s", gerror->message);
       g_error_free (gerror);
-      g_object_unref (ostream);
       goto store_next;
     }
 
-  g_object_unref (ostream);
-
   query = sqlite3_mprintf ("REPLACE INTO tiles (filename, etag, size) VALUES (%Q, %Q, %d)",
         filename,
         champlain_tile_get_etag (tile),
@@ -819,7 +1220,6 @@ store_next:
 
   g_free (filename);
   g_free (path);
-  g_object_unref (file);
 }
 
 
@@ -865,12 +1265,10 @@ call_next:
 
 
 static void
-delete_tile (ChamplainFileCache *file_cache, const gchar *filename)
+delete_tile_row (ChamplainFileCache *file_cache, const gchar *filename)
 {
   g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
   gchar *query, *error = NULL;
-  GError *gerror = NULL;
-  GFile *file;
 
   ChamplainFileCachePrivate *priv = file_cache->priv;
 
@@ -882,6 +1280,14 @@ delete_tile (ChamplainFileCache *file_cache, const gchar *filename)
       sqlite3_free (error);
     }
   sqlite3_free (query);
+}
+
+
+static void
+delete_tile_file (const gchar *filename)
+{
+  GError *gerror = NULL;
+  GFile *file;
 
   file = g_file_new_for_path (filename);
   if (!g_file_delete (file, NULL, &gerror))
@@ -894,86 +1300,384 @@ delete_tile (ChamplainFileCache *file_cache, const gchar *filename)
 
 
 static gboolean
-purge_on_idle (gpointer data)
+parse_tile_filename (const gchar *filename,
+    guint *zoom_level,
+    guint *x,
+    guint *y,
+    guint *scale_factor)
 {
-  champlain_file_cache_purge (CHAMPLAIN_FILE_CACHE (data));
-  return FALSE;
+  const gchar *p = filename + strlen (filename);
+  guint values[3];
+  gchar *end = NULL;
+  gint i;
+
+  /* The file name ends with zoom_level/x/y.png or zoom_level/x/y@2x.png,
+     see get_filename_for_coords() */
+  for (i = 2; i >= 0; i--)
+    {
+      while (p > filename && *(p - 1) != G_DIR_SEPARATOR)
+        p--;
+
+      if (!g_ascii_isdigit (*p) || p == filename)
+        return FALSE;
+
+      values[i] = strtoul (p, i == 2 ? &end : NULL, 10);
+      p--;
+    }
+
+  *zoom_level = values[0];
+  *x = values[1];
+  *y = values[2];
+  *scale_factor = *end == '@' ? MAX (strtoul (end + 1, NULL, 10), 1) : 1;
+
+  return TRUE;
+}
+
+
+static gboolean
+region_contains_tile (PinnedRegion *region,
+    guint zoom_level,
+    guint x,
+    guint y)
+{
+  ChamplainBoundingBox *bbox = region->bbox;
+  gdouble n, top, bottom;
+  gdouble min_x, max_x, min_y, max_y;
+
+  if (zoom_level < region->min_zoom || zoom_level > region->max_zoom)
+    return FALSE;
+
+  n = pow (2.0, zoom_level);
+  top = CLAMP (bbox->top, CHAMPLAIN_MIN_LATITUDE, CHAMPLAIN_MAX_LATITUDE) * M_PI / 180.0;
+  bottom = CLAMP (bbox->bottom, CHAMPLAIN_MIN_LATITUDE, CHAMPLAIN_MAX_LATITUDE) * M_PI / 180.0;
+
+  min_x = floor ((bbox->left + 180.0) / 360.0 * n);
+  max_x = floor ((bbox->right + 180.0) / 360.0 * n);
+  min_y = floor ((1.0 - log (tan (top) + 1.0 / cos (top)) / M_PI) / 2.0 * n);
+  max_y = floor ((1.0 - log (tan (bottom) + 1.0 / cos (bottom)) / M_PI) / 2.0 * n);
+
+  return x >= min_x && x <= max_x && y >= min_y && y <= max_y;
+}
+
+
+static gdouble
+tile_weight (ChamplainFileCachePrivate *priv,
+    const gchar *filename,
+    gboolean *pinned)
+{
+  guint zoom_level, x, y, scale_factor;
+  GSList *iter;
+
+  *pinned = FALSE;
+
+  if (!filename || !parse_tile_filename (filename, &zoom_level, &x, &y, &scale_factor))
+    return 1.0;
+
+  for (iter = priv->pinned_regions; iter != NULL; iter = iter->next)
+    {
+      if (region_contains_tile (iter->data, zoom_level, x, y))
+        {
+          *pinned = TRUE;
+          break;
+        }
+    }
+
+  if (zoom_level < WEIGHTED_ZOOM_LEVELS)
+    return priv->zoom_weights[zoom_level];
+
+  return 1.0;
+}
+
+
+static void
+eviction_rank_func (sqlite3_context *context,
+    G_GNUC_UNUSED int argc,
+    sqlite3_value **argv)
+{
+  ChamplainFileCache *file_cache = sqlite3_user_data (context);
+  const gchar *filename = (const gchar *) sqlite3_value_text (argv[0]);
+  gint popularity = sqlite3_value_int (argv[1]);
+  gboolean pinned;
+  gdouble weight;
+
+  weight = tile_weight (file_cache->priv, filename, &pinned);
+
+  if (pinned)
+    sqlite3_result_null (context);
+  else
+    sqlite3_result_double (context, popularity * weight);
+}
+
+
+/* The popularity left to a tile once the rank of the last purged tile is
+   taken off its own rank */
+static void
+decayed_popularity_func (sqlite3_context *context,
+    G_GNUC_UNUSED int argc,
+    sqlite3_value **argv)
+{
+  ChamplainFileCache *file_cache = sqlite3_user_data (context);
+  const gchar *filename = (const gchar *) sqlite3_value_text (argv[0]);
+  gint popularity = sqlite3_value_int (argv[1]);
+  gdouble rank = sqlite3_value_double (argv[2]);
+  gboolean pinned;
+  gdouble weight;
+
+  weight = tile_weight (file_cache->priv, filename, &pinned);
+
+  /* a weight of 0 ranks the tile first whatever its popularity */
+  if (weight <= 0.0)
+    {
+      sqlite3_result_int (context, 0);
+      return;
+    }
+
+  sqlite3_result_int (context, MAX (popularity - (gint) (rank / weight), 0));
+}
+
+
+static void
+pinned_region_free (PinnedRegion *region)
+{
+  champlain_bounding_box_free (region->bbox);
+  g_slice_free (PinnedRegion, region);
 }
 
 
 /**
- * champlain_file_cache_purge_on_idle:
+ * champlain_file_cache_set_zoom_weight:
  * @file_cache: a #ChamplainFileCache
+ * @zoom_level: the zoom level
+ * @weight: the weight of the tiles at @zoom_level
  *
- * Purge the cache from the less popular tiles until cache's size limit is reached.
- * This is a non blocking call as the purge will happen when the application is idle
+ * Sets how much the tiles at the given zoom level are worth keeping when the
+ * cache is purged. The popularity of every tile is multiplied by the weight of
+ * its zoom level and the tiles with the lowest result are deleted first. Zoom
+ * levels up to 8 weigh 4 by default, all others 1. A weight of 0 makes the
+ * tiles the first ones to go.
  *
- * Since: 0.4
+ * Since: 0.12.22
  */
 void
-champlain_file_cache_purge_on_idle (ChamplainFileCache *file_cache)
+champlain_file_cache_set_zoom_weight (ChamplainFileCache *file_cache,
+    guint zoom_level,
+    gdouble weight)
 {
   g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
-  g_idle_add_full (CLUTTER_PRIORITY_REDRAW,
-      (GSourceFunc) purge_on_idle,
-      g_object_ref (file_cache),
-      (GDestroyNotify) g_object_unref);
+  g_return_if_fail (zoom_level < WEIGHTED_ZOOM_LEVELS);
+  g_return_if_fail (weight >= 0.0);
+
+  file_cache->priv->zoom_weights[zoom_level] = weight;
 }
 
 
 /**
- * champlain_file_cache_purge:
+ * champlain_file_cache_get_zoom_weight:
  * @file_cache: a #ChamplainFileCache
+ * @zoom_level: the zoom level
  *
- * Purge the cache from the less popular tiles until cache's size limit is reached.
+ * Gets the weight of the tiles at the given zoom level used when purging the
+ * cache.
  *
- * Since: 0.4
+ * Returns: the weight set by champlain_file_cache_set_zoom_weight()
+ *
+ * Since: 0.12.22
  */
-void
-champlain_file_cache_purge (ChamplainFileCache *file_cache)
+gdouble
+champlain_file_cache_get_zoom_weight (ChamplainFileCache *file_cache,
+    guint zoom_level)
 {
-  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), 1.0);
 
-  ChamplainFileCachePrivate *priv = file_cache->priv;
-  gchar *query;
-  sqlite3_stmt *stmt;
-  int rc = 0;
-  guint current_size = 0;
-  guint highest_popularity = 0;
-  gchar *error;
+  if (zoom_level >= WEIGHTED_ZOOM_LEVELS)
+    return 1.0;
 
-  query = "SELECT SUM (size) FROM tiles";
-  rc = sqlite3_prepare (priv->db, query, strlen (query), &stmt, NULL);
-  if (rc != SQLITE_OK)
-    {
-      DEBUG ("Can't compute cache size %s", sqlite3_errmsg (priv->db));
-    }
+  return file_cache->priv->zoom_weights[zoom_level];
+}
 
-  rc = sqlite3_step (stmt);
-  if (rc != SQLITE_ROW)
-    {
-      DEBUG ("Failed to count the total cache consumption %s",
+
+/**
+ * champlain_file_cache_pin_region:
+ * @file_cache: a #ChamplainFileCache
+ * @bbox: the region to keep
+ * @min_zoom: the lowest zoom level to keep
+ * @max_zoom: the highest zoom level to keep
+ *
+ * Protects the cached tiles inside @bbox at zoom levels between @min_zoom and
+ * @max_zoom from being deleted by champlain_file_cache_purge(). Pinned tiles
+ * still count towards the size limit.
+ *
+ * Pins are only kept in memory: they are not stored in the cache database, are
+ * lost when @file_cache is finalized and don't protect the tiles from purges
+ * made by other processes sharing the cache directory. Pin the regions again
+ * every time the cache is created.
+ *
+ * Returns: an identifier to pass to champlain_file_cache_unpin_region()
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_file_cache_pin_region (ChamplainFileCache *file_cache,
+    ChamplainBoundingBox *bbox,
+    guint min_zoom,
+    guint max_zoom)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), 0);
+  g_return_val_if_fail (bbox != NULL, 0);
+  g_return_val_if_fail (min_zoom <= max_zoom, 0);
+
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  PinnedRegion *region;
+
+  region = g_slice_new (PinnedRegion);
+  region->id = ++priv->last_pin_id;
+  region->bbox = champlain_bounding_box_copy (bbox);
+  region->min_zoom = min_zoom;
+  region->max_zoom = max_zoom;
+
+  priv->pinned_regions = g_slist_prepend (priv->pinned_regions, region);
+
+  return region->id;
+}
+
+
+/**
+ * champlain_file_cache_unpin_region:
+ * @file_cache: a #ChamplainFileCache
+ * @pin_id: an identifier returned by champlain_file_cache_pin_region()
+ *
+ * Lets the tiles of a previously pinned region be purged again.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_file_cache_unpin_region (ChamplainFileCache *file_cache,
+    guint pin_id)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  GSList *iter;
+
+  for (iter = priv->pinned_regions; iter != NULL; iter = iter->next)
+    {
+      PinnedRegion *region = iter->data;
+
+      if (region->id == pin_id)
+        {
+          priv->pinned_regions = g_slist_delete_link (priv->pinned_regions, iter);
+          pinned_region_free (region);
+          return;
+        }
+    }
+}
+
+
+static gboolean
+purge_on_idle (gpointer data)
+{
+  champlain_file_cache_purge (CHAMPLAIN_FILE_CACHE (data));
+  return FALSE;
+}
+
+
+/**
+ * champlain_file_cache_purge_on_idle:
+ * @file_cache: a #ChamplainFileCache
+ *
+ * Purge the cache from the less popular tiles until cache's size limit is reached.
+ * This is a non blocking call as the purge will happen when the application is idle
+ *
+ * Since: 0.4
+ */
+void
+champlain_file_cache_purge_on_idle (ChamplainFileCache *file_cache)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+  g_idle_add_full (CLUTTER_PRIORITY_REDRAW,
+      (GSourceFunc) purge_on_idle,
+      g_object_ref (file_cache),
+      (GDestroyNotify) g_object_unref);
+}
+
+
+/**
+ * champlain_file_cache_purge:
+ * @file_cache: a #ChamplainFileCache
+ *
+ * Purge the cache from the less popular tiles until cache's size limit is reached.
+ *
+ * Since: 0.4
+ */
+void
+champlain_file_cache_purge (ChamplainFileCache *file_cache)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  gchar *query;
+  sqlite3_stmt *stmt;
+  int rc = 0;
+  guint current_size = 0;
+  gdouble highest_rank = 0.0;
+  gchar *error;
+  GPtrArray *deleted;
+  guint i;
+
+  /* the files go once the rows are gone for good */
+  deleted = g_ptr_array_new_with_free_func (g_free);
+
+  /* Keep other processes sharing the cache from purging at the same time.
+     The size is read within the transaction, another process may have
+     purged already. */
+  if (priv->shared)
+    {
+      rc = sqlite3_exec (priv->db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+      if (rc != SQLITE_OK)
+        {
+          /* SQLITE_BUSY once the busy timeout expired, the process holding
+             the lock is most likely purging itself */
+          DEBUG ("Can't lock the cache for purging: %s", sqlite3_errmsg (priv->db));
+          return;
+        }
+    }
+
+  query = "SELECT SUM (size) FROM tiles";
+  rc = sqlite3_prepare (priv->db, query, strlen (query), &stmt, NULL);
+  if (rc != SQLITE_OK)
+    {
+      DEBUG ("Can't compute cache size %s", sqlite3_errmsg (priv->db));
+      goto finish;
+    }
+
+  rc = sqlite3_step (stmt);
+  if (rc != SQLITE_ROW)
+    {
+      DEBUG ("Failed to count the total cache consumption %s",
           sqlite3_errmsg (priv->db));
       sqlite3_finalize (stmt);
-      return;
+      goto finish;
     }
 
   current_size = sqlite3_column_int (stmt, 0);
+  sqlite3_finalize (stmt);
+
   if (current_size < priv->size_limit)
     {
       DEBUG ("Cache doesn't need to be purged at %d bytes", current_size);
-      sqlite3_finalize (stmt);
-      return;
+      goto finish;
     }
 
-  sqlite3_finalize (stmt);
-
-  /* Ok, delete the less popular tiles until size_limit reached */
-  query = "SELECT filename, size, popularity FROM tiles ORDER BY popularity";
+  /* Ok, delete the less popular tiles until size_limit reached; pinned
+     tiles have no rank and are skipped */
+  query = "SELECT filename, size, "
+    "eviction_rank (filename, popularity) AS rank "
+    "FROM tiles WHERE rank IS NOT NULL ORDER BY rank";
   rc = sqlite3_prepare (priv->db, query, strlen (query), &stmt, NULL);
   if (rc != SQLITE_OK)
     {
       DEBUG ("Can't fetch tiles to delete: %s", sqlite3_errmsg (priv->db));
+      goto finish;
     }
 
   rc = sqlite3_step (stmt);
@@ -984,10 +1688,11 @@ champlain_file_cache_purge (ChamplainFileCache *file_cache)
 
       filename = (const char *) sqlite3_column_text (stmt, 0);
       size = sqlite3_column_int (stmt, 1);
-      highest_popularity = sqlite3_column_int (stmt, 2);
+      highest_rank = sqlite3_column_double (stmt, 2);
       DEBUG ("Deleting %s of size %d", filename, size);
 
-      delete_tile (file_cache, filename);
+      delete_tile_row (file_cache, filename);
+      g_ptr_array_add (deleted, g_strdup (filename));
 
       current_size -= size;
 
@@ -997,8 +1702,12 @@ champlain_file_cache_purge (ChamplainFileCache *file_cache)
 
   sqlite3_finalize (stmt);
 
-  query = sqlite3_mprintf ("UPDATE tiles SET popularity = popularity - %d",
-        highest_popularity);
+  /* Age the remaining tiles by the rank of the last deleted one. The rank is
+     the weighted popularity, so the amount is divided by each tile's weight;
+     taking the raw popularity off would zero the heavier overview tiles. */
+  query = sqlite3_mprintf ("UPDATE tiles SET popularity = "
+        "decayed_popularity (filename, popularity, %.15g)",
+        highest_rank);
   sqlite3_exec (priv->db, query, NULL, NULL, &error);
   if (error != NULL)
     {
@@ -1006,6 +1715,966 @@ champlain_file_cache_purge (ChamplainFileCache *file_cache)
       sqlite3_free (error);
     }
   sqlite3_free (query);
-  
-  sqlite3_exec (priv->db, "PRAGMA incremental_vacuum;", NULL, NULL, &error);
+
+finish:
+  if (priv->shared && sqlite3_exec (priv->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      /* the rows come back, so must the files */
+      DEBUG ("Committing the purge failed: %s", sqlite3_errmsg (priv->db));
+      sqlite3_exec (priv->db, "ROLLBACK", NULL, NULL, NULL);
+      g_ptr_array_unref (deleted);
+      return;
+    }
+
+  for (i = 0; i < deleted->len; i++)
+    delete_tile_file (g_ptr_array_index (deleted, i));
+
+  if (deleted->len > 0)
+    sqlite3_exec (priv->db, "PRAGMA incremental_vacuum;", NULL, NULL, NULL);
+
+  g_ptr_array_unref (deleted);
+}
+
+
+typedef struct
+{
+  gchar *filename;
+  gsize size;
+  TileFormat format;
+  gboolean replaced;
+} RecompressData;
+
+static void
+recompress_data_free (RecompressData *data)
+{
+  g_free (data->filename);
+  g_slice_free (RecompressData, data);
+}
+
+
+static gchar *
+reencode_png (const gchar *contents,
+    gsize length,
+    GCancellable *cancellable,
+    gsize *new_length)
+{
+  GInputStream *stream;
+  GdkPixbuf *pixbuf;
+  gchar *buffer = NULL;
+  guint8 bit_depth, color_type;
+
+  /* GdkPixbuf only writes 8 bit RGB(A): palettes would be expanded and deeper
+     samples truncated, so only those images survive the round trip. The
+     IHDR chunk always comes first, right after the signature. */
+  if (length < 26 || memcmp (contents + 12, "IHDR", 4) != 0)
+    return NULL;
+
+  bit_depth = contents[24];
+  color_type = contents[25];
+  if (bit_depth != 8 || color_type == 3)
+    return NULL;
+
+  stream = g_memory_input_stream_new_from_data (contents, length, NULL);
+  pixbuf = gdk_pixbuf_new_from_stream (stream, cancellable, NULL);
+  g_object_unref (stream);
+
+  if (!pixbuf)
+    return NULL;
+
+  /* The pixels stay the same, only the encoder settings change */
+  if (!gdk_pixbuf_save_to_buffer (pixbuf, &buffer, new_length, "png", NULL,
+          "compression", "9", NULL))
+    buffer = NULL;
+
+  g_object_unref (pixbuf);
+
+  return buffer;
+}
+
+
+static gchar *
+deflate_contents (const gchar *contents,
+    gsize length,
+    GCancellable *cancellable,
+    gsize *new_length)
+{
+  GZlibCompressor *compressor;
+  GBytes *bytes;
+  gchar *buffer;
+  gsize size;
+
+  compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB, 9);
+  bytes = convert_contents (G_CONVERTER (compressor), contents, length,
+        cancellable, NULL);
+  g_object_unref (compressor);
+
+  if (!bytes)
+    return NULL;
+
+  size = g_bytes_get_size (bytes);
+  buffer = g_malloc (DEFLATE_MAGIC_LEN + size);
+  memcpy (buffer, DEFLATE_MAGIC, DEFLATE_MAGIC_LEN);
+  memcpy (buffer + DEFLATE_MAGIC_LEN, g_bytes_get_data (bytes, NULL), size);
+  g_bytes_unref (bytes);
+
+  *new_length = DEFLATE_MAGIC_LEN + size;
+  return buffer;
+}
+
+
+static void
+recompress_tile_thread (GTask *task,
+    G_GNUC_UNUSED gpointer source_object,
+    gpointer task_data,
+    GCancellable *cancellable)
+{
+  RecompressData *data = task_data;
+  GStatBuf stat_before, stat_after;
+  GError *error = NULL;
+  gchar *contents;
+  gchar *best;
+  gsize length;
+  gsize best_length;
+
+  if (g_stat (data->filename, &stat_before) != 0)
+    {
+      int saved_errno = errno;
+
+      g_task_return_new_error (task, G_IO_ERROR,
+          g_io_error_from_errno (saved_errno),
+          "%s", g_strerror (saved_errno));
+      return;
+    }
+
+  if (!g_file_get_contents (data->filename, &contents, &length, &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  data->format = TILE_FORMAT_EXAMINED;
+  best = contents;
+  best_length = length;
+
+  if (contents_are_deflated (contents, length))
+    data->format = TILE_FORMAT_DEFLATE;
+  else if (length > 4 && memcmp (contents, "\x89PNG", 4) == 0)
+    {
+      gsize new_length;
+      gchar *reencoded = reencode_png (contents, length, cancellable, &new_length);
+
+      if (reencoded && new_length < best_length)
+        {
+          best = reencoded;
+          best_length = new_length;
+        }
+      else
+        g_free (reencoded);
+    }
+  else
+    {
+      /* Anything else the tile source provides (vector tiles, raw map data)
+         usually deflates well; already compressed images won't shrink and
+         are left alone below */
+      gsize new_length;
+      gchar *deflated = deflate_contents (contents, length, cancellable, &new_length);
+
+      if (deflated && new_length < best_length)
+        {
+          best = deflated;
+          best_length = new_length;
+          data->format = TILE_FORMAT_DEFLATE;
+        }
+      else
+        g_free (deflated);
+    }
+
+  /* Giving up half way says nothing about the tile, it is examined again */
+  if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+    {
+      if (best != contents)
+        g_free (best);
+      g_free (contents);
+      g_task_return_error (task, error);
+      return;
+    }
+
+  data->size = best_length;
+
+  if (best != contents)
+    {
+      /* Don't overwrite a tile that was stored again in the meantime */
+      if (g_stat (data->filename, &stat_after) != 0 ||
+          stat_after.st_mtime != stat_before.st_mtime ||
+          stat_after.st_size != stat_before.st_size)
+        data->replaced = TRUE;
+      else if (write_tile_file (data->filename, best, best_length, &error))
+        {
+          GFile *file = g_file_new_for_path (data->filename);
+
+          /* Keep the modification time, it decides when the tile expires */
+          g_file_set_attribute_uint64 (file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+              stat_before.st_mtime, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+          g_object_unref (file);
+        }
+
+      g_free (best);
+    }
+
+  g_free (contents);
+
+  if (error)
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+
+static gboolean recompress_next_tile (gpointer data);
+
+static void
+recompress_tile_cb (ChamplainFileCache *file_cache,
+    GAsyncResult *result,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  RecompressData *data = g_task_get_task_data (G_TASK (result));
+  GError *error = NULL;
+  gchar *query = NULL;
+  gchar *error_msg = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_error_free (error);
+          priv->recompress_running = FALSE;
+          return;
+        }
+
+      /* The tile couldn't be read or written, which may work next time;
+         it stays unexamined, this run moves past its rowid anyway */
+      DEBUG ("Recompressing %s failed: %s", data->filename, error->message);
+      g_error_free (error);
+    }
+  else if (!data->replaced)
+    {
+      DEBUG ("Recompressed %s to %" G_GSIZE_FORMAT " bytes",
+          data->filename, data->size);
+      query = sqlite3_mprintf ("UPDATE tiles SET format = %d, size = %d "
+            "WHERE filename = %Q AND format = %d",
+            data->format, (gint) data->size, data->filename,
+            TILE_FORMAT_ORIGINAL);
+    }
+
+  if (query)
+    {
+      sqlite3_exec (priv->db, query, NULL, NULL, &error_msg);
+      if (error_msg != NULL)
+        {
+          DEBUG ("Saving tile format failed: %s", error_msg);
+          sqlite3_free (error_msg);
+        }
+      sqlite3_free (query);
+    }
+
+  if (!priv->recompress_cancellable ||
+      g_cancellable_is_cancelled (priv->recompress_cancellable))
+    {
+      priv->recompress_running = FALSE;
+      return;
+    }
+
+  priv->recompress_source_id = g_idle_add_full (G_PRIORITY_LOW,
+        recompress_next_tile, file_cache, NULL);
+}
+
+
+static gboolean
+recompress_next_tile (gpointer data)
+{
+  ChamplainFileCache *file_cache = CHAMPLAIN_FILE_CACHE (data);
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  RecompressData *recompress_data;
+  sqlite3_stmt *stmt;
+  GTask *task;
+  int rc;
+
+  priv->recompress_source_id = 0;
+
+  /* Walk the table by rowid so every tile is visited once per run */
+  rc = sqlite3_prepare_v2 (priv->db,
+        "SELECT rowid, filename FROM tiles WHERE rowid > ? AND format = 0 "
+        "ORDER BY rowid LIMIT 1", -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+    {
+      DEBUG ("Can't fetch tiles to recompress: %s", sqlite3_errmsg (priv->db));
+      priv->recompress_running = FALSE;
+      return FALSE;
+    }
+
+  sqlite3_bind_int64 (stmt, 1, priv->recompress_rowid);
+  if (sqlite3_step (stmt) != SQLITE_ROW)
+    {
+      DEBUG ("All tiles recompressed");
+      sqlite3_finalize (stmt);
+      priv->recompress_running = FALSE;
+      return FALSE;
+    }
+
+  priv->recompress_rowid = sqlite3_column_int64 (stmt, 0);
+
+  recompress_data = g_slice_new0 (RecompressData);
+  recompress_data->filename = g_strdup ((const gchar *) sqlite3_column_text (stmt, 1));
+  sqlite3_finalize (stmt);
+
+  task = g_task_new (file_cache, priv->recompress_cancellable,
+        (GAsyncReadyCallback) recompress_tile_cb, NULL);
+  g_task_set_source_tag (task, recompress_next_tile);
+  g_task_set_task_data (task, recompress_data,
+      (GDestroyNotify) recompress_data_free);
+  g_task_run_in_thread (task, recompress_tile_thread);
+  g_object_unref (task);
+
+  return FALSE;
+}
+
+
+/**
+ * champlain_file_cache_recompress_on_idle:
+ * @file_cache: a #ChamplainFileCache
+ *
+ * Starts recompressing the cached tiles in the background so more of them fit
+ * within the cache's size limit. PNG tiles are re-encoded with the highest
+ * compression level without changing their pixels, other tile data is
+ * deflated. Tiles are processed one at a time in a worker thread whenever the
+ * application is idle and only rewritten when they get smaller. Tiles stored
+ * afterwards are picked up by the next call.
+ *
+ * This is a non blocking call; calling it while a run is in progress has no
+ * effect.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_file_cache_recompress_on_idle (ChamplainFileCache *file_cache)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+
+  if (priv->recompress_running || !priv->db || !priv->recompress_cancellable)
+    return;
+
+  priv->recompress_running = TRUE;
+  priv->recompress_rowid = 0;
+  priv->recompress_source_id = g_idle_add_full (G_PRIORITY_LOW,
+        recompress_next_tile, file_cache, NULL);
+}
+
+
+static void
+set_sqlite_error (GError **error,
+    sqlite3 *db,
+    const gchar *what)
+{
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+      "%s: %s", what, sqlite3_errmsg (db));
+}
+
+
+/* The MBTiles name of the format of a tile, NULL if unknown */
+static const gchar *
+get_mbtiles_format (const gchar *contents,
+    gsize length)
+{
+  if (length > 8 && memcmp (contents, "\x89PNG\r\n\x1a\n", 8) == 0)
+    return "png";
+  if (length > 3 && memcmp (contents, "\xff\xd8\xff", 3) == 0)
+    return "jpg";
+  if (length > 12 && memcmp (contents, "RIFF", 4) == 0 &&
+      memcmp (contents + 8, "WEBP", 4) == 0)
+    return "webp";
+  /* vector tiles are served gzipped */
+  if (length > 2 && memcmp (contents, "\x1f\x8b", 2) == 0)
+    return "pbf";
+
+  return NULL;
+}
+
+
+/**
+ * champlain_file_cache_export_region:
+ * @file_cache: a #ChamplainFileCache
+ * @filename: the file to write
+ * @bbox: the region to export
+ * @min_zoom: the lowest zoom level to export
+ * @max_zoom: the highest zoom level to export
+ * @error: return location for a #GError, or %NULL
+ *
+ * Writes all cached tiles of the cache's map source inside @bbox at zoom levels
+ * between @min_zoom and @max_zoom into a single MBTiles file which can be
+ * loaded into another cache with champlain_file_cache_import_pack(). An
+ * existing file is overwritten. Tiles which are not in the cache are not
+ * downloaded. The format recorded in the metadata is the one of the first
+ * exported tile.
+ *
+ * This call blocks until the whole region is written.
+ *
+ * Returns: %TRUE on success, %FALSE if an error occurred
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_file_cache_export_region (ChamplainFileCache *file_cache,
+    const gchar *filename,
+    ChamplainBoundingBox *bbox,
+    guint min_zoom,
+    guint max_zoom,
+    GError **error)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+  g_return_val_if_fail (bbox != NULL, FALSE);
+  g_return_val_if_fail (min_zoom <= max_zoom, FALSE);
+
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  const gchar *id = champlain_map_source_get_id (CHAMPLAIN_MAP_SOURCE (file_cache));
+  PinnedRegion region = { 0, bbox, min_zoom, max_zoom };
+  sqlite3 *pack = NULL;
+  sqlite3_stmt *stmt_tiles = NULL;
+  sqlite3_stmt *stmt_insert = NULL;
+  gchar *prefix = NULL;
+  gchar *query;
+  const gchar *format = NULL;
+  gboolean ok = FALSE;
+  guint count = 0;
+
+  if (!priv->db)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+          "The cache database isn't open");
+      return FALSE;
+    }
+
+  if (g_unlink (filename) != 0 && errno != ENOENT)
+    {
+      int saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+          "Unable to replace '%s': %s", filename, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  if (sqlite3_open_v2 (filename, &pack,
+          SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK)
+    {
+      set_sqlite_error (error, pack, "Unable to create the pack");
+      goto cleanup;
+    }
+
+  /* The pack is rebuilt from scratch on failure, no need for a journal */
+  query = sqlite3_mprintf (
+        "PRAGMA journal_mode=OFF;"
+        "PRAGMA synchronous=OFF;"
+        "CREATE TABLE metadata (name TEXT, value TEXT);"
+        "CREATE TABLE tiles (zoom_level INTEGER, tile_column INTEGER, "
+        "tile_row INTEGER, tile_data BLOB);"
+        "CREATE UNIQUE INDEX tile_index ON tiles (zoom_level, tile_column, tile_row);"
+        "INSERT INTO metadata VALUES ('name', %Q);"
+        "INSERT INTO metadata VALUES ('bounds', '%f,%f,%f,%f');"
+        "INSERT INTO metadata VALUES ('minzoom', '%u');"
+        "INSERT INTO metadata VALUES ('maxzoom', '%u');"
+        "BEGIN",
+        id, bbox->left, bbox->bottom, bbox->right, bbox->top,
+        min_zoom, max_zoom);
+  if (sqlite3_exec (pack, query, NULL, NULL, NULL) != SQLITE_OK)
+    {
+      set_sqlite_error (error, pack, "Unable to initialize the pack");
+      sqlite3_free (query);
+      goto cleanup;
+    }
+  sqlite3_free (query);
+
+  if (sqlite3_prepare_v2 (pack,
+          "INSERT OR REPLACE INTO tiles VALUES (?, ?, ?, ?)", -1,
+          &stmt_insert, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (priv->db,
+          "SELECT filename FROM tiles", -1,
+          &stmt_tiles, NULL) != SQLITE_OK)
+    {
+      set_sqlite_error (error, stmt_insert ? priv->db : pack,
+          "Unable to prepare the export");
+      goto cleanup;
+    }
+
+  prefix = g_strdup_printf ("%s" G_DIR_SEPARATOR_S "%s" G_DIR_SEPARATOR_S,
+        priv->cache_dir, id);
+
+  while (sqlite3_step (stmt_tiles) == SQLITE_ROW)
+    {
+      const gchar *tile_filename = (const gchar *) sqlite3_column_text (stmt_tiles, 0);
+      guint zoom_level, x, y, scale_factor;
+      gchar *contents;
+      gsize length;
+
+      /* MBTiles has no notion of HiDPI tiles, only standard ones are
+         exported */
+      if (!tile_filename || !g_str_has_prefix (tile_filename, prefix) ||
+          !parse_tile_filename (tile_filename, &zoom_level, &x, &y, &scale_factor) ||
+          scale_factor != 1 ||
+          !region_contains_tile (&region, zoom_level, x, y))
+        continue;
+
+      /* Tiles deleted behind our back are simply skipped */
+      if (!g_file_get_contents (tile_filename, &contents, &length, NULL))
+        continue;
+
+      if (!decode_contents (&contents, &length, NULL))
+        continue;
+
+      /* tiles rendered locally are cached as raw surfaces, which no other
+         MBTiles reader would understand */
+      if (champlain_image_decoder_is_surface ((const guint8 *) contents, length))
+        {
+          g_free (contents);
+          continue;
+        }
+
+      if (!format)
+        format = get_mbtiles_format (contents, length);
+
+      /* MBTiles rows count from the bottom */
+      sqlite3_bind_int (stmt_insert, 1, zoom_level);
+      sqlite3_bind_int (stmt_insert, 2, x);
+      sqlite3_bind_int (stmt_insert, 3, (1u << zoom_level) - 1 - y);
+      sqlite3_bind_blob (stmt_insert, 4, contents, length, g_free);
+
+      if (sqlite3_step (stmt_insert) != SQLITE_DONE)
+        {
+          set_sqlite_error (error, pack, "Unable to write the tile");
+          goto cleanup;
+        }
+      sqlite3_reset (stmt_insert);
+      count++;
+    }
+
+  /* Readers pick the MIME type of the tiles from it */
+  if (format)
+    {
+      query = sqlite3_mprintf ("INSERT INTO metadata VALUES ('format', %Q)", format);
+      if (sqlite3_exec (pack, query, NULL, NULL, NULL) != SQLITE_OK)
+        {
+          set_sqlite_error (error, pack, "Unable to write the pack");
+          sqlite3_free (query);
+          goto cleanup;
+        }
+      sqlite3_free (query);
+    }
+
+  if (sqlite3_exec (pack, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      set_sqlite_error (error, pack, "Unable to write the pack");
+      goto cleanup;
+    }
+
+  DEBUG ("Exported %u tiles to %s", count, filename);
+  ok = TRUE;
+
+cleanup:
+  if (stmt_tiles)
+    sqlite3_finalize (stmt_tiles);
+  if (stmt_insert)
+    sqlite3_finalize (stmt_insert);
+  sqlite3_close (pack);
+  g_free (prefix);
+
+  if (!ok)
+    g_unlink (filename);
+
+  return ok;
+}
+
+
+/* A pack being imported. The tile files are written by a worker, the main
+   thread records them in the database. */
+typedef struct
+{
+  gchar *pack_filename;
+  gchar *cache_dir;
+  gchar *source_id;
+  /* the tile files written so far and their sizes */
+  GPtrArray *filenames;
+  GArray *sizes;
+} ImportData;
+
+
+static ImportData *
+import_data_new (ChamplainFileCache *file_cache,
+    const gchar *pack_filename)
+{
+  ImportData *data = g_slice_new (ImportData);
+
+  data->pack_filename = g_strdup (pack_filename);
+  data->cache_dir = g_strdup (file_cache->priv->cache_dir);
+  data->source_id = g_strdup (champlain_map_source_get_id (CHAMPLAIN_MAP_SOURCE (file_cache)));
+  data->filenames = g_ptr_array_new_with_free_func (g_free);
+  data->sizes = g_array_new (FALSE, FALSE, sizeof (gsize));
+
+  return data;
+}
+
+
+static void
+import_data_free (ImportData *data)
+{
+  g_free (data->pack_filename);
+  g_free (data->cache_dir);
+  g_free (data->source_id);
+  g_ptr_array_unref (data->filenames);
+  g_array_unref (data->sizes);
+  g_slice_free (ImportData, data);
+}
+
+
+/* Writes the tiles of the pack to files; those written before an error are
+   listed in @data too */
+static gboolean
+import_pack_files (ImportData *data,
+    GCancellable *cancellable,
+    GError **error)
+{
+  sqlite3 *pack = NULL;
+  sqlite3_stmt *stmt_tiles = NULL;
+  gchar *last_dir = NULL;
+  gboolean ok = FALSE;
+  int rc;
+
+  if (sqlite3_open_v2 (data->pack_filename, &pack, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+    {
+      set_sqlite_error (error, pack, "Unable to open the pack");
+      goto cleanup;
+    }
+
+  /* Reading in index order keeps the writes within one directory together */
+  if (sqlite3_prepare_v2 (pack,
+          "SELECT zoom_level, tile_column, tile_row, tile_data FROM tiles "
+          "ORDER BY zoom_level, tile_column, tile_row", -1,
+          &stmt_tiles, NULL) != SQLITE_OK)
+    {
+      set_sqlite_error (error, pack, "Unable to read the pack");
+      goto cleanup;
+    }
+
+  while ((rc = sqlite3_step (stmt_tiles)) == SQLITE_ROW)
+    {
+      guint zoom_level = sqlite3_column_int (stmt_tiles, 0);
+      guint x = sqlite3_column_int (stmt_tiles, 1);
+      guint row = sqlite3_column_int (stmt_tiles, 2);
+      const gchar *contents = sqlite3_column_blob (stmt_tiles, 3);
+      gsize length = sqlite3_column_bytes (stmt_tiles, 3);
+      gchar *tile_filename;
+      gchar *dir;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto cleanup;
+
+      if (zoom_level >= 32 || row >= (1u << zoom_level) || !contents)
+        continue;
+
+      tile_filename = build_tile_filename (data->cache_dir, data->source_id,
+            zoom_level, x, (1u << zoom_level) - 1 - row, 1);
+
+      dir = g_path_get_dirname (tile_filename);
+      if (g_strcmp0 (dir, last_dir) != 0)
+        {
+          if (g_mkdir_with_parents (dir, 0700) == -1 && errno != EEXIST)
+            {
+              int saved_errno = errno;
+
+              g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                  "Unable to create the image cache path '%s': %s",
+                  dir, g_strerror (saved_errno));
+              g_free (dir);
+              g_free (tile_filename);
+              goto cleanup;
+            }
+          g_free (last_dir);
+          last_dir = dir;
+        }
+      else
+        g_free (dir);
+
+      if (!write_tile_file (tile_filename, contents, length, error))
+        {
+          g_free (tile_filename);
+          goto cleanup;
+        }
+
+      g_ptr_array_add (data->filenames, tile_filename);
+      g_array_append_val (data->sizes, length);
+    }
+
+  if (rc != SQLITE_DONE)
+    {
+      set_sqlite_error (error, pack, "Unable to read the pack");
+      goto cleanup;
+    }
+
+  ok = TRUE;
+
+cleanup:
+  if (stmt_tiles)
+    sqlite3_finalize (stmt_tiles);
+  sqlite3_close (pack);
+  g_free (last_dir);
+
+  return ok;
+}
+
+
+/* Records the tile files written by import_pack_files() in the database, in
+   large transactions so big packs load quickly */
+static gboolean
+record_imported_tiles (ChamplainFileCache *file_cache,
+    ImportData *data,
+    GError **error)
+{
+  ChamplainFileCachePrivate *priv = file_cache->priv;
+  sqlite3_stmt *stmt_replace = NULL;
+  gboolean in_transaction = FALSE;
+  gboolean ok = FALSE;
+  guint i;
+
+  if (!priv->db)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+          "The cache database isn't open");
+      return FALSE;
+    }
+
+  if (sqlite3_prepare_v2 (priv->db,
+          "REPLACE INTO tiles (filename, size) VALUES (?, ?)", -1,
+          &stmt_replace, NULL) != SQLITE_OK)
+    {
+      set_sqlite_error (error, priv->db, "Unable to prepare the import");
+      goto cleanup;
+    }
+
+  for (i = 0; i < data->filenames->len; i++)
+    {
+      if (!in_transaction)
+        {
+          if (sqlite3_exec (priv->db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK)
+            {
+              set_sqlite_error (error, priv->db, "Unable to start the import");
+              goto cleanup;
+            }
+          in_transaction = TRUE;
+        }
+
+      sqlite3_bind_text (stmt_replace, 1,
+          g_ptr_array_index (data->filenames, i), -1, SQLITE_STATIC);
+      sqlite3_bind_int (stmt_replace, 2, g_array_index (data->sizes, gsize, i));
+      if (sqlite3_step (stmt_replace) != SQLITE_DONE)
+        {
+          set_sqlite_error (error, priv->db, "Unable to record the tile");
+          goto cleanup;
+        }
+      sqlite3_reset (stmt_replace);
+
+      if ((i + 1) % IMPORT_BATCH_SIZE == 0)
+        {
+          /* Let other processes sharing the cache in from time to time */
+          if (sqlite3_exec (priv->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+            {
+              set_sqlite_error (error, priv->db, "Unable to record the tiles");
+              goto cleanup;
+            }
+          in_transaction = FALSE;
+        }
+    }
+
+  if (in_transaction)
+    {
+      if (sqlite3_exec (priv->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+        {
+          set_sqlite_error (error, priv->db, "Unable to record the tiles");
+          goto cleanup;
+        }
+      in_transaction = FALSE;
+    }
+
+  DEBUG ("Imported %u tiles from %s", data->filenames->len, data->pack_filename);
+  ok = TRUE;
+
+cleanup:
+  /* Tiles recorded so far stay, they are valid */
+  if (in_transaction)
+    sqlite3_exec (priv->db, "COMMIT", NULL, NULL, NULL);
+  if (stmt_replace)
+    sqlite3_finalize (stmt_replace);
+
+  return ok;
+}
+
+
+/**
+ * champlain_file_cache_import_pack:
+ * @file_cache: a #ChamplainFileCache
+ * @filename: the MBTiles file to read
+ * @error: return location for a #GError, or %NULL
+ *
+ * Stores all tiles of an MBTiles file, such as one written by
+ * champlain_file_cache_export_region(), in the cache as tiles of the cache's
+ * map source. Existing tiles are replaced. The tiles are written in the order
+ * they are laid out on disk and recorded in the database in large
+ * transactions, so big packs load quickly. Call champlain_file_cache_purge()
+ * afterwards if the pack may exceed the size limit.
+ *
+ * This call blocks until the whole pack is imported, use
+ * champlain_file_cache_import_pack_async() from the main loop.
+ *
+ * Returns: %TRUE on success, %FALSE if an error occurred
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_file_cache_import_pack (ChamplainFileCache *file_cache,
+    const gchar *filename,
+    GError **error)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache), FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  ImportData *data;
+  gboolean ok;
+
+  if (!file_cache->priv->db)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+          "The cache database isn't open");
+      return FALSE;
+    }
+
+  data = import_data_new (file_cache, filename);
+
+  /* Tiles written before a failure are recorded all the same */
+  ok = import_pack_files (data, NULL, error);
+  if (!record_imported_tiles (file_cache, data, ok ? error : NULL))
+    ok = FALSE;
+
+  import_data_free (data);
+
+  return ok;
+}
+
+
+static void
+import_pack_thread (GTask *task,
+    G_GNUC_UNUSED gpointer source_object,
+    gpointer task_data,
+    GCancellable *cancellable)
+{
+  GError *error = NULL;
+
+  if (import_pack_files (task_data, cancellable, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+
+static void
+import_pack_files_cb (ChamplainFileCache *file_cache,
+    GAsyncResult *result,
+    GTask *task)
+{
+  ImportData *data = g_task_get_task_data (G_TASK (result));
+  GError *error = NULL;
+  gboolean ok;
+
+  /* Tiles written before a failure are recorded all the same */
+  ok = g_task_propagate_boolean (G_TASK (result), &error);
+  if (!record_imported_tiles (file_cache, data, ok ? &error : NULL))
+    ok = FALSE;
+
+  if (ok)
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+  g_object_unref (task);
+}
+
+
+/**
+ * champlain_file_cache_import_pack_async:
+ * @file_cache: a #ChamplainFileCache
+ * @filename: the MBTiles file to read
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: (scope async): called when the pack is imported
+ * @user_data: data for @callback
+ *
+ * Imports a pack like champlain_file_cache_import_pack() without blocking.
+ * The tile files are written in a worker thread, only recording them in the
+ * database happens in the main thread. When the import is cancelled or
+ * fails, the tiles written until then are kept.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_file_cache_import_pack_async (ChamplainFileCache *file_cache,
+    const gchar *filename,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  g_return_if_fail (CHAMPLAIN_IS_FILE_CACHE (file_cache));
+  g_return_if_fail (filename != NULL);
+
+  GTask *task;
+  GTask *files_task;
+
+  task = g_task_new (file_cache, cancellable, callback, user_data);
+  g_task_set_source_tag (task, champlain_file_cache_import_pack_async);
+
+  if (!file_cache->priv->db)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+          "The cache database isn't open");
+      g_object_unref (task);
+      return;
+    }
+
+  /* the cache directory and source id are read here, not in the worker */
+  files_task = g_task_new (file_cache, cancellable,
+        (GAsyncReadyCallback) import_pack_files_cb, task);
+  g_task_set_source_tag (files_task, import_pack_files);
+  g_task_set_task_data (files_task, import_data_new (file_cache, filename),
+      (GDestroyNotify) import_data_free);
+  g_task_run_in_thread (files_task, import_pack_thread);
+  g_object_unref (files_task);
+}
+
+
+/**
+ * champlain_file_cache_import_pack_finish:
+ * @file_cache: a #ChamplainFileCache
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an import started with champlain_file_cache_import_pack_async().
+ *
+ * Returns: %TRUE on success, %FALSE if an error occurred
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_file_cache_import_pack_finish (ChamplainFileCache *file_cache,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, file_cache), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
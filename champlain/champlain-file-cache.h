@@ -25,7 +25,9 @@
 #define _CHAMPLAIN_FILE_CACHE_H_
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <champlain/champlain-tile-cache.h>
+#include <champlain/champlain-bounding-box.h>
 
 G_BEGIN_DECLS
 
@@ -83,9 +85,44 @@ void champlain_file_cache_set_size_limit (ChamplainFileCache *file_cache,
 
 const gchar *champlain_file_cache_get_cache_dir (ChamplainFileCache *file_cache);
 
+gboolean champlain_file_cache_get_shared (ChamplainFileCache *file_cache);
+
+void champlain_file_cache_set_zoom_weight (ChamplainFileCache *file_cache,
+    guint zoom_level,
+    gdouble weight);
+gdouble champlain_file_cache_get_zoom_weight (ChamplainFileCache *file_cache,
+    guint zoom_level);
+
+guint champlain_file_cache_pin_region (ChamplainFileCache *file_cache,
+    ChamplainBoundingBox *bbox,
+    guint min_zoom,
+    guint max_zoom);
+void champlain_file_cache_unpin_region (ChamplainFileCache *file_cache,
+    guint pin_id);
+
+gboolean champlain_file_cache_export_region (ChamplainFileCache *file_cache,
+    const gchar *filename,
+    ChamplainBoundingBox *bbox,
+    guint min_zoom,
+    guint max_zoom,
+    GError **error);
+gboolean champlain_file_cache_import_pack (ChamplainFileCache *file_cache,
+    const gchar *filename,
+    GError **error);
+void champlain_file_cache_import_pack_async (ChamplainFileCache *file_cache,
+    const gchar *filename,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+gboolean champlain_file_cache_import_pack_finish (ChamplainFileCache *file_cache,
+    GAsyncResult *result,
+    GError **error);
+
 void champlain_file_cache_purge (ChamplainFileCache *file_cache);
 void champlain_file_cache_purge_on_idle (ChamplainFileCache *file_cache);
 
+void champlain_file_cache_recompress_on_idle (ChamplainFileCache *file_cache);
+
 G_END_DECLS
 
 #endif /* _CHAMPLAIN_FILE_CACHE_H_ */
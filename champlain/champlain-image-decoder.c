@@ -0,0 +1,1310 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Decoders for the common tile formats using the image libraries directly.
+ * They write into the cairo surface in its final pixel format, which saves
+ * the GdkPixbuf loader machinery and the conversion of the pixbuf. Formats
+ * without a decoder here, or images a decoder fails on, are left to
+ * GdkPixbuf.
+ *
+ * Images being downloaded can be decoded piece by piece as they arrive, see
+ * champlain_image_stream_new().
+ *
+ * Tiles rendered locally are cached in a run-length encoded copy of the
+ * surface instead, which is much cheaper to produce than any image format.
+ */
+
+#include "champlain-image-decoder.h"
+
+#define DEBUG_FLAG CHAMPLAIN_DEBUG_LOADING
+#include "champlain-debug.h"
+#include "champlain-pixel-convert.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#ifdef CHAMPLAIN_HAS_LIBJPEG
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+#ifdef CHAMPLAIN_HAS_LIBPNG
+#include <png.h>
+#endif
+
+#ifdef CHAMPLAIN_HAS_LIBWEBP
+#include <webp/decode.h>
+#endif
+
+
+static cairo_surface_t *
+create_surface (cairo_format_t format,
+    gint width,
+    gint height,
+    GError **error)
+{
+  cairo_surface_t *surface;
+
+  surface = cairo_image_surface_create (format, width, height);
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Bad surface");
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  cairo_surface_flush (surface);
+
+  return surface;
+}
+
+
+#ifdef CHAMPLAIN_HAS_LIBJPEG
+
+typedef struct
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+  gchar message[JMSG_LENGTH_MAX];
+} JpegError;
+
+
+static void
+jpeg_error_exit (j_common_ptr cinfo)
+{
+  JpegError *jerr = (JpegError *) cinfo->err;
+
+  cinfo->err->format_message (cinfo, jerr->message);
+  longjmp (jerr->setjmp_buffer, 1);
+}
+
+
+static void
+jpeg_output_message (G_GNUC_UNUSED j_common_ptr cinfo)
+{
+  /* warnings only, stay quiet */
+}
+
+
+static gboolean
+jpeg_probe (const guint8 *data,
+    gsize size)
+{
+  return size > 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff;
+}
+
+
+static cairo_surface_t *
+jpeg_decode (const guint8 *data,
+    gsize size,
+    guint min_size,
+    GError **error)
+{
+  struct jpeg_decompress_struct cinfo;
+  /* volatile, they are used after longjmp() */
+  cairo_surface_t * volatile surface = NULL;
+  guint8 * volatile row = NULL;
+  JpegError jerr;
+  guint8 *pixels;
+  gint stride;
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.error_exit = jpeg_error_exit;
+  jerr.pub.output_message = jpeg_output_message;
+
+  if (setjmp (jerr.setjmp_buffer))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unable to decode JPEG: %s", jerr.message);
+      jpeg_destroy_decompress (&cinfo);
+      if (surface)
+        cairo_surface_destroy (surface);
+      g_free (row);
+      return NULL;
+    }
+
+  jpeg_create_decompress (&cinfo);
+  jpeg_mem_src (&cinfo, (guint8 *) data, size);
+  jpeg_read_header (&cinfo, TRUE);
+
+  /* Scaling in the DCT domain is almost free, use it when the image is
+   * larger than it's going to be displayed */
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = 1;
+  while (min_size > 0 && cinfo.scale_denom < 8 &&
+         cinfo.image_width / (cinfo.scale_denom * 2) >= min_size &&
+         cinfo.image_height / (cinfo.scale_denom * 2) >= min_size)
+    cinfo.scale_denom *= 2;
+
+#if defined (JCS_EXTENSIONS) && G_BYTE_ORDER == G_LITTLE_ENDIAN
+  cinfo.out_color_space = JCS_EXT_BGRA;
+#elif defined (JCS_EXTENSIONS)
+  cinfo.out_color_space = JCS_EXT_ARGB;
+#else
+  cinfo.out_color_space = JCS_RGB;
+#endif
+
+  jpeg_start_decompress (&cinfo);
+
+  surface = create_surface (CAIRO_FORMAT_RGB24, cinfo.output_width, cinfo.output_height, error);
+  if (!surface)
+    {
+      jpeg_destroy_decompress (&cinfo);
+      return NULL;
+    }
+
+  pixels = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+#ifndef JCS_EXTENSIONS
+  row = g_malloc (cinfo.output_width * 3);
+#endif
+
+  while (cinfo.output_scanline < cinfo.output_height)
+    {
+      guint8 *dst = pixels + cinfo.output_scanline * stride;
+
+#ifdef JCS_EXTENSIONS
+      jpeg_read_scanlines (&cinfo, &dst, 1);
+#else
+      guint8 *src = row;
+
+      jpeg_read_scanlines (&cinfo, &src, 1);
+      champlain_pixel_convert_rgb_to_argb (row, dst, cinfo.output_width);
+#endif
+    }
+
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+  g_free (row);
+
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+#endif
+
+
+#ifdef CHAMPLAIN_HAS_LIBPNG
+
+static gboolean
+png_probe (const guint8 *data,
+    gsize size)
+{
+  return size > 8 && png_sig_cmp ((png_const_bytep) data, 0, 8) == 0;
+}
+
+
+static cairo_surface_t *
+png_decode (const guint8 *data,
+    gsize size,
+    G_GNUC_UNUSED guint min_size,
+    GError **error)
+{
+  cairo_surface_t *surface;
+  png_image image;
+  guint8 *pixels;
+  gint stride, y;
+
+  memset (&image, 0, sizeof (image));
+  image.version = PNG_IMAGE_VERSION;
+
+  if (!png_image_begin_read_from_memory (&image, data, size))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unable to decode PNG: %s", image.message);
+      return NULL;
+    }
+
+  image.format = PNG_FORMAT_RGBA;
+
+  surface = create_surface (CAIRO_FORMAT_ARGB32, image.width, image.height, error);
+  if (!surface)
+    {
+      png_image_free (&image);
+      return NULL;
+    }
+
+  pixels = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  /* decode straight into the surface and premultiply in place */
+  if (!png_image_finish_read (&image, NULL, pixels, stride, NULL))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unable to decode PNG: %s", image.message);
+      png_image_free (&image);
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  for (y = 0; y < (gint) image.height; y++)
+    champlain_pixel_convert_rgba_to_argb_pre (pixels + y * stride, pixels + y * stride, image.width);
+
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+
+typedef struct
+{
+  png_structp png;
+  png_infop info;
+  cairo_surface_t *surface;
+  gboolean done;
+  gchar *message;
+} PngStream;
+
+
+static void
+png_stream_error (png_structp png,
+    png_const_charp message)
+{
+  PngStream *stream = png_get_error_ptr (png);
+
+  g_free (stream->message);
+  stream->message = g_strdup (message);
+  png_longjmp (png, 1);
+}
+
+
+static void
+png_stream_warning (G_GNUC_UNUSED png_structp png,
+    G_GNUC_UNUSED png_const_charp message)
+{
+  /* warnings only, stay quiet */
+}
+
+
+static void
+png_stream_info_cb (png_structp png,
+    png_infop info)
+{
+  PngStream *stream = png_get_progressive_ptr (png);
+
+  /* the same RGBA the simplified API produces in png_decode() */
+  png_set_expand (png);
+  png_set_strip_16 (png);
+  png_set_gray_to_rgb (png);
+  png_set_filler (png, 0xff, PNG_FILLER_AFTER);
+  png_set_interlace_handling (png);
+  png_read_update_info (png, info);
+
+  stream->surface = create_surface (CAIRO_FORMAT_ARGB32,
+        png_get_image_width (png, info), png_get_image_height (png, info), NULL);
+  if (!stream->surface)
+    png_error (png, "Bad surface");
+}
+
+
+static void
+png_stream_row_cb (png_structp png,
+    png_bytep new_row,
+    png_uint_32 row_num,
+    G_GNUC_UNUSED int pass)
+{
+  PngStream *stream = png_get_progressive_ptr (png);
+
+  /* interlaced images fill in the rows over several passes */
+  if (new_row)
+    png_progressive_combine_row (png,
+        cairo_image_surface_get_data (stream->surface) +
+        row_num * cairo_image_surface_get_stride (stream->surface),
+        new_row);
+}
+
+
+static void
+png_stream_end_cb (png_structp png,
+    G_GNUC_UNUSED png_infop info)
+{
+  PngStream *stream = png_get_progressive_ptr (png);
+
+  stream->done = TRUE;
+}
+
+
+static gpointer
+png_stream_new (G_GNUC_UNUSED guint min_size)
+{
+  PngStream *stream = g_slice_new0 (PngStream);
+
+  stream->png = png_create_read_struct (PNG_LIBPNG_VER_STRING, stream,
+        png_stream_error, png_stream_warning);
+  if (stream->png)
+    stream->info = png_create_info_struct (stream->png);
+  if (stream->png)
+    png_set_progressive_read_fn (stream->png, stream,
+        png_stream_info_cb, png_stream_row_cb, png_stream_end_cb);
+
+  return stream;
+}
+
+
+static gboolean
+png_stream_write (gpointer state,
+    const guint8 *data,
+    gsize size,
+    GError **error)
+{
+  PngStream *stream = state;
+
+  if (!stream->png || !stream->info)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Unable to decode PNG");
+      return FALSE;
+    }
+
+  if (setjmp (png_jmpbuf (stream->png)))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unable to decode PNG: %s", stream->message);
+      return FALSE;
+    }
+
+  png_process_data (stream->png, stream->info, (png_bytep) data, size);
+
+  return TRUE;
+}
+
+
+static cairo_surface_t *
+png_stream_finish (gpointer state,
+    GError **error)
+{
+  PngStream *stream = state;
+  cairo_surface_t *surface;
+  guint8 *pixels;
+  gint width, height, stride, y;
+
+  if (!stream->done)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unable to decode PNG: truncated image");
+      return NULL;
+    }
+
+  surface = g_steal_pointer (&stream->surface);
+  pixels = cairo_image_surface_get_data (surface);
+  width = cairo_image_surface_get_width (surface);
+  height = cairo_image_surface_get_height (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  for (y = 0; y < height; y++)
+    champlain_pixel_convert_rgba_to_argb_pre (pixels + y * stride, pixels + y * stride, width);
+
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+
+static void
+png_stream_free (gpointer state)
+{
+  PngStream *stream = state;
+
+  png_destroy_read_struct (&stream->png, &stream->info, NULL);
+  if (stream->surface)
+    cairo_surface_destroy (stream->surface);
+  g_free (stream->message);
+  g_slice_free (PngStream, stream);
+}
+
+#endif
+
+
+#ifdef CHAMPLAIN_HAS_LIBWEBP
+
+static gboolean
+webp_probe (const guint8 *data,
+    gsize size)
+{
+  return size > 12 && memcmp (data, "RIFF", 4) == 0 && memcmp (data + 8, "WEBP", 4) == 0;
+}
+
+
+/* Sets up @config, with the features of the image read already, to decode
+ * into the returned surface */
+static cairo_surface_t *
+webp_prepare (WebPDecoderConfig *config,
+    guint min_size,
+    GError **error)
+{
+  cairo_surface_t *surface;
+  gint width, height;
+
+  width = config->input.width;
+  height = config->input.height;
+  if (min_size > 0 && (guint) MIN (width, height) >= min_size * 2)
+    {
+      /* the decoder scales while decoding, keep the aspect ratio */
+      gdouble scale = (gdouble) min_size / MIN (width, height);
+
+      width = MAX (1, (gint) (width * scale + 0.5));
+      height = MAX (1, (gint) (height * scale + 0.5));
+      config->options.use_scaling = 1;
+      config->options.scaled_width = width;
+      config->options.scaled_height = height;
+    }
+
+  surface = create_surface (config->input.has_alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+        width, height, error);
+  if (!surface)
+    return NULL;
+
+  /* premultiplied output in cairo's byte order */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  config->output.colorspace = MODE_bgrA;
+#else
+  config->output.colorspace = MODE_Argb;
+#endif
+  config->output.is_external_memory = 1;
+  config->output.u.RGBA.rgba = cairo_image_surface_get_data (surface);
+  config->output.u.RGBA.stride = cairo_image_surface_get_stride (surface);
+  config->output.u.RGBA.size = (gsize) cairo_image_surface_get_stride (surface) * height;
+
+  return surface;
+}
+
+
+static cairo_surface_t *
+webp_decode (const guint8 *data,
+    gsize size,
+    guint min_size,
+    GError **error)
+{
+  cairo_surface_t *surface;
+  WebPDecoderConfig config;
+
+  if (!WebPInitDecoderConfig (&config) ||
+      WebPGetFeatures (data, size, &config.input) != VP8_STATUS_OK)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Unable to decode WebP");
+      return NULL;
+    }
+
+  surface = webp_prepare (&config, min_size, error);
+  if (!surface)
+    return NULL;
+
+  if (WebPDecode (data, size, &config) != VP8_STATUS_OK)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Unable to decode WebP");
+      WebPFreeDecBuffer (&config.output);
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  WebPFreeDecBuffer (&config.output);
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+
+typedef struct
+{
+  WebPDecoderConfig config;
+  guint min_size;
+  /* the start of the image until its features are known */
+  GByteArray *header;
+  WebPIDecoder *idec;
+  cairo_surface_t *surface;
+  VP8StatusCode status;
+} WebpStream;
+
+
+static gpointer
+webp_stream_new (guint min_size)
+{
+  WebpStream *stream = g_slice_new0 (WebpStream);
+
+  WebPInitDecoderConfig (&stream->config);
+  stream->min_size = min_size;
+  stream->header = g_byte_array_new ();
+  stream->status = VP8_STATUS_SUSPENDED;
+
+  return stream;
+}
+
+
+static gboolean
+webp_stream_write (gpointer state,
+    const guint8 *data,
+    gsize size,
+    GError **error)
+{
+  WebpStream *stream = state;
+
+  if (!stream->idec)
+    {
+      VP8StatusCode status;
+
+      g_byte_array_append (stream->header, data, size);
+      status = WebPGetFeatures (stream->header->data, stream->header->len, &stream->config.input);
+      if (status == VP8_STATUS_NOT_ENOUGH_DATA)
+        return TRUE;
+
+      if (status == VP8_STATUS_OK)
+        stream->surface = webp_prepare (&stream->config, stream->min_size, NULL);
+      if (stream->surface)
+        stream->idec = WebPIDecode (NULL, 0, &stream->config);
+      if (!stream->idec)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Unable to decode WebP");
+          return FALSE;
+        }
+
+      data = stream->header->data;
+      size = stream->header->len;
+    }
+
+  stream->status = WebPIAppend (stream->idec, data, size);
+  g_clear_pointer (&stream->header, g_byte_array_unref);
+
+  if (stream->status != VP8_STATUS_OK && stream->status != VP8_STATUS_SUSPENDED)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Unable to decode WebP");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+static cairo_surface_t *
+webp_stream_finish (gpointer state,
+    GError **error)
+{
+  WebpStream *stream = state;
+  cairo_surface_t *surface;
+
+  if (stream->status != VP8_STATUS_OK)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unable to decode WebP: truncated image");
+      return NULL;
+    }
+
+  surface = g_steal_pointer (&stream->surface);
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+
+static void
+webp_stream_free (gpointer state)
+{
+  WebpStream *stream = state;
+
+  if (stream->idec)
+    WebPIDelete (stream->idec);
+  WebPFreeDecBuffer (&stream->config.output);
+  if (stream->surface)
+    cairo_surface_destroy (stream->surface);
+  if (stream->header)
+    g_byte_array_unref (stream->header);
+  g_slice_free (WebpStream, stream);
+}
+
+#endif
+
+
+/* The run-length encoded surfaces: the magic, the width and the height as
+ * 32-bit little endian numbers, then the rows of pixels. Every row is a
+ * sequence of packets starting with a control byte: 0-127 are followed by
+ * 1-128 literal pixels, 128-255 by a single pixel repeated 2-129 times.
+ * Pixels are cairo's premultiplied ARGB as 32-bit little endian numbers. */
+#define RLE_MAGIC "\211RLE"
+#define RLE_HEADER_SIZE 12
+#define RLE_MAX_SIZE 8192
+
+static gboolean
+rle_probe (const guint8 *data,
+    gsize size)
+{
+  return size >= RLE_HEADER_SIZE && memcmp (data, RLE_MAGIC, 4) == 0;
+}
+
+
+static cairo_surface_t *
+rle_decode (const guint8 *data,
+    gsize size,
+    G_GNUC_UNUSED guint min_size,
+    GError **error)
+{
+  cairo_surface_t *surface;
+  const guint8 *p = data + RLE_HEADER_SIZE;
+  const guint8 *end = data + size;
+  guint8 *pixels;
+  guint32 width, height;
+  gint stride;
+  guint x, y;
+
+  memcpy (&width, data + 4, 4);
+  memcpy (&height, data + 8, 4);
+  width = GUINT32_FROM_LE (width);
+  height = GUINT32_FROM_LE (height);
+
+  if (width == 0 || height == 0 || width > RLE_MAX_SIZE || height > RLE_MAX_SIZE)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Unsupported surface size %ux%u", width, height);
+      return NULL;
+    }
+
+  surface = create_surface (CAIRO_FORMAT_ARGB32, width, height, error);
+  if (!surface)
+    return NULL;
+
+  pixels = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  for (y = 0; y < height; y++)
+    {
+      guint32 *row = (guint32 *) (pixels + y * stride);
+
+      x = 0;
+      while (x < width)
+        {
+          guint control, count, i;
+          guint32 pixel;
+
+          if (p >= end)
+            goto truncated;
+
+          control = *p++;
+          count = control < 128 ? control + 1 : control - 126;
+          if (x + count > width)
+            goto truncated;
+
+          if (control < 128)
+            {
+              if ((gsize) (end - p) < count * 4)
+                goto truncated;
+
+              for (i = 0; i < count; i++, p += 4)
+                {
+                  memcpy (&pixel, p, 4);
+                  row[x++] = GUINT32_FROM_LE (pixel);
+                }
+            }
+          else
+            {
+              if (end - p < 4)
+                goto truncated;
+
+              memcpy (&pixel, p, 4);
+              p += 4;
+              pixel = GUINT32_FROM_LE (pixel);
+              for (i = 0; i < count; i++)
+                row[x++] = pixel;
+            }
+        }
+    }
+
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+
+truncated:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Corrupted surface data");
+  cairo_surface_destroy (surface);
+  return NULL;
+}
+
+
+static void
+rle_append_pixels (GByteArray *array,
+    const guint32 *pixels,
+    guint count)
+{
+  guint i;
+
+  for (i = 0; i < count; i++)
+    {
+      guint32 pixel = GUINT32_TO_LE (pixels[i]);
+
+      g_byte_array_append (array, (const guint8 *) &pixel, 4);
+    }
+}
+
+
+/* libjpeg can only suspend with a source manager of its own, JPEG images are
+ * decoded in one go once complete */
+static const ChamplainImageDecoder decoders[] = {
+  { "rle", rle_probe, rle_decode, NULL, NULL, NULL, NULL },
+#ifdef CHAMPLAIN_HAS_LIBJPEG
+  { "jpeg", jpeg_probe, jpeg_decode, NULL, NULL, NULL, NULL },
+#endif
+#ifdef CHAMPLAIN_HAS_LIBPNG
+  { "png", png_probe, png_decode,
+    png_stream_new, png_stream_write, png_stream_finish, png_stream_free },
+#endif
+#ifdef CHAMPLAIN_HAS_LIBWEBP
+  { "webp", webp_probe, webp_decode,
+    webp_stream_new, webp_stream_write, webp_stream_finish, webp_stream_free },
+#endif
+  { NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+
+/*
+ * champlain_image_decoder_surface_from_pixbuf:
+ * @pixbuf: a #GdkPixbuf
+ * @error: return location for a #GError
+ *
+ * Converts @pixbuf to cairo's native endian, premultiplied (A)RGB.
+ *
+ * Returns: a %CAIRO_FORMAT_ARGB32 or %CAIRO_FORMAT_RGB24 surface, or %NULL
+ * on failure.
+ */
+cairo_surface_t *
+champlain_image_decoder_surface_from_pixbuf (GdkPixbuf *pixbuf,
+    GError **error)
+{
+  cairo_surface_t *surface;
+  const guchar *src;
+  guchar *dst;
+  gint width, height, n_channels, src_stride, dst_stride, y;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+  n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+
+  surface = create_surface (n_channels == 4 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+        width, height, error);
+  if (!surface)
+    return NULL;
+
+  src = gdk_pixbuf_get_pixels (pixbuf);
+  src_stride = gdk_pixbuf_get_rowstride (pixbuf);
+  dst = cairo_image_surface_get_data (surface);
+  dst_stride = cairo_image_surface_get_stride (surface);
+
+  for (y = 0; y < height; y++)
+    {
+      if (n_channels == 4)
+        champlain_pixel_convert_rgba_to_argb_pre (src + y * src_stride, dst + y * dst_stride, width);
+      else
+        champlain_pixel_convert_rgb_to_argb (src + y * src_stride, dst + y * dst_stride, width);
+    }
+
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+
+static cairo_surface_t *
+pixbuf_decode (const guint8 *data,
+    gsize size,
+    GError **error)
+{
+  cairo_surface_t *surface = NULL;
+  GdkPixbufLoader *loader;
+
+  loader = gdk_pixbuf_loader_new ();
+
+  if (gdk_pixbuf_loader_write (loader, data, size, error) &&
+      gdk_pixbuf_loader_close (loader, error))
+    surface = champlain_image_decoder_surface_from_pixbuf (gdk_pixbuf_loader_get_pixbuf (loader), error);
+  else
+    gdk_pixbuf_loader_close (loader, NULL);
+
+  g_object_unref (loader);
+
+  return surface;
+}
+
+
+/*
+ * champlain_image_decoder_decode:
+ * @data: the encoded image
+ * @size: the size of @data
+ * @min_size: the size the image is displayed at, 0 for the full size
+ * @error: return location for a #GError
+ *
+ * Decodes @data with the decoder handling its format, or with GdkPixbuf if
+ * there is none or it fails.
+ *
+ * Returns: a %CAIRO_FORMAT_ARGB32 or %CAIRO_FORMAT_RGB24 surface, or %NULL
+ * on failure.
+ */
+cairo_surface_t *
+champlain_image_decoder_decode (const guint8 *data,
+    gsize size,
+    guint min_size,
+    GError **error)
+{
+  const ChamplainImageDecoder *decoder;
+
+  for (decoder = decoders; decoder->name; decoder++)
+    {
+      if (decoder->probe (data, size))
+        {
+          cairo_surface_t *surface;
+          GError *decoder_error = NULL;
+
+          surface = decoder->decode (data, size, min_size, &decoder_error);
+          if (surface)
+            return surface;
+
+          /* GdkPixbuf may still be able to make something out of it */
+          DEBUG ("%s", decoder_error->message);
+          g_error_free (decoder_error);
+          break;
+        }
+    }
+
+  return pixbuf_decode (data, size, error);
+}
+
+
+/*
+ * champlain_image_decoder_set_tile_size:
+ * @surface: a decoded image
+ * @tile_size: the size of the tile showing the image
+ *
+ * Sets the device scale of @surface so that cairo draws it @tile_size
+ * pixels large, whatever the resolution of the image.
+ */
+void
+champlain_image_decoder_set_tile_size (cairo_surface_t *surface,
+    guint tile_size)
+{
+  if (tile_size == 0)
+    return;
+
+  cairo_surface_set_device_scale (surface,
+      (gdouble) cairo_image_surface_get_width (surface) / tile_size,
+      (gdouble) cairo_image_surface_get_height (surface) / tile_size);
+}
+
+
+/*
+ * champlain_image_decoder_encode_surface:
+ * @surface: a %CAIRO_FORMAT_ARGB32 image surface
+ *
+ * Run-length encodes @surface in the format champlain_image_decoder_decode()
+ * reads back. It is meant for caching rendered tiles: it takes a fraction of
+ * the time of a PNG and makes map renderings, with their large areas of the
+ * same color, much smaller than the surface. Can be called from any thread.
+ *
+ * Returns: the encoded surface
+ */
+GBytes *
+champlain_image_decoder_encode_surface (cairo_surface_t *surface)
+{
+  GByteArray *array;
+  const guint8 *pixels;
+  guint32 width, height, value;
+  gint stride;
+  guint x, y;
+
+  g_return_val_if_fail (cairo_image_surface_get_format (surface) == CAIRO_FORMAT_ARGB32, NULL);
+
+  cairo_surface_flush (surface);
+
+  width = cairo_image_surface_get_width (surface);
+  height = cairo_image_surface_get_height (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  pixels = cairo_image_surface_get_data (surface);
+
+  /* enough for a map tile, the array grows for anything more detailed */
+  array = g_byte_array_sized_new (RLE_HEADER_SIZE + width * height / 4);
+  g_byte_array_append (array, (const guint8 *) RLE_MAGIC, 4);
+  value = GUINT32_TO_LE (width);
+  g_byte_array_append (array, (const guint8 *) &value, 4);
+  value = GUINT32_TO_LE (height);
+  g_byte_array_append (array, (const guint8 *) &value, 4);
+
+  for (y = 0; y < height; y++)
+    {
+      const guint32 *row = (const guint32 *) (pixels + y * stride);
+
+      x = 0;
+      while (x < width)
+        {
+          guint8 control;
+          guint count = 1;
+
+          while (x + count < width && count < 129 && row[x + count] == row[x])
+            count++;
+
+          if (count >= 2)
+            {
+              control = count + 126;
+              g_byte_array_append (array, &control, 1);
+              rle_append_pixels (array, row + x, 1);
+            }
+          else
+            {
+              /* literal pixels up to the start of the next run */
+              while (x + count < width && count < 128 &&
+                     !(x + count + 1 < width && row[x + count] == row[x + count + 1]))
+                count++;
+
+              control = count - 1;
+              g_byte_array_append (array, &control, 1);
+              rle_append_pixels (array, row + x, count);
+            }
+
+          x += count;
+        }
+    }
+
+  return g_byte_array_free_to_bytes (array);
+}
+
+
+/*
+ * champlain_image_decoder_is_surface:
+ * @data: tile data
+ * @size: the size of @data
+ *
+ * Returns: whether @data was made by champlain_image_decoder_encode_surface()
+ * rather than being a standard image format.
+ */
+gboolean
+champlain_image_decoder_is_surface (const guint8 *data,
+    gsize size)
+{
+  return rle_probe (data, size);
+}
+
+
+/* The magic of all the formats fits in this many bytes */
+#define STREAM_PROBE_SIZE 16
+
+struct _ChamplainImageStream
+{
+  /* protects chunks, busy and task */
+  GMutex lock;
+  /* GBytes received but not decoded yet */
+  GQueue chunks;
+  /* a worker is decoding the chunks */
+  gboolean busy;
+  /* returns the image once the last chunk is decoded */
+  GTask *task;
+  /* no more chunks are coming, used by the caller only */
+  gboolean closed;
+
+  /* used by the worker decoding the chunks only */
+  guint min_size;
+  GByteArray *data;
+  gboolean started;
+  gboolean failed;
+  const ChamplainImageDecoder *decoder;
+  gpointer state;
+  GdkPixbufLoader *loader;
+};
+
+
+static void
+image_stream_clear (ChamplainImageStream *stream)
+{
+  g_mutex_clear (&stream->lock);
+  g_queue_clear_full (&stream->chunks, (GDestroyNotify) g_bytes_unref);
+  g_clear_object (&stream->task);
+  g_byte_array_unref (stream->data);
+  if (stream->state)
+    stream->decoder->stream_free (stream->state);
+  if (stream->loader)
+    {
+      gdk_pixbuf_loader_close (stream->loader, NULL);
+      g_object_unref (stream->loader);
+    }
+}
+
+
+/* Picks the decoder by the start of the image */
+static void
+image_stream_start (ChamplainImageStream *stream)
+{
+  const ChamplainImageDecoder *decoder;
+
+  stream->started = TRUE;
+
+  for (decoder = decoders; decoder->name; decoder++)
+    {
+      if (decoder->probe (stream->data->data, stream->data->len))
+        {
+          stream->decoder = decoder;
+          if (decoder->stream_new)
+            stream->state = decoder->stream_new (stream->min_size);
+          return;
+        }
+    }
+
+  stream->loader = gdk_pixbuf_loader_new ();
+}
+
+
+static void
+image_stream_decode (ChamplainImageStream *stream,
+    const guint8 *data,
+    gsize size)
+{
+  GError *error = NULL;
+  gboolean ok = TRUE;
+
+  if (stream->failed)
+    return;
+
+  if (!stream->started)
+    {
+      if (stream->data->len < STREAM_PROBE_SIZE)
+        return;
+
+      image_stream_start (stream);
+      data = stream->data->data;
+      size = stream->data->len;
+    }
+
+  if (stream->state)
+    ok = stream->decoder->stream_write (stream->state, data, size, &error);
+  else if (stream->loader)
+    ok = gdk_pixbuf_loader_write (stream->loader, data, size, &error);
+
+  if (!ok)
+    {
+      /* tried again on the whole image in the end */
+      DEBUG ("%s", error->message);
+      g_error_free (error);
+      stream->failed = TRUE;
+    }
+}
+
+
+static cairo_surface_t *
+image_stream_finish (ChamplainImageStream *stream,
+    GError **error)
+{
+  cairo_surface_t *surface = NULL;
+  GError *stream_error = NULL;
+
+  /* smaller than STREAM_PROBE_SIZE */
+  if (!stream->started)
+    {
+      image_stream_start (stream);
+      image_stream_decode (stream, stream->data->data, stream->data->len);
+    }
+
+  if (!stream->failed && stream->state)
+    surface = stream->decoder->stream_finish (stream->state, &stream_error);
+  else if (!stream->failed && stream->loader)
+    {
+      if (gdk_pixbuf_loader_close (stream->loader, &stream_error))
+        surface = champlain_image_decoder_surface_from_pixbuf (
+              gdk_pixbuf_loader_get_pixbuf (stream->loader), &stream_error);
+      g_clear_object (&stream->loader);
+    }
+
+  if (surface)
+    return surface;
+
+  if (stream_error)
+    {
+      DEBUG ("%s", stream_error->message);
+      g_error_free (stream_error);
+    }
+
+  /* the decoders without incremental decoding, and the fallbacks */
+  return champlain_image_decoder_decode (stream->data->data, stream->data->len,
+      stream->min_size, error);
+}
+
+
+static void
+image_stream_thread (GTask *task,
+    G_GNUC_UNUSED gpointer source_object,
+    gpointer task_data,
+    G_GNUC_UNUSED GCancellable *cancellable)
+{
+  ChamplainImageStream *stream = task_data;
+  GTask *result_task;
+
+  while (TRUE)
+    {
+      GBytes *bytes;
+      gconstpointer data;
+      gsize size;
+
+      g_mutex_lock (&stream->lock);
+      bytes = g_queue_pop_head (&stream->chunks);
+      if (!bytes)
+        {
+          stream->busy = FALSE;
+          result_task = g_steal_pointer (&stream->task);
+          g_mutex_unlock (&stream->lock);
+          break;
+        }
+      g_mutex_unlock (&stream->lock);
+
+      data = g_bytes_get_data (bytes, &size);
+      g_byte_array_append (stream->data, data, size);
+      image_stream_decode (stream, data, size);
+      g_bytes_unref (bytes);
+    }
+
+  /* all the chunks are in once the stream is closed */
+  if (result_task && !g_task_return_error_if_cancelled (result_task))
+    {
+      cairo_surface_t *surface;
+      GError *error = NULL;
+
+      surface = image_stream_finish (stream, &error);
+      if (surface)
+        g_task_return_pointer (result_task, surface, (GDestroyNotify) cairo_surface_destroy);
+      else
+        g_task_return_error (result_task, error);
+    }
+  g_clear_object (&result_task);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+
+/* Called with the lock held */
+static void
+image_stream_schedule (ChamplainImageStream *stream)
+{
+  GTask *task;
+
+  if (stream->busy)
+    return;
+
+  /* the chunks are decoded in order by one worker at a time, the worker
+   * ends when it runs out of them so that it doesn't wait for the network */
+  stream->busy = TRUE;
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_task_data (task, g_atomic_rc_box_acquire (stream),
+      (GDestroyNotify) champlain_image_stream_unref);
+  g_task_run_in_thread (task, image_stream_thread);
+  g_object_unref (task);
+}
+
+
+/*
+ * champlain_image_stream_new:
+ * @min_size: the size the image is displayed at, 0 for the full size
+ *
+ * Creates a decoder taking the image piece by piece, see
+ * champlain_image_stream_write(). The pieces are decoded in worker threads,
+ * as far as the format allows before the image is complete.
+ *
+ * Returns: the new stream, free with champlain_image_stream_unref()
+ */
+ChamplainImageStream *
+champlain_image_stream_new (guint min_size)
+{
+  ChamplainImageStream *stream;
+
+  stream = g_atomic_rc_box_new0 (ChamplainImageStream);
+  g_mutex_init (&stream->lock);
+  g_queue_init (&stream->chunks);
+  stream->min_size = min_size;
+  stream->data = g_byte_array_new ();
+
+  return stream;
+}
+
+
+/*
+ * champlain_image_stream_unref:
+ * @stream: a #ChamplainImageStream
+ *
+ * Drops a reference to @stream. A stream dropped before it is closed is
+ * abandoned, the chunks decoded at the time are thrown away.
+ */
+void
+champlain_image_stream_unref (ChamplainImageStream *stream)
+{
+  g_atomic_rc_box_release_full (stream, (GDestroyNotify) image_stream_clear);
+}
+
+
+/*
+ * champlain_image_stream_write:
+ * @stream: a #ChamplainImageStream
+ * @bytes: the next piece of the image
+ *
+ * Queues @bytes for decoding.
+ */
+void
+champlain_image_stream_write (ChamplainImageStream *stream,
+    GBytes *bytes)
+{
+  g_return_if_fail (!stream->closed);
+
+  g_mutex_lock (&stream->lock);
+  g_queue_push_tail (&stream->chunks, g_bytes_ref (bytes));
+  image_stream_schedule (stream);
+  g_mutex_unlock (&stream->lock);
+}
+
+
+/*
+ * champlain_image_stream_close_async:
+ * @stream: a #ChamplainImageStream
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called with the decoded image
+ * @user_data: data for @callback
+ *
+ * Tells @stream the whole image has been written. @callback is called from
+ * the thread default main context once the image is decoded; the decoders
+ * without incremental decoding and GdkPixbuf, if the decoder of the format
+ * fails, take the whole image then.
+ */
+void
+champlain_image_stream_close_async (ChamplainImageStream *stream,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  g_return_if_fail (!stream->closed);
+
+  stream->closed = TRUE;
+
+  g_mutex_lock (&stream->lock);
+  stream->task = g_task_new (NULL, cancellable, callback, user_data);
+  image_stream_schedule (stream);
+  g_mutex_unlock (&stream->lock);
+}
+
+
+/*
+ * champlain_image_stream_close_finish:
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError
+ *
+ * Returns: a %CAIRO_FORMAT_ARGB32 or %CAIRO_FORMAT_RGB24 surface, or %NULL
+ * on failure.
+ */
+cairo_surface_t *
+champlain_image_stream_close_finish (GAsyncResult *result,
+    GError **error)
+{
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __CHAMPLAIN_IMAGE_DECODER_H__
+#define __CHAMPLAIN_IMAGE_DECODER_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <cairo.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+/* A decoder writing an image straight into a cairo image surface, without
+ * going through a GdkPixbuf. Decoders run in worker threads. */
+typedef struct
+{
+  const gchar *name;
+  /* whether the data looks like an image this decoder handles */
+  gboolean (*probe) (const guint8 *data,
+      gsize size);
+  /* decodes the image, possibly scaled down to no less than @min_size
+   * pixels on each side if that is cheap; NULL on failure */
+  cairo_surface_t *(*decode) (const guint8 *data,
+      gsize size,
+      guint min_size,
+      GError **error);
+  /* decoding piece by piece as the data arrives, NULL if the decoder needs
+   * the whole image */
+  gpointer (*stream_new) (guint min_size);
+  gboolean (*stream_write) (gpointer state,
+      const guint8 *data,
+      gsize size,
+      GError **error);
+  cairo_surface_t *(*stream_finish) (gpointer state,
+      GError **error);
+  void (*stream_free) (gpointer state);
+} ChamplainImageDecoder;
+
+/* Decodes an image in worker threads while it is still being received */
+typedef struct _ChamplainImageStream ChamplainImageStream;
+
+G_GNUC_INTERNAL
+cairo_surface_t *champlain_image_decoder_surface_from_pixbuf (GdkPixbuf *pixbuf,
+    GError **error);
+G_GNUC_INTERNAL
+cairo_surface_t *champlain_image_decoder_decode (const guint8 *data,
+    gsize size,
+    guint min_size,
+    GError **error);
+G_GNUC_INTERNAL
+void champlain_image_decoder_set_tile_size (cairo_surface_t *surface,
+    guint tile_size);
+G_GNUC_INTERNAL
+GBytes *champlain_image_decoder_encode_surface (cairo_surface_t *surface);
+G_GNUC_INTERNAL
+gboolean champlain_image_decoder_is_surface (const guint8 *data,
+    gsize size);
+
+G_GNUC_INTERNAL
+ChamplainImageStream *champlain_image_stream_new (guint min_size);
+G_GNUC_INTERNAL
+void champlain_image_stream_unref (ChamplainImageStream *stream);
+G_GNUC_INTERNAL
+void champlain_image_stream_write (ChamplainImageStream *stream,
+    GBytes *bytes);
+G_GNUC_INTERNAL
+void champlain_image_stream_close_async (ChamplainImageStream *stream,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+G_GNUC_INTERNAL
+cairo_surface_t *champlain_image_stream_close_finish (GAsyncResult *result,
+    GError **error);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __CHAMPLAIN_IMAGE_RENDERER_PRIVATE_H__
+#define __CHAMPLAIN_IMAGE_RENDERER_PRIVATE_H__
+
+#include <cairo.h>
+
+#include "champlain-image-renderer.h"
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL
+void champlain_image_renderer_render_surface (ChamplainImageRenderer *renderer,
+    ChamplainTile *tile,
+    cairo_surface_t *surface,
+    const guint8 *data,
+    guint size);
+
+G_END_DECLS
+
+#endif
@@ -23,11 +23,19 @@
  * #ChamplainImageRenderer renders tiles from binary image data. The rendering
  * is performed using #GdkPixbufLoader so the set of supported image
  * formats is equal to the set of formats supported by #GdkPixbufLoader.
+ * JPEG, PNG and WebP images are decoded by the respective libraries directly
+ * when libchamplain was built with them, which is faster. JPEG images larger
+ * than the tile are decoded at a reduced size.
+ *
+ * Decoding the images and converting them to the pixel format used for
+ * display happens in worker threads.
  */
 
 #include "champlain-image-renderer.h"
-#include <gdk-pixbuf/gdk-pixbuf.h>
-#include <gdk/gdk.h>
+
+#include "champlain-private.h"
+#include "champlain-image-renderer-private.h"
+#include "champlain-image-decoder.h"
 
 struct _ChamplainImageRendererPrivate
 {
@@ -45,6 +53,7 @@ struct _RendererData
   ChamplainTile *tile;
   gchar *data;
   guint size;
+  guint tile_size;
 };
 
 static void set_data (ChamplainRenderer *renderer,
@@ -126,70 +135,48 @@ set_data (ChamplainRenderer *renderer, const guint8 *data, guint size)
 }
 
 
-static gboolean
-image_tile_draw_cb (ClutterCanvas   *canvas,
-    cairo_t *cr,
-    gint width,
-    gint height,
-    ChamplainTile *tile)
-{
-  cairo_surface_t *surface;
-
-  surface = champlain_exportable_get_surface (CHAMPLAIN_EXPORTABLE (tile));
-
-  /* Clear the drawing area */
-  cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
-  cairo_paint (cr);
-  cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
-
-  cairo_set_source_surface (cr, surface, 0, 0);
-  cairo_paint(cr);
-
-  return FALSE;
-}
+/* cairo's premultiplied native endian ARGB in memory order */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define SURFACE_PIXEL_FORMAT COGL_PIXEL_FORMAT_BGRA_8888_PRE
+#else
+#define SURFACE_PIXEL_FORMAT COGL_PIXEL_FORMAT_ARGB_8888_PRE
+#endif
 
 
 static void
-image_rendered_cb (GInputStream *stream, GAsyncResult *res, RendererData *data)
+set_tile_surface (ChamplainTile *tile,
+    cairo_surface_t *image_surface,
+    gconstpointer data,
+    guint size)
 {
-  ChamplainTile *tile = data->tile;
   gboolean error = TRUE;
   ClutterActor *actor = NULL;
-  GdkPixbuf *pixbuf;
   ClutterContent *content;
   gfloat width, height;
-  cairo_surface_t *image_surface = NULL;
-  cairo_format_t format;
-  cairo_t *cr;
-  
-  pixbuf = gdk_pixbuf_new_from_stream_finish (res, NULL);
-  if (!pixbuf)
-    {
-      g_warning ("NULL pixbuf");
-      goto finish;
-    }
-  
-  width = gdk_pixbuf_get_width (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
-  format = (gdk_pixbuf_get_has_alpha (pixbuf) ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24);
-  image_surface = cairo_image_surface_create (format, width, height);
-  if (cairo_surface_status (image_surface) != CAIRO_STATUS_SUCCESS)
+
+  if (!image_surface)
+    goto finish;
+
+  /* Upload the pixels straight into a texture, the surface is the only copy
+   * kept in memory */
+  content = clutter_image_new ();
+  if (!clutter_image_set_data (CLUTTER_IMAGE (content),
+          cairo_image_surface_get_data (image_surface),
+          SURFACE_PIXEL_FORMAT,
+          cairo_image_surface_get_width (image_surface),
+          cairo_image_surface_get_height (image_surface),
+          cairo_image_surface_get_stride (image_surface),
+          NULL))
     {
-      g_warning ("Bad surface");
+      g_object_unref (content);
       goto finish;
     }
-  cr = cairo_create (image_surface);
-  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
-  cairo_paint (cr);
-  champlain_exportable_set_surface (CHAMPLAIN_EXPORTABLE (tile), image_surface);
-  cairo_destroy (cr);
 
-  /* Load the image into clutter */
   width = height = champlain_tile_get_size (tile);
-  content = clutter_canvas_new ();
-  clutter_canvas_set_size (CLUTTER_CANVAS (content), width, height);
-  g_signal_connect (content, "draw", G_CALLBACK (image_tile_draw_cb), tile);
-  clutter_content_invalidate (content);
+
+  /* HiDPI images are exported at the size of the tile as well */
+  champlain_image_decoder_set_tile_size (image_surface, width);
+  champlain_exportable_set_surface (CHAMPLAIN_EXPORTABLE (tile), image_surface);
 
   actor = clutter_actor_new ();
   clutter_actor_set_size (actor, width, height);
@@ -197,7 +184,7 @@ image_rendered_cb (GInputStream *stream, GAsyncResult *res, RendererData *data)
   g_object_unref (content);
   /* has to be set for proper opacity */
   clutter_actor_set_offscreen_redirect (actor, CLUTTER_OFFSCREEN_REDIRECT_AUTOMATIC_FOR_OPACITY);
-  
+
   error = FALSE;
 
 finish:
@@ -205,43 +192,133 @@ finish:
   if (actor)
     champlain_tile_set_content (tile, actor);
 
-  g_signal_emit_by_name (tile, "render-complete", data->data, data->size, error);
-
-  if (pixbuf)
-    g_object_unref (pixbuf);
+  g_signal_emit_by_name (tile, "render-complete", data, size, error);
+}
 
-  if (image_surface)
-    cairo_surface_destroy (image_surface);
 
-  g_object_unref (data->renderer);
-  g_object_unref (tile);
-  g_object_unref (stream);
+static void
+renderer_data_free (RendererData *data)
+{
+  g_clear_object (&data->renderer);
+  g_clear_object (&data->tile);
   g_free (data->data);
   g_slice_free (RendererData, data);
 }
 
 
+/* Decodes the image to a surface, so that the main thread only has to hand
+ * it over to clutter */
+static void
+render_thread (GTask *task,
+    G_GNUC_UNUSED gpointer source_object,
+    gpointer task_data,
+    G_GNUC_UNUSED GCancellable *cancellable)
+{
+  RendererData *data = task_data;
+  cairo_surface_t *surface;
+  GError *error = NULL;
+
+  surface = champlain_image_decoder_decode ((const guint8 *) data->data, data->size,
+        data->tile_size, &error);
+
+  if (!surface)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  g_task_return_pointer (task, surface, (GDestroyNotify) cairo_surface_destroy);
+}
+
+
+static void
+image_rendered_cb (G_GNUC_UNUSED GObject *source_object,
+    GAsyncResult *res,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  RendererData *data = g_task_get_task_data (G_TASK (res));
+  cairo_surface_t *surface;
+  GError *error = NULL;
+
+  surface = g_task_propagate_pointer (G_TASK (res), &error);
+  if (!surface)
+    {
+      g_warning ("Unable to render tile: %s", error->message);
+      g_error_free (error);
+    }
+
+  set_tile_surface (data->tile, surface, data->data, data->size);
+
+  if (surface)
+    cairo_surface_destroy (surface);
+
+  /* the worker thread may drop the last reference to the task, don't leave
+   * the clutter objects to it */
+  g_clear_object (&data->tile);
+  g_clear_object (&data->renderer);
+}
+
+
+static void
+render_async (ChamplainRenderer *renderer,
+    ChamplainTile *tile,
+    gchar *data,
+    guint size)
+{
+  RendererData *renderer_data;
+  GTask *task;
+
+  renderer_data = g_slice_new (RendererData);
+  renderer_data->renderer = g_object_ref (renderer);
+  renderer_data->tile = g_object_ref (tile);
+  renderer_data->data = data;
+  renderer_data->size = size;
+  renderer_data->tile_size = champlain_tile_get_size (tile) * champlain_tile_get_scale_factor (tile);
+
+  task = g_task_new (renderer, NULL, image_rendered_cb, NULL);
+  g_task_set_task_data (task, renderer_data, (GDestroyNotify) renderer_data_free);
+  g_task_run_in_thread (task, render_thread);
+  g_object_unref (task);
+}
+
+
+/*
+ * champlain_image_renderer_render_surface:
+ * @renderer: a #ChamplainImageRenderer
+ * @tile: the tile to render
+ * @surface: (nullable): @data decoded already, %NULL if decoding failed
+ * @data: the image data reported by #ChamplainTile::render-complete
+ * @size: the size of @data
+ *
+ * Renders a tile from an image decoded elsewhere, e.g. while it was being
+ * downloaded or when it was sliced from a metatile, instead of from the data
+ * passed with champlain_renderer_set_data().
+ */
+void
+champlain_image_renderer_render_surface (ChamplainImageRenderer *renderer,
+    ChamplainTile *tile,
+    cairo_surface_t *surface,
+    const guint8 *data,
+    guint size)
+{
+  g_return_if_fail (CHAMPLAIN_IS_IMAGE_RENDERER (renderer));
+  g_return_if_fail (CHAMPLAIN_IS_TILE (tile));
+
+  set_tile_surface (tile, surface, data, size);
+}
+
+
 static void
 render (ChamplainRenderer *renderer, ChamplainTile *tile)
 {
   ChamplainImageRendererPrivate *priv = CHAMPLAIN_IMAGE_RENDERER (renderer)->priv;
-  GInputStream *stream;
 
   if (!priv->data || priv->size == 0)
     {
       g_signal_emit_by_name (tile, "render-complete", priv->data, priv->size, TRUE);
       return;
     }
-    
-  RendererData *data;
-
-  data = g_slice_new (RendererData);
-  data->tile = g_object_ref (tile);
-  data->renderer = g_object_ref (renderer);
-  data->data = priv->data;
-  data->size = priv->size;
-    
-  stream = g_memory_input_stream_new_from_data (priv->data, priv->size, NULL);
-  gdk_pixbuf_new_from_stream_async (stream, NULL, (GAsyncReadyCallback)image_rendered_cb, data);
+
+  render_async (renderer, tile, priv->data, priv->size);
   priv->data = NULL;
 }
@@ -303,6 +303,11 @@ champlain_map_source_chain_push (ChamplainMapSourceChain *source_chain,
 
   g_object_ref_sink (map_source);
 
+  /* the chain provides the tiles of its last tile source */
+  if (!is_cache)
+    champlain_map_source_set_max_scale_factor (CHAMPLAIN_MAP_SOURCE (source_chain),
+        champlain_map_source_get_max_scale_factor (map_source));
+
   if (!priv->stack_top)
     {
       ChamplainMapSource *chain_next_source = champlain_map_source_get_next_source (CHAMPLAIN_MAP_SOURCE (source_chain));
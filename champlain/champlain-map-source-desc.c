@@ -42,6 +42,7 @@ enum
   PROP_PROJECTION,
   PROP_CONSTRUCTOR,
   PROP_DATA,
+  PROP_MAX_SCALE_FACTOR,
 };
 
 struct _ChamplainMapSourceDescPrivate
@@ -54,6 +55,7 @@ struct _ChamplainMapSourceDescPrivate
   guint min_zoom_level;
   guint max_zoom_level;
   guint tile_size;
+  guint max_scale_factor;
   ChamplainMapProjection projection;
   ChamplainMapSourceConstructor constructor;
   gpointer data;
@@ -78,6 +80,8 @@ static void set_max_zoom_level (ChamplainMapSourceDesc *desc,
     guint zoom_level);
 static void set_tile_size (ChamplainMapSourceDesc *desc,
     guint tile_size);
+static void set_max_scale_factor (ChamplainMapSourceDesc *desc,
+    guint scale_factor);
 static void set_projection (ChamplainMapSourceDesc *desc,
     ChamplainMapProjection projection);
 static void set_data (ChamplainMapSourceDesc *desc,
@@ -140,6 +144,10 @@ champlain_map_source_desc_get_property (GObject *object,
       g_value_set_pointer (value, priv->data);
       break;
 
+    case PROP_MAX_SCALE_FACTOR:
+      g_value_set_uint (value, priv->max_scale_factor);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -199,6 +207,10 @@ champlain_map_source_desc_set_property (GObject *object,
       set_data (desc, g_value_get_pointer (value));
       break;
 
+    case PROP_MAX_SCALE_FACTOR:
+      set_max_scale_factor (desc, g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -381,6 +393,26 @@ champlain_map_source_desc_class_init (ChamplainMapSourceDescClass *klass)
           256,
           G_PARAM_READABLE | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
 
+  /**
+   * ChamplainMapSourceDesc:max-scale-factor:
+   *
+   * The highest scale factor the map source provides tiles for, e.g. 2 if
+   * the server has "@2x" tiles for HiDPI displays. Such sources put {r} in
+   * their #ChamplainMapSourceDesc:uri-format. See
+   * #ChamplainMapSource:max-scale-factor.
+   *
+   * Since: 0.12.22
+   */
+  g_object_class_install_property (object_class,
+      PROP_MAX_SCALE_FACTOR,
+      g_param_spec_uint ("max-scale-factor",
+          "Max scale factor",
+          "The highest scale factor of the map source tiles",
+          1,
+          G_MAXINT,
+          1,
+          G_PARAM_READABLE | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+
   /**
    * ChamplainMapSourceDesc:constructor:
    *
@@ -426,6 +458,7 @@ champlain_map_source_desc_init (ChamplainMapSourceDesc *desc)
   priv->min_zoom_level = 0;
   priv->max_zoom_level = 20;
   priv->tile_size = 256;
+  priv->max_scale_factor = 1;
   priv->projection = CHAMPLAIN_MAP_PROJECTION_MERCATOR;
   priv->constructor = NULL;
   priv->data = NULL;
@@ -635,6 +668,25 @@ champlain_map_source_desc_get_tile_size (ChamplainMapSourceDesc *desc)
 }
 
 
+/**
+ * champlain_map_source_desc_get_max_scale_factor:
+ * @desc: a #ChamplainMapSourceDesc
+ *
+ * Gets the highest scale factor the map source provides tiles for.
+ *
+ * Returns: the map source's highest tile scale factor.
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_map_source_desc_get_max_scale_factor (ChamplainMapSourceDesc *desc)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MAP_SOURCE_DESC (desc), 1);
+
+  return desc->priv->max_scale_factor;
+}
+
+
 /**
  * champlain_map_source_desc_get_projection:
  * @desc: a #ChamplainMapSourceDesc
@@ -803,6 +855,18 @@ set_tile_size (ChamplainMapSourceDesc *desc,
 }
 
 
+static void
+set_max_scale_factor (ChamplainMapSourceDesc *desc,
+    guint scale_factor)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MAP_SOURCE_DESC (desc));
+
+  desc->priv->max_scale_factor = scale_factor;
+
+  g_object_notify (G_OBJECT (desc), "max-scale-factor");
+}
+
+
 static void
 set_projection (ChamplainMapSourceDesc *desc,
     ChamplainMapProjection projection)
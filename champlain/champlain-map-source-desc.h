@@ -116,6 +116,7 @@ const gchar *champlain_map_source_desc_get_uri_format (ChamplainMapSourceDesc *d
 guint champlain_map_source_desc_get_min_zoom_level (ChamplainMapSourceDesc *desc);
 guint champlain_map_source_desc_get_max_zoom_level (ChamplainMapSourceDesc *desc);
 guint champlain_map_source_desc_get_tile_size (ChamplainMapSourceDesc *desc);
+guint champlain_map_source_desc_get_max_scale_factor (ChamplainMapSourceDesc *desc);
 ChamplainMapProjection champlain_map_source_desc_get_projection (ChamplainMapSourceDesc *desc);
 gpointer champlain_map_source_desc_get_data (ChamplainMapSourceDesc *desc);
 ChamplainMapSourceConstructor champlain_map_source_desc_get_constructor (ChamplainMapSourceDesc *desc);
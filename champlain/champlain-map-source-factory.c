@@ -615,6 +615,8 @@ champlain_map_source_new_generic (ChamplainMapSourceDesc *desc)
             projection,
             uri_format,
             renderer));
+  champlain_map_source_set_max_scale_factor (map_source,
+      champlain_map_source_desc_get_max_scale_factor (desc));
 
   return map_source;
 }
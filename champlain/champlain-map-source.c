@@ -59,6 +59,7 @@ struct _ChamplainMapSourcePrivate
 {
   ChamplainMapSource *next_source;
   ChamplainRenderer *renderer;
+  guint max_scale_factor;
 };
 
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (ChamplainMapSource, champlain_map_source, G_TYPE_INITIALLY_UNOWNED)
@@ -68,6 +69,7 @@ enum
   PROP_0,
   PROP_NEXT_SOURCE,
   PROP_RENDERER,
+  PROP_MAX_SCALE_FACTOR,
 };
 
 static void
@@ -88,6 +90,10 @@ champlain_map_source_get_property (GObject *object,
       g_value_set_object (value, priv->renderer);
       break;
 
+    case PROP_MAX_SCALE_FACTOR:
+      g_value_set_uint (value, priv->max_scale_factor);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -114,6 +120,11 @@ champlain_map_source_set_property (GObject *object,
           g_value_get_object (value));
       break;
 
+    case PROP_MAX_SCALE_FACTOR:
+      champlain_map_source_set_max_scale_factor (map_source,
+          g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -208,6 +219,24 @@ champlain_map_source_class_init (ChamplainMapSourceClass *klass)
         CHAMPLAIN_TYPE_RENDERER,
         G_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_RENDERER, pspec);
+
+  /**
+   * ChamplainMapSource:max-scale-factor:
+   *
+   * The highest #ChamplainTile:scale-factor the map source provides tiles
+   * for, e.g. 2 for sources with "@2x" tiles. #ChamplainView loads tiles at
+   * the lower of this and its #ChamplainView:scale-factor.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint ("max-scale-factor",
+        "Max scale factor",
+        "The highest scale factor of the tiles",
+        1,
+        G_MAXINT,
+        1,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_MAX_SCALE_FACTOR, pspec);
 }
 
 
@@ -220,6 +249,7 @@ champlain_map_source_init (ChamplainMapSource *map_source)
 
   priv->next_source = NULL;
   priv->renderer = NULL;
+  priv->max_scale_factor = 1;
 }
 
 
@@ -261,6 +291,48 @@ champlain_map_source_get_renderer (ChamplainMapSource *map_source)
 }
 
 
+/**
+ * champlain_map_source_get_max_scale_factor:
+ * @map_source: a #ChamplainMapSource
+ *
+ * Gets the highest scale factor the map source provides tiles for.
+ *
+ * Returns: the #ChamplainMapSource:max-scale-factor.
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_map_source_get_max_scale_factor (ChamplainMapSource *map_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MAP_SOURCE (map_source), 1);
+
+  return map_source->priv->max_scale_factor;
+}
+
+
+/**
+ * champlain_map_source_set_max_scale_factor:
+ * @map_source: a #ChamplainMapSource
+ * @scale_factor: the highest scale factor, at least 1
+ *
+ * Sets the highest scale factor the map source provides tiles for, see
+ * #ChamplainMapSource:max-scale-factor.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_map_source_set_max_scale_factor (ChamplainMapSource *map_source,
+    guint scale_factor)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MAP_SOURCE (map_source));
+  g_return_if_fail (scale_factor >= 1);
+
+  map_source->priv->max_scale_factor = scale_factor;
+
+  g_object_notify (G_OBJECT (map_source), "max-scale-factor");
+}
+
+
 /**
  * champlain_map_source_set_next_source:
  * @map_source: a #ChamplainMapSource
@@ -102,6 +102,9 @@ void champlain_map_source_set_next_source (ChamplainMapSource *map_source,
 ChamplainRenderer *champlain_map_source_get_renderer (ChamplainMapSource *map_source);
 void champlain_map_source_set_renderer (ChamplainMapSource *map_source,
     ChamplainRenderer *renderer);
+guint champlain_map_source_get_max_scale_factor (ChamplainMapSource *map_source);
+void champlain_map_source_set_max_scale_factor (ChamplainMapSource *map_source,
+    guint scale_factor);
 
 const gchar *champlain_map_source_get_id (ChamplainMapSource *map_source);
 const gchar *champlain_map_source_get_name (ChamplainMapSource *map_source);
@@ -24,14 +24,25 @@
  * memory. The cache contents is not preserved between application restarts
  * so this cache serves mostly as a quick access temporary cache to the
  * most recently used tiles.
+ *
+ * To shorten the time until the first map is displayed after an application
+ * restart, the cache can remember the most recently requested tiles in a
+ * manifest file using champlain_memory_cache_save_manifest(). On the next
+ * start, champlain_memory_cache_preload() reads the listed tiles from the
+ * following #ChamplainFileCache in the chain in parallel so the first
+ * visible tiles are served from memory.
  */
 
 #define DEBUG_FLAG CHAMPLAIN_DEBUG_CACHE
 #include "champlain-debug.h"
 
 #include "champlain-memory-cache.h"
+#include "champlain-private.h"
+#include "champlain-file-cache-private.h"
 
 #include <glib.h>
+#include <gio/gio.h>
+#include <stdio.h>
 #include <string.h>
 
 struct _ChamplainMemoryCachePrivate
@@ -39,6 +50,10 @@ struct _ChamplainMemoryCachePrivate
   guint size_limit;
   GQueue *queue;
   GHashTable *hash_table;
+
+  /* keys of the most recently requested tiles, used for the manifest */
+  GQueue *recent_queue;
+  GHashTable *recent_table;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (ChamplainMemoryCache, champlain_memory_cache, CHAMPLAIN_TYPE_TILE_CACHE)
@@ -56,6 +71,12 @@ typedef struct
   guint size;
 } QueueMember;
 
+typedef struct
+{
+  ChamplainMemoryCache *memory_cache;
+  gchar *key;
+} PreloadData;
+
 
 static void fill_tile (ChamplainMapSource *map_source,
     ChamplainTile *tile);
@@ -125,6 +146,8 @@ champlain_memory_cache_finalize (GObject *object)
   champlain_memory_cache_clean (memory_cache);
   g_queue_free (memory_cache->priv->queue);
   g_hash_table_destroy (memory_cache->priv->hash_table);
+  g_hash_table_destroy (memory_cache->priv->recent_table);
+  g_queue_free_full (memory_cache->priv->recent_queue, g_free);
 
   G_OBJECT_CLASS (champlain_memory_cache_parent_class)->finalize (object);
 }
@@ -202,6 +225,8 @@ champlain_memory_cache_init (ChamplainMemoryCache *memory_cache)
 
   priv->queue = g_queue_new ();
   priv->hash_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  priv->recent_queue = g_queue_new ();
+  priv->recent_table = g_hash_table_new (g_str_hash, g_str_equal);
 }
 
 
@@ -256,10 +281,11 @@ generate_queue_key (ChamplainMemoryCache *memory_cache,
   ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (memory_cache);
   gchar *key;
 
-  key = g_strdup_printf ("%d/%d/%d/%s",
+  key = g_strdup_printf ("%d/%d/%d@%dx/%s",
         champlain_tile_get_zoom_level (tile),
         champlain_tile_get_x (tile),
         champlain_tile_get_y (tile),
+        champlain_tile_get_scale_factor (tile),
         champlain_map_source_get_id (map_source));
   return key;
 }
@@ -285,6 +311,34 @@ delete_queue_member (QueueMember *member, gpointer user_data)
 }
 
 
+static void
+remember_recent_key (ChamplainMemoryCache *memory_cache,
+    const gchar *key)
+{
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  GList *link;
+  gchar *recent_key;
+
+  link = g_hash_table_lookup (priv->recent_table, key);
+  if (link)
+    {
+      move_queue_member_to_head (priv->recent_queue, link);
+      return;
+    }
+
+  while (priv->recent_queue->length >= priv->size_limit)
+    {
+      recent_key = g_queue_pop_tail (priv->recent_queue);
+      g_hash_table_remove (priv->recent_table, recent_key);
+      g_free (recent_key);
+    }
+
+  recent_key = g_strdup (key);
+  g_queue_push_head (priv->recent_queue, recent_key);
+  g_hash_table_insert (priv->recent_table, recent_key, g_queue_peek_head_link (priv->recent_queue));
+}
+
+
 static void
 tile_rendered_cb (ChamplainTile *tile,
     gpointer data,
@@ -336,6 +390,7 @@ fill_tile (ChamplainMapSource *map_source,
       gchar *key;
 
       key = generate_queue_key (memory_cache, tile);
+      remember_recent_key (memory_cache, key);
       link = g_hash_table_lookup (priv->hash_table, key);
       g_free (key);
       if (link)
@@ -475,3 +530,180 @@ on_tile_filled (ChamplainTileCache *tile_cache,
   if (CHAMPLAIN_IS_TILE_CACHE (next_source))
     champlain_tile_cache_on_tile_filled (CHAMPLAIN_TILE_CACHE (next_source), tile);
 }
+
+
+/**
+ * champlain_memory_cache_save_manifest:
+ * @memory_cache: a #ChamplainMemoryCache
+ * @filename: the file the manifest is written to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Writes the list of the most recently requested tiles (at most
+ * #ChamplainMemoryCache:size-limit of them) to the given file so they can be
+ * loaded back by champlain_memory_cache_preload() on the next application
+ * start. Only the tile coordinates are stored, the tile data stay in the
+ * #ChamplainFileCache.
+ *
+ * Returns: %TRUE if the manifest was written, %FALSE otherwise
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_memory_cache_save_manifest (ChamplainMemoryCache *memory_cache,
+    const gchar *filename,
+    GError **error)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache), FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  GString *manifest;
+  GList *link;
+  gboolean ret;
+
+  manifest = g_string_new (NULL);
+  for (link = priv->recent_queue->head; link != NULL; link = link->next)
+    {
+      g_string_append (manifest, link->data);
+      g_string_append_c (manifest, '\n');
+    }
+
+  ret = g_file_set_contents (filename, manifest->str, manifest->len, error);
+  g_string_free (manifest, TRUE);
+
+  return ret;
+}
+
+
+static void
+preload_tile_loaded_cb (ChamplainFileCache *file_cache,
+    GAsyncResult *res,
+    PreloadData *data)
+{
+  ChamplainMemoryCache *memory_cache = data->memory_cache;
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  GError *error = NULL;
+  GBytes *bytes;
+
+  bytes = champlain_file_cache_load_tile_contents_finish (file_cache, res, &error);
+  if (!bytes)
+    {
+      DEBUG ("Preloading of %s failed: %s", data->key, error->message);
+      g_error_free (error);
+    }
+  else if (!g_hash_table_contains (priv->hash_table, data->key) &&
+           priv->queue->length < priv->size_limit)
+    {
+      QueueMember *member;
+      gsize size;
+
+      /* preloaded tiles are older than anything requested in the meantime
+         so they go to the tail of the queue */
+      member = g_slice_new (QueueMember);
+      member->key = g_steal_pointer (&data->key);
+      member->data = g_bytes_unref_to_data (bytes, &size);
+      member->size = size;
+      bytes = NULL;
+
+      g_queue_push_tail (priv->queue, member);
+      g_hash_table_insert (priv->hash_table, g_strdup (member->key), g_queue_peek_tail_link (priv->queue));
+    }
+
+  if (bytes)
+    g_bytes_unref (bytes);
+  g_free (data->key);
+  g_object_unref (memory_cache);
+  g_slice_free (PreloadData, data);
+}
+
+
+/**
+ * champlain_memory_cache_preload:
+ * @memory_cache: a #ChamplainMemoryCache
+ * @filename: a manifest written by champlain_memory_cache_save_manifest()
+ * @scale_factor: the scale factor the tiles are displayed at, the smaller of
+ * champlain_view_get_scale_factor() and
+ * champlain_map_source_get_max_scale_factor()
+ *
+ * Loads the tiles listed in the manifest into the cache. The tile data are
+ * read in parallel in worker threads from the #ChamplainFileCache following
+ * this cache in the map source chain so the call returns immediately; tiles
+ * requested before their data arrive are loaded the usual way. Only tiles of
+ * the current map source are preloaded, at @scale_factor whatever the scale
+ * factor they were used at when the manifest was saved. Expired tiles are
+ * left out so that they get validated when requested.
+ *
+ * Call this function after the map source chain has been assembled and
+ * before the map source is set to the #ChamplainView.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_memory_cache_preload (ChamplainMemoryCache *memory_cache,
+    const gchar *filename,
+    guint scale_factor)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMORY_CACHE (memory_cache));
+  g_return_if_fail (filename != NULL);
+  g_return_if_fail (scale_factor >= 1);
+
+  ChamplainMemoryCachePrivate *priv = memory_cache->priv;
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (memory_cache);
+  ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
+  const gchar *id;
+  gchar *contents = NULL;
+  gchar **lines;
+  GHashTable *keys;
+  guint i, count = 0;
+
+  if (!CHAMPLAIN_IS_FILE_CACHE (next_source))
+    {
+      DEBUG ("No file cache to preload the tiles from");
+      return;
+    }
+
+  if (!g_file_get_contents (filename, &contents, NULL, NULL))
+    return;
+
+  id = champlain_map_source_get_id (map_source);
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+  /* the same tile may be listed at several scale factors */
+  keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; lines[i] != NULL && count < priv->size_limit; i++)
+    {
+      PreloadData *data;
+      guint zoom_level, x, y, saved_scale_factor;
+      gint id_offset = 0;
+      gchar *key;
+
+      /* the keys are "zoom/x/y@scalex/id", see generate_queue_key() */
+      if (sscanf (lines[i], "%u/%u/%u@%ux/%n", &zoom_level, &x, &y, &saved_scale_factor, &id_offset) != 4 ||
+          id_offset == 0 || g_strcmp0 (lines[i] + id_offset, id) != 0)
+        continue;
+
+      key = g_strdup_printf ("%u/%u/%u@%ux/%s", zoom_level, x, y, scale_factor, id);
+      if (g_hash_table_contains (priv->hash_table, key))
+        {
+          g_free (key);
+          continue;
+        }
+      if (!g_hash_table_add (keys, key))
+        continue;
+
+      data = g_slice_new (PreloadData);
+      data->memory_cache = g_object_ref (memory_cache);
+      data->key = g_strdup (key);
+
+      champlain_file_cache_load_tile_contents_async (CHAMPLAIN_FILE_CACHE (next_source),
+          zoom_level, x, y, scale_factor, NULL,
+          (GAsyncReadyCallback) preload_tile_loaded_cb, data);
+      count++;
+    }
+
+  DEBUG ("Preloading %u tiles", count);
+
+  g_hash_table_unref (keys);
+  g_strfreev (lines);
+}
@@ -81,6 +81,13 @@ void champlain_memory_cache_set_size_limit (ChamplainMemoryCache *memory_cache,
 
 void champlain_memory_cache_clean (ChamplainMemoryCache *memory_cache);
 
+gboolean champlain_memory_cache_save_manifest (ChamplainMemoryCache *memory_cache,
+    const gchar *filename,
+    GError **error);
+void champlain_memory_cache_preload (ChamplainMemoryCache *memory_cache,
+    const gchar *filename,
+    guint scale_factor);
+
 G_END_DECLS
 
 #endif /* _CHAMPLAIN_MEMORY_CACHE_H_ */
@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * libmemphis keeps the map it loads to itself and goes through all of it
+ * for every tile. The index is therefore built from the OSM XML: every node
+ * and way is kept serialized, and assigned to the buckets its bounding box
+ * intersects. Ways bring all their nodes along, so that they are drawn the
+ * same as from the whole map. Relations and other elements libmemphis
+ * doesn't draw are left out.
+ */
+
+#include "champlain-memphis-index.h"
+
+#define DEBUG_FLAG CHAMPLAIN_DEBUG_MEMPHIS
+#include "champlain-debug.h"
+#include "champlain-defines.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* How far from a bucket, in buckets, elements are still included, wide
+ * lines and labels reach over the tile border */
+#define BUCKET_MARGIN 0.125
+
+typedef struct
+{
+  gint64 id;
+  /* the position, in buckets */
+  gdouble x;
+  gdouble y;
+  /* the serialized element in the text */
+  gsize offset;
+  gsize length;
+  gboolean tagged;
+} IndexNode;
+
+typedef struct
+{
+  gsize offset;
+  gsize length;
+  /* the nodes of the way in the refs */
+  guint first_ref;
+  guint n_refs;
+} IndexWay;
+
+typedef struct
+{
+  /* indices of the tagged nodes and of the ways, in ascending order */
+  GArray *nodes;
+  GArray *ways;
+} Bucket;
+
+struct _ChamplainMemphisIndex
+{
+  guint zoom_level;
+  /* the <osm> start tag and the bounds, copied to every bucket */
+  GString *header;
+  /* the serialized nodes and ways */
+  GString *text;
+  GArray *nodes;
+  GArray *ways;
+  /* node ids while parsing, then indices of the nodes or -1 for nodes
+   * missing from the data */
+  GArray *refs;
+  /* x << 32 | y -> Bucket */
+  GHashTable *buckets;
+};
+
+typedef enum
+{
+  PARSE_OSM,
+  PARSE_NODE,
+  PARSE_WAY
+} ParseState;
+
+typedef struct
+{
+  ChamplainMemphisIndex *index;
+  ParseState state;
+  /* the depth within an element that isn't indexed */
+  guint ignored_depth;
+  /* the node or way being parsed */
+  GString *element;
+  IndexNode node;
+  IndexWay way;
+} ParseData;
+
+typedef struct
+{
+  gint64 id;
+  guint index;
+} NodeId;
+
+
+static void
+bucket_free (Bucket *bucket)
+{
+  g_array_unref (bucket->nodes);
+  g_array_unref (bucket->ways);
+  g_slice_free (Bucket, bucket);
+}
+
+
+static const gchar *
+get_attribute (const gchar **attribute_names,
+    const gchar **attribute_values,
+    const gchar *name)
+{
+  gint i;
+
+  for (i = 0; attribute_names[i]; i++)
+    {
+      if (strcmp (attribute_names[i], name) == 0)
+        return attribute_values[i];
+    }
+
+  return NULL;
+}
+
+
+static void
+append_start_tag (GString *string,
+    const gchar *element_name,
+    const gchar **attribute_names,
+    const gchar **attribute_values,
+    gboolean empty)
+{
+  gint i;
+
+  g_string_append_c (string, '<');
+  g_string_append (string, element_name);
+
+  for (i = 0; attribute_names[i]; i++)
+    {
+      gchar *value = g_markup_escape_text (attribute_values[i], -1);
+
+      g_string_append_printf (string, " %s=\"%s\"", attribute_names[i], value);
+      g_free (value);
+    }
+
+  g_string_append (string, empty ? "/>\n" : ">\n");
+}
+
+
+static void
+start_element_cb (G_GNUC_UNUSED GMarkupParseContext *context,
+    const gchar *element_name,
+    const gchar **attribute_names,
+    const gchar **attribute_values,
+    gpointer user_data,
+    GError **error)
+{
+  ParseData *data = user_data;
+  ChamplainMemphisIndex *index = data->index;
+
+  if (data->ignored_depth > 0)
+    {
+      data->ignored_depth++;
+      return;
+    }
+
+  switch (data->state)
+    {
+    case PARSE_OSM:
+      if (strcmp (element_name, "osm") == 0)
+        append_start_tag (index->header, element_name, attribute_names, attribute_values, FALSE);
+      else if (strcmp (element_name, "bounds") == 0 || strcmp (element_name, "bound") == 0)
+        append_start_tag (index->header, element_name, attribute_names, attribute_values, TRUE);
+      else if (strcmp (element_name, "node") == 0)
+        {
+          const gchar *id, *lat, *lon;
+          gdouble n = (gdouble) (1u << index->zoom_level);
+          gdouble latitude;
+
+          id = get_attribute (attribute_names, attribute_values, "id");
+          lat = get_attribute (attribute_names, attribute_values, "lat");
+          lon = get_attribute (attribute_names, attribute_values, "lon");
+          if (!id || !lat || !lon)
+            {
+              g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_MISSING_ATTRIBUTE,
+                  "Node without id or position");
+              return;
+            }
+
+          memset (&data->node, 0, sizeof (IndexNode));
+          data->node.id = g_ascii_strtoll (id, NULL, 10);
+
+          latitude = CLAMP (g_ascii_strtod (lat, NULL), CHAMPLAIN_MIN_LATITUDE, CHAMPLAIN_MAX_LATITUDE) * G_PI / 180.0;
+          data->node.x = (g_ascii_strtod (lon, NULL) + 180.0) / 360.0 * n;
+          data->node.y = (1.0 - log (tan (latitude) + 1.0 / cos (latitude)) / G_PI) / 2.0 * n;
+
+          g_string_truncate (data->element, 0);
+          append_start_tag (data->element, element_name, attribute_names, attribute_values, FALSE);
+          data->state = PARSE_NODE;
+        }
+      else if (strcmp (element_name, "way") == 0)
+        {
+          memset (&data->way, 0, sizeof (IndexWay));
+          data->way.first_ref = index->refs->len;
+
+          g_string_truncate (data->element, 0);
+          append_start_tag (data->element, element_name, attribute_names, attribute_values, FALSE);
+          data->state = PARSE_WAY;
+        }
+      else
+        data->ignored_depth = 1;
+      break;
+
+    case PARSE_NODE:
+      if (strcmp (element_name, "tag") == 0)
+        {
+          append_start_tag (data->element, element_name, attribute_names, attribute_values, TRUE);
+          data->node.tagged = TRUE;
+        }
+      else
+        data->ignored_depth = 1;
+      break;
+
+    case PARSE_WAY:
+      if (strcmp (element_name, "nd") == 0)
+        {
+          const gchar *ref = get_attribute (attribute_names, attribute_values, "ref");
+          gint64 id;
+
+          if (!ref)
+            {
+              g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_MISSING_ATTRIBUTE,
+                  "Way node without ref");
+              return;
+            }
+
+          id = g_ascii_strtoll (ref, NULL, 10);
+          g_array_append_val (index->refs, id);
+          data->way.n_refs++;
+          append_start_tag (data->element, element_name, attribute_names, attribute_values, TRUE);
+        }
+      else if (strcmp (element_name, "tag") == 0)
+        append_start_tag (data->element, element_name, attribute_names, attribute_values, TRUE);
+      else
+        data->ignored_depth = 1;
+      break;
+    }
+}
+
+
+static void
+end_element_cb (G_GNUC_UNUSED GMarkupParseContext *context,
+    const gchar *element_name,
+    gpointer user_data,
+    G_GNUC_UNUSED GError **error)
+{
+  ParseData *data = user_data;
+  ChamplainMemphisIndex *index = data->index;
+
+  if (data->ignored_depth > 0)
+    {
+      data->ignored_depth--;
+      return;
+    }
+
+  if (data->state == PARSE_NODE && strcmp (element_name, "node") == 0)
+    {
+      g_string_append (data->element, "</node>\n");
+      data->node.offset = index->text->len;
+      data->node.length = data->element->len;
+      g_string_append_len (index->text, data->element->str, data->element->len);
+      g_array_append_val (index->nodes, data->node);
+      data->state = PARSE_OSM;
+    }
+  else if (data->state == PARSE_WAY && strcmp (element_name, "way") == 0)
+    {
+      g_string_append (data->element, "</way>\n");
+      data->way.offset = index->text->len;
+      data->way.length = data->element->len;
+      g_string_append_len (index->text, data->element->str, data->element->len);
+      g_array_append_val (index->ways, data->way);
+      data->state = PARSE_OSM;
+    }
+}
+
+
+static gint
+compare_node_ids (gconstpointer a,
+    gconstpointer b)
+{
+  gint64 id_a = ((const NodeId *) a)->id;
+  gint64 id_b = ((const NodeId *) b)->id;
+
+  return id_a < id_b ? -1 : id_a > id_b;
+}
+
+
+/* Replaces the node ids of the ways by indices of the nodes */
+static void
+resolve_refs (ChamplainMemphisIndex *index)
+{
+  NodeId *ids;
+  guint i;
+
+  ids = g_new (NodeId, MAX (index->nodes->len, 1));
+  for (i = 0; i < index->nodes->len; i++)
+    {
+      ids[i].id = g_array_index (index->nodes, IndexNode, i).id;
+      ids[i].index = i;
+    }
+  qsort (ids, index->nodes->len, sizeof (NodeId), compare_node_ids);
+
+  for (i = 0; i < index->refs->len; i++)
+    {
+      NodeId key, *found;
+
+      key.id = g_array_index (index->refs, gint64, i);
+      found = bsearch (&key, ids, index->nodes->len, sizeof (NodeId), compare_node_ids);
+      g_array_index (index->refs, gint64, i) = found ? (gint64) found->index : -1;
+    }
+
+  g_free (ids);
+}
+
+
+static void
+add_to_buckets (ChamplainMemphisIndex *index,
+    gdouble min_x,
+    gdouble min_y,
+    gdouble max_x,
+    gdouble max_y,
+    gboolean way,
+    guint element)
+{
+  gdouble last = (gdouble) (1u << index->zoom_level) - 1;
+  guint x, y, x1, y1, x2, y2;
+
+  x1 = CLAMP (floor (min_x - BUCKET_MARGIN), 0, last);
+  y1 = CLAMP (floor (min_y - BUCKET_MARGIN), 0, last);
+  x2 = CLAMP (floor (max_x + BUCKET_MARGIN), 0, last);
+  y2 = CLAMP (floor (max_y + BUCKET_MARGIN), 0, last);
+
+  for (y = y1; y <= y2; y++)
+    {
+      for (x = x1; x <= x2; x++)
+        {
+          gint64 key = ((gint64) x << 32) | y;
+          Bucket *bucket = g_hash_table_lookup (index->buckets, &key);
+
+          if (!bucket)
+            {
+              gint64 *bucket_key = g_new (gint64, 1);
+
+              *bucket_key = key;
+              bucket = g_slice_new (Bucket);
+              bucket->nodes = g_array_new (FALSE, FALSE, sizeof (guint));
+              bucket->ways = g_array_new (FALSE, FALSE, sizeof (guint));
+              g_hash_table_insert (index->buckets, bucket_key, bucket);
+            }
+
+          g_array_append_val (way ? bucket->ways : bucket->nodes, element);
+        }
+    }
+}
+
+
+static void
+build_buckets (ChamplainMemphisIndex *index)
+{
+  guint i, j;
+
+  /* untagged nodes are only drawn as part of ways */
+  for (i = 0; i < index->nodes->len; i++)
+    {
+      IndexNode *node = &g_array_index (index->nodes, IndexNode, i);
+
+      if (node->tagged)
+        add_to_buckets (index, node->x, node->y, node->x, node->y, FALSE, i);
+    }
+
+  for (i = 0; i < index->ways->len; i++)
+    {
+      IndexWay *way = &g_array_index (index->ways, IndexWay, i);
+      gdouble min_x = G_MAXDOUBLE, min_y = G_MAXDOUBLE;
+      gdouble max_x = -G_MAXDOUBLE, max_y = -G_MAXDOUBLE;
+
+      for (j = way->first_ref; j < way->first_ref + way->n_refs; j++)
+        {
+          gint64 ref = g_array_index (index->refs, gint64, j);
+          IndexNode *node;
+
+          if (ref < 0)
+            continue;
+
+          node = &g_array_index (index->nodes, IndexNode, ref);
+          min_x = MIN (min_x, node->x);
+          min_y = MIN (min_y, node->y);
+          max_x = MAX (max_x, node->x);
+          max_y = MAX (max_y, node->y);
+        }
+
+      if (min_x <= max_x)
+        add_to_buckets (index, min_x, min_y, max_x, max_y, TRUE, i);
+    }
+}
+
+
+/*
+ * champlain_memphis_index_new:
+ * @data: OSM XML data
+ * @size: the size of @data
+ * @zoom_level: the zoom level of the buckets
+ * @error: return location for a #GError
+ *
+ * Builds the spatial index of @data.
+ *
+ * Returns: the index, or %NULL if @data couldn't be parsed.
+ */
+ChamplainMemphisIndex *
+champlain_memphis_index_new (const gchar *data,
+    gsize size,
+    guint zoom_level,
+    GError **error)
+{
+  static const GMarkupParser parser = { start_element_cb, end_element_cb, NULL, NULL, NULL };
+  ChamplainMemphisIndex *index;
+  GMarkupParseContext *context;
+  ParseData parse_data;
+  gboolean parsed;
+
+  g_return_val_if_fail (zoom_level < 31, NULL);
+
+  index = g_slice_new (ChamplainMemphisIndex);
+  index->zoom_level = zoom_level;
+  index->header = g_string_new (NULL);
+  index->text = g_string_new (NULL);
+  index->nodes = g_array_new (FALSE, FALSE, sizeof (IndexNode));
+  index->ways = g_array_new (FALSE, FALSE, sizeof (IndexWay));
+  index->refs = g_array_new (FALSE, FALSE, sizeof (gint64));
+  index->buckets = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+        g_free, (GDestroyNotify) bucket_free);
+
+  memset (&parse_data, 0, sizeof (ParseData));
+  parse_data.index = index;
+  parse_data.state = PARSE_OSM;
+  parse_data.element = g_string_new (NULL);
+
+  context = g_markup_parse_context_new (&parser, 0, &parse_data, NULL);
+  parsed = g_markup_parse_context_parse (context, data, size, error) &&
+    g_markup_parse_context_end_parse (context, error);
+  g_markup_parse_context_free (context);
+  g_string_free (parse_data.element, TRUE);
+
+  if (!parsed)
+    {
+      champlain_memphis_index_free (index);
+      return NULL;
+    }
+
+  if (index->header->len == 0)
+    {
+      g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+          "Not OSM data");
+      champlain_memphis_index_free (index);
+      return NULL;
+    }
+
+  resolve_refs (index);
+  build_buckets (index);
+
+  DEBUG ("Indexed %u nodes and %u ways in %u buckets", index->nodes->len,
+      index->ways->len, g_hash_table_size (index->buckets));
+
+  return index;
+}
+
+
+void
+champlain_memphis_index_free (ChamplainMemphisIndex *index)
+{
+  g_string_free (index->header, TRUE);
+  g_string_free (index->text, TRUE);
+  g_array_unref (index->nodes);
+  g_array_unref (index->ways);
+  g_array_unref (index->refs);
+  g_hash_table_unref (index->buckets);
+  g_slice_free (ChamplainMemphisIndex, index);
+}
+
+
+guint
+champlain_memphis_index_get_zoom_level (ChamplainMemphisIndex *index)
+{
+  return index->zoom_level;
+}
+
+
+/*
+ * champlain_memphis_index_get_bucket:
+ * @index: a #ChamplainMemphisIndex
+ * @x: the x coordinate of the bucket
+ * @y: the y coordinate of the bucket
+ * @size: return location for the size of the data
+ *
+ * Extracts the nodes and ways intersecting a bucket. The bounds of the
+ * whole map are kept, so that the bucket covers the same area.
+ *
+ * Returns: the bucket as OSM XML, free with g_free()
+ */
+gchar *
+champlain_memphis_index_get_bucket (ChamplainMemphisIndex *index,
+    guint x,
+    guint y,
+    gsize *size)
+{
+  gint64 key = ((gint64) x << 32) | y;
+  Bucket *bucket;
+  GString *xml;
+  guint i, j;
+
+  xml = g_string_new ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  g_string_append_len (xml, index->header->str, index->header->len);
+
+  bucket = g_hash_table_lookup (index->buckets, &key);
+  if (bucket)
+    {
+      guint8 *used = g_new0 (guint8, index->nodes->len);
+
+      /* the nodes have to come before the ways using them */
+      for (i = 0; i < bucket->nodes->len; i++)
+        used[g_array_index (bucket->nodes, guint, i)] = TRUE;
+
+      for (i = 0; i < bucket->ways->len; i++)
+        {
+          IndexWay *way = &g_array_index (index->ways, IndexWay, g_array_index (bucket->ways, guint, i));
+
+          for (j = way->first_ref; j < way->first_ref + way->n_refs; j++)
+            {
+              gint64 ref = g_array_index (index->refs, gint64, j);
+
+              if (ref >= 0)
+                used[ref] = TRUE;
+            }
+        }
+
+      for (i = 0; i < index->nodes->len; i++)
+        {
+          IndexNode *node = &g_array_index (index->nodes, IndexNode, i);
+
+          if (used[i])
+            g_string_append_len (xml, index->text->str + node->offset, node->length);
+        }
+
+      for (i = 0; i < bucket->ways->len; i++)
+        {
+          IndexWay *way = &g_array_index (index->ways, IndexWay, g_array_index (bucket->ways, guint, i));
+
+          g_string_append_len (xml, index->text->str + way->offset, way->length);
+        }
+
+      g_free (used);
+    }
+
+  g_string_append (xml, "</osm>\n");
+
+  *size = xml->len;
+  return g_string_free (xml, FALSE);
+}
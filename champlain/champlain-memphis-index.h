@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __CHAMPLAIN_MEMPHIS_INDEX_H__
+#define __CHAMPLAIN_MEMPHIS_INDEX_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A spatial index over OSM XML data. The data is split into buckets, the
+ * tiles of a single zoom level, each holding the nodes and ways that
+ * intersect it. A bucket is extracted as OSM XML again, so that libmemphis
+ * only has to go through a small part of the map when drawing a tile.
+ *
+ * The index is immutable once built and can be used from any thread. */
+
+typedef struct _ChamplainMemphisIndex ChamplainMemphisIndex;
+
+G_GNUC_INTERNAL
+ChamplainMemphisIndex *champlain_memphis_index_new (const gchar *data,
+    gsize size,
+    guint zoom_level,
+    GError **error);
+G_GNUC_INTERNAL
+void champlain_memphis_index_free (ChamplainMemphisIndex *index);
+G_GNUC_INTERNAL
+guint champlain_memphis_index_get_zoom_level (ChamplainMemphisIndex *index);
+G_GNUC_INTERNAL
+gchar *champlain_memphis_index_get_bucket (ChamplainMemphisIndex *index,
+    guint x,
+    guint y,
+    gsize *size);
+
+G_END_DECLS
+
+#endif
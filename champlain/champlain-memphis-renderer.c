@@ -41,18 +41,16 @@
 #include "champlain-defines.h"
 #include "champlain-enum-types.h"
 #include "champlain-private.h"
+#include "champlain-tile-private.h"
+#include "champlain-image-decoder.h"
 #include "champlain-memphis-renderer.h"
+#include "champlain-memphis-index.h"
 #include "champlain-bounding-box.h"
 
-#include <gdk-pixbuf/gdk-pixbuf.h>
-
 #include <memphis/memphis.h>
 #include <errno.h>
 #include <string.h>
 
-/* Tuning parameters */
-#define MAX_THREADS 4
-
 const gchar default_rules[] =
   "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
   "<rules version=\"0.1\" background=\"#ffffff\">"
@@ -65,7 +63,8 @@ enum
 {
   PROP_0,
   PROP_TILE_SIZE,
-  PROP_BOUNDING_BOX
+  PROP_BOUNDING_BOX,
+  PROP_MAX_THREADS
 };
 
 static void render (ChamplainRenderer *renderer,
@@ -77,17 +76,54 @@ static void set_bounding_box (ChamplainMemphisRenderer *renderer,
     ChamplainBoundingBox *bbox);
 
 
+/* Tiles from this zoom level on are drawn from the buckets of the spatial
+ * index instead of the whole map */
+#define INDEX_ZOOM_LEVEL 14
+
+/* The map data set by set_data(), never modified once created except for
+ * the maps of the buckets being loaded on demand */
+typedef struct
+{
+  MemphisMap *map;
+  /* NULL if the data couldn't be indexed */
+  ChamplainMemphisIndex *index;
+  /* protects bucket_maps */
+  GMutex lock;
+  /* x << 32 | y -> MemphisMap of the bucket */
+  GHashTable *bucket_maps;
+} MapSnapshot;
+
+/* A MemphisRenderer used by a single worker at a time */
+typedef struct
+{
+  MemphisRenderer *renderer;
+  MapSnapshot *snapshot;
+  /* the map of the snapshot the renderer is set to */
+  MemphisMap *map;
+  guint tile_size;
+} WorkerRenderer;
+
 struct _ChamplainMemphisRendererPrivate
 {
   MemphisRuleSet *rules;
-  MemphisRenderer *renderer;
+  /* held for reading while drawing, for writing while the rules change */
+  GRWLock rules_lock;
+  /* protects snapshot and idle_renderers */
+  GMutex lock;
+  MapSnapshot *snapshot;
+  GQueue idle_renderers;
   GThreadPool *thpool;
+  guint max_threads;
   guint tile_size;
   ChamplainBoundingBox *bbox;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (ChamplainMemphisRenderer, champlain_memphis_renderer, CHAMPLAIN_TYPE_RENDERER)
 
+/* libmemphis shares its string pool between all the maps of the process,
+ * they are loaded one at a time whichever renderer they belong to */
+static GMutex memphis_load_lock;
+
 typedef struct _WorkerThreadData WorkerThreadData;
 
 struct _WorkerThreadData
@@ -100,23 +136,125 @@ struct _WorkerThreadData
   ChamplainRenderer *renderer;
   ChamplainTile *tile;
   cairo_surface_t *cst;
+  /* whether to encode the tile for the cache, and the result */
+  gboolean encode;
+  GBytes *encoded;
 };
 
-/* lock to protect the renderer state while rendering */
-#if GLIB_CHECK_VERSION(2,32,0)
-  static GRWLock MemphisLock;
-#else
-  GStaticRWLock MemphisLock = G_STATIC_RW_LOCK_INIT;
-  #define g_rw_lock_reader_lock(l)   g_static_rw_lock_reader_lock (l)
-  #define g_rw_lock_reader_unlock(l) g_static_rw_lock_reader_unlock (l)
-  #define g_rw_lock_writer_lock(l)   g_static_rw_lock_writer_lock (l)
-  #define g_rw_lock_writer_unlock(l) g_static_rw_lock_writer_unlock (l)
-#endif
-
 static void memphis_worker_thread (gpointer data,
     gpointer user_data);
 
 
+static MapSnapshot *
+map_snapshot_new (MemphisMap *map,
+    ChamplainMemphisIndex *index)
+{
+  MapSnapshot *snapshot = g_atomic_rc_box_new0 (MapSnapshot);
+
+  snapshot->map = map;
+  snapshot->index = index;
+  g_mutex_init (&snapshot->lock);
+  snapshot->bucket_maps = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+        g_free, (GDestroyNotify) memphis_map_free);
+
+  return snapshot;
+}
+
+
+static void
+map_snapshot_clear (MapSnapshot *snapshot)
+{
+  memphis_map_free (snapshot->map);
+  if (snapshot->index)
+    champlain_memphis_index_free (snapshot->index);
+  g_hash_table_unref (snapshot->bucket_maps);
+  g_mutex_clear (&snapshot->lock);
+}
+
+
+/* Returns the map to draw the tile from, the map of the bucket containing
+ * it if possible */
+static MemphisMap *
+map_snapshot_get_map (MapSnapshot *snapshot,
+    gint x,
+    gint y,
+    guint z)
+{
+  MemphisMap *map;
+  GError *error = NULL;
+  gchar *data;
+  gsize size;
+  gint64 key, *bucket_key;
+  guint shift;
+
+  if (!snapshot->index || z < INDEX_ZOOM_LEVEL || z - INDEX_ZOOM_LEVEL >= 31 || x < 0 || y < 0)
+    return snapshot->map;
+
+  shift = z - INDEX_ZOOM_LEVEL;
+  key = ((gint64) (x >> shift) << 32) | (y >> shift);
+
+  g_mutex_lock (&snapshot->lock);
+  map = g_hash_table_lookup (snapshot->bucket_maps, &key);
+  g_mutex_unlock (&snapshot->lock);
+
+  if (map)
+    return map;
+
+  g_mutex_lock (&memphis_load_lock);
+
+  /* another worker may have loaded it in the meantime */
+  g_mutex_lock (&snapshot->lock);
+  map = g_hash_table_lookup (snapshot->bucket_maps, &key);
+  g_mutex_unlock (&snapshot->lock);
+
+  if (!map)
+    {
+      data = champlain_memphis_index_get_bucket (snapshot->index, x >> shift, y >> shift, &size);
+
+      map = memphis_map_new ();
+      memphis_map_load_from_data (map, data, size, &error);
+      g_free (data);
+
+      if (error)
+        {
+          DEBUG ("Can't load bucket (%d, %d): %s", x >> shift, y >> shift, error->message);
+          g_error_free (error);
+          memphis_map_free (map);
+          map = snapshot->map;
+        }
+      else
+        {
+          bucket_key = g_new (gint64, 1);
+          *bucket_key = key;
+
+          g_mutex_lock (&snapshot->lock);
+          g_hash_table_insert (snapshot->bucket_maps, bucket_key, map);
+          g_mutex_unlock (&snapshot->lock);
+        }
+    }
+
+  g_mutex_unlock (&memphis_load_lock);
+
+  return map;
+}
+
+
+static void
+map_snapshot_unref (MapSnapshot *snapshot)
+{
+  g_atomic_rc_box_release_full (snapshot, (GDestroyNotify) map_snapshot_clear);
+}
+
+
+static void
+worker_renderer_free (WorkerRenderer *worker)
+{
+  memphis_renderer_free (worker->renderer);
+  map_snapshot_unref (worker->snapshot);
+  g_slice_free (WorkerRenderer, worker);
+}
+
+
 static void
 champlain_memphis_renderer_get_property (GObject *object,
     guint property_id,
@@ -135,6 +273,10 @@ champlain_memphis_renderer_get_property (GObject *object,
       g_value_set_boxed (value, champlain_memphis_renderer_get_bounding_box (renderer));
       break;
 
+    case PROP_MAX_THREADS:
+      g_value_set_uint (value, champlain_memphis_renderer_get_max_threads (renderer));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -159,6 +301,10 @@ champlain_memphis_renderer_set_property (GObject *object,
       set_bounding_box (renderer, g_value_get_boxed (value));
       break;
 
+    case PROP_MAX_THREADS:
+      champlain_memphis_renderer_set_max_threads (renderer, g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -176,10 +322,11 @@ champlain_memphis_renderer_dispose (GObject *object)
       g_thread_pool_free (priv->thpool, FALSE, TRUE);
       priv->thpool = NULL;
     }
-  if (priv->renderer)
+  g_queue_clear_full (&priv->idle_renderers, (GDestroyNotify) worker_renderer_free);
+  if (priv->snapshot)
     {
-      memphis_renderer_free (priv->renderer);
-      priv->renderer = NULL;
+      map_snapshot_unref (priv->snapshot);
+      priv->snapshot = NULL;
     }
   if (priv->rules)
     {
@@ -198,6 +345,8 @@ champlain_memphis_renderer_finalize (GObject *object)
   ChamplainMemphisRendererPrivate *priv = renderer->priv;
 
   champlain_bounding_box_free (priv->bbox);
+  g_rw_lock_clear (&priv->rules_lock);
+  g_mutex_clear (&priv->lock);
 
   G_OBJECT_CLASS (champlain_memphis_renderer_parent_class)->finalize (object);
 }
@@ -241,6 +390,24 @@ champlain_memphis_renderer_class_init (ChamplainMemphisRendererClass *klass)
           "The bounding box of the renderer",
           CHAMPLAIN_TYPE_BOUNDING_BOX,
           G_PARAM_READWRITE));
+
+  /**
+   * ChamplainMemphisRenderer:max-threads:
+   *
+   * The maximum number of tiles rendered at the same time, 0 to render one
+   * tile per processor core.
+   *
+   * Since: 0.12.22
+   */
+  g_object_class_install_property (object_class,
+      PROP_MAX_THREADS,
+      g_param_spec_uint ("max-threads",
+          "Max Threads",
+          "The maximum number of rendering threads",
+          0,
+          G_MAXINT,
+          0,
+          G_PARAM_READWRITE));
 }
 
 
@@ -255,10 +422,14 @@ champlain_memphis_renderer_init (ChamplainMemphisRenderer *renderer)
   memphis_rule_set_load_from_data (priv->rules, default_rules,
       strlen (default_rules), NULL);
 
-  priv->renderer = memphis_renderer_new_full (priv->rules, memphis_map_new ());
+  g_rw_lock_init (&priv->rules_lock);
+  g_mutex_init (&priv->lock);
+  priv->snapshot = map_snapshot_new (memphis_map_new (), NULL);
+  g_queue_init (&priv->idle_renderers);
 
+  priv->max_threads = 0;
   priv->thpool = g_thread_pool_new (memphis_worker_thread, renderer,
-        MAX_THREADS, FALSE, NULL);
+        g_get_num_processors (), FALSE, NULL);
 
   priv->bbox = NULL;
 }
@@ -281,20 +452,12 @@ champlain_memphis_renderer_new_full (guint tile_size)
 }
 
 
-/*
- * Transform ARGB (Cairo) to RGBA (GdkPixbuf). RGBA is actualy reversed in
- * memory, so the transformation is ARGB -> ABGR (i.e. swapping B and R)
- */
-static void
-argb_to_rgba (guchar *data,
-    guint size)
-{
-  guint32 *ptr;
-  guint32 *endptr = (guint32 *) data + size / 4;
-
-  for (ptr = (guint32 *) data; ptr < endptr; ptr++)
-    *ptr = (*ptr & 0xFF00FF00) ^ ((*ptr & 0xFF0000) >> 16) ^ ((*ptr & 0xFF) << 16);
-}
+/* cairo's premultiplied native endian ARGB in memory order */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define SURFACE_PIXEL_FORMAT COGL_PIXEL_FORMAT_BGRA_8888_PRE
+#else
+#define SURFACE_PIXEL_FORMAT COGL_PIXEL_FORMAT_ARGB_8888_PRE
+#endif
 
 
 static gboolean
@@ -303,15 +466,13 @@ tile_loaded_cb (gpointer worker_data)
   WorkerThreadData *data = (WorkerThreadData *) worker_data;
   ChamplainTile *tile = data->tile;
   cairo_surface_t *cst = data->cst;
+  GBytes *encoded = data->encoded;
   ChamplainRenderer *renderer = CHAMPLAIN_RENDERER (data->renderer);
-  gpointer ret_data = NULL;
-  guint ret_size = 0;
+  gconstpointer ret_data = NULL;
+  gsize ret_size = 0;
   gboolean ret_error = TRUE;
   ClutterActor *actor;
   guint size = data->size;
-  GdkPixbuf *pixbuf = NULL;
-  gchar *buffer = NULL;
-  gsize buffer_size;
   ClutterContent *content;
 
   g_slice_free (WorkerThreadData, data);
@@ -325,34 +486,23 @@ tile_loaded_cb (gpointer worker_data)
   if (!cst)
     goto finish;
 
-  /* modify directly the buffer of cairo surface - we don't use it any more
-     and we close the surface anyway */
-  argb_to_rgba (cairo_image_surface_get_data (cst),
-      cairo_image_surface_get_stride (cst) * cairo_image_surface_get_height (cst));
-  champlain_exportable_set_surface (CHAMPLAIN_EXPORTABLE (tile), cst);
-
-  pixbuf = gdk_pixbuf_new_from_data (cairo_image_surface_get_data (cst),
-        GDK_COLORSPACE_RGB, TRUE, 8, size, size,
-        cairo_image_surface_get_stride (cst), NULL, NULL);
-
-  if (!gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &buffer_size, "png", NULL, NULL))
-    goto finish;
-    
+  /* the surface is uploaded as it is, cairo's format is understood by the
+   * texture */
   content = clutter_image_new ();
   if (!clutter_image_set_data (CLUTTER_IMAGE (content),
-          gdk_pixbuf_get_pixels (pixbuf),
-          gdk_pixbuf_get_has_alpha (pixbuf)
-            ? COGL_PIXEL_FORMAT_RGBA_8888
-            : COGL_PIXEL_FORMAT_RGB_888,
-          gdk_pixbuf_get_width (pixbuf),
-          gdk_pixbuf_get_height (pixbuf),
-          gdk_pixbuf_get_rowstride (pixbuf),
+          cairo_image_surface_get_data (cst),
+          SURFACE_PIXEL_FORMAT,
+          cairo_image_surface_get_width (cst),
+          cairo_image_surface_get_height (cst),
+          cairo_image_surface_get_stride (cst),
           NULL))
     {
       g_object_unref (content);
       goto finish;
     }
 
+  champlain_exportable_set_surface (CHAMPLAIN_EXPORTABLE (tile), cst);
+
   actor = clutter_actor_new ();
   clutter_actor_set_size (actor, size, size);
   clutter_actor_set_content (actor, content);
@@ -360,41 +510,106 @@ tile_loaded_cb (gpointer worker_data)
 
   champlain_tile_set_content (tile, actor);
 
-  ret_data = buffer;
-  ret_size = buffer_size;
+  if (encoded)
+    ret_data = g_bytes_get_data (encoded, &ret_size);
   ret_error = FALSE;
 
 finish:
   if (tile)
-    g_signal_emit_by_name (tile, "render-complete", ret_data, ret_size, ret_error);
+    g_signal_emit_by_name (tile, "render-complete", ret_data, (guint) ret_size, ret_error);
 
-  if (pixbuf)
-    g_object_unref (pixbuf);
   if (cst)
     cairo_surface_destroy (cst);
+  if (encoded)
+    g_bytes_unref (encoded);
   g_object_unref (renderer);
   g_object_unref (tile);
-  g_free (buffer);
 
   return FALSE;
 }
 
 
+/* Takes an idle MemphisRenderer, or creates a new one, and points it at the
+ * current map data; MemphisRenderer isn't thread-safe, each worker needs its
+ * own */
+static WorkerRenderer *
+acquire_worker_renderer (ChamplainMemphisRenderer *renderer,
+    guint tile_size)
+{
+  ChamplainMemphisRendererPrivate *priv = renderer->priv;
+  WorkerRenderer *worker;
+  MapSnapshot *snapshot;
+
+  g_mutex_lock (&priv->lock);
+  worker = g_queue_pop_head (&priv->idle_renderers);
+  snapshot = g_atomic_rc_box_acquire (priv->snapshot);
+  g_mutex_unlock (&priv->lock);
+
+  if (!worker)
+    {
+      worker = g_slice_new0 (WorkerRenderer);
+      worker->renderer = memphis_renderer_new_full (priv->rules, snapshot->map);
+      worker->snapshot = snapshot;
+      worker->map = snapshot->map;
+    }
+  else if (worker->snapshot != snapshot)
+    {
+      memphis_renderer_set_map (worker->renderer, snapshot->map);
+      map_snapshot_unref (worker->snapshot);
+      worker->snapshot = snapshot;
+      worker->map = snapshot->map;
+    }
+  else
+    map_snapshot_unref (snapshot);
+
+  if (worker->tile_size != tile_size)
+    {
+      memphis_renderer_set_resolution (worker->renderer, tile_size);
+      worker->tile_size = tile_size;
+    }
+
+  return worker;
+}
+
+
+static void
+release_worker_renderer (ChamplainMemphisRenderer *renderer,
+    WorkerRenderer *worker)
+{
+  ChamplainMemphisRendererPrivate *priv = renderer->priv;
+
+  g_mutex_lock (&priv->lock);
+  g_queue_push_head (&priv->idle_renderers, worker);
+  g_mutex_unlock (&priv->lock);
+}
+
+
 static void
 memphis_worker_thread (gpointer worker_data,
     G_GNUC_UNUSED gpointer user_data)
 {
   WorkerThreadData *data = (WorkerThreadData *) worker_data;
   ChamplainMemphisRenderer *renderer = CHAMPLAIN_MEMPHIS_RENDERER (data->renderer);
-  gboolean has_data = TRUE;
+  ChamplainMemphisRendererPrivate *priv = renderer->priv;
+  WorkerRenderer *worker;
+  MemphisMap *map;
 
   data->cst = NULL;
+  data->encoded = NULL;
+
+  /* the workers only read the rules, they can draw side by side */
+  g_rw_lock_reader_lock (&priv->rules_lock);
 
-  g_rw_lock_reader_lock (&MemphisLock);
-  has_data = memphis_renderer_tile_has_data (renderer->priv->renderer, data->x, data->y, data->z);
-  g_rw_lock_reader_unlock (&MemphisLock);
+  worker = acquire_worker_renderer (renderer, data->size);
 
-  if (has_data)
+  map = map_snapshot_get_map (worker->snapshot, data->x, data->y, data->z);
+  if (worker->map != map)
+    {
+      memphis_renderer_set_map (worker->renderer, map);
+      worker->map = map;
+    }
+
+  if (memphis_renderer_tile_has_data (worker->renderer, data->x, data->y, data->z))
     {
       cairo_t *cr;
 
@@ -404,13 +619,19 @@ memphis_worker_thread (gpointer worker_data,
 
       DEBUG ("Draw Tile (%d, %d, %d)", data->x, data->y, data->z);
 
-      g_rw_lock_reader_lock (&MemphisLock);
-      memphis_renderer_draw_tile (renderer->priv->renderer, cr, data->x, data->y, data->z);
-      g_rw_lock_reader_unlock (&MemphisLock);
+      memphis_renderer_draw_tile (worker->renderer, cr, data->x, data->y, data->z);
 
       cairo_destroy (cr);
     }
 
+  release_worker_renderer (renderer, worker);
+
+  g_rw_lock_reader_unlock (&priv->rules_lock);
+
+  /* much cheaper than PNG, and out of the main thread */
+  if (data->cst && data->encode)
+    data->encoded = champlain_image_decoder_encode_surface (data->cst);
+
   clutter_threads_add_idle_full (CLUTTER_PRIORITY_REDRAW, tile_loaded_cb, data, NULL);
 }
 
@@ -436,6 +657,7 @@ render (ChamplainRenderer *renderer,
   data->size = priv->tile_size;
   data->tile = tile;
   data->renderer = renderer;
+  data->encode = champlain_tile_get_wants_data (tile);
 
   g_object_ref (tile);
   g_object_ref (renderer);
@@ -459,11 +681,16 @@ set_data (ChamplainRenderer *renderer,
 {
   ChamplainMemphisRendererPrivate *priv = CHAMPLAIN_MEMPHIS_RENDERER (renderer)->priv;
   ChamplainBoundingBox *bbox;
+  MapSnapshot *snapshot, *old_snapshot;
+  ChamplainMemphisIndex *index;
+  GQueue idle_renderers;
   GError *err = NULL;
 
   MemphisMap *map = memphis_map_new ();
 
+  g_mutex_lock (&memphis_load_lock);
   memphis_map_load_from_data (map, (gchar *)data, size, &err);
+  g_mutex_unlock (&memphis_load_lock);
 
   DEBUG ("BBox data received");
 
@@ -475,14 +702,32 @@ set_data (ChamplainRenderer *renderer,
       return;
     }
 
-  g_rw_lock_writer_lock (&MemphisLock);
-  memphis_renderer_set_map (priv->renderer, map);
-  g_rw_lock_writer_unlock (&MemphisLock);
+  /* without the index, all the tiles are drawn from the whole map */
+  index = champlain_memphis_index_new ((const gchar *) data, size, INDEX_ZOOM_LEVEL, &err);
+  if (!index)
+    {
+      DEBUG ("Can't index map data: %s", err->message);
+      g_clear_error (&err);
+    }
 
-  bbox = champlain_bounding_box_new ();
+  snapshot = map_snapshot_new (map, index);
 
+  bbox = champlain_bounding_box_new ();
   memphis_map_get_bounding_box (map, &bbox->bottom, &bbox->left, &bbox->top,
       &bbox->right);
+
+  /* tiles being drawn keep the old map until they are done, the idle
+   * renderers are dropped so that it is freed as soon as possible */
+  g_mutex_lock (&priv->lock);
+  old_snapshot = priv->snapshot;
+  priv->snapshot = snapshot;
+  idle_renderers = priv->idle_renderers;
+  g_queue_init (&priv->idle_renderers);
+  g_mutex_unlock (&priv->lock);
+
+  g_queue_clear_full (&idle_renderers, (GDestroyNotify) worker_renderer_free);
+  map_snapshot_unref (old_snapshot);
+
   g_object_set (G_OBJECT (renderer), "bounding-box", bbox, NULL);
   champlain_bounding_box_free (bbox);
 }
@@ -514,7 +759,7 @@ champlain_memphis_renderer_load_rules (
       return;
     }
 
-  g_rw_lock_writer_lock (&MemphisLock);
+  g_rw_lock_writer_lock (&priv->rules_lock);
   if (rules_path)
     {
       memphis_rule_set_load_from_file (priv->rules, rules_path, &err);
@@ -523,7 +768,7 @@ champlain_memphis_renderer_load_rules (
           g_critical ("Can't load rules file: \"%s\"", err->message);
           memphis_rule_set_load_from_data (priv->rules, default_rules,
               strlen (default_rules), NULL);
-          g_rw_lock_writer_unlock (&MemphisLock);
+          g_rw_lock_writer_unlock (&priv->rules_lock);
           g_error_free (err);
           return;
         }
@@ -532,7 +777,7 @@ champlain_memphis_renderer_load_rules (
     memphis_rule_set_load_from_data (priv->rules, default_rules,
         strlen (default_rules), NULL);
 
-  g_rw_lock_writer_unlock (&MemphisLock);
+  g_rw_lock_writer_unlock (&priv->rules_lock);
 }
 
 
@@ -556,9 +801,9 @@ champlain_memphis_renderer_get_background_color (
   ClutterColor color;
   guint8 r, b, g, a;
 
-  g_rw_lock_reader_lock (&MemphisLock);
+  g_rw_lock_reader_lock (&renderer->priv->rules_lock);
   memphis_rule_set_get_bg_color (renderer->priv->rules, &r, &g, &b, &a);
-  g_rw_lock_reader_unlock (&MemphisLock);
+  g_rw_lock_reader_unlock (&renderer->priv->rules_lock);
 
   color.red = r;
   color.green = g;
@@ -584,10 +829,10 @@ champlain_memphis_renderer_set_background_color (
 {
   g_return_if_fail (CHAMPLAIN_IS_MEMPHIS_RENDERER (renderer));
 
-  g_rw_lock_writer_lock (&MemphisLock);
+  g_rw_lock_writer_lock (&renderer->priv->rules_lock);
   memphis_rule_set_set_bg_color (renderer->priv->rules, color->red,
       color->green, color->blue, color->alpha);
-  g_rw_lock_writer_unlock (&MemphisLock);
+  g_rw_lock_writer_unlock (&renderer->priv->rules_lock);
 }
 
 
@@ -608,9 +853,9 @@ champlain_memphis_renderer_set_rule (ChamplainMemphisRenderer *renderer,
   g_return_if_fail (CHAMPLAIN_IS_MEMPHIS_RENDERER (renderer) &&
       MEMPHIS_RULE (rule));
 
-  g_rw_lock_writer_lock (&MemphisLock);
+  g_rw_lock_writer_lock (&renderer->priv->rules_lock);
   memphis_rule_set_set_rule (renderer->priv->rules, (MemphisRule *) rule);
-  g_rw_lock_writer_unlock (&MemphisLock);
+  g_rw_lock_writer_unlock (&renderer->priv->rules_lock);
 }
 
 
@@ -634,9 +879,9 @@ champlain_memphis_renderer_get_rule (ChamplainMemphisRenderer *renderer,
 
   MemphisRule *rule;
 
-  g_rw_lock_reader_lock (&MemphisLock);
+  g_rw_lock_reader_lock (&renderer->priv->rules_lock);
   rule = memphis_rule_set_get_rule (renderer->priv->rules, id);
-  g_rw_lock_reader_unlock (&MemphisLock);
+  g_rw_lock_reader_unlock (&renderer->priv->rules_lock);
 
   return (ChamplainMemphisRule *) rule;
 }
@@ -662,9 +907,9 @@ champlain_memphis_renderer_get_rule_ids (ChamplainMemphisRenderer *renderer)
 
   GList *list;
 
-  g_rw_lock_reader_lock (&MemphisLock);
+  g_rw_lock_reader_lock (&renderer->priv->rules_lock);
   list = memphis_rule_set_get_rule_ids (renderer->priv->rules);
-  g_rw_lock_reader_unlock (&MemphisLock);
+  g_rw_lock_reader_unlock (&renderer->priv->rules_lock);
 
   return list;
 }
@@ -686,9 +931,9 @@ champlain_memphis_renderer_remove_rule (
 {
   g_return_if_fail (CHAMPLAIN_IS_MEMPHIS_RENDERER (renderer));
 
-  g_rw_lock_writer_lock (&MemphisLock);
+  g_rw_lock_writer_lock (&renderer->priv->rules_lock);
   memphis_rule_set_remove_rule (renderer->priv->rules, id);
-  g_rw_lock_writer_unlock (&MemphisLock);
+  g_rw_lock_writer_unlock (&renderer->priv->rules_lock);
 }
 
 
@@ -707,14 +952,9 @@ champlain_memphis_renderer_set_tile_size (ChamplainMemphisRenderer *renderer,
 {
   g_return_if_fail (CHAMPLAIN_IS_MEMPHIS_RENDERER (renderer));
 
-  ChamplainMemphisRendererPrivate *priv = renderer->priv;
-
+  /* the workers pick the new size up with the next tile */
   renderer->priv->tile_size = size;
 
-  g_rw_lock_writer_lock (&MemphisLock);
-  memphis_renderer_set_resolution (priv->renderer, size);
-  g_rw_lock_writer_unlock (&MemphisLock);
-
   g_object_notify (G_OBJECT (renderer), "tile-size");
 }
 
@@ -770,3 +1010,49 @@ set_bounding_box (ChamplainMemphisRenderer *renderer, ChamplainBoundingBox *bbox
   priv->bbox = champlain_bounding_box_copy (bbox);
   g_object_notify (G_OBJECT (renderer), "bounding-box");
 }
+
+
+/**
+ * champlain_memphis_renderer_set_max_threads:
+ * @renderer: a #ChamplainMemphisRenderer
+ * @max_threads: the maximum number of rendering threads, 0 for one per
+ * processor core
+ *
+ * Sets the maximum number of tiles rendered at the same time.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_memphis_renderer_set_max_threads (ChamplainMemphisRenderer *renderer,
+    guint max_threads)
+{
+  g_return_if_fail (CHAMPLAIN_IS_MEMPHIS_RENDERER (renderer));
+
+  ChamplainMemphisRendererPrivate *priv = renderer->priv;
+
+  priv->max_threads = max_threads;
+  g_thread_pool_set_max_threads (priv->thpool,
+      max_threads > 0 ? max_threads : g_get_num_processors (), NULL);
+
+  g_object_notify (G_OBJECT (renderer), "max-threads");
+}
+
+
+/**
+ * champlain_memphis_renderer_get_max_threads:
+ * @renderer: a #ChamplainMemphisRenderer
+ *
+ * Gets the maximum number of tiles rendered at the same time.
+ *
+ * Returns: the maximum number of rendering threads, 0 for one per processor
+ * core
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_memphis_renderer_get_max_threads (ChamplainMemphisRenderer *renderer)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_MEMPHIS_RENDERER (renderer), 0);
+
+  return renderer->priv->max_threads;
+}
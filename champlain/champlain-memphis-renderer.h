@@ -185,6 +185,11 @@ void champlain_memphis_renderer_set_tile_size (ChamplainMemphisRenderer *rendere
 
 guint champlain_memphis_renderer_get_tile_size (ChamplainMemphisRenderer *renderer);
 
+void champlain_memphis_renderer_set_max_threads (ChamplainMemphisRenderer *renderer,
+    guint max_threads);
+
+guint champlain_memphis_renderer_get_max_threads (ChamplainMemphisRenderer *renderer);
+
 G_END_DECLS
 
 #endif /* _CHAMPLAIN_MEMPHIS_RENDERER */
@@ -35,6 +35,8 @@
 #include "champlain-debug.h"
 #include "champlain-bounding-box.h"
 #include "champlain-enum-types.h"
+#include "champlain-private.h"
+#include "champlain-tile-private.h"
 #include "champlain-version.h"
 #include "champlain-tile.h"
 
@@ -498,6 +500,9 @@ fill_tile (ChamplainMapSource *map_source,
 
       g_signal_connect (tile, "render-complete", G_CALLBACK (tile_rendered_cb), map_source);
 
+      /* the rendered data is only needed for the cache */
+      champlain_tile_set_wants_data (tile,
+          champlain_tile_source_get_cache (CHAMPLAIN_TILE_SOURCE (map_source)) != NULL);
       champlain_renderer_render (renderer, tile);
     }
   else if (CHAMPLAIN_IS_MAP_SOURCE (next_source))
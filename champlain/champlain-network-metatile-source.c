@@ -0,0 +1,1028 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION:champlain-network-metatile-source
+ * @short_description: A map source that downloads tiles in blocks from
+ * servers rendering arbitrary areas
+ *
+ * This map source requests a square block of N x N tiles, a metatile, from
+ * the server in a single request and slices the returned image into tiles
+ * locally. This suits WMS servers and other servers rendering arbitrary
+ * areas on demand: compared to one request per tile, the number of requests
+ * and the rendering overhead on the server drop considerably. All tiles of
+ * a metatile are stored in the tile cache, so panning around usually finds
+ * the neighbouring tiles cached already.
+ *
+ * The size of the block is set by #ChamplainNetworkMetatileSource:metatile-size,
+ * see champlain_network_metatile_source_set_uri_format() for the format of
+ * the request URI.
+ *
+ * Only the spherical mercator projection is supported.
+ */
+
+#include "champlain-network-metatile-source.h"
+
+#define DEBUG_FLAG CHAMPLAIN_DEBUG_LOADING
+#include "champlain-debug.h"
+#include "champlain-image-renderer.h"
+#include "champlain-private.h"
+#include "champlain-image-renderer-private.h"
+#include "champlain-image-decoder.h"
+#include "champlain-tile.h"
+#include "champlain-version.h"
+
+#include <math.h>
+#include <string.h>
+#include <libsoup/soup.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#define EARTH_RADIUS 6378137.0 /* meters, Equatorial radius */
+#define METATILE_SIZE_DEFAULT 4
+#define MAX_METATILE_SIZE 16
+
+enum
+{
+  PROP_0,
+  PROP_URI_FORMAT,
+  PROP_METATILE_SIZE,
+  PROP_USER_AGENT
+};
+
+struct _ChamplainNetworkMetatileSourcePrivate
+{
+  gchar *uri_format;
+  guint metatile_size;
+  SoupSession *soup_session;
+  /* "zoom/x/y@scale" of the top left tile -> Metatile being downloaded */
+  GHashTable *metatiles;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (ChamplainNetworkMetatileSource, champlain_network_metatile_source, CHAMPLAIN_TYPE_TILE_SOURCE)
+
+typedef struct
+{
+  ChamplainNetworkMetatileSource *source;
+  gchar *key;
+  guint zoom_level;
+  /* the top left tile */
+  guint x;
+  guint y;
+  /* tiles per side */
+  guint size;
+  guint tile_size;
+  /* the display scale the tiles are requested for */
+  guint scale_factor;
+  /* tiles waiting for the metatile */
+  GList *tiles;
+#ifdef CHAMPLAIN_LIBSOUP_3
+  SoupMessage *msg;
+#endif
+} Metatile;
+
+typedef struct
+{
+  GBytes *bytes;
+  guint size;
+  guint tile_size;
+} SliceData;
+
+typedef struct
+{
+  /* position within the metatile */
+  guint x;
+  guint y;
+  cairo_surface_t *surface;
+  gchar *data;
+  gsize size;
+} Piece;
+
+static void fill_tile (ChamplainMapSource *map_source,
+    ChamplainTile *tile);
+
+
+static void
+champlain_network_metatile_source_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  ChamplainNetworkMetatileSource *self = CHAMPLAIN_NETWORK_METATILE_SOURCE (object);
+  ChamplainNetworkMetatileSourcePrivate *priv = self->priv;
+
+  switch (property_id)
+    {
+    case PROP_URI_FORMAT:
+      g_value_set_string (value, priv->uri_format);
+      break;
+
+    case PROP_METATILE_SIZE:
+      g_value_set_uint (value, priv->metatile_size);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+champlain_network_metatile_source_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  ChamplainNetworkMetatileSource *self = CHAMPLAIN_NETWORK_METATILE_SOURCE (object);
+
+  switch (property_id)
+    {
+    case PROP_URI_FORMAT:
+      champlain_network_metatile_source_set_uri_format (self,
+          g_value_get_string (value));
+      break;
+
+    case PROP_METATILE_SIZE:
+      champlain_network_metatile_source_set_metatile_size (self,
+          g_value_get_uint (value));
+      break;
+
+    case PROP_USER_AGENT:
+      champlain_network_metatile_source_set_user_agent (self,
+          g_value_get_string (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+champlain_network_metatile_source_dispose (GObject *object)
+{
+  ChamplainNetworkMetatileSourcePrivate *priv = CHAMPLAIN_NETWORK_METATILE_SOURCE (object)->priv;
+
+  if (priv->soup_session)
+    {
+      soup_session_abort (priv->soup_session);
+      g_object_unref (priv->soup_session);
+      priv->soup_session = NULL;
+    }
+
+  G_OBJECT_CLASS (champlain_network_metatile_source_parent_class)->dispose (object);
+}
+
+
+static void
+champlain_network_metatile_source_finalize (GObject *object)
+{
+  ChamplainNetworkMetatileSourcePrivate *priv = CHAMPLAIN_NETWORK_METATILE_SOURCE (object)->priv;
+
+  g_free (priv->uri_format);
+  g_hash_table_destroy (priv->metatiles);
+
+  G_OBJECT_CLASS (champlain_network_metatile_source_parent_class)->finalize (object);
+}
+
+
+static void
+champlain_network_metatile_source_class_init (ChamplainNetworkMetatileSourceClass *klass)
+{
+  ChamplainMapSourceClass *map_source_class = CHAMPLAIN_MAP_SOURCE_CLASS (klass);
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GParamSpec *pspec;
+
+  object_class->finalize = champlain_network_metatile_source_finalize;
+  object_class->dispose = champlain_network_metatile_source_dispose;
+  object_class->get_property = champlain_network_metatile_source_get_property;
+  object_class->set_property = champlain_network_metatile_source_set_property;
+
+  map_source_class->fill_tile = fill_tile;
+
+  /**
+   * ChamplainNetworkMetatileSource:uri-format:
+   *
+   * The uri format of the metatile requests, see
+   * champlain_network_metatile_source_set_uri_format()
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_string ("uri-format",
+        "URI Format",
+        "The URI format",
+        "",
+        (G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+  g_object_class_install_property (object_class, PROP_URI_FORMAT, pspec);
+
+  /**
+   * ChamplainNetworkMetatileSource:metatile-size:
+   *
+   * The number of tiles on each side of the block requested from the
+   * server. Larger metatiles mean fewer requests, but each request takes
+   * longer and may fetch tiles that are never displayed.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint ("metatile-size",
+        "Metatile Size",
+        "The number of tiles on each side of a metatile",
+        1,
+        MAX_METATILE_SIZE,
+        METATILE_SIZE_DEFAULT,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_METATILE_SIZE, pspec);
+
+  /**
+   * ChamplainNetworkMetatileSource:user-agent:
+   *
+   * The HTTP user agent used for requests
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_string ("user-agent",
+        "HTTP User Agent",
+        "The HTTP user agent used for network requests",
+        "libchamplain/" CHAMPLAIN_VERSION_S,
+        G_PARAM_WRITABLE);
+  g_object_class_install_property (object_class, PROP_USER_AGENT, pspec);
+}
+
+
+static void
+champlain_network_metatile_source_init (ChamplainNetworkMetatileSource *self)
+{
+  ChamplainNetworkMetatileSourcePrivate *priv = champlain_network_metatile_source_get_instance_private (self);
+
+  self->priv = priv;
+
+  priv->uri_format = NULL;
+  priv->metatile_size = METATILE_SIZE_DEFAULT;
+  priv->metatiles = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* rendering an area is expensive for the server, keep the number of
+   * parallel requests low */
+#ifdef CHAMPLAIN_LIBSOUP_3
+  priv->soup_session = soup_session_new_with_options (
+      "user-agent", "libchamplain/" CHAMPLAIN_VERSION_S,
+      "max-conns-per-host", 2,
+      NULL);
+#else
+  priv->soup_session = soup_session_new_with_options (
+        "proxy-uri", NULL,
+        "ssl-strict", FALSE,
+        SOUP_SESSION_ADD_FEATURE_BY_TYPE,
+        SOUP_TYPE_PROXY_RESOLVER_DEFAULT,
+        SOUP_SESSION_ADD_FEATURE_BY_TYPE,
+        SOUP_TYPE_CONTENT_DECODER,
+        NULL);
+  g_object_set (G_OBJECT (priv->soup_session),
+      "user-agent",
+      "libchamplain/" CHAMPLAIN_VERSION_S,
+      "max-conns-per-host", 2,
+      NULL);
+#endif
+}
+
+
+/**
+ * champlain_network_metatile_source_new_full:
+ * @id: the map source's id
+ * @name: the map source's name
+ * @license: the map source's license
+ * @license_uri: the map source's license URI
+ * @min_zoom: the map source's minimum zoom level
+ * @max_zoom: the map source's maximum zoom level
+ * @tile_size: the map source's tile size (in pixels)
+ * @projection: the map source's projection
+ * @uri_format: the URI to fetch the metatiles from, see #champlain_network_metatile_source_set_uri_format
+ * @renderer: the #ChamplainRenderer used to render tiles
+ *
+ * Constructor of #ChamplainNetworkMetatileSource.
+ *
+ * Returns: a constructed #ChamplainNetworkMetatileSource object
+ *
+ * Since: 0.12.22
+ */
+ChamplainNetworkMetatileSource *
+champlain_network_metatile_source_new_full (const gchar *id,
+    const gchar *name,
+    const gchar *license,
+    const gchar *license_uri,
+    guint min_zoom,
+    guint max_zoom,
+    guint tile_size,
+    ChamplainMapProjection projection,
+    const gchar *uri_format,
+    ChamplainRenderer *renderer)
+{
+  ChamplainNetworkMetatileSource *source;
+
+  source = g_object_new (CHAMPLAIN_TYPE_NETWORK_METATILE_SOURCE,
+        "id", id,
+        "name", name,
+        "license", license,
+        "license-uri", license_uri,
+        "min-zoom-level", min_zoom,
+        "max-zoom-level", max_zoom,
+        "tile-size", tile_size,
+        "projection", projection,
+        "uri-format", uri_format,
+        "renderer", renderer,
+        NULL);
+  return source;
+}
+
+
+/**
+ * champlain_network_metatile_source_get_uri_format:
+ * @metatile_source: the #ChamplainNetworkMetatileSource
+ *
+ * Gets the URI format of the metatile requests.
+ *
+ * Returns: A URI format used for metatile requests.
+ *
+ * Since: 0.12.22
+ */
+const gchar *
+champlain_network_metatile_source_get_uri_format (ChamplainNetworkMetatileSource *metatile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_METATILE_SOURCE (metatile_source), NULL);
+
+  return metatile_source->priv->uri_format;
+}
+
+
+/**
+ * champlain_network_metatile_source_set_uri_format:
+ * @metatile_source: the #ChamplainNetworkMetatileSource
+ * @uri_format: the URI format
+ *
+ * A URI format is a URI where the area to render has been replaced by
+ * tokens:
+ *
+ * - {bbox}: the bounding box of the metatile in EPSG:3857 meters, formatted
+ *   as "minx,miny,maxx,maxy"
+ * - {width}: the width of the metatile in pixels
+ * - {height}: the height of the metatile in pixels
+ * - {z}: the zoom level
+ * - {x}: the x coordinate of the top left tile of the metatile
+ * - {y}: the y coordinate of the top left tile of the metatile
+ *
+ * A WMS server is typically used with a URI format like
+ * "https://example.com/wms?SERVICE=WMS&amp;VERSION=1.3.0&amp;REQUEST=GetMap&amp;LAYERS=roads&amp;STYLES=&amp;CRS=EPSG:3857&amp;BBOX={bbox}&amp;WIDTH={width}&amp;HEIGHT={height}&amp;FORMAT=image/png".
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_metatile_source_set_uri_format (ChamplainNetworkMetatileSource *metatile_source,
+    const gchar *uri_format)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_METATILE_SOURCE (metatile_source));
+
+  ChamplainNetworkMetatileSourcePrivate *priv = metatile_source->priv;
+
+  g_free (priv->uri_format);
+  priv->uri_format = g_strdup (uri_format);
+
+  g_object_notify (G_OBJECT (metatile_source), "uri-format");
+}
+
+
+/**
+ * champlain_network_metatile_source_get_metatile_size:
+ * @metatile_source: the #ChamplainNetworkMetatileSource
+ *
+ * Gets the number of tiles on each side of the requested metatiles.
+ *
+ * Returns: the metatile size.
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_network_metatile_source_get_metatile_size (ChamplainNetworkMetatileSource *metatile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_METATILE_SOURCE (metatile_source), 0);
+
+  return metatile_source->priv->metatile_size;
+}
+
+
+/**
+ * champlain_network_metatile_source_set_metatile_size:
+ * @metatile_source: the #ChamplainNetworkMetatileSource
+ * @metatile_size: the number of tiles on each side of a metatile
+ *
+ * Sets the number of tiles on each side of the requested metatiles. At
+ * zoom levels having fewer tiles than that, the whole world is requested
+ * at once.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_metatile_source_set_metatile_size (ChamplainNetworkMetatileSource *metatile_source,
+    guint metatile_size)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_METATILE_SOURCE (metatile_source));
+  g_return_if_fail (metatile_size >= 1 && metatile_size <= MAX_METATILE_SIZE);
+
+  metatile_source->priv->metatile_size = metatile_size;
+
+  g_object_notify (G_OBJECT (metatile_source), "metatile-size");
+}
+
+
+/**
+ * champlain_network_metatile_source_set_user_agent:
+ * @metatile_source: a #ChamplainNetworkMetatileSource
+ * @user_agent: A User-Agent string
+ *
+ * Sets the User-Agent header used communicating with the server.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_metatile_source_set_user_agent (ChamplainNetworkMetatileSource *metatile_source,
+    const gchar *user_agent)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_METATILE_SOURCE (metatile_source)
+      && user_agent != NULL);
+
+  ChamplainNetworkMetatileSourcePrivate *priv = metatile_source->priv;
+
+  if (priv->soup_session)
+    g_object_set (G_OBJECT (priv->soup_session), "user-agent",
+        user_agent, NULL);
+}
+
+
+static void
+append_coordinate (GString *string,
+    gdouble value)
+{
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append (string, g_ascii_formatd (buffer, sizeof (buffer), "%.6f", value));
+}
+
+
+static gchar *
+get_metatile_uri (ChamplainNetworkMetatileSource *self,
+    Metatile *metatile)
+{
+  ChamplainNetworkMetatileSourcePrivate *priv = self->priv;
+  GString *uri;
+  const gchar *p;
+  gdouble extent, span, minx, maxy;
+
+  /* size of the tiles in meters at this zoom level */
+  extent = 2.0 * M_PI * EARTH_RADIUS;
+  span = extent / (gdouble) ((guint64) 1 << metatile->zoom_level);
+  minx = -extent / 2.0 + metatile->x * span;
+  maxy = extent / 2.0 - metatile->y * span;
+
+  uri = g_string_new (NULL);
+  p = priv->uri_format;
+  while (*p != '\0')
+    {
+      if (g_str_has_prefix (p, "{bbox}"))
+        {
+          append_coordinate (uri, minx);
+          g_string_append_c (uri, ',');
+          append_coordinate (uri, maxy - metatile->size * span);
+          g_string_append_c (uri, ',');
+          append_coordinate (uri, minx + metatile->size * span);
+          g_string_append_c (uri, ',');
+          append_coordinate (uri, maxy);
+          p += strlen ("{bbox}");
+        }
+      else if (g_str_has_prefix (p, "{width}"))
+        {
+          g_string_append_printf (uri, "%u",
+              metatile->size * metatile->tile_size * metatile->scale_factor);
+          p += strlen ("{width}");
+        }
+      else if (g_str_has_prefix (p, "{height}"))
+        {
+          g_string_append_printf (uri, "%u",
+              metatile->size * metatile->tile_size * metatile->scale_factor);
+          p += strlen ("{height}");
+        }
+      else if (g_str_has_prefix (p, "{z}"))
+        {
+          g_string_append_printf (uri, "%u", metatile->zoom_level);
+          p += strlen ("{z}");
+        }
+      else if (g_str_has_prefix (p, "{x}"))
+        {
+          g_string_append_printf (uri, "%u", metatile->x);
+          p += strlen ("{x}");
+        }
+      else if (g_str_has_prefix (p, "{y}"))
+        {
+          g_string_append_printf (uri, "%u", metatile->y);
+          p += strlen ("{y}");
+        }
+      else
+        g_string_append_c (uri, *p++);
+    }
+
+  return g_string_free (uri, FALSE);
+}
+
+
+static void
+metatile_free (Metatile *metatile)
+{
+  g_list_free_full (metatile->tiles, g_object_unref);
+#ifdef CHAMPLAIN_LIBSOUP_3
+  g_clear_object (&metatile->msg);
+#endif
+  g_object_unref (metatile->source);
+  g_free (metatile->key);
+  g_slice_free (Metatile, metatile);
+}
+
+
+static void
+metatile_done (Metatile *metatile)
+{
+  ChamplainNetworkMetatileSourcePrivate *priv = metatile->source->priv;
+
+  g_hash_table_remove (priv->metatiles, metatile->key);
+  metatile_free (metatile);
+}
+
+
+/* Hands the tiles waiting for a metatile which couldn't be loaded to the
+ * next source */
+static void
+metatile_failed (Metatile *metatile)
+{
+  ChamplainMapSource *next_source;
+  GList *iter;
+
+  next_source = champlain_map_source_get_next_source (CHAMPLAIN_MAP_SOURCE (metatile->source));
+
+  for (iter = metatile->tiles; iter; iter = iter->next)
+    {
+      ChamplainTile *tile = iter->data;
+
+      if (next_source && champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+        champlain_map_source_fill_tile (next_source, tile);
+    }
+
+  metatile_done (metatile);
+}
+
+
+static void
+slice_data_free (SliceData *data)
+{
+  g_bytes_unref (data->bytes);
+  g_slice_free (SliceData, data);
+}
+
+
+static void
+piece_free (Piece *piece)
+{
+  if (piece->surface)
+    cairo_surface_destroy (piece->surface);
+  g_free (piece->data);
+  g_slice_free (Piece, piece);
+}
+
+
+static void
+slice_metatile_thread (GTask *task,
+    G_GNUC_UNUSED gpointer source_object,
+    gpointer task_data,
+    GCancellable *cancellable)
+{
+  SliceData *data = task_data;
+  GdkPixbufLoader *loader;
+  GdkPixbufFormat *format;
+  GdkPixbuf *pixbuf;
+  GPtrArray *pieces;
+  GError *error = NULL;
+  const guint8 *contents;
+  gsize length;
+  gchar *format_name;
+  guint expected, x, y;
+
+  contents = g_bytes_get_data (data->bytes, &length);
+
+  loader = gdk_pixbuf_loader_new ();
+  if (!gdk_pixbuf_loader_write (loader, contents, length, &error))
+    {
+      gdk_pixbuf_loader_close (loader, NULL);
+      g_object_unref (loader);
+      g_task_return_error (task, error);
+      return;
+    }
+  if (!gdk_pixbuf_loader_close (loader, &error))
+    {
+      g_object_unref (loader);
+      g_task_return_error (task, error);
+      return;
+    }
+
+  pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+  format = gdk_pixbuf_loader_get_format (loader);
+  format_name = format ? gdk_pixbuf_format_get_name (format) : NULL;
+  g_object_unref (loader);
+
+  expected = data->size * data->tile_size;
+  if ((guint) gdk_pixbuf_get_width (pixbuf) != expected ||
+      (guint) gdk_pixbuf_get_height (pixbuf) != expected)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "Metatile is %dx%d pixels instead of %ux%u",
+          gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf),
+          expected, expected);
+      g_object_unref (pixbuf);
+      g_free (format_name);
+      return;
+    }
+
+  /* keep lossy images lossy, the tiles would get much bigger as PNG */
+  if (g_strcmp0 (format_name, "jpeg") != 0)
+    {
+      g_free (format_name);
+      format_name = g_strdup ("png");
+    }
+
+  pieces = g_ptr_array_new_with_free_func ((GDestroyNotify) piece_free);
+  for (y = 0; y < data->size; y++)
+    {
+      for (x = 0; x < data->size; x++)
+        {
+          Piece *piece;
+          GdkPixbuf *sub_pixbuf;
+          gboolean saved;
+
+          if (g_cancellable_is_cancelled (cancellable))
+            break;
+
+          sub_pixbuf = gdk_pixbuf_new_subpixbuf (pixbuf,
+                x * data->tile_size, y * data->tile_size,
+                data->tile_size, data->tile_size);
+
+          piece = g_slice_new0 (Piece);
+          piece->x = x;
+          piece->y = y;
+
+          if (g_strcmp0 (format_name, "jpeg") == 0)
+            saved = gdk_pixbuf_save_to_buffer (sub_pixbuf, &piece->data, &piece->size,
+                  "jpeg", &error, "quality", "90", NULL);
+          else
+            saved = gdk_pixbuf_save_to_buffer (sub_pixbuf, &piece->data, &piece->size,
+                  "png", &error, NULL);
+
+          /* converted here, the main thread only hands it over to clutter */
+          if (saved)
+            piece->surface = champlain_image_decoder_surface_from_pixbuf (sub_pixbuf, &error);
+          g_object_unref (sub_pixbuf);
+
+          if (!saved || !piece->surface)
+            {
+              piece_free (piece);
+              g_ptr_array_unref (pieces);
+              g_object_unref (pixbuf);
+              g_free (format_name);
+              g_task_return_error (task, error);
+              return;
+            }
+
+          g_ptr_array_add (pieces, piece);
+        }
+    }
+
+  g_object_unref (pixbuf);
+  g_free (format_name);
+
+  g_task_return_pointer (task, pieces, (GDestroyNotify) g_ptr_array_unref);
+}
+
+
+static void
+tile_rendered_cb (ChamplainTile *tile,
+    gpointer data,
+    guint size,
+    gboolean error,
+    ChamplainMapSource *map_source)
+{
+  ChamplainMapSource *next_source;
+
+  g_signal_handlers_disconnect_by_func (tile, tile_rendered_cb, map_source);
+
+  next_source = champlain_map_source_get_next_source (map_source);
+
+  if (!error)
+    {
+      ChamplainTileSource *tile_source = CHAMPLAIN_TILE_SOURCE (map_source);
+      ChamplainTileCache *tile_cache = champlain_tile_source_get_cache (tile_source);
+
+      if (tile_cache && data)
+        champlain_tile_cache_store_tile (tile_cache, tile, data, size);
+
+      champlain_tile_set_fade_in (tile, TRUE);
+      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+      champlain_tile_display_content (tile);
+    }
+  else if (next_source)
+    champlain_map_source_fill_tile (next_source, tile);
+
+  g_object_unref (map_source);
+  g_object_unref (tile);
+}
+
+
+static ChamplainTile *
+steal_waiting_tile (Metatile *metatile,
+    Piece *piece)
+{
+  GList *iter;
+
+  for (iter = metatile->tiles; iter; iter = iter->next)
+    {
+      ChamplainTile *tile = iter->data;
+
+      if (champlain_tile_get_x (tile) == metatile->x + piece->x &&
+          champlain_tile_get_y (tile) == metatile->y + piece->y)
+        {
+          metatile->tiles = g_list_delete_link (metatile->tiles, iter);
+          return tile;
+        }
+    }
+
+  return NULL;
+}
+
+
+static void
+metatile_sliced_cb (GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (source_object);
+  ChamplainTileCache *tile_cache;
+  ChamplainRenderer *renderer;
+  Metatile *metatile = user_data;
+  GPtrArray *pieces;
+  GError *error = NULL;
+  guint i;
+
+  pieces = g_task_propagate_pointer (G_TASK (res), &error);
+  if (!pieces)
+    {
+      DEBUG ("Unable to slice metatile %s: %s", metatile->key, error->message);
+      g_error_free (error);
+      metatile_failed (metatile);
+      return;
+    }
+
+  tile_cache = champlain_tile_source_get_cache (CHAMPLAIN_TILE_SOURCE (map_source));
+  renderer = champlain_map_source_get_renderer (map_source);
+
+  for (i = 0; i < pieces->len; i++)
+    {
+      Piece *piece = g_ptr_array_index (pieces, i);
+      ChamplainTile *tile = steal_waiting_tile (metatile, piece);
+
+      if (tile && champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+        {
+          /* the reference taken when the tile started waiting is passed on
+           * to tile_rendered_cb() */
+          g_signal_connect (tile, "render-complete", G_CALLBACK (tile_rendered_cb),
+              g_object_ref (map_source));
+
+          if (CHAMPLAIN_IS_IMAGE_RENDERER (renderer))
+            champlain_image_renderer_render_surface (CHAMPLAIN_IMAGE_RENDERER (renderer),
+                tile, piece->surface, (const guint8 *) piece->data, piece->size);
+          else
+            {
+              champlain_renderer_set_data (renderer, (const guint8 *) piece->data, piece->size);
+              champlain_renderer_render (renderer, tile);
+            }
+        }
+      else
+        {
+          /* nobody is waiting for this one, only remember it for later */
+          if (tile_cache)
+            {
+              ChamplainTile *cached_tile;
+
+              cached_tile = champlain_tile_new_full (metatile->x + piece->x,
+                    metatile->y + piece->y, metatile->tile_size, metatile->zoom_level);
+              g_object_ref_sink (cached_tile);
+              champlain_tile_set_scale_factor (cached_tile, metatile->scale_factor);
+              champlain_tile_cache_store_tile (tile_cache, cached_tile, piece->data, piece->size);
+              g_object_unref (cached_tile);
+            }
+
+          if (tile)
+            g_object_unref (tile);
+        }
+    }
+
+  g_ptr_array_unref (pieces);
+
+  /* tiles still waiting weren't part of the metatile, which can't really
+   * happen, don't leave them empty anyway */
+  metatile_failed (metatile);
+}
+
+
+static void
+slice_metatile (Metatile *metatile,
+    GBytes *bytes)
+{
+  SliceData *data;
+  GTask *task;
+
+  data = g_slice_new (SliceData);
+  data->bytes = bytes;
+  data->size = metatile->size;
+  data->tile_size = metatile->tile_size * metatile->scale_factor;
+
+  task = g_task_new (metatile->source, NULL, metatile_sliced_cb, metatile);
+  g_task_set_task_data (task, data, (GDestroyNotify) slice_data_free);
+  g_task_run_in_thread (task, slice_metatile_thread);
+  g_object_unref (task);
+}
+
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+static void
+metatile_loaded_cb (GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  Metatile *metatile = user_data;
+  GError *error = NULL;
+  GBytes *bytes;
+
+  bytes = soup_session_send_and_read_finish (SOUP_SESSION (source_object), res, &error);
+  if (error != NULL)
+    {
+      DEBUG ("Unable to download metatile %s: %s", metatile->key, error->message);
+      g_error_free (error);
+      metatile_failed (metatile);
+      return;
+    }
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (soup_message_get_status (metatile->msg)))
+    {
+      DEBUG ("Unable to download metatile %s: %s", metatile->key,
+          soup_message_get_reason_phrase (metatile->msg));
+      g_bytes_unref (bytes);
+      metatile_failed (metatile);
+      return;
+    }
+
+  slice_metatile (metatile, bytes);
+}
+#else
+static void
+metatile_loaded_cb (G_GNUC_UNUSED SoupSession *session,
+    SoupMessage *msg,
+    gpointer user_data)
+{
+  Metatile *metatile = user_data;
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+    {
+      DEBUG ("Unable to download metatile %s: %s", metatile->key,
+          soup_status_get_phrase (msg->status_code));
+      metatile_failed (metatile);
+      return;
+    }
+
+  slice_metatile (metatile, g_bytes_new (msg->response_body->data,
+        msg->response_body->length));
+}
+#endif
+
+
+/* Requests the metatile containing the given tile; @tile, if not %NULL, is
+ * rendered once the metatile arrives */
+static void
+request_metatile (ChamplainNetworkMetatileSource *self,
+    guint zoom_level,
+    guint x,
+    guint y,
+    guint scale_factor,
+    ChamplainTile *tile)
+{
+  ChamplainNetworkMetatileSourcePrivate *priv = self->priv;
+  Metatile *metatile;
+  SoupMessage *msg;
+  gchar *key, *uri;
+  guint size;
+
+  size = priv->metatile_size;
+  if (zoom_level < 31)
+    size = MIN (size, 1u << zoom_level);
+  x = x / size * size;
+  y = y / size * size;
+
+  key = g_strdup_printf ("%u/%u/%u@%ux", zoom_level, x, y, scale_factor);
+  metatile = g_hash_table_lookup (priv->metatiles, key);
+  if (metatile)
+    {
+      g_free (key);
+      if (tile)
+        metatile->tiles = g_list_prepend (metatile->tiles, g_object_ref (tile));
+      return;
+    }
+
+  metatile = g_slice_new0 (Metatile);
+  metatile->source = g_object_ref (self);
+  metatile->key = key;
+  metatile->zoom_level = zoom_level;
+  metatile->x = x;
+  metatile->y = y;
+  metatile->size = size;
+  metatile->tile_size = champlain_map_source_get_tile_size (CHAMPLAIN_MAP_SOURCE (self));
+  metatile->scale_factor = scale_factor;
+  if (tile)
+    metatile->tiles = g_list_prepend (NULL, g_object_ref (tile));
+  g_hash_table_insert (priv->metatiles, metatile->key, metatile);
+
+  uri = get_metatile_uri (self, metatile);
+  msg = soup_message_new (SOUP_METHOD_GET, uri);
+  if (!msg)
+    {
+      DEBUG ("Invalid metatile URI: '%s'", uri);
+      g_free (uri);
+      metatile_failed (metatile);
+      return;
+    }
+
+  DEBUG ("Request metatile: '%s'", uri);
+  g_free (uri);
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+  metatile->msg = msg;
+  soup_session_send_and_read_async (priv->soup_session, msg, G_PRIORITY_DEFAULT_IDLE,
+      NULL, metatile_loaded_cb, metatile);
+#else
+  soup_session_queue_message (priv->soup_session, msg, metatile_loaded_cb, metatile);
+#endif
+}
+
+
+static void
+fill_tile (ChamplainMapSource *map_source,
+    ChamplainTile *tile)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_METATILE_SOURCE (map_source));
+  g_return_if_fail (CHAMPLAIN_IS_TILE (tile));
+
+  ChamplainNetworkMetatileSource *self = CHAMPLAIN_NETWORK_METATILE_SOURCE (map_source);
+  ChamplainNetworkMetatileSourcePrivate *priv = self->priv;
+  ChamplainMapSource *next_source = champlain_map_source_get_next_source (map_source);
+
+  if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_DONE)
+    return;
+
+  if (!priv->uri_format || *priv->uri_format == '\0' || !priv->soup_session)
+    {
+      if (CHAMPLAIN_IS_MAP_SOURCE (next_source))
+        champlain_map_source_fill_tile (next_source, tile);
+      return;
+    }
+
+  if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_LOADED)
+    {
+      /* Area requests can't be validated against the cached tiles. Show the
+       * expired tile right away and refresh the cache in the background. */
+      request_metatile (self, champlain_tile_get_zoom_level (tile),
+          champlain_tile_get_x (tile), champlain_tile_get_y (tile),
+          champlain_tile_get_scale_factor (tile), NULL);
+
+      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+      champlain_tile_display_content (tile);
+      return;
+    }
+
+  request_metatile (self, champlain_tile_get_zoom_level (tile),
+      champlain_tile_get_x (tile), champlain_tile_get_y (tile),
+      champlain_tile_get_scale_factor (tile), tile);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#if !defined (__CHAMPLAIN_CHAMPLAIN_H_INSIDE__) && !defined (CHAMPLAIN_COMPILATION)
+#error "Only <champlain/champlain.h> can be included directly."
+#endif
+
+#ifndef _CHAMPLAIN_NETWORK_METATILE_SOURCE_H_
+#define _CHAMPLAIN_NETWORK_METATILE_SOURCE_H_
+
+#include <champlain/champlain-defines.h>
+#include <champlain/champlain-tile-source.h>
+
+G_BEGIN_DECLS
+
+#define CHAMPLAIN_TYPE_NETWORK_METATILE_SOURCE champlain_network_metatile_source_get_type ()
+
+#define CHAMPLAIN_NETWORK_METATILE_SOURCE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CHAMPLAIN_TYPE_NETWORK_METATILE_SOURCE, ChamplainNetworkMetatileSource))
+
+#define CHAMPLAIN_NETWORK_METATILE_SOURCE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), CHAMPLAIN_TYPE_NETWORK_METATILE_SOURCE, ChamplainNetworkMetatileSourceClass))
+
+#define CHAMPLAIN_IS_NETWORK_METATILE_SOURCE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CHAMPLAIN_TYPE_NETWORK_METATILE_SOURCE))
+
+#define CHAMPLAIN_IS_NETWORK_METATILE_SOURCE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), CHAMPLAIN_TYPE_NETWORK_METATILE_SOURCE))
+
+#define CHAMPLAIN_NETWORK_METATILE_SOURCE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), CHAMPLAIN_TYPE_NETWORK_METATILE_SOURCE, ChamplainNetworkMetatileSourceClass))
+
+typedef struct _ChamplainNetworkMetatileSourcePrivate ChamplainNetworkMetatileSourcePrivate;
+
+typedef struct _ChamplainNetworkMetatileSource ChamplainNetworkMetatileSource;
+typedef struct _ChamplainNetworkMetatileSourceClass ChamplainNetworkMetatileSourceClass;
+
+/**
+ * ChamplainNetworkMetatileSource:
+ *
+ * The #ChamplainNetworkMetatileSource structure contains only private data
+ * and should be accessed using the provided API
+ *
+ * Since: 0.12.22
+ */
+struct _ChamplainNetworkMetatileSource
+{
+  ChamplainTileSource parent_instance;
+
+  ChamplainNetworkMetatileSourcePrivate *priv;
+};
+
+struct _ChamplainNetworkMetatileSourceClass
+{
+  ChamplainTileSourceClass parent_class;
+};
+
+GType champlain_network_metatile_source_get_type (void);
+
+ChamplainNetworkMetatileSource *champlain_network_metatile_source_new_full (const gchar *id,
+    const gchar *name,
+    const gchar *license,
+    const gchar *license_uri,
+    guint min_zoom,
+    guint max_zoom,
+    guint tile_size,
+    ChamplainMapProjection projection,
+    const gchar *uri_format,
+    ChamplainRenderer *renderer);
+
+const gchar *champlain_network_metatile_source_get_uri_format (ChamplainNetworkMetatileSource *metatile_source);
+void champlain_network_metatile_source_set_uri_format (ChamplainNetworkMetatileSource *metatile_source,
+    const gchar *uri_format);
+
+guint champlain_network_metatile_source_get_metatile_size (ChamplainNetworkMetatileSource *metatile_source);
+void champlain_network_metatile_source_set_metatile_size (ChamplainNetworkMetatileSource *metatile_source,
+    guint metatile_size);
+
+void champlain_network_metatile_source_set_user_agent (ChamplainNetworkMetatileSource *metatile_source,
+    const gchar *user_agent);
+
+G_END_DECLS
+
+#endif /* _CHAMPLAIN_NETWORK_METATILE_SOURCE_H_ */
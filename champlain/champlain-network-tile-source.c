@@ -29,6 +29,42 @@
  * Some preconfigured network map sources are built-in this library,
  * see #ChamplainMapSourceFactory.
  *
+ * Tile requests are queued by the source and sent in the order of their
+ * distance from the center of the view, so the tiles in the middle of the
+ * screen arrive first. Tiles with the same URI, such as the tiles of several
+ * views showing the same place, share a single download.
+ *
+ * When #ChamplainNetworkTileSource:adaptive-conns is set, the number of
+ * downloads running at the same time follows the network conditions: it grows
+ * while more connections bring more throughput without hurting the latency and
+ * is halved when the server answers with "429 Too Many Requests" or "503
+ * Service Unavailable". It always stays between
+ * #ChamplainNetworkTileSource:min-conns and
+ * #ChamplainNetworkTileSource:max-conns.
+ *
+ * Downloads failing because of network errors or server side problems are
+ * retried a few times after increasing, randomized delays, see
+ * #ChamplainNetworkTileSource:max-retries. A host failing repeatedly is
+ * considered down and gets no requests for a while; its tiles are shown as
+ * errors straight away. Once a download from the host succeeds again, the
+ * tiles still on screen showing an error are downloaded again.
+ *
+ * When built with libsoup 3, tiles rendered by a #ChamplainImageRenderer are
+ * decoded in worker threads while they are being downloaded. Except for JPEG
+ * images decoded with libjpeg, which takes them whole, the pieces are decoded
+ * as they arrive.
+ *
+ * Cached tiles which have expired are displayed right away and revalidated in
+ * the background, see champlain_network_tile_source_set_background_revalidation().
+ *
+ * The source counts its requests, received bytes, "304 Not Modified" answers
+ * and errors. Downloads can be limited to an average rate and to a total
+ * budget, see champlain_network_tile_source_set_rate_limit() and
+ * champlain_network_tile_source_set_data_budget().
+ *
+ * Connections to the tile servers are opened ahead of the first tiles, see
+ * champlain_network_tile_source_preconnect(). When the server speaks HTTP/2,
+ * several requests share each connection.
  */
 
 #include "config.h"
@@ -43,6 +79,9 @@
 #include "champlain-enum-types.h"
 #include "champlain-map-source.h"
 #include "champlain-private.h"
+#include "champlain-network-tile-source-private.h"
+#include "champlain-image-renderer-private.h"
+#include "champlain-image-decoder.h"
 
 #include <errno.h>
 #include <gio/gio.h>
@@ -51,6 +90,7 @@
 #include <glib-object.h>
 #include <libsoup/soup.h>
 #include <math.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <string.h>
 
@@ -61,16 +101,96 @@ enum
   PROP_OFFLINE,
   PROP_PROXY_URI,
   PROP_MAX_CONNS,
-  PROP_USER_AGENT
+  PROP_USER_AGENT,
+  PROP_SUBDOMAINS,
+  PROP_MIN_CONNS,
+  PROP_ADAPTIVE_CONNS,
+  PROP_MAX_RETRIES,
+  PROP_BACKGROUND_REVALIDATION,
+  PROP_RATE_LIMIT,
+  PROP_DATA_BUDGET,
+  PROP_REQUEST_COUNT,
+  PROP_BYTES_RECEIVED,
+  PROP_NOT_MODIFIED_COUNT,
+  PROP_ERROR_COUNT,
+  PROP_KEEP_ALIVE
 };
 
+typedef enum
+{
+  URI_PART_LITERAL,
+  URI_PART_X,
+  URI_PART_Y,
+  URI_PART_TMSY,
+  URI_PART_Z,
+  URI_PART_SUBDOMAIN,
+  URI_PART_QUADKEY,
+  URI_PART_SCALE
+} UriPartType;
+
+/* One piece of a parsed uri-format; literals point into the uri_format
+   string */
+typedef struct
+{
+  UriPartType type;
+  const gchar *literal;
+  gsize length;
+} UriPart;
+
 struct _ChamplainNetworkTileSourcePrivate
 {
   gboolean offline;
   gchar *uri_format;
+  GArray *uri_parts;
+  gchar **subdomains;
   gchar *proxy_uri;
   SoupSession *soup_session;
   gint max_conns;
+  gint min_conns;
+  gboolean adaptive_conns;
+
+  /* adaptive concurrency state */
+  gint current_conns;
+  gint64 window_start;
+  guint window_tiles;
+  guint64 window_bytes;
+  gboolean window_saturated;
+  gdouble last_throughput;
+  gdouble min_latency;
+  gdouble avg_latency;
+
+  gint max_retries;
+  GHashTable *hosts;
+
+  GHashTable *requests;
+  GQueue *queue;
+  /* requests in flight, each weighing the share of a connection it takes */
+  guint in_flight_load;
+  guint dispatch_source_id;
+
+  gboolean background_revalidation;
+  GQueue *revalidations;
+  guint n_revalidating;
+
+  /* token bucket of bytes, holding at most rate_limit of them */
+  guint rate_limit;
+  gdouble tokens;
+  gint64 tokens_time;
+  guint throttle_source_id;
+  guint64 data_budget;
+
+  guint keep_alive;
+  gint64 last_preconnect;
+
+  guint64 request_count;
+  guint64 bytes_received;
+  guint64 not_modified_count;
+  guint64 error_count;
+
+  gboolean has_focus;
+  guint focus_zoom;
+  gdouble focus_x;
+  gdouble focus_y;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (ChamplainNetworkTileSource, champlain_network_tile_source, CHAMPLAIN_TYPE_TILE_SOURCE)
@@ -80,30 +200,123 @@ G_DEFINE_TYPE_WITH_PRIVATE (ChamplainNetworkTileSource, champlain_network_tile_s
  */
 #define MAX_CONNS_DEFAULT 2
 
-#ifndef CHAMPLAIN_LIBSOUP_3
+/* Seconds idle connections are kept open by default */
+#define KEEP_ALIVE_DEFAULT 60
+
+/* Requests in flight per allowed connection when they are multiplexed. A
+ * request to a host without HTTP/2 takes a whole connection, so it weighs
+ * that many streams. */
+#define STREAMS_PER_CONN 4
+
+/* Not defined by libsoup 2 */
+#define HTTP_STATUS_TOO_MANY_REQUESTS 429
+
+/* The latency is considered grown when its moving average exceeds the best
+ * latency seen so far by this factor */
+#define LATENCY_GROWTH_LIMIT 2.0
+
+/* Failed downloads are retried after RETRY_BASE_DELAY_MS, doubled with every
+ * attempt up to RETRY_MAX_DELAY_MS, of which a random half is waited */
+#define MAX_RETRIES_DEFAULT 3
+#define RETRY_BASE_DELAY_MS 500
+#define RETRY_MAX_DELAY_MS 30000
+#define RETRY_AFTER_MAX_S 300
+
+/* Expired tiles are revalidated over at most this many connections, and only
+ * when no tile is waiting for a download */
+#define REVALIDATION_CONNS 1
+
+/* Only the revalidations nearest to the view center are kept */
+#define MAX_REVALIDATIONS 256
+
+/* Size of the pieces in which the response body is read and decoded */
+#define READ_CHUNK_SIZE 16384
+
+/* After this many failures in a row a host gets no requests for
+ * BREAKER_MIN_OPEN_MS, doubled every time it is found still down */
+#define BREAKER_FAILURE_THRESHOLD 5
+#define BREAKER_MIN_OPEN_MS 5000
+#define BREAKER_MAX_OPEN_MS 300000
+
+static const gchar *default_subdomains[] = { "a", "b", "c", NULL };
+
+/* Tiles of other zoom levels than the one in focus are loaded last */
+#define OTHER_ZOOM_DISTANCE 1e6
+
+typedef struct _TileRequest TileRequest;
+
+/* Health of one of the hosts tiles are downloaded from */
 typedef struct
 {
-  ChamplainMapSource *map_source;
-  SoupMessage *msg;
-} TileCancelledData;
-#endif
+  ChamplainNetworkTileSource *tile_source;
+  guint failures;
+  /* when set, no requests are sent before that (monotonic) time */
+  gint64 open_until;
+  guint open_duration;
+  gboolean probing;
+  guint probe_source_id;
+  /* GWeakRefs of tiles showing an error because of the host */
+  GSList *failed_tiles;
+  /* the host answered over HTTP/2, its requests share connections */
+  gboolean multiplexed;
+} HostState;
 
 typedef struct
 {
-  ChamplainMapSource *map_source;
+  TileRequest *request;
   ChamplainTile *tile;
-#ifdef CHAMPLAIN_LIBSOUP_3
+  gulong state_handler_id;
+} TileWaiter;
+
+/* A download shared by all tiles waiting for the same URI */
+struct _TileRequest
+{
+  ChamplainNetworkTileSource *tile_source;
+  gchar *key;
+  gchar *uri;
+  gchar *host;
+  gchar *etag;
+  gchar *modified_since;
+  GList *waiters;
+  /* set while the request is in flight */
   SoupMessage *msg;
+  gint64 send_time;
+  guint status;
+  guint attempts;
+  guint retry_after;
+  guint retry_source_id;
+  gboolean transient;
+  gboolean probe;
+  /* revalidates a cached tile, nobody waits for it */
+  gboolean background;
+  /* weight in the in-flight load, see STREAMS_PER_CONN */
+  guint load;
+#ifdef CHAMPLAIN_LIBSOUP_3
   GCancellable *cancellable;
-#else
-  TileCancelledData *cancelled_data;
+  gchar *response_etag;
+  GInputStream *stream;
+  GByteArray *contents;
+  /* decodes the body while it is being read, for the image renderer */
+  ChamplainImageStream *decoder;
+  /* the decoded body once complete, NULL if decoding failed */
+  cairo_surface_t *surface;
+  gboolean decoded;
 #endif
-} TileLoadedData;
+};
+
+typedef enum
+{
+  REQUEST_LOADED,
+  REQUEST_NOT_MODIFIED,
+  REQUEST_FAILED,
+  REQUEST_CANCELLED
+} RequestResult;
 
 typedef struct
 {
   ChamplainMapSource *map_source;
   gchar *etag;
+  gboolean store;
 } TileRenderedData;
 
 
@@ -111,12 +324,23 @@ static void fill_tile (ChamplainMapSource *map_source,
     ChamplainTile *tile);
 static void tile_state_notify (ChamplainTile *tile,
     G_GNUC_UNUSED GParamSpec *pspec,
+    TileWaiter *waiter);
+static void tile_request_free (TileRequest *request);
+static gboolean free_idle_request (gpointer key,
+    TileRequest *request,
+    gpointer user_data);
+static void host_state_free (HostState *host);
+static void reset_host_protocol (const gchar *host_name,
+    HostState *host,
     gpointer user_data);
+static void dispatch_requests (ChamplainNetworkTileSource *tile_source);
 
 static gchar *get_tile_uri (ChamplainNetworkTileSource *source,
     gint x,
     gint y,
-    gint z);
+    gint z,
+    guint scale_factor);
+static void compile_uri_format (ChamplainNetworkTileSource *tile_source);
 
 static void
 champlain_network_tile_source_get_property (GObject *object,
@@ -144,6 +368,54 @@ champlain_network_tile_source_get_property (GObject *object,
       g_value_set_int (value, priv->max_conns);
       break;
 
+    case PROP_SUBDOMAINS:
+      g_value_set_boxed (value, priv->subdomains);
+      break;
+
+    case PROP_MIN_CONNS:
+      g_value_set_int (value, priv->min_conns);
+      break;
+
+    case PROP_ADAPTIVE_CONNS:
+      g_value_set_boolean (value, priv->adaptive_conns);
+      break;
+
+    case PROP_MAX_RETRIES:
+      g_value_set_int (value, priv->max_retries);
+      break;
+
+    case PROP_BACKGROUND_REVALIDATION:
+      g_value_set_boolean (value, priv->background_revalidation);
+      break;
+
+    case PROP_RATE_LIMIT:
+      g_value_set_uint (value, priv->rate_limit);
+      break;
+
+    case PROP_DATA_BUDGET:
+      g_value_set_uint64 (value, priv->data_budget);
+      break;
+
+    case PROP_REQUEST_COUNT:
+      g_value_set_uint64 (value, priv->request_count);
+      break;
+
+    case PROP_BYTES_RECEIVED:
+      g_value_set_uint64 (value, priv->bytes_received);
+      break;
+
+    case PROP_NOT_MODIFIED_COUNT:
+      g_value_set_uint64 (value, priv->not_modified_count);
+      break;
+
+    case PROP_ERROR_COUNT:
+      g_value_set_uint64 (value, priv->error_count);
+      break;
+
+    case PROP_KEEP_ALIVE:
+      g_value_set_uint (value, priv->keep_alive);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -180,6 +452,38 @@ champlain_network_tile_source_set_property (GObject *object,
       champlain_network_tile_source_set_user_agent (tile_source, g_value_get_string (value));
       break;
 
+    case PROP_SUBDOMAINS:
+      champlain_network_tile_source_set_subdomains (tile_source, g_value_get_boxed (value));
+      break;
+
+    case PROP_MIN_CONNS:
+      champlain_network_tile_source_set_min_conns (tile_source, g_value_get_int (value));
+      break;
+
+    case PROP_ADAPTIVE_CONNS:
+      champlain_network_tile_source_set_adaptive_conns (tile_source, g_value_get_boolean (value));
+      break;
+
+    case PROP_MAX_RETRIES:
+      champlain_network_tile_source_set_max_retries (tile_source, g_value_get_int (value));
+      break;
+
+    case PROP_BACKGROUND_REVALIDATION:
+      champlain_network_tile_source_set_background_revalidation (tile_source, g_value_get_boolean (value));
+      break;
+
+    case PROP_RATE_LIMIT:
+      champlain_network_tile_source_set_rate_limit (tile_source, g_value_get_uint (value));
+      break;
+
+    case PROP_DATA_BUDGET:
+      champlain_network_tile_source_set_data_budget (tile_source, g_value_get_uint64 (value));
+      break;
+
+    case PROP_KEEP_ALIVE:
+      champlain_network_tile_source_set_keep_alive (tile_source, g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -191,6 +495,25 @@ champlain_network_tile_source_dispose (GObject *object)
 {
   ChamplainNetworkTileSourcePrivate *priv = CHAMPLAIN_NETWORK_TILE_SOURCE (object)->priv;
 
+  if (priv->dispatch_source_id)
+    {
+      g_source_remove (priv->dispatch_source_id);
+      priv->dispatch_source_id = 0;
+    }
+
+  if (priv->throttle_source_id)
+    {
+      g_source_remove (priv->throttle_source_id);
+      priv->throttle_source_id = 0;
+    }
+
+  /* Requests in flight keep the source alive, only queued ones and ones
+     waiting for a retry can be left */
+  g_queue_clear (priv->queue);
+  g_queue_clear (priv->revalidations);
+  g_hash_table_foreach_remove (priv->requests, (GHRFunc) free_idle_request, NULL);
+  g_hash_table_remove_all (priv->hosts);
+
   if (priv->soup_session)
       soup_session_abort (priv->soup_session);
 
@@ -206,7 +529,13 @@ champlain_network_tile_source_finalize (GObject *object)
   ChamplainNetworkTileSourcePrivate *priv = CHAMPLAIN_NETWORK_TILE_SOURCE (object)->priv;
 
   g_free (priv->uri_format);
+  g_array_unref (priv->uri_parts);
+  g_strfreev (priv->subdomains);
   g_free (priv->proxy_uri);
+  g_hash_table_destroy (priv->requests);
+  g_hash_table_destroy (priv->hosts);
+  g_queue_free (priv->queue);
+  g_queue_free (priv->revalidations);
 
   G_OBJECT_CLASS (champlain_network_tile_source_parent_class)->finalize (object);
 }
@@ -312,6 +641,203 @@ champlain_network_tile_source_class_init (ChamplainNetworkTileSourceClass *klass
         G_PARAM_WRITABLE);
 
   g_object_class_install_property (object_class, PROP_USER_AGENT, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:subdomains:
+   *
+   * The host name parts the {s} placeholder of the uri format is replaced
+   * with, see #champlain_network_tile_source_set_subdomains
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_boxed ("subdomains",
+        "Subdomains",
+        "The values of the {s} placeholder of the URI format",
+        G_TYPE_STRV,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_SUBDOMAINS, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:min-conns:
+   *
+   * The lowest number of simultaneous connections the source falls back to
+   * when #ChamplainNetworkTileSource:adaptive-conns is set.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_int ("min-conns",
+        "Min Connection Count",
+        "The minimum number of simultaneous connections "
+        "in adaptive mode.",
+        1,
+        G_MAXINT,
+        1,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_MIN_CONNS, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:adaptive-conns:
+   *
+   * Whether the number of simultaneous connections adapts to the measured
+   * throughput, latency and server overload responses, between
+   * #ChamplainNetworkTileSource:min-conns and
+   * #ChamplainNetworkTileSource:max-conns.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_boolean ("adaptive-conns",
+        "Adaptive Connections",
+        "Whether the number of connections adapts to network conditions",
+        FALSE,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_ADAPTIVE_CONNS, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:max-retries:
+   *
+   * How many times a download failing because of a network error or a
+   * temporary server problem is retried before the tile is given up.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_int ("max-retries",
+        "Max Retries",
+        "The maximum number of retries of a failed download",
+        0,
+        G_MAXINT,
+        MAX_RETRIES_DEFAULT,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_MAX_RETRIES, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:background-revalidation:
+   *
+   * Whether expired tiles from the cache are shown right away and
+   * revalidated in the background.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_boolean ("background-revalidation",
+        "Background Revalidation",
+        "Revalidate expired cached tiles in the background",
+        TRUE,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_BACKGROUND_REVALIDATION, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:rate-limit:
+   *
+   * The average number of bytes per second the source may download, 0 for
+   * no limit.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint ("rate-limit",
+        "Rate Limit",
+        "The maximum download rate in bytes per second",
+        0,
+        G_MAXUINT,
+        0,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_RATE_LIMIT, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:data-budget:
+   *
+   * The number of bytes the source may download, 0 for no limit. Beyond
+   * it the source only lets the tiles be loaded from the caches.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint64 ("data-budget",
+        "Data Budget",
+        "The number of bytes which may be downloaded",
+        0,
+        G_MAXUINT64,
+        0,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_DATA_BUDGET, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:request-count:
+   *
+   * The number of requests sent, retries included.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint64 ("request-count",
+        "Request Count",
+        "The number of requests sent",
+        0,
+        G_MAXUINT64,
+        0,
+        G_PARAM_READABLE);
+  g_object_class_install_property (object_class, PROP_REQUEST_COUNT, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:bytes-received:
+   *
+   * The number of bytes of response bodies received.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint64 ("bytes-received",
+        "Bytes Received",
+        "The number of bytes received",
+        0,
+        G_MAXUINT64,
+        0,
+        G_PARAM_READABLE);
+  g_object_class_install_property (object_class, PROP_BYTES_RECEIVED, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:not-modified-count:
+   *
+   * The number of requests answered with "304 Not Modified".
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint64 ("not-modified-count",
+        "Not Modified Count",
+        "The number of requests answered with 304 Not Modified",
+        0,
+        G_MAXUINT64,
+        0,
+        G_PARAM_READABLE);
+  g_object_class_install_property (object_class, PROP_NOT_MODIFIED_COUNT, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:error-count:
+   *
+   * The number of failed requests, retried ones included.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint64 ("error-count",
+        "Error Count",
+        "The number of failed requests",
+        0,
+        G_MAXUINT64,
+        0,
+        G_PARAM_READABLE);
+  g_object_class_install_property (object_class, PROP_ERROR_COUNT, pspec);
+
+  /**
+   * ChamplainNetworkTileSource:keep-alive:
+   *
+   * How many seconds idle connections to the tile server are kept open,
+   * 0 to keep them open indefinitely.
+   *
+   * Since: 0.12.22
+   */
+  pspec = g_param_spec_uint ("keep-alive",
+        "Keep Alive",
+        "Seconds idle connections are kept open",
+        0,
+        G_MAXUINT,
+        KEEP_ALIVE_DEFAULT,
+        G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_KEEP_ALIVE, pspec);
 }
 
 
@@ -324,14 +850,41 @@ champlain_network_tile_source_init (ChamplainNetworkTileSource *tile_source)
 
   priv->proxy_uri = NULL;
   priv->uri_format = NULL;
+  priv->uri_parts = g_array_new (FALSE, FALSE, sizeof (UriPart));
+  priv->subdomains = g_strdupv ((gchar **) default_subdomains);
   priv->offline = FALSE;
   priv->max_conns = MAX_CONNS_DEFAULT;
+  priv->min_conns = 1;
+  priv->adaptive_conns = FALSE;
+  priv->current_conns = MAX_CONNS_DEFAULT;
+  priv->window_start = 0;
+  priv->window_tiles = 0;
+  priv->window_bytes = 0;
+  priv->window_saturated = FALSE;
+  priv->last_throughput = 0;
+  priv->min_latency = 0;
+  priv->avg_latency = 0;
+  priv->max_retries = MAX_RETRIES_DEFAULT;
+  priv->hosts = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) host_state_free);
+  priv->requests = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->queue = g_queue_new ();
+  priv->in_flight_load = 0;
+  priv->background_revalidation = TRUE;
+  priv->revalidations = g_queue_new ();
+  priv->n_revalidating = 0;
+  priv->dispatch_source_id = 0;
+  priv->has_focus = FALSE;
+  priv->keep_alive = KEEP_ALIVE_DEFAULT;
+  priv->last_preconnect = 0;
 
 #ifdef CHAMPLAIN_LIBSOUP_3
+  /* HTTP/2 is used whenever the server offers it */
   priv->soup_session = soup_session_new_with_options (
       "user-agent", "libchamplain/" CHAMPLAIN_VERSION_S,
       "max-conns-per-host", MAX_CONNS_DEFAULT,
       "max-conns", MAX_CONNS_DEFAULT,
+      "idle-timeout", KEEP_ALIVE_DEFAULT,
       NULL);
 #else
   priv->soup_session = soup_session_new_with_options (
@@ -347,11 +900,134 @@ champlain_network_tile_source_init (ChamplainNetworkTileSource *tile_source)
       "libchamplain/" CHAMPLAIN_VERSION_S,
       "max-conns-per-host", MAX_CONNS_DEFAULT,
       "max-conns", MAX_CONNS_DEFAULT,
+      "idle-timeout", KEEP_ALIVE_DEFAULT,
       NULL);
 #endif
 }
 
 
+static void
+add_uri_part (GArray *parts,
+    UriPartType type,
+    const gchar *literal,
+    gsize length)
+{
+  UriPart part = { type, literal, length };
+
+  if (type == URI_PART_LITERAL && length == 0)
+    return;
+
+  g_array_append_val (parts, part);
+}
+
+
+static gboolean
+get_variable_type (const gchar *name,
+    gsize length,
+    gboolean braces,
+    UriPartType *type)
+{
+  static const struct
+  {
+    const gchar *hash_name;
+    const gchar *brace_name;
+    UriPartType type;
+  } variables[] = {
+    { "X", "x", URI_PART_X },
+    { "Y", "y", URI_PART_Y },
+    { "TMSY", "-y", URI_PART_TMSY },
+    { "Z", "z", URI_PART_Z },
+    { NULL, "s", URI_PART_SUBDOMAIN },
+    { NULL, "quadkey", URI_PART_QUADKEY },
+    { NULL, "r", URI_PART_SCALE },
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (variables); i++)
+    {
+      const gchar *variable = braces ? variables[i].brace_name : variables[i].hash_name;
+
+      if (variable && strlen (variable) == length && strncmp (name, variable, length) == 0)
+        {
+          *type = variables[i].type;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+
+/* Splits the {...} placeholders off a piece of the uri format between two
+   '#' characters */
+static void
+compile_uri_literal (GArray *parts,
+    const gchar *start,
+    const gchar *end)
+{
+  const gchar *p = start;
+
+  while (p < end)
+    {
+      const gchar *open = memchr (p, '{', end - p);
+      const gchar *close;
+      UriPartType type;
+
+      if (!open)
+        break;
+
+      close = memchr (open, '}', end - open);
+      if (!close)
+        break;
+
+      if (get_variable_type (open + 1, close - open - 1, TRUE, &type))
+        {
+          add_uri_part (parts, URI_PART_LITERAL, start, open - start);
+          add_uri_part (parts, type, NULL, 0);
+          start = close + 1;
+        }
+
+      p = close + 1;
+    }
+
+  add_uri_part (parts, URI_PART_LITERAL, start, end - start);
+}
+
+
+static void
+compile_uri_format (ChamplainNetworkTileSource *tile_source)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  const gchar *token;
+  const gchar *end;
+
+  g_array_set_size (priv->uri_parts, 0);
+
+  if (!priv->uri_format)
+    return;
+
+  /* Like the variables, any other text between '#' characters is copied
+     without the '#' characters */
+  token = priv->uri_format;
+  do
+    {
+      UriPartType type;
+
+      end = strchr (token, '#');
+      if (!end)
+        end = token + strlen (token);
+
+      if (get_variable_type (token, end - token, FALSE, &type))
+        add_uri_part (priv->uri_parts, type, NULL, 0);
+      else
+        compile_uri_literal (priv->uri_parts, token, end);
+
+      token = end + 1;
+    }
+  while (*end != '\0');
+}
+
+
 /**
  * champlain_network_tile_source_new_full:
  * @id: the map source's id
@@ -435,6 +1111,17 @@ champlain_network_tile_source_get_uri_format (ChamplainNetworkTileSource *tile_s
  * For example, this is the OpenStreetMap URI format:
  * "https://tile.openstreetmap.org/\#Z\#/\#X\#/\#Y\#.png"
  *
+ * The placeholders used by most other mapping libraries are understood as
+ * well: {x}, {y}, {z}, {-y} for Y in TMS coordinates, {s} for one of the
+ * subdomains set by champlain_network_tile_source_set_subdomains(), {quadkey}
+ * for the tile's quadtree key used by Bing Maps and {r} which is replaced by
+ * "@2x" for tiles with a #ChamplainTile:scale-factor of 2 (and so on) and
+ * by nothing for standard resolution tiles. Sources with {r} should set
+ * #ChamplainMapSource:max-scale-factor. The same tile always gets the same
+ * subdomain.
+ *
+ * The format is parsed once when it is set.
+ *
  * Since: 0.4
  */
 void
@@ -447,6 +1134,13 @@ champlain_network_tile_source_set_uri_format (ChamplainNetworkTileSource *tile_s
 
   g_free (priv->uri_format);
   priv->uri_format = g_strdup (uri_format);
+  compile_uri_format (tile_source);
+
+  /* The new host wasn't connected to yet, the view preconnects when the
+     source is set */
+  priv->last_preconnect = 0;
+  /* The server behind a known host may have changed too */
+  g_hash_table_foreach (priv->hosts, (GHFunc) reset_host_protocol, NULL);
 
   g_object_notify (G_OBJECT (tile_source), "uri-format");
 }
@@ -599,412 +1293,2137 @@ champlain_network_tile_source_set_max_conns (ChamplainNetworkTileSource *tile_so
   g_return_if_fail (SOUP_IS_SESSION (tile_source->priv->soup_session));
 
   tile_source->priv->max_conns = max_conns;
+  tile_source->priv->current_conns = CLAMP (tile_source->priv->current_conns,
+        MIN (tile_source->priv->min_conns, max_conns), max_conns);
 
   g_object_set (G_OBJECT (tile_source->priv->soup_session),
       "max-conns-per-host", max_conns,
       "max-conns", max_conns,
       NULL);
 
+  dispatch_requests (tile_source);
+
   g_object_notify (G_OBJECT (tile_source), "max_conns");
 }
 
 /**
- * champlain_network_tile_source_set_user_agent:
- * @tile_source: a #ChamplainNetworkTileSource
- * @user_agent: A User-Agent string
+ * champlain_network_tile_source_get_min_conns:
+ * @tile_source: the #ChamplainNetworkTileSource
  *
- * Sets the User-Agent header used communicating with the server.
- * Since: 0.12.16
+ * Gets the lowest number of simultaneous connections used in adaptive mode.
+ *
+ * Returns: the minimum number of simultaneous connections
+ *
+ * Since: 0.12.22
  */
-void
-champlain_network_tile_source_set_user_agent (
-    ChamplainNetworkTileSource *tile_source,
-    const gchar *user_agent)
+gint
+champlain_network_tile_source_get_min_conns (ChamplainNetworkTileSource *tile_source)
 {
-  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source)
-      && user_agent != NULL);
-
-  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
 
-  if (priv->soup_session)
-    g_object_set (G_OBJECT (priv->soup_session), "user-agent",
-        user_agent, NULL);
+  return tile_source->priv->min_conns;
 }
 
 
-#define SIZE 8
-static gchar *
-get_tile_uri (ChamplainNetworkTileSource *tile_source,
-    gint x,
-    gint y,
-    gint z)
+/**
+ * champlain_network_tile_source_set_min_conns:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @min_conns: the minimum number of simultaneous connections
+ *
+ * Sets the lowest number of simultaneous connections the source falls back
+ * to in adaptive mode, see champlain_network_tile_source_set_adaptive_conns().
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_set_min_conns (ChamplainNetworkTileSource *tile_source,
+    gint min_conns)
 {
-  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
-
-  gchar **tokens;
-  gchar *token;
-  GString *ret;
-  gint i = 0;
-
-  tokens = g_strsplit (priv->uri_format, "#", 20);
-  token = tokens[i];
-  ret = g_string_sized_new (strlen (priv->uri_format));
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+  g_return_if_fail (min_conns > 0);
 
-  while (token != NULL)
-    {
-      gint number = G_MAXINT;
-      gchar value[SIZE];
-
-      if (strcmp (token, "X") == 0)
-        number = x;
-      if (strcmp (token, "Y") == 0)
-        number = y;
-      if (strcmp (token, "TMSY") == 0){
-        int ymax = 1 << z;
-        number = ymax - y - 1;
-      }
-      if (strcmp (token, "Z") == 0)
-        number = z;
-
-      if (number != G_MAXINT)
-        {
-          g_snprintf (value, SIZE, "%d", number);
-          g_string_append (ret, value);
-        }
-      else
-        g_string_append (ret, token);
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
 
-      token = tokens[++i];
-    }
+  priv->min_conns = min_conns;
+  priv->current_conns = CLAMP (priv->current_conns,
+        MIN (min_conns, priv->max_conns), priv->max_conns);
 
-  token = ret->str;
-  g_string_free (ret, FALSE);
-  g_strfreev (tokens);
+  dispatch_requests (tile_source);
 
-  return token;
+  g_object_notify (G_OBJECT (tile_source), "min-conns");
 }
 
-static void
-tile_rendered_data_free (TileRenderedData *data)
-{
-  g_clear_pointer (&data->etag, g_free);
+
+/**
+ * champlain_network_tile_source_get_adaptive_conns:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Checks whether the number of simultaneous connections adapts to network
+ * conditions.
+ *
+ * Returns: the value of #ChamplainNetworkTileSource:adaptive-conns
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_network_tile_source_get_adaptive_conns (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), FALSE);
+
+  return tile_source->priv->adaptive_conns;
+}
+
+
+/**
+ * champlain_network_tile_source_set_adaptive_conns:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @adaptive_conns: whether the number of connections adapts
+ *
+ * In adaptive mode the source starts with the default of 2 simultaneous
+ * connections (within the bounds) and adds one more each time the previous
+ * increase paid off in throughput without making the latency grow. The number
+ * is halved whenever the server reports being overloaded. Set
+ * #ChamplainNetworkTileSource:max-conns to the number your tile provider
+ * allows before enabling this.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_set_adaptive_conns (ChamplainNetworkTileSource *tile_source,
+    gboolean adaptive_conns)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  priv->adaptive_conns = adaptive_conns;
+  priv->current_conns = CLAMP (MAX_CONNS_DEFAULT,
+        MIN (priv->min_conns, priv->max_conns), priv->max_conns);
+  priv->window_start = 0;
+  priv->last_throughput = 0;
+  priv->min_latency = 0;
+  priv->avg_latency = 0;
+
+  dispatch_requests (tile_source);
+
+  g_object_notify (G_OBJECT (tile_source), "adaptive-conns");
+}
+
+
+/**
+ * champlain_network_tile_source_get_max_retries:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets how many times a failed download is retried.
+ *
+ * Returns: the maximum number of retries
+ *
+ * Since: 0.12.22
+ */
+gint
+champlain_network_tile_source_get_max_retries (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->max_retries;
+}
+
+
+/**
+ * champlain_network_tile_source_set_max_retries:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @max_retries: the maximum number of retries
+ *
+ * Sets how many times a download failing because of a network error or a
+ * temporary server problem (a 408, 429 or 5xx response) is retried before the
+ * tile is given up. The delay before a retry doubles with every attempt and is
+ * randomized so the retries of many tiles don't hit the server at once. A
+ * Retry-After header sent by the server is honoured.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_set_max_retries (ChamplainNetworkTileSource *tile_source,
+    gint max_retries)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+  g_return_if_fail (max_retries >= 0);
+
+  tile_source->priv->max_retries = max_retries;
+
+  g_object_notify (G_OBJECT (tile_source), "max-retries");
+}
+
+
+/**
+ * champlain_network_tile_source_get_background_revalidation:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets whether expired cached tiles are revalidated in the background.
+ *
+ * Returns: %TRUE when expired tiles are revalidated in the background
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_network_tile_source_get_background_revalidation (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), FALSE);
+
+  return tile_source->priv->background_revalidation;
+}
+
+
+/**
+ * champlain_network_tile_source_set_background_revalidation:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @background_revalidation: whether to revalidate in the background
+ *
+ * When enabled, a tile whose cached version has expired is displayed straight
+ * from the cache and a conditional request for it is queued. These requests
+ * are sent over a single connection, nearest to the view center first, and
+ * only when no tile is waiting for a download. A "304 Not Modified" response
+ * only refreshes the modification time of the cached tile, new data replaces
+ * the cached tile for the next time it is displayed.
+ *
+ * When disabled, the tile is displayed only once the server has been asked
+ * whether it changed.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_set_background_revalidation (ChamplainNetworkTileSource *tile_source,
+    gboolean background_revalidation)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  tile_source->priv->background_revalidation = background_revalidation;
+
+  g_object_notify (G_OBJECT (tile_source), "background-revalidation");
+}
+
+
+/**
+ * champlain_network_tile_source_get_rate_limit:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the maximum download rate.
+ *
+ * Returns: the maximum download rate in bytes per second, 0 when unlimited
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_network_tile_source_get_rate_limit (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->rate_limit;
+}
+
+
+/**
+ * champlain_network_tile_source_set_rate_limit:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @rate_limit: the maximum download rate in bytes per second, 0 for no limit
+ *
+ * Limits the average download rate of the source. Downloaded bytes are taken
+ * from a bucket refilled at @rate_limit bytes per second and holding at most
+ * as many; no request is sent while the bucket is empty. Queued tiles wait,
+ * so the map fills in more slowly instead of using more data.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_set_rate_limit (ChamplainNetworkTileSource *tile_source,
+    guint rate_limit)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  priv->rate_limit = rate_limit;
+  priv->tokens = rate_limit;
+  priv->tokens_time = g_get_monotonic_time ();
+
+  if (priv->throttle_source_id)
+    {
+      g_source_remove (priv->throttle_source_id);
+      priv->throttle_source_id = 0;
+    }
+  dispatch_requests (tile_source);
+
+  g_object_notify (G_OBJECT (tile_source), "rate-limit");
+}
+
+
+/**
+ * champlain_network_tile_source_get_data_budget:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the number of bytes the source may download.
+ *
+ * Returns: the data budget in bytes, 0 when unlimited
+ *
+ * Since: 0.12.22
+ */
+guint64
+champlain_network_tile_source_get_data_budget (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->data_budget;
+}
+
+
+/**
+ * champlain_network_tile_source_set_data_budget:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @data_budget: the number of bytes which may be downloaded, 0 for no limit
+ *
+ * Sets how much data the source may download, counted by
+ * #ChamplainNetworkTileSource:bytes-received. Once the budget is used up the
+ * source behaves as if it was offline: tiles are only loaded from the caches,
+ * expired ones are used as they are and missing ones are left to the next
+ * source in the chain. Raise the budget or reset the counters with
+ * champlain_network_tile_source_reset_counters() to download again.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_set_data_budget (ChamplainNetworkTileSource *tile_source,
+    guint64 data_budget)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  tile_source->priv->data_budget = data_budget;
+
+  g_object_notify (G_OBJECT (tile_source), "data-budget");
+}
+
+
+/**
+ * champlain_network_tile_source_get_request_count:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the number of requests sent, retries included.
+ *
+ * Returns: the number of requests
+ *
+ * Since: 0.12.22
+ */
+guint64
+champlain_network_tile_source_get_request_count (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->request_count;
+}
+
+
+/**
+ * champlain_network_tile_source_get_bytes_received:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the number of bytes of response bodies received, including the ones
+ * of failed and cancelled downloads.
+ *
+ * Returns: the number of bytes
+ *
+ * Since: 0.12.22
+ */
+guint64
+champlain_network_tile_source_get_bytes_received (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->bytes_received;
+}
+
+
+/**
+ * champlain_network_tile_source_get_not_modified_count:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the number of requests answered with "304 Not Modified".
+ *
+ * Returns: the number of requests
+ *
+ * Since: 0.12.22
+ */
+guint64
+champlain_network_tile_source_get_not_modified_count (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->not_modified_count;
+}
+
+
+/**
+ * champlain_network_tile_source_get_error_count:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the number of failed requests, retried ones included.
+ *
+ * Returns: the number of requests
+ *
+ * Since: 0.12.22
+ */
+guint64
+champlain_network_tile_source_get_error_count (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->error_count;
+}
+
+
+/**
+ * champlain_network_tile_source_reset_counters:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Sets the request, byte, 304 and error counters back to 0, e.g. when a new
+ * billing period starts.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_reset_counters (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  g_object_freeze_notify (G_OBJECT (tile_source));
+
+  priv->request_count = 0;
+  priv->bytes_received = 0;
+  priv->not_modified_count = 0;
+  priv->error_count = 0;
+
+  g_object_notify (G_OBJECT (tile_source), "request-count");
+  g_object_notify (G_OBJECT (tile_source), "bytes-received");
+  g_object_notify (G_OBJECT (tile_source), "not-modified-count");
+  g_object_notify (G_OBJECT (tile_source), "error-count");
+
+  g_object_thaw_notify (G_OBJECT (tile_source));
+}
+
+
+/**
+ * champlain_network_tile_source_get_keep_alive:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets how long idle connections are kept open.
+ *
+ * Returns: the number of seconds, 0 when they are kept open indefinitely
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_network_tile_source_get_keep_alive (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), 0);
+
+  return tile_source->priv->keep_alive;
+}
+
+
+/**
+ * champlain_network_tile_source_set_keep_alive:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @keep_alive: the number of seconds, 0 to keep idle connections open
+ * indefinitely
+ *
+ * Sets how long connections to the tile server are kept open when no tile is
+ * being downloaded. Longer times save the connection setup when the user
+ * starts moving the map again, at the cost of keeping the connections busy on
+ * the server.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_set_keep_alive (ChamplainNetworkTileSource *tile_source,
+    guint keep_alive)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+  g_return_if_fail (SOUP_IS_SESSION (tile_source->priv->soup_session));
+
+  tile_source->priv->keep_alive = keep_alive;
+  g_object_set (G_OBJECT (tile_source->priv->soup_session),
+      "idle-timeout", keep_alive,
+      NULL);
+
+  g_object_notify (G_OBJECT (tile_source), "keep-alive");
+}
+
+
+/**
+ * champlain_network_tile_source_get_subdomains:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Gets the values of the {s} placeholder of the uri format.
+ *
+ * Returns: (transfer none) (array zero-terminated=1): the subdomains
+ *
+ * Since: 0.12.22
+ */
+const gchar * const *
+champlain_network_tile_source_get_subdomains (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source), NULL);
+
+  return (const gchar * const *) tile_source->priv->subdomains;
+}
+
+
+/**
+ * champlain_network_tile_source_set_subdomains:
+ * @tile_source: the #ChamplainNetworkTileSource
+ * @subdomains: (array zero-terminated=1) (allow-none): the subdomains
+ *
+ * Sets the host name parts the {s} placeholder of the uri format is replaced
+ * with, for example "a", "b" and "c" for tile servers available as
+ * a.tile.example.org, b.tile.example.org and c.tile.example.org. Spreading the
+ * requests over several host names lets more of them run in parallel. Passing
+ * %NULL restores the default "a", "b" and "c".
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_set_subdomains (ChamplainNetworkTileSource *tile_source,
+    const gchar * const *subdomains)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  if (!subdomains || !subdomains[0])
+    subdomains = default_subdomains;
+
+  g_strfreev (priv->subdomains);
+  priv->subdomains = g_strdupv ((gchar **) subdomains);
+
+  g_object_notify (G_OBJECT (tile_source), "subdomains");
+}
+
+
+/**
+ * champlain_network_tile_source_set_user_agent:
+ * @tile_source: a #ChamplainNetworkTileSource
+ * @user_agent: A User-Agent string
+ *
+ * Sets the User-Agent header used communicating with the server.
+ * Since: 0.12.16
+ */
+void
+champlain_network_tile_source_set_user_agent (
+    ChamplainNetworkTileSource *tile_source,
+    const gchar *user_agent)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source)
+      && user_agent != NULL);
+
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  if (priv->soup_session)
+    g_object_set (G_OBJECT (priv->soup_session), "user-agent",
+        user_agent, NULL);
+}
+
+
+static guint
+count_digits (guint number)
+{
+  guint digits = 1;
+
+  while (number >= 10)
+    {
+      number /= 10;
+      digits++;
+    }
+
+  return digits;
+}
+
+
+static gchar *
+append_number (gchar *p,
+    guint number,
+    guint digits)
+{
+  gchar *q = p + digits;
+
+  do
+    {
+      *--q = '0' + number % 10;
+      number /= 10;
+    }
+  while (number > 0);
+
+  return p + digits;
+}
+
+
+static gchar *
+get_tile_uri (ChamplainNetworkTileSource *tile_source,
+    gint x,
+    gint y,
+    gint z,
+    guint scale_factor)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  guint numbers[URI_PART_SCALE + 1];
+  guint n_subdomains = g_strv_length (priv->subdomains);
+  const gchar *subdomain = priv->subdomains[(guint) (x + y) % n_subdomains];
+  gsize subdomain_length = strlen (subdomain);
+  gsize length = 0;
+  gchar *uri, *p;
+  guint i;
+
+  numbers[URI_PART_X] = x;
+  numbers[URI_PART_Y] = y;
+  numbers[URI_PART_TMSY] = (1 << z) - y - 1;
+  numbers[URI_PART_Z] = z;
+  numbers[URI_PART_SCALE] = scale_factor;
+
+  /* Measure first so the URI is built in a single allocation */
+  for (i = 0; i < priv->uri_parts->len; i++)
+    {
+      UriPart *part = &g_array_index (priv->uri_parts, UriPart, i);
+
+      switch (part->type)
+        {
+        case URI_PART_LITERAL:
+          length += part->length;
+          break;
+
+        case URI_PART_SUBDOMAIN:
+          length += subdomain_length;
+          break;
+
+        case URI_PART_QUADKEY:
+          length += z;
+          break;
+
+        case URI_PART_SCALE:
+          /* "@2x", nothing for standard resolution tiles */
+          if (scale_factor > 1)
+            length += count_digits (scale_factor) + 2;
+          break;
+
+        default:
+          length += count_digits (numbers[part->type]);
+        }
+    }
+
+  uri = p = g_malloc (length + 1);
+
+  for (i = 0; i < priv->uri_parts->len; i++)
+    {
+      UriPart *part = &g_array_index (priv->uri_parts, UriPart, i);
+      gint level;
+
+      switch (part->type)
+        {
+        case URI_PART_LITERAL:
+          memcpy (p, part->literal, part->length);
+          p += part->length;
+          break;
+
+        case URI_PART_SUBDOMAIN:
+          memcpy (p, subdomain, subdomain_length);
+          p += subdomain_length;
+          break;
+
+        case URI_PART_QUADKEY:
+          for (level = z; level > 0; level--)
+            {
+              guint mask = 1 << (level - 1);
+
+              *p++ = '0' + ((x & mask) ? 1 : 0) + ((y & mask) ? 2 : 0);
+            }
+          break;
+
+        case URI_PART_SCALE:
+          if (scale_factor > 1)
+            {
+              *p++ = '@';
+              p = append_number (p, scale_factor, count_digits (scale_factor));
+              *p++ = 'x';
+            }
+          break;
+
+        default:
+          p = append_number (p, numbers[part->type], count_digits (numbers[part->type]));
+        }
+    }
+
+  *p = '\0';
+
+  return uri;
+}
+
+
+static void
+tile_rendered_data_free (TileRenderedData *data)
+{
+  g_clear_pointer (&data->etag, g_free);
   g_clear_object (&data->map_source);
   g_slice_free (TileRenderedData, data);
 }
 
 static void
-tile_loaded_data_free (TileLoadedData *data)
+tile_rendered_cb (ChamplainTile *tile,
+    gpointer data,
+    guint size,
+    gboolean error,
+    TileRenderedData *user_data)
+{
+  ChamplainMapSource *map_source = g_steal_pointer (&user_data->map_source);
+  ChamplainMapSource *next_source;
+  gchar *etag = g_steal_pointer (&user_data->etag);
+
+  g_signal_handlers_disconnect_by_func (tile, tile_rendered_cb, user_data);
+
+  next_source = champlain_map_source_get_next_source (map_source);
+
+  if (!error)
+    {
+      ChamplainTileSource *tile_source = CHAMPLAIN_TILE_SOURCE (map_source);
+      ChamplainTileCache *tile_cache = champlain_tile_source_get_cache (tile_source);
+
+      if (etag != NULL)
+        champlain_tile_set_etag (tile, etag);
+
+      if (tile_cache && data && user_data->store)
+        champlain_tile_cache_store_tile (tile_cache, tile, data, size);
+
+      champlain_tile_set_fade_in (tile, TRUE);
+      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+      champlain_tile_display_content (tile);
+    }
+  else if (next_source)
+    champlain_map_source_fill_tile (next_source, tile);
+
+  g_free (etag);
+  g_object_unref (map_source);
+}
+
+static void
+tile_source_loaded (ChamplainMapSource *self,
+                    const guint8       *data,
+                    gsize               size,
+                    ChamplainTile      *tile)
+{
+  ChamplainRenderer *renderer = champlain_map_source_get_renderer (self);
+  champlain_renderer_set_data (renderer, data, size);
+  champlain_renderer_render (renderer, tile);
+}
+
+static void
+on_tile_load_already_cached (ChamplainMapSource *self,
+                             ChamplainTile      *tile)
+{
+      ChamplainTileSource *tile_source = CHAMPLAIN_TILE_SOURCE (self);
+      ChamplainTileCache *tile_cache = champlain_tile_source_get_cache (tile_source);
+
+      if (tile_cache)
+        champlain_tile_cache_refresh_tile_time (tile_cache, tile);
+
+      champlain_tile_set_fade_in (tile, TRUE);
+      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+      champlain_tile_display_content (tile);
+}
+
+static void
+on_tile_load_failure (ChamplainMapSource *self,
+                      ChamplainTile      *tile)
+{
+  ChamplainMapSource *next_source = champlain_map_source_get_next_source (self);
+
+  if (next_source)
+    champlain_map_source_fill_tile (next_source, tile);
+}
+
+static void
+connect_to_render_complete (ChamplainMapSource *self,
+                            ChamplainTile      *tile,
+                            const char         *etag,
+                            gboolean            store)
+{
+  TileRenderedData *data;
+  data = g_slice_new (TileRenderedData);
+  data->map_source = g_object_ref (self);
+  data->etag = g_strdup (etag);
+  data->store = store;
+
+  g_signal_connect_data (tile,
+    "render-complete",
+    G_CALLBACK (tile_rendered_cb),
+    data,
+    (GClosureNotify)tile_rendered_data_free,
+    0);
+}
+
+static void
+tile_waiter_free (TileWaiter *waiter)
+{
+  if (waiter->state_handler_id)
+    g_signal_handler_disconnect (waiter->tile, waiter->state_handler_id);
+  g_object_unref (waiter->tile);
+  g_slice_free (TileWaiter, waiter);
+}
+
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+static void
+clear_response (TileRequest *request)
+{
+  g_clear_pointer (&request->response_etag, g_free);
+  g_clear_object (&request->stream);
+  g_clear_pointer (&request->contents, g_byte_array_unref);
+  g_clear_pointer (&request->decoder, champlain_image_stream_unref);
+  g_clear_pointer (&request->surface, cairo_surface_destroy);
+  request->decoded = FALSE;
+}
+#endif
+
+
+static void
+tile_request_free (TileRequest *request)
+{
+  g_list_free_full (request->waiters, (GDestroyNotify) tile_waiter_free);
+  if (request->retry_source_id)
+    g_source_remove (request->retry_source_id);
+  g_free (request->key);
+  g_free (request->uri);
+  g_free (request->host);
+  g_free (request->etag);
+  g_free (request->modified_since);
+#ifdef CHAMPLAIN_LIBSOUP_3
+  clear_response (request);
+  g_clear_object (&request->cancellable);
+  g_clear_object (&request->msg);
+#endif
+  g_slice_free (TileRequest, request);
+}
+
+
+static void
+set_current_conns (ChamplainNetworkTileSource *tile_source,
+    gint conns)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  conns = CLAMP (conns, MIN (priv->min_conns, priv->max_conns), priv->max_conns);
+  if (conns != priv->current_conns)
+    DEBUG ("Using %d connections", conns);
+
+  priv->current_conns = conns;
+  priv->window_start = 0;
+}
+
+
+/* Additive increase, multiplicative decrease: overload responses halve the
+ * concurrency, and after each window of completed downloads one connection
+ * is added if the last change didn't hurt, or removed if latency grew
+ * without throughput following. */
+static void
+adapt_concurrency (ChamplainNetworkTileSource *tile_source,
+    TileRequest *request,
+    RequestResult result,
+    gsize size)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  gint64 now = g_get_monotonic_time ();
+  gdouble latency, throughput;
+
+  if (!priv->adaptive_conns || result == REQUEST_CANCELLED)
+    return;
+
+  if (request->status == HTTP_STATUS_TOO_MANY_REQUESTS ||
+      request->status == SOUP_STATUS_SERVICE_UNAVAILABLE)
+    {
+      set_current_conns (tile_source, priv->current_conns / 2);
+      priv->last_throughput = 0;
+      return;
+    }
+
+  if (result == REQUEST_FAILED)
+    return;
+
+  latency = now - request->send_time;
+  if (priv->min_latency == 0 || latency < priv->min_latency)
+    priv->min_latency = latency;
+  priv->avg_latency = priv->avg_latency == 0 ? latency :
+    0.8 * priv->avg_latency + 0.2 * latency;
+
+  if (priv->window_start == 0)
+    {
+      priv->window_start = request->send_time;
+      priv->window_tiles = 0;
+      priv->window_bytes = 0;
+      priv->window_saturated = FALSE;
+    }
+
+  priv->window_tiles++;
+  priv->window_bytes += size;
+
+  if (priv->window_tiles < 2 * (guint) priv->current_conns || now <= priv->window_start)
+    return;
+
+  throughput = priv->window_bytes * (gdouble) G_USEC_PER_SEC / (now - priv->window_start);
+
+  DEBUG ("%d connections: %.0f B/s, latency %.0f us (best %.0f us)",
+      priv->current_conns, throughput, priv->avg_latency, priv->min_latency);
+
+  if (priv->avg_latency > LATENCY_GROWTH_LIMIT * priv->min_latency &&
+      throughput < priv->last_throughput)
+    set_current_conns (tile_source, priv->current_conns - 1);
+  else if (priv->window_saturated &&
+           throughput >= priv->last_throughput &&
+           priv->avg_latency <= LATENCY_GROWTH_LIMIT * priv->min_latency)
+    set_current_conns (tile_source, priv->current_conns + 1);
+  else
+    priv->window_start = 0;
+
+  priv->last_throughput = throughput;
+}
+
+
+static gboolean
+is_over_budget (ChamplainNetworkTileSource *tile_source)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  return priv->data_budget != 0 && priv->bytes_received >= priv->data_budget;
+}
+
+
+static void
+account_bytes (ChamplainNetworkTileSource *tile_source,
+    gsize size)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  if (size == 0)
+    return;
+
+  priv->bytes_received += size;
+  /* may go below zero, the next requests wait until the debt is paid */
+  priv->tokens -= size;
+
+  g_object_notify (G_OBJECT (tile_source), "bytes-received");
+}
+
+
+static gboolean
+free_idle_request (G_GNUC_UNUSED gpointer key,
+    TileRequest *request,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  if (request->msg)
+    return FALSE;
+
+  tile_request_free (request);
+  return TRUE;
+}
+
+
+static void
+host_state_free (HostState *host)
+{
+  GSList *iter;
+
+  if (host->probe_source_id)
+    g_source_remove (host->probe_source_id);
+
+  for (iter = host->failed_tiles; iter != NULL; iter = iter->next)
+    {
+      g_weak_ref_clear (iter->data);
+      g_free (iter->data);
+    }
+  g_slist_free (host->failed_tiles);
+
+  g_slice_free (HostState, host);
+}
+
+
+static void
+reset_host_protocol (G_GNUC_UNUSED const gchar *host_name,
+    HostState *host,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  /* learnt again from the next response */
+  host->multiplexed = FALSE;
+}
+
+
+static HostState *
+get_host_state (ChamplainNetworkTileSource *tile_source,
+    const gchar *host_name)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  HostState *host = g_hash_table_lookup (priv->hosts, host_name);
+
+  if (!host)
+    {
+      host = g_slice_new0 (HostState);
+      host->tile_source = tile_source;
+      g_hash_table_insert (priv->hosts, g_strdup (host_name), host);
+    }
+
+  return host;
+}
+
+
+static gboolean
+status_is_transient (guint status)
+{
+  return status == SOUP_STATUS_NONE ||
+#ifndef CHAMPLAIN_LIBSOUP_3
+         SOUP_STATUS_IS_TRANSPORT_ERROR (status) ||
+#endif
+         status == SOUP_STATUS_REQUEST_TIMEOUT ||
+         status == HTTP_STATUS_TOO_MANY_REQUESTS ||
+         SOUP_STATUS_IS_SERVER_ERROR (status);
+}
+
+
+static guint
+get_retry_after (SoupMessageHeaders *headers)
+{
+  const gchar *value = soup_message_headers_get_one (headers, "Retry-After");
+
+  /* HTTP dates aren't worth the trouble, servers mostly send seconds */
+  if (!value || !g_ascii_isdigit (*value))
+    return 0;
+
+  return MIN (strtoul (value, NULL, 10), RETRY_AFTER_MAX_S);
+}
+
+
+static void
+remember_failed_tile (HostState *host,
+    ChamplainTile *tile)
+{
+  GSList *iter, *next;
+  GWeakRef *ref;
+
+  for (iter = host->failed_tiles; iter != NULL; iter = next)
+    {
+      ChamplainTile *failed_tile = g_weak_ref_get (iter->data);
+
+      next = iter->next;
+
+      if (failed_tile == tile)
+        {
+          g_object_unref (failed_tile);
+          return;
+        }
+
+      if (failed_tile)
+        g_object_unref (failed_tile);
+      else
+        {
+          g_weak_ref_clear (iter->data);
+          g_free (iter->data);
+          host->failed_tiles = g_slist_delete_link (host->failed_tiles, iter);
+        }
+    }
+
+  ref = g_new (GWeakRef, 1);
+  g_weak_ref_init (ref, tile);
+  host->failed_tiles = g_slist_prepend (host->failed_tiles, ref);
+}
+
+
+static void
+refetch_failed_tiles (HostState *host)
+{
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (host->tile_source);
+  GSList *tiles = g_steal_pointer (&host->failed_tiles);
+  GSList *iter;
+
+  for (iter = tiles; iter != NULL; iter = iter->next)
+    {
+      ChamplainTile *tile = g_weak_ref_get (iter->data);
+
+      /* Only tiles still on the map and not reloaded meanwhile */
+      if (tile && clutter_actor_get_parent (CLUTTER_ACTOR (tile)) &&
+          champlain_tile_get_state (tile) == CHAMPLAIN_STATE_DONE)
+        {
+          DEBUG ("Reloading tile %d, %d, %d",
+              champlain_tile_get_zoom_level (tile),
+              champlain_tile_get_x (tile),
+              champlain_tile_get_y (tile));
+          champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADING);
+          fill_tile (map_source, tile);
+        }
+
+      g_clear_object (&tile);
+      g_weak_ref_clear (iter->data);
+      g_free (iter->data);
+    }
+
+  g_slist_free (tiles);
+}
+
+
+static gboolean
+host_probe_cb (HostState *host)
+{
+  host->probe_source_id = 0;
+
+  /* The first of the reloaded tiles finds out whether the host is back */
+  refetch_failed_tiles (host);
+
+  return FALSE;
+}
+
+
+static void
+open_breaker (HostState *host)
+{
+  host->open_duration = host->open_duration ?
+    MIN (host->open_duration * 2, BREAKER_MAX_OPEN_MS) : BREAKER_MIN_OPEN_MS;
+  host->open_until = g_get_monotonic_time () + (gint64) host->open_duration * 1000;
+
+  DEBUG ("Host seems down, no requests for %u ms", host->open_duration);
+
+  if (host->probe_source_id)
+    g_source_remove (host->probe_source_id);
+  host->probe_source_id = g_timeout_add (host->open_duration,
+        (GSourceFunc) host_probe_cb, host);
+}
+
+
+/* Returns TRUE when the tiles which failed because of the host should be
+   loaded again */
+static gboolean
+update_host_health (HostState *host,
+    TileRequest *request,
+    RequestResult result)
+{
+  if (request->probe)
+    host->probing = FALSE;
+
+  switch (result)
+    {
+    case REQUEST_LOADED:
+    case REQUEST_NOT_MODIFIED:
+      host->failures = 0;
+      host->open_until = 0;
+      host->open_duration = 0;
+      if (host->probe_source_id)
+        {
+          g_source_remove (host->probe_source_id);
+          host->probe_source_id = 0;
+        }
+      return host->failed_tiles != NULL;
+
+    case REQUEST_FAILED:
+      if (!request->transient)
+        break;
+
+      host->failures++;
+      if (request->probe ||
+          (host->open_until == 0 && host->failures >= BREAKER_FAILURE_THRESHOLD))
+        open_breaker (host);
+      break;
+
+    case REQUEST_CANCELLED:
+      break;
+    }
+
+  return FALSE;
+}
+
+
+static void
+finish_request (TileRequest *request,
+    RequestResult result,
+    const gchar *etag,
+    const guint8 *data,
+    gsize size)
+{
+  ChamplainNetworkTileSource *tile_source = request->tile_source;
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  ChamplainMapSource *map_source = CHAMPLAIN_MAP_SOURCE (tile_source);
+#ifdef CHAMPLAIN_LIBSOUP_3
+  ChamplainRenderer *renderer = champlain_map_source_get_renderer (map_source);
+#endif
+  gboolean store = TRUE;
+  GList *waiters, *iter;
+
+  /* a cancelled request is replaced by a new one for new waiters */
+  if (g_hash_table_lookup (priv->requests, request->key) == request)
+    g_hash_table_remove (priv->requests, request->key);
+
+  /* Completing a tile changes its state, stop listening first */
+  waiters = g_steal_pointer (&request->waiters);
+  for (iter = waiters; iter != NULL; iter = iter->next)
+    {
+      TileWaiter *waiter = iter->data;
+
+      g_signal_handler_disconnect (waiter->tile, waiter->state_handler_id);
+      waiter->state_handler_id = 0;
+    }
+
+  for (iter = waiters; iter != NULL; iter = iter->next)
+    {
+      ChamplainTile *tile = ((TileWaiter *) iter->data)->tile;
+
+      switch (result)
+        {
+        case REQUEST_LOADED:
+          if (request->background)
+            {
+              ChamplainTileCache *tile_cache = champlain_tile_source_get_cache (
+                    CHAMPLAIN_TILE_SOURCE (tile_source));
+
+              /* Nothing displays the new version yet, it only replaces the
+                 cached one */
+              if (tile_cache && store)
+                {
+                  if (etag != NULL)
+                    champlain_tile_set_etag (tile, etag);
+                  champlain_tile_cache_store_tile (tile_cache, tile, (const gchar *) data, size);
+                }
+              store = FALSE;
+              break;
+            }
+
+          /* the data is the same for all the tiles, store it once */
+          connect_to_render_complete (map_source, tile, etag, store);
+          store = FALSE;
+#ifdef CHAMPLAIN_LIBSOUP_3
+          if (request->decoded && CHAMPLAIN_IS_IMAGE_RENDERER (renderer))
+            {
+              champlain_image_renderer_render_surface (CHAMPLAIN_IMAGE_RENDERER (renderer),
+                  tile, request->surface, data, size);
+              break;
+            }
+#endif
+          tile_source_loaded (map_source, data, size, tile);
+          break;
+
+        case REQUEST_NOT_MODIFIED:
+          if (request->background)
+            {
+              ChamplainTileCache *tile_cache = champlain_tile_source_get_cache (
+                    CHAMPLAIN_TILE_SOURCE (tile_source));
+
+              /* the copy tile isn't shown, only the cached one is fresh again */
+              if (tile_cache)
+                champlain_tile_cache_refresh_tile_time (tile_cache, tile);
+              break;
+            }
+
+          on_tile_load_already_cached (map_source, tile);
+          break;
+
+        case REQUEST_FAILED:
+          /* the cached version stays */
+          if (request->background)
+            break;
+
+          /* reloaded once the host works again */
+          if (request->transient)
+            remember_failed_tile (get_host_state (tile_source, request->host), tile);
+          on_tile_load_failure (map_source, tile);
+          break;
+
+        case REQUEST_CANCELLED:
+          break;
+        }
+    }
+
+  g_list_free_full (waiters, (GDestroyNotify) tile_waiter_free);
+  tile_request_free (request);
+}
+
+
+static gboolean
+retry_request_cb (TileRequest *request)
+{
+  ChamplainNetworkTileSource *tile_source = request->tile_source;
+
+  request->retry_source_id = 0;
+  g_queue_push_tail (request->background ?
+      tile_source->priv->revalidations : tile_source->priv->queue, request);
+  dispatch_requests (tile_source);
+
+  return FALSE;
+}
+
+
+static void
+schedule_retry (TileRequest *request)
 {
-  g_clear_object (&data->tile);
-  g_clear_object (&data->map_source);
+  guint delay;
+
+  delay = MIN (RETRY_BASE_DELAY_MS << MIN (request->attempts - 1, 16), RETRY_MAX_DELAY_MS);
+  delay = delay / 2 + g_random_int_range (0, delay / 2 + 1);
+  delay = MAX (delay, request->retry_after * 1000);
+
+  DEBUG ("Retrying %s in %u ms", request->uri, delay);
+
 #ifdef CHAMPLAIN_LIBSOUP_3
-  g_clear_object (&data->cancellable);
-  g_clear_object (&data->msg);
+  clear_response (request);
+  g_clear_object (&request->msg);
+  g_clear_object (&request->cancellable);
+#else
+  /* owned by the session */
+  request->msg = NULL;
 #endif
-  g_slice_free (TileLoadedData, data);
+  request->status = SOUP_STATUS_NONE;
+  request->retry_after = 0;
+  request->retry_source_id = g_timeout_add (delay, (GSourceFunc) retry_request_cb, request);
 }
 
+
 static void
-tile_rendered_cb (ChamplainTile *tile,
-    gpointer data,
-    guint size,
-    gboolean error,
-    TileRenderedData *user_data)
+request_done (TileRequest *request,
+    RequestResult result,
+    const gchar *etag,
+    const guint8 *data,
+    gsize size)
 {
-  ChamplainMapSource *map_source = g_steal_pointer (&user_data->map_source);
-  ChamplainMapSource *next_source;
-  gchar *etag = g_steal_pointer (&user_data->etag);
+  ChamplainNetworkTileSource *tile_source = request->tile_source;
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  HostState *host = get_host_state (tile_source, request->host);
+  gboolean refetch;
 
-  g_signal_handlers_disconnect_by_func (tile, tile_rendered_cb, user_data);
+  priv->in_flight_load -= request->load;
+  if (request->background)
+    priv->n_revalidating--;
 
-  next_source = champlain_map_source_get_next_source (map_source);
+  if (result == REQUEST_FAILED)
+    {
+      request->transient = status_is_transient (request->status);
+      priv->error_count++;
+      g_object_notify (G_OBJECT (tile_source), "error-count");
+    }
+  else if (result == REQUEST_NOT_MODIFIED)
+    {
+      priv->not_modified_count++;
+      g_object_notify (G_OBJECT (tile_source), "not-modified-count");
+    }
 
-  if (!error)
+  adapt_concurrency (tile_source, request, result, size);
+  refetch = update_host_health (host, request, result);
+
+  if (result == REQUEST_FAILED && request->transient && request->waiters &&
+      request->attempts <= (guint) priv->max_retries && host->open_until == 0 &&
+      !is_over_budget (tile_source))
+    schedule_retry (request);
+  else
+    finish_request (request, result, etag, data, size);
+
+  if (refetch)
+    refetch_failed_tiles (host);
+
+  dispatch_requests (tile_source);
+
+  /* taken when the request was sent */
+  g_object_unref (tile_source);
+}
+
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+static void read_next_chunk (TileRequest *request);
+
+
+static void
+tile_decoded_cb (G_GNUC_UNUSED GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  TileRequest *request = user_data;
+  GError *error = NULL;
+
+  request->surface = champlain_image_stream_close_finish (res, &error);
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
     {
-      ChamplainTileSource *tile_source = CHAMPLAIN_TILE_SOURCE (map_source);
-      ChamplainTileCache *tile_cache = champlain_tile_source_get_cache (tile_source);
+      g_error_free (error);
+      request_done (request, REQUEST_CANCELLED, NULL, NULL, 0);
+      return;
+    }
 
-      if (etag != NULL)
-        champlain_tile_set_etag (tile, etag);
+  /* a tile which can't be decoded is rendered as an error */
+  if (error)
+    {
+      DEBUG ("Unable to decode tile %s: %s", request->uri, error->message);
+      g_error_free (error);
+    }
 
-      if (tile_cache && data)
-        champlain_tile_cache_store_tile (tile_cache, tile, data, size);
+  request->decoded = TRUE;
+  request_done (request, REQUEST_LOADED, request->response_etag,
+      request->contents->data, request->contents->len);
+}
 
-      champlain_tile_set_fade_in (tile, TRUE);
-      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
-      champlain_tile_display_content (tile);
+
+static void
+tile_chunk_read_cb (GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  TileRequest *request = user_data;
+  GError *error = NULL;
+  GBytes *bytes;
+  gsize size;
+  gconstpointer data;
+
+  bytes = g_input_stream_read_bytes_finish (G_INPUT_STREAM (source_object), res, &error);
+  if (!bytes)
+    {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        request_done (request, REQUEST_CANCELLED, NULL, NULL, 0);
+      else
+        {
+          DEBUG ("Unable to read tile %s: %s", request->uri, error->message);
+          request->status = SOUP_STATUS_NONE;
+          request_done (request, REQUEST_FAILED, NULL, NULL, 0);
+        }
+
+      g_error_free (error);
+      return;
     }
-  else if (next_source)
-    champlain_map_source_fill_tile (next_source, tile);
 
-  g_free (etag);
-  g_object_unref (map_source);
+  data = g_bytes_get_data (bytes, &size);
+  account_bytes (request->tile_source, size);
+  if (size > 0)
+    {
+      g_byte_array_append (request->contents, data, size);
+
+      /* Decode while the rest is still on its way */
+      if (request->decoder)
+        champlain_image_stream_write (request->decoder, bytes);
+
+      g_bytes_unref (bytes);
+      read_next_chunk (request);
+      return;
+    }
+
+  g_bytes_unref (bytes);
+  g_input_stream_close (request->stream, NULL, NULL);
+
+  if (request->decoder)
+    {
+      champlain_image_stream_close_async (request->decoder, request->cancellable,
+          tile_decoded_cb, request);
+      return;
+    }
+
+  request_done (request, REQUEST_LOADED, request->response_etag,
+      request->contents->data, request->contents->len);
+}
+
+
+static void
+read_next_chunk (TileRequest *request)
+{
+  g_input_stream_read_bytes_async (request->stream,
+      READ_CHUNK_SIZE,
+      G_PRIORITY_DEFAULT_IDLE,
+      request->cancellable,
+      tile_chunk_read_cb,
+      request);
+}
+
+
+static void
+tile_loaded_cb (GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  TileRequest *request = user_data;
+  SoupMessage *msg = request->msg;
+  GInputStream *stream;
+  GError *error = NULL;
+  SoupStatus status;
+  SoupMessageHeaders *response_headers;
+
+  stream = soup_session_send_finish (SOUP_SESSION (source_object), res, &error);
+  status = soup_message_get_status (msg);
+  request->status = status;
+
+  if (status != SOUP_STATUS_NONE)
+    get_host_state (request->tile_source, request->host)->multiplexed =
+      soup_message_get_http_version (msg) == SOUP_HTTP_2_0;
+
+  DEBUG ("Got reply %d", status);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      DEBUG ("Download of tile %s got cancelled", request->uri);
+      request_done (request, REQUEST_CANCELLED, NULL, NULL, 0);
+      goto cleanup;
+    }
+
+  if (status == SOUP_STATUS_NOT_MODIFIED)
+    {
+      request_done (request, REQUEST_NOT_MODIFIED, NULL, NULL, 0);
+      goto cleanup;
+    }
+
+  if (!stream || !SOUP_STATUS_IS_SUCCESSFUL (status))
+    {
+      DEBUG ("Unable to download tile %s: %s : %s",
+          request->uri,
+          soup_status_get_phrase (status),
+          soup_message_get_reason_phrase (msg));
+
+      request->retry_after = get_retry_after (soup_message_get_response_headers (msg));
+      request_done (request, REQUEST_FAILED, NULL, NULL, 0);
+      goto cleanup;
+    }
+
+  /* Verify if the server sent an etag and save it */
+  response_headers = soup_message_get_response_headers (msg);
+  request->response_etag = g_strdup (soup_message_headers_get_one (response_headers, "ETag"));
+  DEBUG ("Received ETag %s", request->response_etag);
+
+  request->stream = g_steal_pointer (&stream);
+  request->contents = g_byte_array_sized_new (
+        CLAMP (soup_message_headers_get_content_length (response_headers), 0, 1 << 20));
+
+  /* The image renderer can take the image decoded as it arrives; the
+     revalidations only go to the caches */
+  if (!request->background && request->waiters &&
+      CHAMPLAIN_IS_IMAGE_RENDERER (champlain_map_source_get_renderer (
+            CHAMPLAIN_MAP_SOURCE (request->tile_source))))
+    {
+      ChamplainTile *tile = ((TileWaiter *) request->waiters->data)->tile;
+
+      request->decoder = champlain_image_stream_new (
+            champlain_tile_get_size (tile) * champlain_tile_get_scale_factor (tile));
+    }
+
+  read_next_chunk (request);
+
+cleanup:
+  g_clear_error (&error);
+  g_clear_object (&stream);
+}
+#else
+static void
+tile_loaded_cb (G_GNUC_UNUSED SoupSession *session,
+    SoupMessage *msg,
+    gpointer user_data)
+{
+  TileRequest *request = user_data;
+  const gchar *etag;
+
+  DEBUG ("Got reply %d", msg->status_code);
+  request->status = msg->status_code;
+  if (msg->response_body)
+    account_bytes (request->tile_source, msg->response_body->length);
+
+  if (msg->status_code == SOUP_STATUS_CANCELLED)
+    {
+      DEBUG ("Download of tile %s got cancelled", request->uri);
+      request_done (request, REQUEST_CANCELLED, NULL, NULL, 0);
+      return;
+    }
+
+  if (msg->status_code == SOUP_STATUS_NOT_MODIFIED)
+    {
+      request_done (request, REQUEST_NOT_MODIFIED, NULL, NULL, 0);
+      return;
+    }
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+    {
+      DEBUG ("Unable to download tile %s: %s",
+          request->uri,
+          soup_status_get_phrase (msg->status_code));
+
+      request->retry_after = get_retry_after (msg->response_headers);
+      request_done (request, REQUEST_FAILED, NULL, NULL, 0);
+      return;
+    }
+
+  /* Verify if the server sent an etag and save it */
+  etag = soup_message_headers_get_one (msg->response_headers, "ETag");
+  DEBUG ("Received ETag %s", etag);
+
+  request_done (request, REQUEST_LOADED, etag,
+      (guint8 *) msg->response_body->data, msg->response_body->length);
+}
+#endif
+
+
+static void
+cancel_request (TileRequest *request)
+{
+  ChamplainNetworkTileSourcePrivate *priv = request->tile_source->priv;
+
+  /* Tiles asking for the same URI from now on need a new request */
+  g_hash_table_remove (priv->requests, request->key);
+
+  if (request->msg)
+    {
+      DEBUG ("Canceling tile download");
+#ifdef CHAMPLAIN_LIBSOUP_3
+      g_cancellable_cancel (request->cancellable);
+#else
+      soup_session_cancel_message (priv->soup_session, request->msg, SOUP_STATUS_CANCELLED);
+#endif
+    }
+  else
+    {
+      /* not in the queue while waiting for a retry */
+      g_queue_remove (request->background ? priv->revalidations : priv->queue, request);
+      tile_request_free (request);
+    }
+}
+
+
+static void
+tile_state_notify (ChamplainTile *tile,
+    G_GNUC_UNUSED GParamSpec *pspec,
+    TileWaiter *waiter)
+{
+  TileRequest *request = waiter->request;
+
+  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+    return;
+
+  request->waiters = g_list_remove (request->waiters, waiter);
+  tile_waiter_free (waiter);
+
+  /* Nobody is interested in the tile any more */
+  if (!request->waiters)
+    cancel_request (request);
+}
+
+
+static gchar *
+get_modified_time_string (ChamplainTile *tile)
+{
+  const GTimeVal *time;
+
+  g_return_val_if_fail (CHAMPLAIN_TILE (tile), NULL);
+
+  time = champlain_tile_get_modified_time (tile);
+
+  if (time == NULL)
+    return NULL;
+
+  struct tm *other_time = gmtime (&time->tv_sec);
+  char value[100];
+
+#ifdef G_OS_WIN32
+  strftime (value, 100, "%a, %d %b %Y %H:%M:%S %Z", other_time);
+#else
+  strftime (value, 100, "%a, %d %b %Y %T %Z", other_time);
+#endif
+
+  return g_strdup (value);
+}
+
+
+static void
+send_request (TileRequest *request)
+{
+  ChamplainNetworkTileSource *tile_source = request->tile_source;
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  SoupMessageHeaders *headers;
+  SoupMessage *msg;
+
+  /* released in request_done() */
+  g_object_ref (tile_source);
+  request->load = get_host_state (tile_source, request->host)->multiplexed ?
+    1 : STREAMS_PER_CONN;
+  priv->in_flight_load += request->load;
+  request->send_time = g_get_monotonic_time ();
+  request->attempts++;
+  priv->request_count++;
+  g_object_notify (G_OBJECT (tile_source), "request-count");
+
+  msg = soup_message_new (SOUP_METHOD_GET, request->uri);
+  if (!msg)
+    {
+      DEBUG ("Invalid tile URI %s", request->uri);
+      request->status = SOUP_STATUS_BAD_REQUEST;
+      request_done (request, REQUEST_FAILED, NULL, NULL, 0);
+      return;
+    }
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+  headers = soup_message_get_request_headers (msg);
+#else
+  headers = msg->request_headers;
+#endif
+
+  /* If an etag is available, only use it.
+   * OSM servers seems to send now as the modified time for all tiles
+   * Omarender servers set the modified time correctly
+   */
+  if (request->etag)
+    {
+      DEBUG ("If-None-Match: %s", request->etag);
+      soup_message_headers_append (headers,
+          "If-None-Match", request->etag);
+    }
+  else if (request->modified_since)
+    {
+      DEBUG ("If-Modified-Since %s", request->modified_since);
+      soup_message_headers_append (headers,
+          "If-Modified-Since", request->modified_since);
+    }
+
+  request->msg = msg;
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+  request->cancellable = g_cancellable_new ();
+  soup_session_send_async (priv->soup_session,
+      request->msg,
+      G_PRIORITY_DEFAULT_IDLE,
+      request->cancellable,
+      tile_loaded_cb,
+      request);
+#else
+  /* the session owns the message */
+  soup_session_queue_message (priv->soup_session, msg,
+      tile_loaded_cb,
+      request);
+#endif
 }
 
-static void
-tile_source_loaded (ChamplainMapSource *self,
-                    const guint8       *data,
-                    gsize               size,
-                    ChamplainTile      *tile)
-{
-  ChamplainRenderer *renderer = champlain_map_source_get_renderer (self);
-  champlain_renderer_set_data (renderer, data, size);
-  champlain_renderer_render (renderer, tile);
-}
 
-static void
-on_tile_load_already_cached (ChamplainMapSource *self,
-                             ChamplainTile      *tile)
+static gdouble
+get_request_distance (ChamplainNetworkTileSource *tile_source,
+    TileRequest *request)
 {
-      ChamplainTileSource *tile_source = CHAMPLAIN_TILE_SOURCE (self);
-      ChamplainTileCache *tile_cache = champlain_tile_source_get_cache (tile_source);
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  ChamplainTile *tile = ((TileWaiter *) request->waiters->data)->tile;
+  guint zoom_level = champlain_tile_get_zoom_level (tile);
+  gdouble scale, dx, dy;
 
-      if (tile_cache)
-        champlain_tile_cache_refresh_tile_time (tile_cache, tile);
+  if (!priv->has_focus)
+    return 0;
 
-      champlain_tile_set_fade_in (tile, TRUE);
-      champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
-      champlain_tile_display_content (tile);
+  scale = pow (2.0, (gdouble) priv->focus_zoom - zoom_level);
+  dx = (champlain_tile_get_x (tile) + 0.5) * scale - priv->focus_x;
+  dy = (champlain_tile_get_y (tile) + 0.5) * scale - priv->focus_y;
+
+  return sqrt (dx * dx + dy * dy) +
+         (zoom_level == priv->focus_zoom ? 0 : OTHER_ZOOM_DISTANCE);
 }
 
+
 static void
-on_tile_load_failure (ChamplainMapSource *self,
-                      ChamplainTile      *tile)
+fail_hopeless_requests (ChamplainNetworkTileSource *tile_source,
+    GQueue *queue)
 {
-  ChamplainMapSource *next_source = champlain_map_source_get_next_source (self);
+  gboolean over_budget = is_over_budget (tile_source);
+  gint64 now = g_get_monotonic_time ();
+  GList *iter, *next, *hopeless = NULL;
 
-  if (next_source)
-    champlain_map_source_fill_tile (next_source, tile);
+  for (iter = queue->head; iter != NULL; iter = next)
+    {
+      TileRequest *request = iter->data;
+      HostState *host = get_host_state (tile_source, request->host);
+
+      next = iter->next;
+      /* only the tiles of a host which is down are loaded again later */
+      request->transient = host->open_until != 0 && now < host->open_until;
+      if (request->transient || over_budget)
+        {
+          g_queue_delete_link (queue, iter);
+          hopeless = g_list_prepend (hopeless, request);
+        }
+    }
+
+  for (iter = hopeless; iter != NULL; iter = iter->next)
+    finish_request (iter->data, REQUEST_FAILED, NULL, NULL, 0);
+  g_list_free (hopeless);
 }
 
-static void
-connect_to_render_complete (ChamplainMapSource *self,
-                            ChamplainTile      *tile,
-                            const char         *etag)
+
+static gboolean
+throttle_expired_cb (ChamplainNetworkTileSource *tile_source)
 {
-  TileRenderedData *data;
-  data = g_slice_new (TileRenderedData);
-  data->map_source = g_object_ref (self);
-  data->etag = g_strdup (etag);
+  tile_source->priv->throttle_source_id = 0;
+  dispatch_requests (tile_source);
 
-  g_signal_connect_data (tile,
-    "render-complete",
-    G_CALLBACK (tile_rendered_cb),
-    data,
-    (GClosureNotify)tile_rendered_data_free,
-    0);
+  return FALSE;
 }
 
-#ifdef CHAMPLAIN_LIBSOUP_3
-static void
-tile_bytes_loaded_cb (GObject *source_object,
-    GAsyncResult *res,
-    gpointer user_data)
+
+/* Returns TRUE when the rate limit allows sending a request now */
+static gboolean
+refill_tokens (ChamplainNetworkTileSource *tile_source)
 {
-  GMemoryOutputStream *output_stream = G_MEMORY_OUTPUT_STREAM (source_object);
-  TileLoadedData *callback_data = user_data;
-  ChamplainTile *tile = callback_data->tile;
-  ChamplainMapSource *map_source = callback_data->map_source;
-  GError *error = NULL;
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  gint64 now = g_get_monotonic_time ();
 
-  if (g_output_stream_splice_finish (G_OUTPUT_STREAM (output_stream), res, &error) != -1) {
-    gsize size = g_memory_output_stream_get_data_size (output_stream);
-    gconstpointer data = g_memory_output_stream_get_data (output_stream);
-    tile_source_loaded (map_source, data, size, tile);
-  }
+  if (priv->rate_limit == 0)
+    return TRUE;
 
-  g_clear_error (&error);
-  tile_loaded_data_free (callback_data);
+  priv->tokens = MIN (priv->tokens + (now - priv->tokens_time) * priv->rate_limit / 1e6,
+        priv->rate_limit);
+  priv->tokens_time = now;
+
+  if (priv->tokens > 0)
+    return TRUE;
+
+  if (!priv->throttle_source_id)
+    priv->throttle_source_id = g_timeout_add ((guint) (1 - priv->tokens * 1000 / priv->rate_limit),
+          (GSourceFunc) throttle_expired_cb, tile_source);
+
+  return FALSE;
 }
 
-static void
-tile_loaded_cb (GObject *source_object,
-    GAsyncResult *res,
-    gpointer user_data)
+
+static TileRequest *
+pop_nearest_request (ChamplainNetworkTileSource *tile_source,
+    GQueue *queue,
+    guint room)
 {
-  TileLoadedData *callback_data = (TileLoadedData *) user_data;
-  GCancellable *cancellable = callback_data->cancellable;
-  SoupMessage *msg = callback_data->msg;
-  ChamplainTile *tile = callback_data->tile;
-  ChamplainMapSource *map_source = callback_data->map_source;
-  const gchar *etag;
-  GInputStream *stream;
-  GOutputStream *ostream;
-  GError *error = NULL;
-  SoupStatus status;
-  SoupMessageHeaders *response_headers;
+  GList *iter, *best = NULL;
+  gdouble best_distance = G_MAXDOUBLE;
+  TileRequest *request;
+  HostState *host;
+
+  /* The focus moves with the view so the distances are computed now;
+     on ties the request queued first wins. Requests for a host being
+     probed wait for the outcome, and requests to hosts without HTTP/2
+     wait for room for a whole connection. */
+  for (iter = queue->head; iter != NULL; iter = iter->next)
+    {
+      gdouble distance;
 
-  stream = soup_session_send_finish (SOUP_SESSION (source_object), res, &error);
-  status = soup_message_get_status (msg);
+      request = iter->data;
+      host = get_host_state (tile_source, request->host);
+      if (host->probing || (!host->multiplexed && room < STREAMS_PER_CONN))
+        continue;
+
+      distance = get_request_distance (tile_source, request);
+      if (distance < best_distance)
+        {
+          best = iter;
+          best_distance = distance;
+        }
+    }
 
-  g_signal_handlers_disconnect_by_func (tile, tile_state_notify, cancellable);
+  if (!best)
+    return NULL;
 
-  DEBUG ("Got reply %d", status);
+  request = best->data;
+  g_queue_delete_link (queue, best);
 
-  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+  /* The first request after the pause finds out if the host is back */
+  host = get_host_state (tile_source, request->host);
+  if (host->open_until != 0)
     {
-      DEBUG ("Download of tile %d, %d got cancelled",
-          champlain_tile_get_x (tile), champlain_tile_get_y (tile));
-      goto cleanup;
+      host->probing = TRUE;
+      request->probe = TRUE;
     }
 
-  if (status == SOUP_STATUS_NOT_MODIFIED)
+  return request;
+}
+
+
+static void
+dispatch_requests (ChamplainNetworkTileSource *tile_source)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  gint max_conns = priv->adaptive_conns ? priv->current_conns : priv->max_conns;
+  /* With HTTP/2 more requests fit into the same connections, so the window
+     is counted in streams */
+  guint max_load = max_conns * STREAMS_PER_CONN;
+  TileRequest *request;
+
+  /* Requests for hosts which are down or beyond the budget fail right away */
+  fail_hopeless_requests (tile_source, priv->queue);
+  fail_hopeless_requests (tile_source, priv->revalidations);
+
+  /* More connections would have been used, so adding one may help */
+  if (priv->in_flight_load + STREAMS_PER_CONN > max_load && !g_queue_is_empty (priv->queue))
+    priv->window_saturated = TRUE;
+
+  while (priv->in_flight_load < max_load &&
+         !g_queue_is_empty (priv->queue) &&
+         refill_tokens (tile_source) &&
+         (request = pop_nearest_request (tile_source, priv->queue,
+              max_load - priv->in_flight_load)) != NULL)
+    send_request (request);
+
+  /* Revalidations only get connections nobody waiting for a tile needs */
+  while (g_queue_is_empty (priv->queue) &&
+         priv->in_flight_load < max_load &&
+         !g_queue_is_empty (priv->revalidations) &&
+         refill_tokens (tile_source) &&
+         priv->n_revalidating < REVALIDATION_CONNS &&
+         (request = pop_nearest_request (tile_source, priv->revalidations,
+              max_load - priv->in_flight_load)) != NULL)
     {
-      on_tile_load_already_cached (map_source, tile);
-      goto cleanup;
+      priv->n_revalidating++;
+      send_request (request);
     }
+}
 
-  if (!SOUP_STATUS_IS_SUCCESSFUL (status))
-    {
-      DEBUG ("Unable to download tile %d, %d: %s : %s",
-          champlain_tile_get_x (tile),
-          champlain_tile_get_y (tile),
-          soup_status_get_phrase (status),
-          soup_message_get_reason_phrase (msg));
 
-      on_tile_load_failure (map_source, tile);
-      goto cleanup;
-    }
+static gboolean
+dispatch_requests_cb (ChamplainNetworkTileSource *tile_source)
+{
+  tile_source->priv->dispatch_source_id = 0;
+  dispatch_requests (tile_source);
 
-  /* Verify if the server sent an etag and save it */
-  response_headers = soup_message_get_response_headers (msg);
-  etag = soup_message_headers_get_one (response_headers, "ETag");
-  DEBUG ("Received ETag %s", etag);
+  return FALSE;
+}
 
-  connect_to_render_complete (map_source, tile, etag);
 
-  ostream = g_memory_output_stream_new_resizable ();
-  g_output_stream_splice_async (ostream,
-      stream,
-      G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
-      G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-      G_PRIORITY_DEFAULT_IDLE,
-      cancellable,
-      tile_bytes_loaded_cb,
-      callback_data);
-  g_clear_object (&ostream);
-  g_clear_object (&stream);
+/*
+ * Tells the source where the middle of the view is, in tiles at the given
+ * zoom level. Queued requests closest to it are sent first.
+ */
+void
+champlain_network_tile_source_set_focus (ChamplainNetworkTileSource *tile_source,
+    guint zoom_level,
+    gdouble x,
+    gdouble y)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
 
-  return;
-cleanup:
-  tile_loaded_data_free (callback_data);
-  g_clear_error (&error);
-  g_clear_object (&stream);
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+
+  priv->has_focus = TRUE;
+  priv->focus_zoom = zoom_level;
+  priv->focus_x = x;
+  priv->focus_y = y;
 }
-#else
-static void
-tile_loaded_cb (G_GNUC_UNUSED SoupSession *session,
-    SoupMessage *msg,
-    gpointer user_data)
-{
-  TileLoadedData *callback_data = (TileLoadedData *) user_data;
-  ChamplainMapSource *map_source = callback_data->map_source;
-  ChamplainTile *tile = callback_data->tile;
-  const gchar *etag;
 
-  g_signal_handlers_disconnect_by_func (tile, tile_state_notify, callback_data->cancelled_data);
 
-  DEBUG ("Got reply %d", msg->status_code);
+static gchar *
+get_uri_host (const gchar *uri)
+{
+  GUri *guri = g_uri_parse (uri, G_URI_FLAGS_NONE, NULL);
+  gchar *host = NULL;
 
-  if (msg->status_code == SOUP_STATUS_CANCELLED)
+  if (guri)
     {
-      DEBUG ("Download of tile %d, %d got cancelled",
-          champlain_tile_get_x (tile), champlain_tile_get_y (tile));
-      goto cleanup;
+      host = g_strdup (g_uri_get_host (guri));
+      g_uri_unref (guri);
     }
 
-  if (msg->status_code == SOUP_STATUS_NOT_MODIFIED)
+  return host ? host : g_strdup ("");
+}
+
+
+#if defined (CHAMPLAIN_LIBSOUP_3) || SOUP_CHECK_VERSION (2, 62, 0)
+static void
+preconnected_cb (GObject *source_object,
+    GAsyncResult *res,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  GError *error = NULL;
+
+  if (!soup_session_preconnect_finish (SOUP_SESSION (source_object), res, &error))
     {
-      on_tile_load_already_cached (map_source, tile);
-      goto cleanup;
+      DEBUG ("Unable to preconnect: %s", error->message);
+      g_error_free (error);
     }
+}
+#endif
 
-  if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+
+/**
+ * champlain_network_tile_source_preconnect:
+ * @tile_source: the #ChamplainNetworkTileSource
+ *
+ * Opens a connection to each of the hosts the tiles come from, so that the
+ * DNS lookup and the TCP and TLS handshakes are done before the first tiles
+ * are requested. This is done on its own when the source is set to a
+ * #ChamplainView; call it when the tiles are about to be needed otherwise.
+ *
+ * Nothing is done when the source is offline, has used up its data budget or
+ * preconnected recently.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_network_tile_source_preconnect (ChamplainNetworkTileSource *tile_source)
+{
+  g_return_if_fail (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (tile_source));
+
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  gint64 now = g_get_monotonic_time ();
+  GHashTable *hosts;
+  guint n_subdomains, i;
+
+  if (priv->offline || !priv->uri_format || is_over_budget (tile_source))
+    return;
+
+  /* The connections are probably still open */
+  if (priv->last_preconnect != 0 &&
+      (priv->keep_alive == 0 || now - priv->last_preconnect < priv->keep_alive * G_USEC_PER_SEC / 2))
+    return;
+  priv->last_preconnect = now;
+
+  /* Each subdomain may be a different host */
+  hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  n_subdomains = MAX (1, priv->subdomains ? g_strv_length (priv->subdomains) : 0);
+
+  for (i = 0; i < n_subdomains; i++)
     {
-      DEBUG ("Unable to download tile %d, %d: %s",
-          champlain_tile_get_x (tile),
-          champlain_tile_get_y (tile),
-          soup_status_get_phrase (msg->status_code));
+      gchar *uri = get_tile_uri (tile_source, i, 0, 0, 1);
+      gchar *host = get_uri_host (uri);
 
-      on_tile_load_failure (map_source, tile);
-      goto cleanup;
+      if (*host == '\0' || g_hash_table_contains (hosts, host))
+        {
+          g_free (host);
+          g_free (uri);
+          continue;
+        }
+
+      DEBUG ("Preconnecting to %s", host);
+      g_hash_table_add (hosts, host);
+
+#if defined (CHAMPLAIN_LIBSOUP_3) || SOUP_CHECK_VERSION (2, 62, 0)
+      SoupMessage *msg = soup_message_new (SOUP_METHOD_GET, uri);
+
+      if (msg)
+        {
+          soup_session_preconnect_async (priv->soup_session, msg,
+              G_PRIORITY_LOW, NULL, preconnected_cb, NULL);
+          g_object_unref (msg);
+        }
+#else
+      /* only the name lookup can be done ahead with older libsoup */
+      soup_session_prefetch_dns (priv->soup_session, host, NULL, NULL, NULL);
+#endif
+      g_free (uri);
     }
 
-  /* Verify if the server sent an etag and save it */
-  etag = soup_message_headers_get_one (msg->response_headers, "ETag");
-  DEBUG ("Received ETag %s", etag);
+  g_hash_table_destroy (hosts);
+}
+
+
+static TileRequest *
+queue_request (ChamplainNetworkTileSource *tile_source,
+    GQueue *queue,
+    gchar *key,
+    gchar *uri,
+    gchar *etag,
+    gchar *date)
+{
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  TileRequest *request;
 
-  connect_to_render_complete (map_source, tile, etag);
+  request = g_slice_new0 (TileRequest);
+  request->tile_source = tile_source;
+  request->key = key;
+  request->uri = uri;
+  request->host = get_uri_host (uri);
+  request->etag = etag;
+  request->modified_since = date;
 
-  tile_source_loaded (map_source, (guint8*) msg->response_body->data, msg->response_body->length, tile);
+  g_hash_table_insert (priv->requests, request->key, request);
+  g_queue_push_tail (queue, request);
 
-cleanup:
-  tile_loaded_data_free (callback_data);
+  /* Let the view queue all the visible tiles before picking one */
+  if (!priv->dispatch_source_id)
+    priv->dispatch_source_id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+          (GSourceFunc) dispatch_requests_cb, tile_source, NULL);
+
+  return request;
 }
 
+
 static void
-destroy_cancelled_data (TileCancelledData *data,
-    G_GNUC_UNUSED GClosure *closure)
+add_waiter (TileRequest *request,
+    ChamplainTile *tile)
 {
-  if (data->map_source)
-    g_object_remove_weak_pointer (G_OBJECT (data->map_source), (gpointer *) &data->map_source);
+  TileWaiter *waiter;
+
+  waiter = g_slice_new (TileWaiter);
+  waiter->request = request;
+  waiter->tile = g_object_ref (tile);
+  waiter->state_handler_id = g_signal_connect (tile, "notify::state",
+        G_CALLBACK (tile_state_notify), waiter);
+  request->waiters = g_list_append (request->waiters, waiter);
+}
 
-  if (data->msg)
-    g_object_remove_weak_pointer (G_OBJECT (data->msg), (gpointer *) &data->msg);
 
-  g_slice_free (TileCancelledData, data);
+static void
+get_validators (ChamplainTile *tile,
+    gchar **etag,
+    gchar **date)
+{
+  *etag = g_strdup (champlain_tile_get_etag (tile));
+  *date = *etag ? NULL : get_modified_time_string (tile);
 }
-#endif
 
 
 static void
-tile_state_notify (ChamplainTile *tile,
-    G_GNUC_UNUSED GParamSpec *pspec,
-    gpointer user_data)
+drop_farthest_revalidation (ChamplainNetworkTileSource *tile_source)
 {
-#ifdef CHAMPLAIN_LIBSOUP_3
-  GCancellable *cancellable = user_data;
-#else
-  TileCancelledData *data = user_data;
-  if (!data->map_source || !data->msg)
-    return;
-#endif
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  GList *iter, *farthest = NULL;
+  gdouble farthest_distance = -1;
+  TileRequest *request;
 
-  if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_DONE)
+  for (iter = priv->revalidations->head; iter != NULL; iter = iter->next)
     {
-      DEBUG ("Canceling tile download");
-#ifdef CHAMPLAIN_LIBSOUP_3
-      g_cancellable_cancel (cancellable);
-#else
-      ChamplainNetworkTileSourcePrivate *priv = CHAMPLAIN_NETWORK_TILE_SOURCE (data->map_source)->priv;
-      soup_session_cancel_message (priv->soup_session, data->msg, SOUP_STATUS_CANCELLED);
-#endif
+      gdouble distance = get_request_distance (tile_source, iter->data);
+
+      if (distance > farthest_distance)
+        {
+          farthest = iter;
+          farthest_distance = distance;
+        }
     }
+
+  request = farthest->data;
+  g_queue_delete_link (priv->revalidations, farthest);
+  g_hash_table_remove (priv->requests, request->key);
+  tile_request_free (request);
 }
 
 
-static gchar *
-get_modified_time_string (ChamplainTile *tile)
+static void
+queue_revalidation (ChamplainNetworkTileSource *tile_source,
+    ChamplainTile *tile,
+    gchar *uri)
 {
-  const GTimeVal *time;
-
-  g_return_val_if_fail (CHAMPLAIN_TILE (tile), NULL);
-
-  time = champlain_tile_get_modified_time (tile);
-
-  if (time == NULL)
-    return NULL;
+  ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
+  ChamplainTile *copy;
+  TileRequest *request;
+  gchar *etag, *date;
+  gchar *key;
 
-  struct tm *other_time = gmtime (&time->tv_sec);
-  char value[100];
+  key = g_strconcat (uri, "\nrevalidate", NULL);
+  if (g_hash_table_contains (priv->requests, key))
+    {
+      g_free (key);
+      g_free (uri);
+      return;
+    }
 
-#ifdef G_OS_WIN32
-  strftime (value, 100, "%a, %d %b %Y %H:%M:%S %Z", other_time);
-#else
-  strftime (value, 100, "%a, %d %b %Y %T %Z", other_time);
-#endif
+  get_validators (tile, &etag, &date);
+  request = queue_request (tile_source, priv->revalidations, key, uri, etag, date);
+  request->background = TRUE;
 
-  return g_strdup (value);
+  /* The displayed tile is done, the result goes to the caches through a
+     tile of its own, see finish_request() */
+  copy = g_object_ref_sink (champlain_tile_new_full (champlain_tile_get_x (tile),
+          champlain_tile_get_y (tile),
+          champlain_tile_get_size (tile),
+          champlain_tile_get_zoom_level (tile)));
+  champlain_tile_set_scale_factor (copy, champlain_tile_get_scale_factor (tile));
+  champlain_tile_set_state (copy, CHAMPLAIN_STATE_LOADING);
+  add_waiter (request, copy);
+  g_object_unref (copy);
+
+  if (g_queue_get_length (priv->revalidations) > MAX_REVALIDATIONS)
+    drop_farthest_revalidation (tile_source);
 }
 
 
@@ -1017,91 +3436,58 @@ fill_tile (ChamplainMapSource *map_source,
 
   ChamplainNetworkTileSource *tile_source = CHAMPLAIN_NETWORK_TILE_SOURCE (map_source);
   ChamplainNetworkTileSourcePrivate *priv = tile_source->priv;
-#ifdef CHAMPLAIN_LIBSOUP_3
-  GCancellable *cancellable = NULL;
-#endif
 
   if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_DONE)
     return;
 
-  if (!priv->offline)
+  /* Over the budget, only what the caches have is used */
+  if (!priv->offline && !is_over_budget (tile_source))
     {
-      TileLoadedData *callback_data;
-      SoupMessage *msg;
+      TileRequest *request;
       gchar *uri;
+      gchar *etag = NULL;
+      gchar *date = NULL;
+      gchar *key;
 
       uri = get_tile_uri (tile_source,
             champlain_tile_get_x (tile),
             champlain_tile_get_y (tile),
-            champlain_tile_get_zoom_level (tile));
-      msg = soup_message_new (SOUP_METHOD_GET, uri);
-      g_free (uri);
+            champlain_tile_get_zoom_level (tile),
+            champlain_tile_get_scale_factor (tile));
 
       if (champlain_tile_get_state (tile) == CHAMPLAIN_STATE_LOADED)
         {
-          /* validate tile */
-
-          const gchar *etag = champlain_tile_get_etag (tile);
-          gchar *date = get_modified_time_string (tile);
-#ifdef CHAMPLAIN_LIBSOUP_3
-          SoupMessageHeaders *headers = soup_message_get_request_headers (msg);
-#else
-          SoupMessageHeaders *headers = msg->request_headers;
-#endif
-
-          /* If an etag is available, only use it.
-           * OSM servers seems to send now as the modified time for all tiles
-           * Omarender servers set the modified time correctly
-           */
-          if (etag)
+          if (priv->background_revalidation)
             {
-              DEBUG ("If-None-Match: %s", etag);
-              soup_message_headers_append (headers,
-                  "If-None-Match", etag);
-            }
-          else if (date)
-            {
-              DEBUG ("If-Modified-Since %s", date);
-              soup_message_headers_append (headers,
-                  "If-Modified-Since", date);
+              queue_revalidation (tile_source, tile, uri);
+
+              /* The cached version is good enough until then */
+              champlain_tile_set_fade_in (tile, FALSE);
+              champlain_tile_set_state (tile, CHAMPLAIN_STATE_DONE);
+              champlain_tile_display_content (tile);
+              return;
             }
 
-          g_free (date);
+          /* validate tile */
+          get_validators (tile, &etag, &date);
         }
 
-#ifdef CHAMPLAIN_LIBSOUP_3
-      cancellable = g_cancellable_new ();
-      g_signal_connect_data (tile, "notify::state", G_CALLBACK (tile_state_notify), g_object_ref (cancellable), (GClosureNotify) g_object_unref, 0);
-#else
-      TileCancelledData *tile_cancelled_data = g_slice_new (TileCancelledData);
-      tile_cancelled_data->map_source = map_source;
-      tile_cancelled_data->msg = msg;
-
-      g_object_add_weak_pointer (G_OBJECT (msg), (gpointer *) &tile_cancelled_data->msg);
-      g_object_add_weak_pointer (G_OBJECT (map_source), (gpointer *) &tile_cancelled_data->map_source);
+      /* Validations are only shared by tiles with the same cached version */
+      key = g_strconcat (uri, "\n", etag ? etag : "", "\n", date ? date : "", NULL);
+      request = g_hash_table_lookup (priv->requests, key);
 
-      g_signal_connect_data (tile, "notify::state", G_CALLBACK (tile_state_notify),
-          tile_cancelled_data, (GClosureNotify) destroy_cancelled_data, 0);
-#endif
+      if (request)
+        {
+          DEBUG ("Joining the download of %s", uri);
+          g_free (key);
+          g_free (uri);
+          g_free (etag);
+          g_free (date);
+        }
+      else
+        request = queue_request (tile_source, priv->queue, key, uri, etag, date);
 
-      callback_data = g_slice_new (TileLoadedData);
-      callback_data->tile = g_object_ref (tile);
-      callback_data->map_source = g_object_ref (map_source);
-#ifdef CHAMPLAIN_LIBSOUP_3
-      callback_data->cancellable = g_steal_pointer (&cancellable);
-      callback_data->msg = g_steal_pointer (&msg);
-      soup_session_send_async (priv->soup_session,
-          callback_data->msg,
-          G_PRIORITY_DEFAULT_IDLE,
-          callback_data->cancellable,
-          tile_loaded_cb,
-          callback_data);
-#else
-      callback_data->cancelled_data = tile_cancelled_data;
-      soup_session_queue_message (priv->soup_session, msg,
-          tile_loaded_cb,
-          callback_data);
-#endif
+      add_waiter (request, tile);
     }
   else
     {
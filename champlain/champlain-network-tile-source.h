@@ -100,9 +100,49 @@ gint champlain_network_tile_source_get_max_conns (ChamplainNetworkTileSource *ti
 void champlain_network_tile_source_set_max_conns (ChamplainNetworkTileSource *tile_source,
     gint max_conns);
 
+gint champlain_network_tile_source_get_min_conns (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_min_conns (ChamplainNetworkTileSource *tile_source,
+    gint min_conns);
+
+gboolean champlain_network_tile_source_get_adaptive_conns (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_adaptive_conns (ChamplainNetworkTileSource *tile_source,
+    gboolean adaptive_conns);
+
+gint champlain_network_tile_source_get_max_retries (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_max_retries (ChamplainNetworkTileSource *tile_source,
+    gint max_retries);
+
+gboolean champlain_network_tile_source_get_background_revalidation (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_background_revalidation (ChamplainNetworkTileSource *tile_source,
+    gboolean background_revalidation);
+
+guint champlain_network_tile_source_get_rate_limit (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_rate_limit (ChamplainNetworkTileSource *tile_source,
+    guint rate_limit);
+
+guint64 champlain_network_tile_source_get_data_budget (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_data_budget (ChamplainNetworkTileSource *tile_source,
+    guint64 data_budget);
+
+guint64 champlain_network_tile_source_get_request_count (ChamplainNetworkTileSource *tile_source);
+guint64 champlain_network_tile_source_get_bytes_received (ChamplainNetworkTileSource *tile_source);
+guint64 champlain_network_tile_source_get_not_modified_count (ChamplainNetworkTileSource *tile_source);
+guint64 champlain_network_tile_source_get_error_count (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_reset_counters (ChamplainNetworkTileSource *tile_source);
+
+guint champlain_network_tile_source_get_keep_alive (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_keep_alive (ChamplainNetworkTileSource *tile_source,
+    guint keep_alive);
+
+void champlain_network_tile_source_preconnect (ChamplainNetworkTileSource *tile_source);
+
 void champlain_network_tile_source_set_user_agent (ChamplainNetworkTileSource *tile_source,
     const gchar *user_agent);
 
+const gchar * const *champlain_network_tile_source_get_subdomains (ChamplainNetworkTileSource *tile_source);
+void champlain_network_tile_source_set_subdomains (ChamplainNetworkTileSource *tile_source,
+    const gchar * const *subdomains);
+
 G_END_DECLS
 
 #endif /* _CHAMPLAIN_NETWORK_TILE_SOURCE_H_ */
@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "champlain-pixel-convert.h"
+
+#include <string.h>
+
+/* The vector kernels assume the in-memory byte order of a native endian
+ * ARGB word is B, G, R, A */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN && defined (__GNUC__) && \
+  (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN && defined (__ARM_NEON)
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+typedef void (*ConvertFunc) (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels);
+typedef void (*SwapFunc) (guint8 *data,
+    guint n_pixels);
+
+typedef struct
+{
+  const gchar *name;
+  gboolean (*supported) (void);
+  ConvertFunc rgba_to_argb_pre;
+  ConvertFunc rgb_to_argb;
+  SwapFunc swap_red_blue;
+} Kernel;
+
+/* (c * a) / 255, rounded */
+#define PREMULTIPLY(c, a, t) ((t) = (c) * (a) + 0x80, (((t) >> 8) + (t)) >> 8)
+
+
+static gboolean
+scalar_supported (void)
+{
+  return TRUE;
+}
+
+
+static void
+scalar_rgba_to_argb_pre (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  guint32 *d = (guint32 *) dst;
+  guint i;
+
+  for (i = 0; i < n_pixels; i++, src += 4)
+    {
+      guint a = src[3], t1, t2, t3;
+
+      d[i] = (a << 24) |
+        (PREMULTIPLY (src[0], a, t1) << 16) |
+        (PREMULTIPLY (src[1], a, t2) << 8) |
+        PREMULTIPLY (src[2], a, t3);
+    }
+}
+
+
+static void
+scalar_rgb_to_argb (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  guint32 *d = (guint32 *) dst;
+  guint i;
+
+  for (i = 0; i < n_pixels; i++, src += 3)
+    d[i] = 0xff000000 | ((guint32) src[0] << 16) | ((guint32) src[1] << 8) | src[2];
+}
+
+
+static void
+scalar_swap_red_blue (guint8 *data,
+    guint n_pixels)
+{
+  guint32 *ptr = (guint32 *) data;
+  guint32 *endptr = ptr + n_pixels;
+
+  for (; ptr < endptr; ptr++)
+    *ptr = (*ptr & 0xFF00FF00) ^ ((*ptr & 0xFF0000) >> 16) ^ ((*ptr & 0xFF) << 16);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+static gboolean
+sse2_supported (void)
+{
+#ifdef __x86_64__
+  return TRUE;
+#else
+  return __builtin_cpu_supports ("sse2");
+#endif
+}
+
+
+/* Premultiplies two pixels unpacked to 16 bit channels, swapping red and
+ * blue on the way; the alpha channel is multiplied by 255, i.e. kept */
+__attribute__((target ("sse2"))) static inline __m128i
+sse2_premultiply (__m128i pixels,
+    __m128i alpha_mask,
+    __m128i alpha_one)
+{
+  __m128i alpha, t;
+
+  alpha = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (pixels, _MM_SHUFFLE (3, 3, 3, 3)),
+        _MM_SHUFFLE (3, 3, 3, 3));
+  alpha = _mm_or_si128 (_mm_andnot_si128 (alpha_mask, alpha), alpha_one);
+  pixels = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (pixels, _MM_SHUFFLE (3, 0, 1, 2)),
+        _MM_SHUFFLE (3, 0, 1, 2));
+
+  t = _mm_add_epi16 (_mm_mullo_epi16 (pixels, alpha), _mm_set1_epi16 (0x80));
+  return _mm_srli_epi16 (_mm_add_epi16 (t, _mm_srli_epi16 (t, 8)), 8);
+}
+
+
+__attribute__((target ("sse2"))) static void
+sse2_rgba_to_argb_pre (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i alpha_mask = _mm_set_epi16 (-1, 0, 0, 0, -1, 0, 0, 0);
+  const __m128i alpha_one = _mm_set_epi16 (0xff, 0, 0, 0, 0xff, 0, 0, 0);
+  guint i;
+
+  for (i = 0; i + 4 <= n_pixels; i += 4)
+    {
+      __m128i pixels = _mm_loadu_si128 ((const __m128i *) (src + i * 4));
+      __m128i lo = sse2_premultiply (_mm_unpacklo_epi8 (pixels, zero), alpha_mask, alpha_one);
+      __m128i hi = sse2_premultiply (_mm_unpackhi_epi8 (pixels, zero), alpha_mask, alpha_one);
+
+      _mm_storeu_si128 ((__m128i *) (dst + i * 4), _mm_packus_epi16 (lo, hi));
+    }
+
+  scalar_rgba_to_argb_pre (src + i * 4, dst + i * 4, n_pixels - i);
+}
+
+
+__attribute__((target ("sse2"))) static void
+sse2_swap_red_blue (guint8 *data,
+    guint n_pixels)
+{
+  const __m128i mask_ag = _mm_set1_epi32 (0xFF00FF00);
+  const __m128i mask_b = _mm_set1_epi32 (0xFF);
+  guint i;
+
+  for (i = 0; i + 4 <= n_pixels; i += 4)
+    {
+      __m128i pixels = _mm_loadu_si128 ((const __m128i *) (data + i * 4));
+      __m128i rb = _mm_andnot_si128 (mask_ag, pixels);
+
+      pixels = _mm_or_si128 (_mm_and_si128 (pixels, mask_ag),
+            _mm_or_si128 (_mm_srli_epi32 (rb, 16),
+              _mm_slli_epi32 (_mm_and_si128 (rb, mask_b), 16)));
+      _mm_storeu_si128 ((__m128i *) (data + i * 4), pixels);
+    }
+
+  scalar_swap_red_blue (data + i * 4, n_pixels - i);
+}
+
+
+static gboolean
+avx2_supported (void)
+{
+  return __builtin_cpu_supports ("avx2");
+}
+
+
+__attribute__((target ("avx2"))) static inline __m256i
+avx2_premultiply (__m256i pixels,
+    __m256i alpha_mask,
+    __m256i alpha_one)
+{
+  __m256i alpha, t;
+
+  alpha = _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (pixels, _MM_SHUFFLE (3, 3, 3, 3)),
+        _MM_SHUFFLE (3, 3, 3, 3));
+  alpha = _mm256_or_si256 (_mm256_andnot_si256 (alpha_mask, alpha), alpha_one);
+  pixels = _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (pixels, _MM_SHUFFLE (3, 0, 1, 2)),
+        _MM_SHUFFLE (3, 0, 1, 2));
+
+  t = _mm256_add_epi16 (_mm256_mullo_epi16 (pixels, alpha), _mm256_set1_epi16 (0x80));
+  return _mm256_srli_epi16 (_mm256_add_epi16 (t, _mm256_srli_epi16 (t, 8)), 8);
+}
+
+
+__attribute__((target ("avx2"))) static void
+avx2_rgba_to_argb_pre (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i alpha_mask = _mm256_set_epi16 (-1, 0, 0, 0, -1, 0, 0, 0,
+        -1, 0, 0, 0, -1, 0, 0, 0);
+  const __m256i alpha_one = _mm256_set_epi16 (0xff, 0, 0, 0, 0xff, 0, 0, 0,
+        0xff, 0, 0, 0, 0xff, 0, 0, 0);
+  guint i;
+
+  /* unpacking and packing both work within 128 bit lanes, so the pixels
+   * end up in their original order */
+  for (i = 0; i + 8 <= n_pixels; i += 8)
+    {
+      __m256i pixels = _mm256_loadu_si256 ((const __m256i *) (src + i * 4));
+      __m256i lo = avx2_premultiply (_mm256_unpacklo_epi8 (pixels, zero), alpha_mask, alpha_one);
+      __m256i hi = avx2_premultiply (_mm256_unpackhi_epi8 (pixels, zero), alpha_mask, alpha_one);
+
+      _mm256_storeu_si256 ((__m256i *) (dst + i * 4), _mm256_packus_epi16 (lo, hi));
+    }
+
+  sse2_rgba_to_argb_pre (src + i * 4, dst + i * 4, n_pixels - i);
+}
+
+
+__attribute__((target ("avx2"))) static void
+avx2_swap_red_blue (guint8 *data,
+    guint n_pixels)
+{
+  const __m256i shuffle = _mm256_setr_epi8 (2, 1, 0, 3, 6, 5, 4, 7,
+        10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7,
+        10, 9, 8, 11, 14, 13, 12, 15);
+  guint i;
+
+  for (i = 0; i + 8 <= n_pixels; i += 8)
+    {
+      __m256i pixels = _mm256_loadu_si256 ((const __m256i *) (data + i * 4));
+
+      _mm256_storeu_si256 ((__m256i *) (data + i * 4), _mm256_shuffle_epi8 (pixels, shuffle));
+    }
+
+  sse2_swap_red_blue (data + i * 4, n_pixels - i);
+}
+
+
+__attribute__((target ("avx2"))) static void
+avx2_rgb_to_argb (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  /* spreads 4 RGB pixels from the low 12 bytes of each lane to BGRA */
+  const __m256i shuffle = _mm256_setr_epi8 (2, 1, 0, -1, 5, 4, 3, -1,
+        8, 7, 6, -1, 11, 10, 9, -1,
+        2, 1, 0, -1, 5, 4, 3, -1,
+        8, 7, 6, -1, 11, 10, 9, -1);
+  const __m256i alpha = _mm256_set1_epi32 (0xff000000);
+  guint i;
+
+  /* 8 pixels are read as 2 x 16 bytes, of which 2 x 12 are used; stop
+   * early enough not to read past the end of the row */
+  for (i = 0; i + 11 <= n_pixels; i += 8)
+    {
+      __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + i * 3));
+      __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + i * 3 + 12));
+      __m256i pixels = _mm256_inserti128_si256 (_mm256_castsi128_si256 (lo), hi, 1);
+
+      _mm256_storeu_si256 ((__m256i *) (dst + i * 4),
+          _mm256_or_si256 (_mm256_shuffle_epi8 (pixels, shuffle), alpha));
+    }
+
+  scalar_rgb_to_argb (src + i * 3, dst + i * 4, n_pixels - i);
+}
+
+#endif
+
+
+#ifdef HAVE_NEON_KERNELS
+
+static gboolean
+neon_supported (void)
+{
+  return TRUE;
+}
+
+
+/* (c * a) / 255, rounded */
+static inline uint8x8_t
+neon_premultiply (uint8x8_t c,
+    uint8x8_t a)
+{
+  uint16x8_t t = vmull_u8 (c, a);
+
+  return vraddhn_u16 (t, vrshrq_n_u16 (t, 8));
+}
+
+
+static void
+neon_rgba_to_argb_pre (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  guint i;
+
+  for (i = 0; i + 8 <= n_pixels; i += 8)
+    {
+      uint8x8x4_t in = vld4_u8 (src + i * 4);
+      uint8x8x4_t out;
+
+      out.val[0] = neon_premultiply (in.val[2], in.val[3]);
+      out.val[1] = neon_premultiply (in.val[1], in.val[3]);
+      out.val[2] = neon_premultiply (in.val[0], in.val[3]);
+      out.val[3] = in.val[3];
+      vst4_u8 (dst + i * 4, out);
+    }
+
+  scalar_rgba_to_argb_pre (src + i * 4, dst + i * 4, n_pixels - i);
+}
+
+
+static void
+neon_rgb_to_argb (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  guint i;
+
+  for (i = 0; i + 8 <= n_pixels; i += 8)
+    {
+      uint8x8x3_t in = vld3_u8 (src + i * 3);
+      uint8x8x4_t out;
+
+      out.val[0] = in.val[2];
+      out.val[1] = in.val[1];
+      out.val[2] = in.val[0];
+      out.val[3] = vdup_n_u8 (0xff);
+      vst4_u8 (dst + i * 4, out);
+    }
+
+  scalar_rgb_to_argb (src + i * 3, dst + i * 4, n_pixels - i);
+}
+
+
+static void
+neon_swap_red_blue (guint8 *data,
+    guint n_pixels)
+{
+  guint i;
+
+  for (i = 0; i + 16 <= n_pixels; i += 16)
+    {
+      uint8x16x4_t pixels = vld4q_u8 (data + i * 4);
+      uint8x16_t red = pixels.val[0];
+
+      pixels.val[0] = pixels.val[2];
+      pixels.val[2] = red;
+      vst4q_u8 (data + i * 4, pixels);
+    }
+
+  scalar_swap_red_blue (data + i * 4, n_pixels - i);
+}
+
+#endif
+
+
+/* From the fastest to the slowest */
+static const Kernel kernels[] = {
+#ifdef HAVE_X86_KERNELS
+  { "avx2", avx2_supported, avx2_rgba_to_argb_pre, avx2_rgb_to_argb, avx2_swap_red_blue },
+  { "sse2", sse2_supported, sse2_rgba_to_argb_pre, scalar_rgb_to_argb, sse2_swap_red_blue },
+#endif
+#ifdef HAVE_NEON_KERNELS
+  { "neon", neon_supported, neon_rgba_to_argb_pre, neon_rgb_to_argb, neon_swap_red_blue },
+#endif
+  { "scalar", scalar_supported, scalar_rgba_to_argb_pre, scalar_rgb_to_argb, scalar_swap_red_blue },
+};
+
+static const Kernel *kernel = NULL;
+
+
+static const Kernel *
+get_kernel (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint i;
+
+      for (i = 0; i < G_N_ELEMENTS (kernels); i++)
+        {
+          if (kernels[i].supported ())
+            {
+              kernel = &kernels[i];
+              break;
+            }
+        }
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return kernel;
+}
+
+
+/*
+ * champlain_pixel_convert_rgba_to_argb_pre:
+ * @src: @n_pixels of non-premultiplied RGBA, as in a #GdkPixbuf with alpha
+ * @dst: room for @n_pixels of premultiplied ARGB, as in a cairo surface
+ * @n_pixels: the number of pixels to convert
+ *
+ * Converts a row of pixels from a #GdkPixbuf with alpha channel to the
+ * format of a %CAIRO_FORMAT_ARGB32 surface.
+ */
+void
+champlain_pixel_convert_rgba_to_argb_pre (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  get_kernel ()->rgba_to_argb_pre (src, dst, n_pixels);
+}
+
+
+/*
+ * champlain_pixel_convert_rgb_to_argb:
+ * @src: @n_pixels of RGB, as in a #GdkPixbuf without alpha
+ * @dst: room for @n_pixels of opaque ARGB, as in a cairo surface
+ * @n_pixels: the number of pixels to convert
+ *
+ * Converts a row of pixels from a #GdkPixbuf without alpha channel to the
+ * format of a %CAIRO_FORMAT_RGB24 surface.
+ */
+void
+champlain_pixel_convert_rgb_to_argb (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels)
+{
+  get_kernel ()->rgb_to_argb (src, dst, n_pixels);
+}
+
+
+/*
+ * champlain_pixel_convert_swap_red_blue:
+ * @data: @n_pixels of 32 bit pixels
+ * @n_pixels: the number of pixels to convert
+ *
+ * Swaps the red and blue channels in place, which turns cairo's native
+ * endian ARGB into RGBA bytes on little endian machines.
+ */
+void
+champlain_pixel_convert_swap_red_blue (guint8 *data,
+    guint n_pixels)
+{
+  get_kernel ()->swap_red_blue (data, n_pixels);
+}
+
+
+/*
+ * champlain_pixel_convert_get_kernel:
+ *
+ * Returns: the name of the conversion functions in use
+ */
+const gchar *
+champlain_pixel_convert_get_kernel (void)
+{
+  return get_kernel ()->name;
+}
+
+
+/*
+ * champlain_pixel_convert_set_kernel:
+ * @name: "avx2", "sse2", "neon" or "scalar"
+ *
+ * Switches to other conversion functions, for benchmarking. Not thread safe.
+ *
+ * Returns: %FALSE if @name isn't supported on this machine
+ */
+gboolean
+champlain_pixel_convert_set_kernel (const gchar *name)
+{
+  guint i;
+
+  get_kernel ();
+
+  for (i = 0; i < G_N_ELEMENTS (kernels); i++)
+    {
+      if (g_strcmp0 (kernels[i].name, name) == 0 && kernels[i].supported ())
+        {
+          kernel = &kernels[i];
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __CHAMPLAIN_PIXEL_CONVERT_H__
+#define __CHAMPLAIN_PIXEL_CONVERT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Conversions of rows of pixels between the formats used by the renderers.
+ * The fastest implementation supported by the CPU is picked at run time.
+ *
+ * "argb_pre" is cairo's premultiplied ARGB in native endian 32 bit words,
+ * "rgba" and "rgb" are GdkPixbuf's non-premultiplied bytes. */
+
+G_GNUC_INTERNAL
+void champlain_pixel_convert_rgba_to_argb_pre (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels);
+G_GNUC_INTERNAL
+void champlain_pixel_convert_rgb_to_argb (const guint8 *src,
+    guint8 *dst,
+    guint n_pixels);
+G_GNUC_INTERNAL
+void champlain_pixel_convert_swap_red_blue (guint8 *data,
+    guint n_pixels);
+
+G_GNUC_INTERNAL
+const gchar *champlain_pixel_convert_get_kernel (void);
+G_GNUC_INTERNAL
+gboolean champlain_pixel_convert_set_kernel (const gchar *name);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __CHAMPLAIN_TILE_PRIVATE_H__
+#define __CHAMPLAIN_TILE_PRIVATE_H__
+
+#include "champlain-tile.h"
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL
+void champlain_tile_release_surface (ChamplainTile *self);
+G_GNUC_INTERNAL
+void champlain_tile_set_wants_data (ChamplainTile *self,
+    gboolean wants_data);
+G_GNUC_INTERNAL
+gboolean champlain_tile_get_wants_data (ChamplainTile *self);
+
+G_END_DECLS
+
+#endif
@@ -26,7 +26,9 @@
 #include "champlain-tile.h"
 
 #include "champlain-enum-types.h"
+#include "champlain-image-decoder.h"
 #include "champlain-private.h"
+#include "champlain-tile-private.h"
 
 #include <math.h>
 #include <errno.h>
@@ -38,6 +40,11 @@
 static void set_surface (ChamplainExportable *exportable,
     cairo_surface_t *surface);
 static cairo_surface_t *get_surface (ChamplainExportable *exportable);
+static void render_complete_cb (ChamplainTile *self,
+    gpointer data,
+    guint size,
+    gboolean error,
+    gpointer user_data);
 static void exportable_interface_init (ChamplainExportableIface *iface);
 
 struct _ChamplainTilePrivate
@@ -45,6 +52,7 @@ struct _ChamplainTilePrivate
   guint x; /* The x position on the map (in pixels) */
   guint y; /* The y position on the map (in pixels) */
   guint size; /* The tile's width and height (only support square tiles */
+  guint scale_factor; /* The resolution of the tile's image relative to size */
   guint zoom_level; /* The tile's zoom level */
 
   ChamplainState state; /* The tile state: loading, validation, done */
@@ -56,6 +64,10 @@ struct _ChamplainTilePrivate
   gchar *etag; /* The HTTP ETag sent by the server */
   gboolean content_displayed;
   cairo_surface_t *surface;
+  /* The encoded image the surface can be decoded from again */
+  GBytes *data;
+  /* Whether the map source uses the data passed with render-complete */
+  gboolean wants_data;
 };
 
 G_DEFINE_TYPE_WITH_CODE (ChamplainTile, champlain_tile, CLUTTER_TYPE_ACTOR,
@@ -69,6 +81,7 @@ enum
   PROP_Y,
   PROP_ZOOM_LEVEL,
   PROP_SIZE,
+  PROP_SCALE_FACTOR,
   PROP_STATE,
   PROP_CONTENT,
   PROP_ETAG,
@@ -112,6 +125,10 @@ champlain_tile_get_property (GObject *object,
       g_value_set_uint (value, champlain_tile_get_size (self));
       break;
 
+    case PROP_SCALE_FACTOR:
+      g_value_set_uint (value, champlain_tile_get_scale_factor (self));
+      break;
+
     case PROP_STATE:
       g_value_set_enum (value, champlain_tile_get_state (self));
       break;
@@ -164,6 +181,10 @@ champlain_tile_set_property (GObject *object,
       champlain_tile_set_size (self, g_value_get_uint (value));
       break;
 
+    case PROP_SCALE_FACTOR:
+      champlain_tile_set_scale_factor (self, g_value_get_uint (value));
+      break;
+
     case PROP_STATE:
       champlain_tile_set_state (self, g_value_get_enum (value));
       break;
@@ -202,6 +223,7 @@ champlain_tile_dispose (GObject *object)
     }
 
   g_clear_pointer (&priv->surface, cairo_surface_destroy);
+  g_clear_pointer (&priv->data, g_bytes_unref);
   G_OBJECT_CLASS (champlain_tile_parent_class)->dispose (object);
 }
 
@@ -296,6 +318,26 @@ champlain_tile_class_init (ChamplainTileClass *klass)
           256,
           G_PARAM_READWRITE));
 
+  /**
+   * ChamplainTile:scale-factor:
+   *
+   * The scale factor of the tile's image: the image is scale-factor times
+   * larger than #ChamplainTile:size, e.g. 2 for tiles of HiDPI displays.
+   * Map sources fetch the image at this resolution and caches store it
+   * separately from the other resolutions.
+   *
+   * Since: 0.12.22
+   */
+  g_object_class_install_property (object_class,
+      PROP_SCALE_FACTOR,
+      g_param_spec_uint ("scale-factor",
+          "Scale factor",
+          "The scale factor of the tile's image",
+          1,
+          G_MAXINT,
+          1,
+          G_PARAM_READWRITE));
+
   /**
    * ChamplainTile:state:
    *
@@ -402,12 +444,18 @@ champlain_tile_init (ChamplainTile *self)
   priv->y = 0;
   priv->zoom_level = 0;
   priv->size = 0;
+  priv->scale_factor = 1;
   priv->modified_time = NULL;
   priv->etag = NULL;
   priv->fade_in = FALSE;
+  priv->wants_data = TRUE;
   priv->content_displayed = FALSE;
 
   priv->content_actor = NULL;
+  priv->surface = NULL;
+  priv->data = NULL;
+
+  g_signal_connect (self, "render-complete", G_CALLBACK (render_complete_cb), NULL);
 }
 
 
@@ -425,6 +473,8 @@ set_surface (ChamplainExportable *exportable,
 
   cairo_surface_destroy (self->priv->surface);
   self->priv->surface = cairo_surface_reference (surface);
+  /* until render-complete says otherwise, the surface can't be decoded again */
+  g_clear_pointer (&self->priv->data, g_bytes_unref);
   g_object_notify (G_OBJECT (self), "surface");
 }
 
@@ -434,7 +484,100 @@ get_surface (ChamplainExportable *exportable)
 {
   g_return_val_if_fail (CHAMPLAIN_IS_TILE (exportable), NULL);
 
-  return CHAMPLAIN_TILE (exportable)->priv->surface;
+  ChamplainTilePrivate *priv = CHAMPLAIN_TILE (exportable)->priv;
+
+  if (!priv->surface && priv->data)
+    {
+      GError *error = NULL;
+      gsize size;
+      gconstpointer data = g_bytes_get_data (priv->data, &size);
+
+      priv->surface = champlain_image_decoder_decode (data, size,
+            priv->size * priv->scale_factor, &error);
+      if (priv->surface)
+        champlain_image_decoder_set_tile_size (priv->surface, priv->size);
+      else
+        {
+          g_warning ("Unable to decode tile: %s", error->message);
+          g_error_free (error);
+        }
+    }
+
+  return priv->surface;
+}
+
+
+static void
+render_complete_cb (ChamplainTile *self,
+    gpointer data,
+    guint size,
+    gboolean error,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  ChamplainTilePrivate *priv = self->priv;
+
+  /* Remember what the surface was rendered from, it's much smaller than the
+   * surface itself. */
+  if (!error && data && size > 0 && priv->surface)
+    {
+      g_clear_pointer (&priv->data, g_bytes_unref);
+      priv->data = g_bytes_new (data, size);
+    }
+}
+
+
+/*
+ * champlain_tile_release_surface:
+ * @self: a #ChamplainTile
+ *
+ * Frees the tile's surface if it can be decoded again when needed, e.g. for
+ * champlain_view_to_surface().
+ */
+void
+champlain_tile_release_surface (ChamplainTile *self)
+{
+  g_return_if_fail (CHAMPLAIN_IS_TILE (self));
+
+  ChamplainTilePrivate *priv = self->priv;
+
+  if (priv->data)
+    g_clear_pointer (&priv->surface, cairo_surface_destroy);
+}
+
+
+/*
+ * champlain_tile_set_wants_data:
+ * @self: a #ChamplainTile
+ * @wants_data: whether the data passed with #ChamplainTile::render-complete
+ * is used
+ *
+ * Tells the renderer of the tile whether the map source does anything with
+ * the data passed with #ChamplainTile::render-complete, e.g. stores it in a
+ * cache. Renderers producing the data just for that may skip it otherwise.
+ */
+void
+champlain_tile_set_wants_data (ChamplainTile *self,
+    gboolean wants_data)
+{
+  g_return_if_fail (CHAMPLAIN_IS_TILE (self));
+
+  self->priv->wants_data = wants_data;
+}
+
+
+/*
+ * champlain_tile_get_wants_data:
+ * @self: a #ChamplainTile
+ *
+ * Returns: whether the data passed with #ChamplainTile::render-complete is
+ * used, see champlain_tile_set_wants_data().
+ */
+gboolean
+champlain_tile_get_wants_data (ChamplainTile *self)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_TILE (self), TRUE);
+
+  return self->priv->wants_data;
 }
 
 
@@ -538,6 +681,25 @@ champlain_tile_get_size (ChamplainTile *self)
 }
 
 
+/**
+ * champlain_tile_get_scale_factor:
+ * @self: the #ChamplainTile
+ *
+ * Gets the scale factor of the tile's image.
+ *
+ * Returns: the tile's scale factor
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_tile_get_scale_factor (ChamplainTile *self)
+{
+  g_return_val_if_fail (CHAMPLAIN_TILE (self), 1);
+
+  return self->priv->scale_factor;
+}
+
+
 /**
  * champlain_tile_get_state:
  * @self: the #ChamplainTile
@@ -641,6 +803,28 @@ champlain_tile_set_size (ChamplainTile *self,
 }
 
 
+/**
+ * champlain_tile_set_scale_factor:
+ * @self: the #ChamplainTile
+ * @scale_factor: the scale factor, at least 1
+ *
+ * Sets the scale factor of the tile's image, see #ChamplainTile:scale-factor.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_tile_set_scale_factor (ChamplainTile *self,
+    guint scale_factor)
+{
+  g_return_if_fail (CHAMPLAIN_TILE (self));
+  g_return_if_fail (scale_factor >= 1);
+
+  self->priv->scale_factor = scale_factor;
+
+  g_object_notify (G_OBJECT (self), "scale-factor");
+}
+
+
 /**
  * champlain_tile_set_state:
  * @self: the #ChamplainTile
@@ -102,6 +102,7 @@ guint champlain_tile_get_x (ChamplainTile *self);
 guint champlain_tile_get_y (ChamplainTile *self);
 guint champlain_tile_get_zoom_level (ChamplainTile *self);
 guint champlain_tile_get_size (ChamplainTile *self);
+guint champlain_tile_get_scale_factor (ChamplainTile *self);
 ChamplainState champlain_tile_get_state (ChamplainTile *self);
 ClutterActor *champlain_tile_get_content (ChamplainTile *self);
 const GTimeVal *champlain_tile_get_modified_time (ChamplainTile *self);
@@ -116,6 +117,8 @@ void champlain_tile_set_zoom_level (ChamplainTile *self,
     guint zoom_level);
 void champlain_tile_set_size (ChamplainTile *self,
     guint size);
+void champlain_tile_set_scale_factor (ChamplainTile *self,
+    guint scale_factor);
 void champlain_tile_set_state (ChamplainTile *self,
     ChamplainState state);
 void champlain_tile_set_content (ChamplainTile *self,
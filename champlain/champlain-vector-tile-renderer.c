@@ -0,0 +1,1701 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION:champlain-vector-tile-renderer
+ * @short_description: A renderer that renders tiles from Mapbox Vector Tiles
+ *
+ * #ChamplainVectorTileRenderer renders tiles from
+ * <ulink role="online-location" url="https://github.com/mapbox/vector-tile-spec">
+ * Mapbox Vector Tile</ulink> data, as served e.g. by OpenMapTiles compatible
+ * servers. Use it as the renderer of a #ChamplainNetworkTileSource and the
+ * caches of the map source chain; they download and store the raw,
+ * possibly gzip compressed, protobuf data like they do for images. Decoding
+ * and drawing the tiles happens in worker threads.
+ *
+ * The look of the map is set by a style, see
+ * champlain_vector_tile_renderer_set_style(). The most recently rendered
+ * tiles are kept in a cache of decoded tiles, see
+ * #ChamplainVectorTileRenderer:cache-size, so tiles loaded again are only
+ * drawn again after the style changes. Call champlain_view_reload_tiles()
+ * to show a new style.
+ */
+
+#include "champlain-vector-tile-renderer.h"
+
+#include "champlain-private.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+/* The most recently rendered tiles kept by default */
+#define DEFAULT_CACHE_SIZE 64
+
+static const gchar default_style[] =
+  "[background]\n"
+  "fill=#f8f4f0\n"
+  "\n"
+  "[landcover]\n"
+  "layer=landcover\n"
+  "fill=#d8e8c8\n"
+  "\n"
+  "[residential]\n"
+  "layer=landuse\n"
+  "filter=class=residential\n"
+  "fill=#ede8e0\n"
+  "\n"
+  "[park]\n"
+  "layer=park\n"
+  "fill=#c8dfb4\n"
+  "\n"
+  "[water]\n"
+  "layer=water\n"
+  "fill=#aad3df\n"
+  "\n"
+  "[waterway]\n"
+  "layer=waterway\n"
+  "stroke=#aad3df\n"
+  "line-width=1.0\n"
+  "\n"
+  "[building]\n"
+  "layer=building\n"
+  "min-zoom=14\n"
+  "fill=#dfdbd7\n"
+  "stroke=#cbc4bc\n"
+  "line-width=0.5\n"
+  "\n"
+  "[minor-road]\n"
+  "layer=transportation\n"
+  "filter=class=minor,service,track\n"
+  "min-zoom=13\n"
+  "stroke=#ffffff\n"
+  "line-width=1.0\n"
+  "\n"
+  "[road]\n"
+  "layer=transportation\n"
+  "filter=class=primary,secondary,tertiary\n"
+  "stroke=#ffffff\n"
+  "line-width=2.0\n"
+  "\n"
+  "[motorway]\n"
+  "layer=transportation\n"
+  "filter=class=motorway,trunk\n"
+  "stroke=#f9b29c\n"
+  "line-width=2.5\n"
+  "\n"
+  "[rail]\n"
+  "layer=transportation\n"
+  "filter=class=rail\n"
+  "stroke=#b0b0b0\n"
+  "line-width=1.0\n"
+  "\n"
+  "[boundary]\n"
+  "layer=boundary\n"
+  "filter=admin_level=2\n"
+  "stroke=#9e9cab\n"
+  "line-width=1.0\n";
+
+enum
+{
+  PROP_0,
+  PROP_STYLE,
+  PROP_CACHE_SIZE
+};
+
+/* Mapbox Vector Tile geometry types and commands */
+enum
+{
+  GEOM_POINT = 1,
+  GEOM_LINESTRING = 2,
+  GEOM_POLYGON = 3
+};
+
+enum
+{
+  CMD_MOVE_TO = 1,
+  CMD_LINE_TO = 2,
+  CMD_CLOSE_PATH = 7
+};
+
+typedef struct
+{
+  gchar *layer;
+  /* NULL if all features of the layer match */
+  gchar *filter_key;
+  /* NULL if the features only need to have filter_key */
+  gchar **filter_values;
+  gboolean filter_negate;
+  gint min_zoom;
+  gint max_zoom;
+  gboolean fill;
+  ClutterColor fill_color;
+  gboolean stroke;
+  ClutterColor stroke_color;
+  gdouble line_width;
+  gdouble radius;
+} StyleRule;
+
+/* Immutable once parsed, shared with the worker threads */
+typedef struct
+{
+  gboolean background;
+  ClutterColor background_color;
+  GPtrArray *rules;
+  guint serial;
+} Style;
+
+typedef struct
+{
+  guint type;
+  guint32 *tags;
+  guint n_tags;
+  const guint8 *geometry;
+  gsize geometry_size;
+} VectorFeature;
+
+typedef struct
+{
+  gchar *name;
+  guint extent;
+  GPtrArray *keys;
+  GPtrArray *values;
+  GArray *features;
+} VectorLayer;
+
+/* Immutable once decoded, shared with the worker threads */
+typedef struct
+{
+  /* The uncompressed tile, the features point into it */
+  GBytes *data;
+  GPtrArray *layers;
+} VectorTile;
+
+typedef struct
+{
+  gchar *key;
+  /* The data as received, possibly compressed */
+  GBytes *data;
+  VectorTile *vector_tile;
+  /* NULL if rendered with an outdated style */
+  cairo_surface_t *surface;
+  guint style_serial;
+} CacheEntry;
+
+struct _ChamplainVectorTileRendererPrivate
+{
+  GBytes *data;
+  gchar *style_text;
+  Style *style;
+  guint style_serial;
+  guint cache_size;
+  /* Most recently used entries first */
+  GQueue *cache_queue;
+  GHashTable *cache_table;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (ChamplainVectorTileRenderer, champlain_vector_tile_renderer, CHAMPLAIN_TYPE_RENDERER)
+
+typedef struct _RendererData RendererData;
+
+struct _RendererData
+{
+  ChamplainRenderer *renderer;
+  ChamplainTile *tile;
+  GBytes *data;
+  VectorTile *vector_tile;
+  Style *style;
+  guint zoom_level;
+  guint tile_size;
+  guint scale_factor;
+  cairo_surface_t *surface;
+};
+
+static void set_data (ChamplainRenderer *renderer,
+    const guint8 *data,
+    guint size);
+static void render (ChamplainRenderer *renderer,
+    ChamplainTile *tile);
+
+
+static void
+style_rule_free (StyleRule *rule)
+{
+  g_free (rule->layer);
+  g_free (rule->filter_key);
+  g_strfreev (rule->filter_values);
+  g_slice_free (StyleRule, rule);
+}
+
+
+static void
+style_clear (Style *style)
+{
+  g_ptr_array_unref (style->rules);
+}
+
+
+static void
+style_unref (Style *style)
+{
+  g_atomic_rc_box_release_full (style, (GDestroyNotify) style_clear);
+}
+
+
+static void
+vector_layer_free (VectorLayer *layer)
+{
+  guint i;
+
+  for (i = 0; i < layer->features->len; i++)
+    g_free (g_array_index (layer->features, VectorFeature, i).tags);
+
+  g_free (layer->name);
+  g_ptr_array_unref (layer->keys);
+  g_ptr_array_unref (layer->values);
+  g_array_unref (layer->features);
+  g_slice_free (VectorLayer, layer);
+}
+
+
+static void
+vector_tile_clear (VectorTile *vector_tile)
+{
+  g_bytes_unref (vector_tile->data);
+  g_ptr_array_unref (vector_tile->layers);
+}
+
+
+static void
+vector_tile_unref (VectorTile *vector_tile)
+{
+  g_atomic_rc_box_release_full (vector_tile, (GDestroyNotify) vector_tile_clear);
+}
+
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_free (entry->key);
+  g_bytes_unref (entry->data);
+  if (entry->vector_tile)
+    vector_tile_unref (entry->vector_tile);
+  if (entry->surface)
+    cairo_surface_destroy (entry->surface);
+  g_slice_free (CacheEntry, entry);
+}
+
+
+static void
+champlain_vector_tile_renderer_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  ChamplainVectorTileRenderer *renderer = CHAMPLAIN_VECTOR_TILE_RENDERER (object);
+
+  switch (property_id)
+    {
+    case PROP_STYLE:
+      g_value_set_string (value, champlain_vector_tile_renderer_get_style (renderer));
+      break;
+
+    case PROP_CACHE_SIZE:
+      g_value_set_uint (value, champlain_vector_tile_renderer_get_cache_size (renderer));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+champlain_vector_tile_renderer_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  ChamplainVectorTileRenderer *renderer = CHAMPLAIN_VECTOR_TILE_RENDERER (object);
+  GError *error = NULL;
+
+  switch (property_id)
+    {
+    case PROP_STYLE:
+      if (!champlain_vector_tile_renderer_set_style (renderer, g_value_get_string (value), &error))
+        {
+          g_warning ("Invalid style: %s", error->message);
+          g_error_free (error);
+        }
+      break;
+
+    case PROP_CACHE_SIZE:
+      champlain_vector_tile_renderer_set_cache_size (renderer, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+champlain_vector_tile_renderer_dispose (GObject *object)
+{
+  ChamplainVectorTileRendererPrivate *priv = CHAMPLAIN_VECTOR_TILE_RENDERER (object)->priv;
+
+  g_hash_table_remove_all (priv->cache_table);
+  g_queue_clear_full (priv->cache_queue, (GDestroyNotify) cache_entry_free);
+
+  G_OBJECT_CLASS (champlain_vector_tile_renderer_parent_class)->dispose (object);
+}
+
+
+static void
+champlain_vector_tile_renderer_finalize (GObject *object)
+{
+  ChamplainVectorTileRendererPrivate *priv = CHAMPLAIN_VECTOR_TILE_RENDERER (object)->priv;
+
+  if (priv->data)
+    g_bytes_unref (priv->data);
+  g_free (priv->style_text);
+  style_unref (priv->style);
+  g_hash_table_destroy (priv->cache_table);
+  g_queue_free (priv->cache_queue);
+
+  G_OBJECT_CLASS (champlain_vector_tile_renderer_parent_class)->finalize (object);
+}
+
+
+static void
+champlain_vector_tile_renderer_class_init (ChamplainVectorTileRendererClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ChamplainRendererClass *renderer_class = CHAMPLAIN_RENDERER_CLASS (klass);
+
+  object_class->get_property = champlain_vector_tile_renderer_get_property;
+  object_class->set_property = champlain_vector_tile_renderer_set_property;
+  object_class->finalize = champlain_vector_tile_renderer_finalize;
+  object_class->dispose = champlain_vector_tile_renderer_dispose;
+
+  /**
+   * ChamplainVectorTileRenderer:style:
+   *
+   * The style the tiles are drawn with, see
+   * champlain_vector_tile_renderer_set_style().
+   *
+   * Since: 0.12.22
+   */
+  g_object_class_install_property (object_class,
+      PROP_STYLE,
+      g_param_spec_string ("style",
+          "Style",
+          "The style the tiles are drawn with",
+          NULL,
+          G_PARAM_READWRITE));
+
+  /**
+   * ChamplainVectorTileRenderer:cache-size:
+   *
+   * The number of decoded and drawn tiles kept in memory.
+   *
+   * Since: 0.12.22
+   */
+  g_object_class_install_property (object_class,
+      PROP_CACHE_SIZE,
+      g_param_spec_uint ("cache-size",
+          "Cache size",
+          "The number of decoded tiles kept in memory",
+          0,
+          G_MAXUINT,
+          DEFAULT_CACHE_SIZE,
+          G_PARAM_READWRITE));
+
+  renderer_class->set_data = set_data;
+  renderer_class->render = render;
+}
+
+
+static void
+champlain_vector_tile_renderer_init (ChamplainVectorTileRenderer *self)
+{
+  ChamplainVectorTileRendererPrivate *priv = champlain_vector_tile_renderer_get_instance_private (self);
+
+  self->priv = priv;
+
+  priv->data = NULL;
+  priv->style_text = NULL;
+  priv->style = NULL;
+  priv->style_serial = 0;
+  priv->cache_size = DEFAULT_CACHE_SIZE;
+  priv->cache_queue = g_queue_new ();
+  priv->cache_table = g_hash_table_new (g_str_hash, g_str_equal);
+
+  champlain_vector_tile_renderer_set_style (self, default_style, NULL);
+}
+
+
+/**
+ * champlain_vector_tile_renderer_new:
+ *
+ * Constructor of #ChamplainVectorTileRenderer. The renderer uses a default
+ * style for tiles following the OpenMapTiles schema.
+ *
+ * Returns: a constructed #ChamplainVectorTileRenderer object
+ *
+ * Since: 0.12.22
+ */
+ChamplainVectorTileRenderer *
+champlain_vector_tile_renderer_new (void)
+{
+  return g_object_new (CHAMPLAIN_TYPE_VECTOR_TILE_RENDERER, NULL);
+}
+
+
+static void
+set_data (ChamplainRenderer *renderer, const guint8 *data, guint size)
+{
+  ChamplainVectorTileRendererPrivate *priv = CHAMPLAIN_VECTOR_TILE_RENDERER (renderer)->priv;
+
+  if (priv->data)
+    g_bytes_unref (priv->data);
+
+  priv->data = g_bytes_new (data, size);
+}
+
+
+static gboolean
+parse_color (GKeyFile *key_file,
+    const gchar *group,
+    const gchar *key,
+    ClutterColor *color,
+    gboolean *present,
+    GError **error)
+{
+  gchar *value;
+  gboolean ret = TRUE;
+
+  *present = FALSE;
+
+  value = g_key_file_get_string (key_file, group, key, NULL);
+  if (!value)
+    return TRUE;
+
+  if (clutter_color_from_string (color, value))
+    *present = TRUE;
+  else
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+          "Invalid color '%s' in group '%s'", value, group);
+      ret = FALSE;
+    }
+
+  g_free (value);
+
+  return ret;
+}
+
+
+/* Filters look like "key=value1,value2", "key!=value1,value2" or "key" */
+static void
+parse_filter (StyleRule *rule,
+    const gchar *filter)
+{
+  const gchar *operator;
+  const gchar *values;
+
+  if ((operator = strstr (filter, "!=")) != NULL)
+    {
+      rule->filter_negate = TRUE;
+      values = operator + 2;
+    }
+  else if ((operator = strchr (filter, '=')) != NULL)
+    values = operator + 1;
+  else
+    {
+      rule->filter_key = g_strstrip (g_strdup (filter));
+      return;
+    }
+
+  rule->filter_key = g_strstrip (g_strndup (filter, operator - filter));
+  rule->filter_values = g_strsplit (values, ",", -1);
+}
+
+
+static StyleRule *
+parse_rule (GKeyFile *key_file,
+    const gchar *group,
+    GError **error)
+{
+  StyleRule *rule;
+  gchar *filter;
+
+  rule = g_slice_new0 (StyleRule);
+  rule->max_zoom = G_MAXINT;
+  rule->line_width = 1.0;
+
+  rule->layer = g_key_file_get_string (key_file, group, "layer", error);
+  if (!rule->layer)
+    goto error;
+
+  filter = g_key_file_get_string (key_file, group, "filter", NULL);
+  if (filter)
+    {
+      parse_filter (rule, filter);
+      g_free (filter);
+    }
+
+  if (!parse_color (key_file, group, "fill", &rule->fill_color, &rule->fill, error) ||
+      !parse_color (key_file, group, "stroke", &rule->stroke_color, &rule->stroke, error))
+    goto error;
+
+  if (g_key_file_has_key (key_file, group, "line-width", NULL))
+    {
+      GError *tmp_error = NULL;
+
+      rule->line_width = g_key_file_get_double (key_file, group, "line-width", &tmp_error);
+      if (tmp_error)
+        {
+          g_propagate_error (error, tmp_error);
+          goto error;
+        }
+    }
+
+  if (g_key_file_has_key (key_file, group, "radius", NULL))
+    {
+      GError *tmp_error = NULL;
+
+      rule->radius = g_key_file_get_double (key_file, group, "radius", &tmp_error);
+      if (tmp_error)
+        {
+          g_propagate_error (error, tmp_error);
+          goto error;
+        }
+    }
+
+  if (g_key_file_has_key (key_file, group, "min-zoom", NULL))
+    rule->min_zoom = g_key_file_get_integer (key_file, group, "min-zoom", NULL);
+  if (g_key_file_has_key (key_file, group, "max-zoom", NULL))
+    rule->max_zoom = g_key_file_get_integer (key_file, group, "max-zoom", NULL);
+
+  return rule;
+
+error:
+  style_rule_free (rule);
+  return NULL;
+}
+
+
+static Style *
+parse_style (const gchar *text,
+    GError **error)
+{
+  GKeyFile *key_file;
+  Style *style;
+  gchar **groups;
+  guint i;
+
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_data (key_file, text, -1, G_KEY_FILE_NONE, error))
+    {
+      g_key_file_free (key_file);
+      return NULL;
+    }
+
+  style = g_atomic_rc_box_new0 (Style);
+  style->rules = g_ptr_array_new_with_free_func ((GDestroyNotify) style_rule_free);
+
+  /* groups are returned in the order they appear in the file */
+  groups = g_key_file_get_groups (key_file, NULL);
+  for (i = 0; groups[i]; i++)
+    {
+      StyleRule *rule;
+
+      if (g_strcmp0 (groups[i], "background") == 0)
+        {
+          if (!parse_color (key_file, groups[i], "fill", &style->background_color,
+                  &style->background, error))
+            break;
+          continue;
+        }
+
+      rule = parse_rule (key_file, groups[i], error);
+      if (!rule)
+        break;
+
+      g_ptr_array_add (style->rules, rule);
+    }
+
+  if (groups[i])
+    g_clear_pointer (&style, style_unref);
+
+  g_strfreev (groups);
+  g_key_file_free (key_file);
+
+  return style;
+}
+
+
+/**
+ * champlain_vector_tile_renderer_set_style:
+ * @renderer: a #ChamplainVectorTileRenderer
+ * @style: the style description
+ * @error: return location for a #GError, or %NULL
+ *
+ * Sets the style the tiles are drawn with. The style is a key file where
+ * every group is a rule drawing some features of a layer of the tile. The
+ * rules are drawn in the order they appear. The keys of a rule are:
+ *
+ * - layer: the name of the layer (required)
+ * - filter: the features drawn, "key=value1,value2" draws the features
+ *   whose tag "key" has one of the values, "key!=value1,value2" the other
+ *   ones and "key" all features having the tag. All features of the layer
+ *   are drawn if missing.
+ * - fill: the color polygons and points are filled with
+ * - stroke: the color lines and outlines of polygons are drawn with
+ * - line-width: the width of the lines in pixels
+ * - radius: the radius of points in pixels, points aren't drawn if missing
+ * - min-zoom, max-zoom: the zoom levels the rule applies to
+ *
+ * Colors are in any format accepted by clutter_color_from_string(). A group
+ * named "background" with a "fill" key sets the background color of the
+ * tiles.
+ *
+ * Tiles rendered already don't change until they are loaded again, e.g.
+ * by champlain_view_reload_tiles().
+ *
+ * Returns: %TRUE if the style was valid and has been set.
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_vector_tile_renderer_set_style (ChamplainVectorTileRenderer *renderer,
+    const gchar *style,
+    GError **error)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_VECTOR_TILE_RENDERER (renderer), FALSE);
+  g_return_val_if_fail (style != NULL, FALSE);
+
+  ChamplainVectorTileRendererPrivate *priv = renderer->priv;
+  Style *parsed_style;
+  GList *iter;
+
+  parsed_style = parse_style (style, error);
+  if (!parsed_style)
+    return FALSE;
+
+  parsed_style->serial = ++priv->style_serial;
+
+  if (priv->style)
+    style_unref (priv->style);
+  priv->style = parsed_style;
+
+  g_free (priv->style_text);
+  priv->style_text = g_strdup (style);
+
+  /* the decoded tiles are still good, the drawings aren't */
+  for (iter = priv->cache_queue->head; iter; iter = iter->next)
+    {
+      CacheEntry *entry = iter->data;
+
+      g_clear_pointer (&entry->surface, cairo_surface_destroy);
+    }
+
+  g_object_notify (G_OBJECT (renderer), "style");
+
+  return TRUE;
+}
+
+
+/**
+ * champlain_vector_tile_renderer_get_style:
+ * @renderer: a #ChamplainVectorTileRenderer
+ *
+ * Gets the style the tiles are drawn with.
+ *
+ * Returns: the style description.
+ *
+ * Since: 0.12.22
+ */
+const gchar *
+champlain_vector_tile_renderer_get_style (ChamplainVectorTileRenderer *renderer)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_VECTOR_TILE_RENDERER (renderer), NULL);
+
+  return renderer->priv->style_text;
+}
+
+
+/**
+ * champlain_vector_tile_renderer_load_style:
+ * @renderer: a #ChamplainVectorTileRenderer
+ * @style_path: the path to the style file
+ * @error: return location for a #GError, or %NULL
+ *
+ * Loads the style the tiles are drawn with from a file, see
+ * champlain_vector_tile_renderer_set_style().
+ *
+ * Returns: %TRUE if the style was loaded.
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_vector_tile_renderer_load_style (ChamplainVectorTileRenderer *renderer,
+    const gchar *style_path,
+    GError **error)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_VECTOR_TILE_RENDERER (renderer), FALSE);
+  g_return_val_if_fail (style_path != NULL, FALSE);
+
+  gchar *contents;
+  gboolean ret;
+
+  if (!g_file_get_contents (style_path, &contents, NULL, error))
+    return FALSE;
+
+  ret = champlain_vector_tile_renderer_set_style (renderer, contents, error);
+  g_free (contents);
+
+  return ret;
+}
+
+
+static void
+cache_trim (ChamplainVectorTileRenderer *renderer)
+{
+  ChamplainVectorTileRendererPrivate *priv = renderer->priv;
+
+  while (priv->cache_queue->length > priv->cache_size)
+    {
+      CacheEntry *entry = g_queue_pop_tail (priv->cache_queue);
+
+      g_hash_table_remove (priv->cache_table, entry->key);
+      cache_entry_free (entry);
+    }
+}
+
+
+/**
+ * champlain_vector_tile_renderer_set_cache_size:
+ * @renderer: a #ChamplainVectorTileRenderer
+ * @cache_size: the number of tiles
+ *
+ * Sets the number of decoded and drawn tiles kept in memory.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_vector_tile_renderer_set_cache_size (ChamplainVectorTileRenderer *renderer,
+    guint cache_size)
+{
+  g_return_if_fail (CHAMPLAIN_IS_VECTOR_TILE_RENDERER (renderer));
+
+  renderer->priv->cache_size = cache_size;
+  cache_trim (renderer);
+
+  g_object_notify (G_OBJECT (renderer), "cache-size");
+}
+
+
+/**
+ * champlain_vector_tile_renderer_get_cache_size:
+ * @renderer: a #ChamplainVectorTileRenderer
+ *
+ * Gets the number of decoded and drawn tiles kept in memory.
+ *
+ * Returns: the number of tiles.
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_vector_tile_renderer_get_cache_size (ChamplainVectorTileRenderer *renderer)
+{
+  g_return_val_if_fail (CHAMPLAIN_IS_VECTOR_TILE_RENDERER (renderer), 0);
+
+  return renderer->priv->cache_size;
+}
+
+
+static gchar *
+cache_key (ChamplainTile *tile)
+{
+  return g_strdup_printf ("%u/%u/%u@%ux",
+      champlain_tile_get_zoom_level (tile),
+      champlain_tile_get_x (tile),
+      champlain_tile_get_y (tile),
+      champlain_tile_get_scale_factor (tile));
+}
+
+
+/* Returns the entry of the tile if it was rendered from the same data */
+static CacheEntry *
+cache_lookup (ChamplainVectorTileRenderer *renderer,
+    ChamplainTile *tile,
+    GBytes *data)
+{
+  ChamplainVectorTileRendererPrivate *priv = renderer->priv;
+  CacheEntry *entry;
+  GList *link;
+  gchar *key;
+
+  key = cache_key (tile);
+  link = g_hash_table_lookup (priv->cache_table, key);
+  g_free (key);
+
+  if (!link)
+    return NULL;
+
+  entry = link->data;
+  if (!g_bytes_equal (entry->data, data))
+    return NULL;
+
+  g_queue_unlink (priv->cache_queue, link);
+  g_queue_push_head_link (priv->cache_queue, link);
+
+  return entry;
+}
+
+
+static void
+cache_store (ChamplainVectorTileRenderer *renderer,
+    ChamplainTile *tile,
+    GBytes *data,
+    VectorTile *vector_tile,
+    cairo_surface_t *surface,
+    guint style_serial)
+{
+  ChamplainVectorTileRendererPrivate *priv = renderer->priv;
+  CacheEntry *entry;
+  GList *link;
+  gchar *key;
+
+  key = cache_key (tile);
+  link = g_hash_table_lookup (priv->cache_table, key);
+  if (link)
+    {
+      g_free (key);
+      entry = link->data;
+      g_queue_unlink (priv->cache_queue, link);
+      g_queue_push_head_link (priv->cache_queue, link);
+
+      g_bytes_unref (entry->data);
+      if (entry->vector_tile)
+        vector_tile_unref (entry->vector_tile);
+      if (entry->surface)
+        cairo_surface_destroy (entry->surface);
+    }
+  else
+    {
+      entry = g_slice_new (CacheEntry);
+      entry->key = key;
+      g_queue_push_head (priv->cache_queue, entry);
+      g_hash_table_insert (priv->cache_table, entry->key, g_queue_peek_head_link (priv->cache_queue));
+    }
+
+  entry->data = g_bytes_ref (data);
+  entry->vector_tile = g_atomic_rc_box_acquire (vector_tile);
+  entry->surface = surface && style_serial == priv->style->serial ?
+    cairo_surface_reference (surface) : NULL;
+  entry->style_serial = style_serial;
+
+  cache_trim (renderer);
+}
+
+
+/* A minimal reader of the protocol buffers encoding, just enough for the
+ * vector tile messages */
+typedef struct
+{
+  const guint8 *pos;
+  const guint8 *end;
+  gboolean error;
+} PbfReader;
+
+enum
+{
+  PBF_VARINT = 0,
+  PBF_FIXED64 = 1,
+  PBF_BYTES = 2,
+  PBF_FIXED32 = 5
+};
+
+
+static void
+pbf_fail (PbfReader *reader)
+{
+  reader->error = TRUE;
+  reader->pos = reader->end;
+}
+
+
+static guint64
+pbf_varint (PbfReader *reader)
+{
+  guint64 value = 0;
+  guint shift;
+
+  for (shift = 0; shift < 64 && reader->pos < reader->end; shift += 7)
+    {
+      guint8 byte = *reader->pos++;
+
+      value |= (guint64) (byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+
+  pbf_fail (reader);
+  return 0;
+}
+
+
+static gint32
+pbf_zigzag (guint32 value)
+{
+  return (gint32) (value >> 1) ^ -(gint32) (value & 1);
+}
+
+
+static const guint8 *
+pbf_fixed (PbfReader *reader,
+    gsize size)
+{
+  const guint8 *pos = reader->pos;
+
+  if ((gsize) (reader->end - reader->pos) < size)
+    {
+      pbf_fail (reader);
+      return NULL;
+    }
+
+  reader->pos += size;
+  return pos;
+}
+
+
+/* Reads a length delimited field: an embedded message, a string or packed
+ * values */
+static PbfReader
+pbf_bytes (PbfReader *reader)
+{
+  PbfReader sub = { NULL, NULL, FALSE };
+  guint64 length;
+
+  length = pbf_varint (reader);
+  if (length > (guint64) (reader->end - reader->pos))
+    pbf_fail (reader);
+
+  if (!reader->error)
+    {
+      sub.pos = reader->pos;
+      sub.end = reader->pos + length;
+      reader->pos = sub.end;
+    }
+
+  return sub;
+}
+
+
+static gboolean
+pbf_next (PbfReader *reader,
+    guint *field,
+    guint *wire_type)
+{
+  guint64 key;
+
+  if (reader->pos >= reader->end)
+    return FALSE;
+
+  key = pbf_varint (reader);
+  *field = key >> 3;
+  *wire_type = key & 0x7;
+
+  return !reader->error;
+}
+
+
+static void
+pbf_skip (PbfReader *reader,
+    guint wire_type)
+{
+  switch (wire_type)
+    {
+    case PBF_VARINT:
+      pbf_varint (reader);
+      break;
+
+    case PBF_FIXED64:
+      pbf_fixed (reader, 8);
+      break;
+
+    case PBF_BYTES:
+      pbf_bytes (reader);
+      break;
+
+    case PBF_FIXED32:
+      pbf_fixed (reader, 4);
+      break;
+
+    default:
+      pbf_fail (reader);
+    }
+}
+
+
+static gchar *
+pbf_string (PbfReader *reader)
+{
+  PbfReader sub = pbf_bytes (reader);
+
+  if (reader->error)
+    return NULL;
+
+  return g_strndup ((const gchar *) sub.pos, sub.end - sub.pos);
+}
+
+
+/* Values are only compared with the filters of the style, keep them as
+ * strings */
+static gchar *
+decode_value (PbfReader *reader)
+{
+  PbfReader msg = pbf_bytes (reader);
+  gchar *value = NULL;
+  guint field, wire_type;
+
+  while (pbf_next (&msg, &field, &wire_type))
+    {
+      gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+      const guint8 *fixed;
+
+      g_clear_pointer (&value, g_free);
+
+      if (field == 1 && wire_type == PBF_BYTES)
+        value = pbf_string (&msg);
+      else if (field == 2 && wire_type == PBF_FIXED32)
+        {
+          guint32 bits;
+          gfloat f;
+
+          if ((fixed = pbf_fixed (&msg, 4)) == NULL)
+            break;
+          memcpy (&bits, fixed, 4);
+          bits = GUINT32_FROM_LE (bits);
+          memcpy (&f, &bits, 4);
+          value = g_strdup (g_ascii_dtostr (buf, sizeof (buf), f));
+        }
+      else if (field == 3 && wire_type == PBF_FIXED64)
+        {
+          guint64 bits;
+          gdouble d;
+
+          if ((fixed = pbf_fixed (&msg, 8)) == NULL)
+            break;
+          memcpy (&bits, fixed, 8);
+          bits = GUINT64_FROM_LE (bits);
+          memcpy (&d, &bits, 8);
+          value = g_strdup (g_ascii_dtostr (buf, sizeof (buf), d));
+        }
+      else if (field == 4 && wire_type == PBF_VARINT)
+        value = g_strdup_printf ("%" G_GINT64_FORMAT, (gint64) pbf_varint (&msg));
+      else if (field == 5 && wire_type == PBF_VARINT)
+        value = g_strdup_printf ("%" G_GUINT64_FORMAT, pbf_varint (&msg));
+      else if (field == 6 && wire_type == PBF_VARINT)
+        {
+          guint64 v = pbf_varint (&msg);
+
+          value = g_strdup_printf ("%" G_GINT64_FORMAT, (gint64) (v >> 1) ^ -(gint64) (v & 1));
+        }
+      else if (field == 7 && wire_type == PBF_VARINT)
+        value = g_strdup (pbf_varint (&msg) ? "true" : "false");
+      else
+        pbf_skip (&msg, wire_type);
+    }
+
+  if (msg.error)
+    reader->error = TRUE;
+
+  return value ? value : g_strdup ("");
+}
+
+
+static void
+decode_feature (PbfReader *reader,
+    VectorFeature *feature)
+{
+  PbfReader msg = pbf_bytes (reader);
+  guint field, wire_type;
+
+  while (pbf_next (&msg, &field, &wire_type))
+    {
+      if (field == 2 && wire_type == PBF_BYTES)
+        {
+          PbfReader packed = pbf_bytes (&msg);
+          GArray *tags = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+          while (packed.pos < packed.end)
+            {
+              guint32 tag = pbf_varint (&packed);
+
+              g_array_append_val (tags, tag);
+            }
+
+          if (packed.error)
+            msg.error = TRUE;
+
+          g_free (feature->tags);
+          feature->n_tags = tags->len;
+          feature->tags = (guint32 *) g_array_free (tags, FALSE);
+        }
+      else if (field == 3 && wire_type == PBF_VARINT)
+        feature->type = pbf_varint (&msg);
+      else if (field == 4 && wire_type == PBF_BYTES)
+        {
+          PbfReader geometry = pbf_bytes (&msg);
+
+          feature->geometry = geometry.pos;
+          feature->geometry_size = geometry.end - geometry.pos;
+        }
+      else
+        pbf_skip (&msg, wire_type);
+    }
+
+  if (msg.error)
+    reader->error = TRUE;
+}
+
+
+static VectorLayer *
+decode_layer (PbfReader *reader)
+{
+  PbfReader msg = pbf_bytes (reader);
+  VectorLayer *layer;
+  guint field, wire_type;
+
+  layer = g_slice_new0 (VectorLayer);
+  layer->extent = 4096;
+  layer->keys = g_ptr_array_new_with_free_func (g_free);
+  layer->values = g_ptr_array_new_with_free_func (g_free);
+  layer->features = g_array_new (FALSE, TRUE, sizeof (VectorFeature));
+
+  while (pbf_next (&msg, &field, &wire_type))
+    {
+      if (field == 1 && wire_type == PBF_BYTES)
+        {
+          g_free (layer->name);
+          layer->name = pbf_string (&msg);
+        }
+      else if (field == 2 && wire_type == PBF_BYTES)
+        {
+          VectorFeature feature = { 0 };
+
+          decode_feature (&msg, &feature);
+          g_array_append_val (layer->features, feature);
+        }
+      else if (field == 3 && wire_type == PBF_BYTES)
+        {
+          gchar *key = pbf_string (&msg);
+
+          if (key)
+            g_ptr_array_add (layer->keys, key);
+        }
+      else if (field == 4 && wire_type == PBF_BYTES)
+        g_ptr_array_add (layer->values, decode_value (&msg));
+      else if (field == 5 && wire_type == PBF_VARINT)
+        layer->extent = pbf_varint (&msg);
+      else
+        pbf_skip (&msg, wire_type);
+    }
+
+  if (msg.error || !layer->name || layer->extent == 0)
+    {
+      reader->error = TRUE;
+      vector_layer_free (layer);
+      return NULL;
+    }
+
+  return layer;
+}
+
+
+static GBytes *
+inflate_data (GBytes *data,
+    GError **error)
+{
+  GConverter *decompressor;
+  GInputStream *base_stream, *stream;
+  GOutputStream *output;
+  GBytes *result = NULL;
+
+  decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  base_stream = g_memory_input_stream_new_from_bytes (data);
+  stream = g_converter_input_stream_new (base_stream, decompressor);
+  output = g_memory_output_stream_new_resizable ();
+
+  if (g_output_stream_splice (output, stream,
+          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+          NULL, error) >= 0)
+    result = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output));
+
+  g_object_unref (output);
+  g_object_unref (stream);
+  g_object_unref (base_stream);
+  g_object_unref (decompressor);
+
+  return result;
+}
+
+
+static VectorTile *
+decode_tile (GBytes *data,
+    GError **error)
+{
+  VectorTile *vector_tile;
+  PbfReader reader;
+  const guint8 *bytes;
+  gsize size;
+  guint field, wire_type;
+
+  bytes = g_bytes_get_data (data, &size);
+
+  /* tiles from MBTiles files and some servers are gzip compressed */
+  if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b)
+    {
+      data = inflate_data (data, error);
+      if (!data)
+        return NULL;
+      bytes = g_bytes_get_data (data, &size);
+    }
+  else
+    g_bytes_ref (data);
+
+  vector_tile = g_atomic_rc_box_new0 (VectorTile);
+  vector_tile->data = data;
+  vector_tile->layers = g_ptr_array_new_with_free_func ((GDestroyNotify) vector_layer_free);
+
+  reader.pos = bytes;
+  reader.end = bytes + size;
+  reader.error = FALSE;
+
+  while (pbf_next (&reader, &field, &wire_type))
+    {
+      if (field == 3 && wire_type == PBF_BYTES)
+        {
+          VectorLayer *layer = decode_layer (&reader);
+
+          if (layer)
+            g_ptr_array_add (vector_tile->layers, layer);
+        }
+      else
+        pbf_skip (&reader, wire_type);
+    }
+
+  if (reader.error)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Malformed vector tile");
+      vector_tile_unref (vector_tile);
+      return NULL;
+    }
+
+  return vector_tile;
+}
+
+
+static gboolean
+rule_matches (StyleRule *rule,
+    VectorLayer *layer,
+    VectorFeature *feature)
+{
+  guint i;
+
+  if (!rule->filter_key)
+    return TRUE;
+
+  for (i = 0; i + 1 < feature->n_tags; i += 2)
+    {
+      guint32 key = feature->tags[i];
+      guint32 value = feature->tags[i + 1];
+
+      if (key >= layer->keys->len || value >= layer->values->len ||
+          strcmp (g_ptr_array_index (layer->keys, key), rule->filter_key) != 0)
+        continue;
+
+      if (!rule->filter_values)
+        return TRUE;
+
+      return g_strv_contains ((const gchar * const *) rule->filter_values,
+          g_ptr_array_index (layer->values, value)) != rule->filter_negate;
+    }
+
+  /* the tag is missing */
+  return rule->filter_values && rule->filter_negate;
+}
+
+
+static void
+append_feature_path (cairo_t *cr,
+    VectorFeature *feature,
+    gdouble scale,
+    gdouble radius)
+{
+  PbfReader reader;
+  gint64 x = 0, y = 0;
+
+  reader.pos = feature->geometry;
+  reader.end = feature->geometry + feature->geometry_size;
+  reader.error = FALSE;
+
+  while (reader.pos < reader.end)
+    {
+      guint32 command = pbf_varint (&reader);
+      guint id = command & 0x7;
+      guint count = command >> 3;
+
+      if (id == CMD_CLOSE_PATH)
+        {
+          cairo_close_path (cr);
+          continue;
+        }
+
+      if (id != CMD_MOVE_TO && id != CMD_LINE_TO)
+        return;
+
+      while (count-- > 0 && !reader.error)
+        {
+          x += pbf_zigzag (pbf_varint (&reader));
+          y += pbf_zigzag (pbf_varint (&reader));
+
+          if (feature->type == GEOM_POINT)
+            {
+              cairo_new_sub_path (cr);
+              cairo_arc (cr, x * scale, y * scale, radius, 0, 2 * G_PI);
+            }
+          else if (id == CMD_MOVE_TO)
+            cairo_move_to (cr, x * scale, y * scale);
+          else
+            cairo_line_to (cr, x * scale, y * scale);
+        }
+    }
+}
+
+
+static void
+set_source_color (cairo_t *cr,
+    const ClutterColor *color)
+{
+  cairo_set_source_rgba (cr,
+      color->red / 255.0,
+      color->green / 255.0,
+      color->blue / 255.0,
+      color->alpha / 255.0);
+}
+
+
+static VectorLayer *
+find_layer (VectorTile *vector_tile,
+    const gchar *name)
+{
+  guint i;
+
+  for (i = 0; i < vector_tile->layers->len; i++)
+    {
+      VectorLayer *layer = g_ptr_array_index (vector_tile->layers, i);
+
+      if (strcmp (layer->name, name) == 0)
+        return layer;
+    }
+
+  return NULL;
+}
+
+
+/* Appends the features of the layer matching the rule and having one of
+ * the geometry types to the path */
+static void
+append_rule_path (cairo_t *cr,
+    StyleRule *rule,
+    VectorLayer *layer,
+    gdouble scale,
+    guint type1,
+    guint type2)
+{
+  guint i;
+
+  cairo_new_path (cr);
+
+  for (i = 0; i < layer->features->len; i++)
+    {
+      VectorFeature *feature = &g_array_index (layer->features, VectorFeature, i);
+
+      if (feature->type != type1 && feature->type != type2)
+        continue;
+
+      if (feature->type == GEOM_POINT && rule->radius <= 0)
+        continue;
+
+      if (rule_matches (rule, layer, feature))
+        append_feature_path (cr, feature, scale, rule->radius);
+    }
+}
+
+
+static cairo_surface_t *
+draw_tile (VectorTile *vector_tile,
+    Style *style,
+    guint zoom_level,
+    guint tile_size,
+    guint scale_factor)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  guint i;
+
+  /* drawn in the coordinates of the tile, the line widths of the style
+   * are scaled as well */
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+        tile_size * scale_factor, tile_size * scale_factor);
+  cairo_surface_set_device_scale (surface, scale_factor, scale_factor);
+  cr = cairo_create (surface);
+
+  if (style->background)
+    {
+      set_source_color (cr, &style->background_color);
+      cairo_paint (cr);
+    }
+
+  cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
+  cairo_set_line_cap (cr, CAIRO_LINE_CAP_ROUND);
+
+  for (i = 0; i < style->rules->len; i++)
+    {
+      StyleRule *rule = g_ptr_array_index (style->rules, i);
+      VectorLayer *layer;
+      gdouble scale;
+
+      if ((gint) zoom_level < rule->min_zoom || (gint) zoom_level > rule->max_zoom)
+        continue;
+
+      layer = find_layer (vector_tile, rule->layer);
+      if (!layer)
+        continue;
+
+      scale = (gdouble) tile_size / layer->extent;
+
+      /* all features of a rule are drawn at once, which is faster and
+       * avoids seams between adjacent polygons */
+      if (rule->fill)
+        {
+          append_rule_path (cr, rule, layer, scale, GEOM_POLYGON, GEOM_POINT);
+          set_source_color (cr, &rule->fill_color);
+          cairo_fill (cr);
+        }
+
+      if (rule->stroke)
+        {
+          append_rule_path (cr, rule, layer, scale, GEOM_LINESTRING, GEOM_POLYGON);
+          set_source_color (cr, &rule->stroke_color);
+          cairo_set_line_width (cr, rule->line_width);
+          cairo_stroke (cr);
+        }
+    }
+
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+
+  return surface;
+}
+
+
+/* cairo's premultiplied native endian ARGB in memory order */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define SURFACE_PIXEL_FORMAT COGL_PIXEL_FORMAT_BGRA_8888_PRE
+#else
+#define SURFACE_PIXEL_FORMAT COGL_PIXEL_FORMAT_ARGB_8888_PRE
+#endif
+
+
+static void
+render_surface (ChamplainTile *tile,
+    cairo_surface_t *surface,
+    GBytes *data)
+{
+  ClutterContent *content;
+  ClutterActor *actor;
+  gfloat size;
+  gconstpointer bytes;
+  gsize n_bytes;
+
+  bytes = g_bytes_get_data (data, &n_bytes);
+
+  content = clutter_image_new ();
+  if (!clutter_image_set_data (CLUTTER_IMAGE (content),
+          cairo_image_surface_get_data (surface),
+          SURFACE_PIXEL_FORMAT,
+          cairo_image_surface_get_width (surface),
+          cairo_image_surface_get_height (surface),
+          cairo_image_surface_get_stride (surface),
+          NULL))
+    {
+      g_object_unref (content);
+      g_signal_emit_by_name (tile, "render-complete", bytes, (guint) n_bytes, TRUE);
+      return;
+    }
+
+  size = champlain_tile_get_size (tile);
+  actor = clutter_actor_new ();
+  clutter_actor_set_size (actor, size, size);
+  clutter_actor_set_content (actor, content);
+  g_object_unref (content);
+  /* has to be set for proper opacity */
+  clutter_actor_set_offscreen_redirect (actor, CLUTTER_OFFSCREEN_REDIRECT_AUTOMATIC_FOR_OPACITY);
+
+  champlain_tile_set_content (tile, actor);
+  g_signal_emit_by_name (tile, "render-complete", bytes, (guint) n_bytes, FALSE);
+
+  /* Set after render-complete, the tile can't decode vector data again so
+   * it must not release the surface. It is shared with the cache anyway. */
+  champlain_exportable_set_surface (CHAMPLAIN_EXPORTABLE (tile), surface);
+}
+
+
+static void
+renderer_data_free (RendererData *data)
+{
+  g_clear_object (&data->renderer);
+  g_clear_object (&data->tile);
+  g_bytes_unref (data->data);
+  if (data->vector_tile)
+    vector_tile_unref (data->vector_tile);
+  style_unref (data->style);
+  if (data->surface)
+    cairo_surface_destroy (data->surface);
+  g_slice_free (RendererData, data);
+}
+
+
+/* Decodes the tile unless it has been decoded already and draws it */
+static void
+render_thread (GTask *task,
+    G_GNUC_UNUSED gpointer source_object,
+    gpointer task_data,
+    G_GNUC_UNUSED GCancellable *cancellable)
+{
+  RendererData *data = task_data;
+  GError *error = NULL;
+
+  if (!data->vector_tile)
+    {
+      data->vector_tile = decode_tile (data->data, &error);
+      if (!data->vector_tile)
+        {
+          g_task_return_error (task, error);
+          return;
+        }
+    }
+
+  data->surface = draw_tile (data->vector_tile, data->style, data->zoom_level,
+        data->tile_size, data->scale_factor);
+  if (cairo_surface_status (data->surface) != CAIRO_STATUS_SUCCESS)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "%s",
+          cairo_status_to_string (cairo_surface_status (data->surface)));
+      return;
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+
+static void
+tile_rendered_cb (G_GNUC_UNUSED GObject *source_object,
+    GAsyncResult *res,
+    G_GNUC_UNUSED gpointer user_data)
+{
+  RendererData *data = g_task_get_task_data (G_TASK (res));
+  GError *error = NULL;
+
+  if (g_task_propagate_boolean (G_TASK (res), &error))
+    {
+      cache_store (CHAMPLAIN_VECTOR_TILE_RENDERER (data->renderer), data->tile,
+          data->data, data->vector_tile, data->surface, data->style->serial);
+      render_surface (data->tile, data->surface, data->data);
+    }
+  else
+    {
+      gconstpointer bytes;
+      gsize n_bytes;
+
+      g_warning ("Unable to render tile: %s", error->message);
+      g_error_free (error);
+
+      bytes = g_bytes_get_data (data->data, &n_bytes);
+      g_signal_emit_by_name (data->tile, "render-complete", bytes, (guint) n_bytes, TRUE);
+    }
+
+  /* the worker thread may drop the last reference to the task, don't leave
+   * the clutter objects to it */
+  g_clear_object (&data->tile);
+  g_clear_object (&data->renderer);
+}
+
+
+static void
+render (ChamplainRenderer *renderer, ChamplainTile *tile)
+{
+  ChamplainVectorTileRenderer *vector_renderer = CHAMPLAIN_VECTOR_TILE_RENDERER (renderer);
+  ChamplainVectorTileRendererPrivate *priv = vector_renderer->priv;
+  RendererData *renderer_data;
+  CacheEntry *entry;
+  GBytes *data;
+  GTask *task;
+  guint tile_size, scale_factor;
+
+  if (!priv->data || g_bytes_get_size (priv->data) == 0)
+    {
+      g_signal_emit_by_name (tile, "render-complete", NULL, 0, TRUE);
+      return;
+    }
+
+  data = priv->data;
+  priv->data = NULL;
+  tile_size = champlain_tile_get_size (tile);
+  scale_factor = champlain_tile_get_scale_factor (tile);
+
+  entry = cache_lookup (vector_renderer, tile, data);
+  if (entry && entry->surface && entry->style_serial == priv->style->serial &&
+      cairo_image_surface_get_width (entry->surface) == (gint) (tile_size * scale_factor))
+    {
+      render_surface (tile, entry->surface, data);
+      g_bytes_unref (data);
+      return;
+    }
+
+  renderer_data = g_slice_new (RendererData);
+  renderer_data->renderer = g_object_ref (renderer);
+  renderer_data->tile = g_object_ref (tile);
+  renderer_data->data = data;
+  renderer_data->vector_tile = entry ? g_atomic_rc_box_acquire (entry->vector_tile) : NULL;
+  renderer_data->style = g_atomic_rc_box_acquire (priv->style);
+  renderer_data->zoom_level = champlain_tile_get_zoom_level (tile);
+  renderer_data->tile_size = tile_size;
+  renderer_data->scale_factor = scale_factor;
+  renderer_data->surface = NULL;
+
+  task = g_task_new (renderer, NULL, tile_rendered_cb, NULL);
+  g_task_set_task_data (task, renderer_data, (GDestroyNotify) renderer_data_free);
+  g_task_run_in_thread (task, render_thread);
+  g_object_unref (task);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#if !defined (__CHAMPLAIN_CHAMPLAIN_H_INSIDE__) && !defined (CHAMPLAIN_COMPILATION)
+#error "Only <champlain/champlain.h> can be included directly."
+#endif
+
+#ifndef __CHAMPLAIN_VECTOR_TILE_RENDERER_H__
+#define __CHAMPLAIN_VECTOR_TILE_RENDERER_H__
+
+#include <champlain/champlain-tile.h>
+#include <champlain/champlain-renderer.h>
+
+G_BEGIN_DECLS
+
+#define CHAMPLAIN_TYPE_VECTOR_TILE_RENDERER champlain_vector_tile_renderer_get_type ()
+
+#define CHAMPLAIN_VECTOR_TILE_RENDERER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CHAMPLAIN_TYPE_VECTOR_TILE_RENDERER, ChamplainVectorTileRenderer))
+
+#define CHAMPLAIN_VECTOR_TILE_RENDERER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), CHAMPLAIN_TYPE_VECTOR_TILE_RENDERER, ChamplainVectorTileRendererClass))
+
+#define CHAMPLAIN_IS_VECTOR_TILE_RENDERER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CHAMPLAIN_TYPE_VECTOR_TILE_RENDERER))
+
+#define CHAMPLAIN_IS_VECTOR_TILE_RENDERER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), CHAMPLAIN_TYPE_VECTOR_TILE_RENDERER))
+
+#define CHAMPLAIN_VECTOR_TILE_RENDERER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), CHAMPLAIN_TYPE_VECTOR_TILE_RENDERER, ChamplainVectorTileRendererClass))
+
+typedef struct _ChamplainVectorTileRendererPrivate ChamplainVectorTileRendererPrivate;
+
+typedef struct _ChamplainVectorTileRenderer ChamplainVectorTileRenderer;
+typedef struct _ChamplainVectorTileRendererClass ChamplainVectorTileRendererClass;
+
+/**
+ * ChamplainVectorTileRenderer:
+ *
+ * The #ChamplainVectorTileRenderer structure contains only private data
+ * and should be accessed using the provided API
+ *
+ * Since: 0.12.22
+ */
+struct _ChamplainVectorTileRenderer
+{
+  ChamplainRenderer parent;
+
+  ChamplainVectorTileRendererPrivate *priv;
+};
+
+struct _ChamplainVectorTileRendererClass
+{
+  ChamplainRendererClass parent_class;
+};
+
+GType champlain_vector_tile_renderer_get_type (void);
+
+ChamplainVectorTileRenderer *champlain_vector_tile_renderer_new (void);
+
+gboolean champlain_vector_tile_renderer_set_style (ChamplainVectorTileRenderer *renderer,
+    const gchar *style,
+    GError **error);
+const gchar *champlain_vector_tile_renderer_get_style (ChamplainVectorTileRenderer *renderer);
+gboolean champlain_vector_tile_renderer_load_style (ChamplainVectorTileRenderer *renderer,
+    const gchar *style_path,
+    GError **error);
+
+void champlain_vector_tile_renderer_set_cache_size (ChamplainVectorTileRenderer *renderer,
+    guint cache_size);
+guint champlain_vector_tile_renderer_get_cache_size (ChamplainVectorTileRenderer *renderer);
+
+G_END_DECLS
+
+#endif /* __CHAMPLAIN_VECTOR_TILE_RENDERER_H__ */
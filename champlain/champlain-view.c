@@ -59,6 +59,8 @@
 #include "champlain-map-source.h"
 #include "champlain-map-source-factory.h"
 #include "champlain-private.h"
+#include "champlain-network-tile-source-private.h"
+#include "champlain-tile-private.h"
 #include "champlain-tile.h"
 #include "champlain-license.h"
 
@@ -104,7 +106,9 @@ enum
   PROP_GOTO_ANIMATION_MODE,
   PROP_GOTO_ANIMATION_DURATION,
   PROP_WORLD,
-  PROP_HORIZONTAL_WRAP
+  PROP_HORIZONTAL_WRAP,
+  PROP_KEEP_TILE_SURFACES,
+  PROP_SCALE_FACTOR
 };
 
 #define PADDING 10
@@ -156,6 +160,8 @@ struct _ChamplainViewPrivate
   ClutterContent *background_content; 
 
   gboolean hwrap;
+  gboolean keep_tile_surfaces;
+  guint scale_factor;
   /* There are num_right_clones clones on the right, and one extra on the left */
   gint num_right_clones;
   GList *map_clones;
@@ -671,6 +677,14 @@ champlain_view_get_property (GObject *object,
       g_value_set_boolean (value, champlain_view_get_horizontal_wrap (view));
       break;
 
+    case PROP_KEEP_TILE_SURFACES:
+      g_value_set_boolean (value, priv->keep_tile_surfaces);
+      break;
+
+    case PROP_SCALE_FACTOR:
+      g_value_set_uint (value, priv->scale_factor);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -756,6 +770,14 @@ champlain_view_set_property (GObject *object,
       champlain_view_set_horizontal_wrap (view, g_value_get_boolean (value));
       break;
 
+    case PROP_KEEP_TILE_SURFACES:
+      champlain_view_set_keep_tile_surfaces (view, g_value_get_boolean (value));
+      break;
+
+    case PROP_SCALE_FACTOR:
+      champlain_view_set_scale_factor (view, g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -1202,6 +1224,42 @@ champlain_view_class_init (ChamplainViewClass *champlainViewClass)
           FALSE,
           CHAMPLAIN_PARAM_READWRITE));
 
+  /**
+   * ChamplainView:keep-tile-surfaces:
+   *
+   * Determines whether the map tiles keep their rendered images in memory.
+   * Set it when champlain_view_to_surface() is called often; otherwise the
+   * images are decoded again from the tile data when the view is exported.
+   *
+   * Since: 0.12.22
+   */
+  g_object_class_install_property (object_class,
+      PROP_KEEP_TILE_SURFACES,
+      g_param_spec_boolean ("keep-tile-surfaces",
+          "Keep tile surfaces",
+          "Determines whether the tiles keep their rendered images.",
+          FALSE,
+          CHAMPLAIN_PARAM_READWRITE));
+
+  /**
+   * ChamplainView:scale-factor:
+   *
+   * The scale factor of the display the view is shown on. Tiles are loaded
+   * with this many device pixels per pixel when the map source provides
+   * them, see champlain_map_source_get_max_scale_factor().
+   *
+   * Since: 0.12.22
+   */
+  g_object_class_install_property (object_class,
+      PROP_SCALE_FACTOR,
+      g_param_spec_uint ("scale-factor",
+          "Scale factor",
+          "The scale factor of the display",
+          1,
+          G_MAXUINT,
+          1,
+          CHAMPLAIN_PARAM_READWRITE));
+
   /**
    * ChamplainView::animation-completed:
    *
@@ -1557,6 +1615,8 @@ champlain_view_init (ChamplainView *view)
   priv->map_clones = NULL;
   priv->user_layer_slots = NULL;
   priv->hwrap = FALSE;
+  priv->keep_tile_surfaces = FALSE;
+  priv->scale_factor = 1;
 
   clutter_actor_set_background_color (CLUTTER_ACTOR (view), &color);
 
@@ -2729,6 +2789,8 @@ load_tile_for_source (ChamplainView *view,
   champlain_tile_set_y (tile, y);
   champlain_tile_set_zoom_level (tile, priv->zoom_level);
   champlain_tile_set_size (tile, size);
+  champlain_tile_set_scale_factor (tile,
+      MAX (1, MIN (priv->scale_factor, champlain_map_source_get_max_scale_factor (source))));
   clutter_actor_set_opacity (CLUTTER_ACTOR (tile), opacity);
 
   g_signal_connect (tile, "notify::state", G_CALLBACK (tile_state_notify), view);
@@ -2781,6 +2843,36 @@ fill_tile_cb (FillTileCallbackData *data)
   return FALSE;
 }
 
+/* Gets the connections of network sources ready before their first tiles */
+static void
+preconnect_map_source (ChamplainMapSource *map_source)
+{
+  for (; map_source; map_source = champlain_map_source_get_next_source (map_source))
+    {
+      if (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (map_source))
+        champlain_network_tile_source_preconnect (CHAMPLAIN_NETWORK_TILE_SOURCE (map_source));
+    }
+}
+
+
+/* Lets network sources download the tiles in the middle of the view first */
+static void
+update_download_focus (ChamplainView *view,
+    ChamplainMapSource *map_source,
+    gdouble x,
+    gdouble y)
+{
+  ChamplainViewPrivate *priv = view->priv;
+
+  for (; map_source; map_source = champlain_map_source_get_next_source (map_source))
+    {
+      if (CHAMPLAIN_IS_NETWORK_TILE_SOURCE (map_source))
+        champlain_network_tile_source_set_focus (CHAMPLAIN_NETWORK_TILE_SOURCE (map_source),
+            priv->zoom_level, x, y);
+    }
+}
+
+
 static void
 load_visible_tiles (ChamplainView *view,
     gboolean relocate)
@@ -2796,6 +2888,8 @@ load_visible_tiles (ChamplainView *view,
   gint arm_size, arm_max, turn;
   gint dirs[5] = { 0, 1, 0, -1, 0 };
   gint i, x, y;
+  gdouble center_x, center_y;
+  GList *list;
 
   size = champlain_map_source_get_tile_size (priv->map_source);
   get_tile_bounds (view, &min_x, &min_y, &max_x, &max_y);
@@ -2859,6 +2953,15 @@ load_visible_tiles (ChamplainView *view,
         champlain_viewport_set_actor_position (CHAMPLAIN_VIEWPORT (priv->viewport), CLUTTER_ACTOR (tile), tile_x * size, tile_y * size);
     }
 
+  center_x = (priv->viewport_x + priv->viewport_width / 2.0) / size;
+  center_y = (priv->viewport_y + priv->viewport_height / 2.0) / size;
+  if (priv->hwrap)
+    center_x = x_to_wrap_x (center_x, column_count);
+
+  update_download_focus (view, priv->map_source, center_x, center_y);
+  for (list = priv->overlay_sources; list; list = list->next)
+    update_download_focus (view, list->data, center_x, center_y);
+
   /* Load new tiles if needed */
   x = priv->tile_x_first + x_count / 2 - 1;
   y = priv->tile_y_first + y_count / 2 - 1;
@@ -2976,6 +3079,9 @@ tile_state_notify (ChamplainTile *tile,
     }
   else if (tile_state == CHAMPLAIN_STATE_DONE)
     {
+      if (!priv->keep_tile_surfaces)
+        champlain_tile_release_surface (tile);
+
       if (priv->tiles_loading > 0)
         priv->tiles_loading--;
       if (priv->tiles_loading == 0)
@@ -3020,6 +3126,7 @@ champlain_view_set_map_source (ChamplainView *view,
 
   g_object_unref (priv->map_source);
   priv->map_source = g_object_ref_sink (source);
+  preconnect_map_source (priv->map_source);
 
   g_list_free_full (priv->overlay_sources, g_object_unref);
   priv->overlay_sources = NULL;
@@ -3386,6 +3493,98 @@ champlain_view_get_horizontal_wrap (ChamplainView *view)
 }
 
 
+/**
+ * champlain_view_set_keep_tile_surfaces:
+ * @view: a #ChamplainView
+ * @value: %TRUE to keep the rendered images of the tiles
+ *
+ * Sets the value of the #ChamplainView:keep-tile-surfaces property.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_view_set_keep_tile_surfaces (ChamplainView *view,
+    gboolean value)
+{
+  DEBUG_LOG ()
+
+  g_return_if_fail (CHAMPLAIN_IS_VIEW (view));
+
+  view->priv->keep_tile_surfaces = value;
+  g_object_notify (G_OBJECT (view), "keep-tile-surfaces");
+}
+
+
+/**
+ * champlain_view_get_keep_tile_surfaces:
+ * @view: a #ChamplainView
+ *
+ * Returns the value of the #ChamplainView:keep-tile-surfaces property.
+ *
+ * Returns: %TRUE if the tiles keep their rendered images.
+ *
+ * Since: 0.12.22
+ */
+gboolean
+champlain_view_get_keep_tile_surfaces (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  g_return_val_if_fail (CHAMPLAIN_IS_VIEW (view), FALSE);
+
+  return view->priv->keep_tile_surfaces;
+}
+
+
+/**
+ * champlain_view_set_scale_factor:
+ * @view: a #ChamplainView
+ * @scale_factor: the scale factor of the display
+ *
+ * Sets the value of the #ChamplainView:scale-factor property. The visible
+ * tiles are reloaded when it changes.
+ *
+ * Since: 0.12.22
+ */
+void
+champlain_view_set_scale_factor (ChamplainView *view,
+    guint scale_factor)
+{
+  DEBUG_LOG ()
+
+  g_return_if_fail (CHAMPLAIN_IS_VIEW (view));
+  g_return_if_fail (scale_factor >= 1);
+
+  if (view->priv->scale_factor == scale_factor)
+    return;
+
+  view->priv->scale_factor = scale_factor;
+  champlain_view_reload_tiles (view);
+  g_object_notify (G_OBJECT (view), "scale-factor");
+}
+
+
+/**
+ * champlain_view_get_scale_factor:
+ * @view: a #ChamplainView
+ *
+ * Returns the value of the #ChamplainView:scale-factor property.
+ *
+ * Returns: the scale factor of the display.
+ *
+ * Since: 0.12.22
+ */
+guint
+champlain_view_get_scale_factor (ChamplainView *view)
+{
+  DEBUG_LOG ()
+
+  g_return_val_if_fail (CHAMPLAIN_IS_VIEW (view), 1);
+
+  return view->priv->scale_factor;
+}
+
+
 static void
 position_zoom_actor (ChamplainView *view)
 {
@@ -4126,6 +4325,7 @@ champlain_view_add_overlay_source (ChamplainView *view,
   g_object_ref (map_source);
   priv->overlay_sources = g_list_append (priv->overlay_sources, map_source);
   g_object_set_data (G_OBJECT (map_source), "opacity", GINT_TO_POINTER (opacity));
+  preconnect_map_source (map_source);
   g_object_notify (G_OBJECT (view), "map-source");
 
   champlain_view_reload_tiles (view);
@@ -130,6 +130,10 @@ void champlain_view_set_world (ChamplainView *view,
     ChamplainBoundingBox *bbox);
 void champlain_view_set_horizontal_wrap (ChamplainView *view,
     gboolean wrap);
+void champlain_view_set_keep_tile_surfaces (ChamplainView *view,
+    gboolean value);
+void champlain_view_set_scale_factor (ChamplainView *view,
+    guint scale_factor);
 void champlain_view_add_layer (ChamplainView *view,
     ChamplainLayer *layer);
 void champlain_view_remove_layer (ChamplainView *view,
@@ -150,6 +154,8 @@ ChamplainState champlain_view_get_state (ChamplainView *view);
 ClutterContent *champlain_view_get_background_pattern (ChamplainView *view);
 ChamplainBoundingBox *champlain_view_get_world (ChamplainView *view);
 gboolean champlain_view_get_horizontal_wrap (ChamplainView *view);
+gboolean champlain_view_get_keep_tile_surfaces (ChamplainView *view);
+guint champlain_view_get_scale_factor (ChamplainView *view);
 
 void champlain_view_reload_tiles (ChamplainView *view);
 
@@ -53,6 +53,7 @@
 
 #include "champlain/champlain-network-tile-source.h"
 #include "champlain/champlain-network-bbox-tile-source.h"
+#include "champlain/champlain-network-metatile-source.h"
 #include "champlain/champlain-file-tile-source.h"
 #include "champlain/champlain-null-tile-source.h"
 
@@ -61,6 +62,7 @@
 
 #include "champlain/champlain-image-renderer.h"
 #include "champlain/champlain-error-tile-renderer.h"
+#include "champlain/champlain-vector-tile-renderer.h"
 
 #ifdef CHAMPLAIN_HAS_MEMPHIS
 # include "champlain/champlain-memphis-renderer.h"
@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Benchmarks ChamplainNetworkTileSource against a tile server running in the
+ * same process, so the results don't depend on a real tile server.
+ *
+ * The server answers every /z/x/y.png request with the same PNG after a
+ * delay made of --latency and the time the payload takes at --bandwidth.
+ * It fails a --error-rate fraction of the requests with 503 and, unless
+ * --no-etag is given, answers conditional requests with 304.
+ *
+ * Every pass loads --tiles tiles through the source chain at once, like a
+ * view does, and prints the throughput and the percentiles of the time from
+ * asking for a tile until it is done. No window is shown, but Clutter needs
+ * a display, so use e.g. xvfb-run on machines without one.
+ */
+
+#include <champlain/champlain.h>
+#include <libsoup/soup.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <stdio.h>
+
+#define TILE_SIZE 256
+#define ZOOM_LEVEL 12
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+typedef SoupServerMessage ServerMessage;
+#else
+typedef SoupMessage ServerMessage;
+#endif
+
+static gint latency = 50;
+static gint bandwidth = 0;
+static gdouble error_rate = 0;
+static gboolean no_etag = FALSE;
+static gint payload = 16;
+static gint n_tiles = 256;
+static gint n_passes = 3;
+static gint max_conns = 2;
+static gboolean adaptive = FALSE;
+static gboolean revalidate = FALSE;
+static gboolean use_caches = FALSE;
+
+static GOptionEntry entries[] =
+{
+  { "latency", 'l', 0, G_OPTION_ARG_INT, &latency, "Server response delay in ms (50)", "MS" },
+  { "bandwidth", 'b', 0, G_OPTION_ARG_INT, &bandwidth, "Bandwidth of every connection in KiB/s, 0 for unlimited (0)", "KIBPS" },
+  { "error-rate", 'e', 0, G_OPTION_ARG_DOUBLE, &error_rate, "Fraction of requests failing with 503 (0)", "RATE" },
+  { "no-etag", 0, 0, G_OPTION_ARG_NONE, &no_etag, "Don't send ETags nor answer with 304", NULL },
+  { "payload", 'p', 0, G_OPTION_ARG_INT, &payload, "Approximate tile size in KiB (16)", "KIB" },
+  { "tiles", 't', 0, G_OPTION_ARG_INT, &n_tiles, "Tiles loaded in every pass (256)", "N" },
+  { "passes", 'n', 0, G_OPTION_ARG_INT, &n_passes, "Number of passes (3)", "N" },
+  { "max-conns", 'c', 0, G_OPTION_ARG_INT, &max_conns, "Maximum number of connections (2)", "N" },
+  { "adaptive", 'a', 0, G_OPTION_ARG_NONE, &adaptive, "Adapt the number of connections", NULL },
+  { "revalidate", 'r', 0, G_OPTION_ARG_NONE, &revalidate, "Validate expired cached tiles instead of downloading them", NULL },
+  { "caches", 0, 0, G_OPTION_ARG_NONE, &use_caches, "Put a memory and a file cache in front of the network", NULL },
+  { NULL }
+};
+
+typedef struct
+{
+  SoupServer *server;
+  gchar *data;
+  gsize size;
+  guint n_requests;
+  guint n_not_modified;
+  guint n_errors;
+} TileServer;
+
+typedef struct
+{
+  ChamplainMapSource *map_source;
+  gchar *cache_dir;
+  guint pass;
+  GPtrArray *tiles;
+  GArray *latencies;
+  guint n_failed;
+  guint n_pending;
+  gint64 pass_start;
+} Bench;
+
+typedef struct
+{
+  Bench *bench;
+  gint64 start;
+  gboolean failed;
+} TileData;
+
+
+static gboolean
+create_payload (TileServer *tile_server,
+    GError **error)
+{
+  GdkPixbuf *pixbuf;
+  gchar *padding;
+  guint x, y;
+  gboolean ok;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, TILE_SIZE, TILE_SIZE);
+  for (y = 0; y < TILE_SIZE; y++)
+    {
+      guchar *row = gdk_pixbuf_get_pixels (pixbuf) + y * gdk_pixbuf_get_rowstride (pixbuf);
+
+      for (x = 0; x < TILE_SIZE; x++)
+        {
+          row[3 * x] = x;
+          row[3 * x + 1] = y;
+          row[3 * x + 2] = x ^ y;
+        }
+    }
+
+  /* Text chunks aren't compressed, they make the payload as big as asked */
+  padding = g_strnfill (MAX (payload, 1) * 1024, 'x');
+  ok = gdk_pixbuf_save_to_buffer (pixbuf, &tile_server->data, &tile_server->size,
+        "png", error, "tEXt::padding", padding, NULL);
+
+  g_free (padding);
+  g_object_unref (pixbuf);
+
+  return ok;
+}
+
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+static void
+pause_message (SoupServer *server,
+    ServerMessage *msg)
+{
+#if SOUP_CHECK_VERSION (3, 2, 0)
+  soup_server_message_pause (msg);
+#else
+  soup_server_pause_message (server, msg);
+#endif
+}
+
+
+static void
+unpause_message (SoupServer *server,
+    ServerMessage *msg)
+{
+#if SOUP_CHECK_VERSION (3, 2, 0)
+  soup_server_message_unpause (msg);
+#else
+  soup_server_unpause_message (server, msg);
+#endif
+}
+
+
+static void
+set_status (ServerMessage *msg,
+    guint status)
+{
+  soup_server_message_set_status (msg, status, NULL);
+}
+#else
+#define pause_message soup_server_pause_message
+#define unpause_message soup_server_unpause_message
+#define soup_server_message_get_request_headers(msg) ((msg)->request_headers)
+#define soup_server_message_get_response_headers(msg) ((msg)->response_headers)
+#define soup_server_message_set_response soup_message_set_response
+#define set_status soup_message_set_status
+#endif
+
+
+typedef struct
+{
+  SoupServer *server;
+  ServerMessage *msg;
+} DelayedResponse;
+
+static gboolean
+respond_cb (DelayedResponse *response)
+{
+  unpause_message (response->server, response->msg);
+
+  g_object_unref (response->msg);
+  g_slice_free (DelayedResponse, response);
+
+  return FALSE;
+}
+
+
+static void
+serve_tile (SoupServer *server,
+    ServerMessage *msg,
+    const gchar *path,
+    TileServer *tile_server)
+{
+  SoupMessageHeaders *request_headers = soup_server_message_get_request_headers (msg);
+  SoupMessageHeaders *response_headers = soup_server_message_get_response_headers (msg);
+  const gchar *if_none_match;
+  DelayedResponse *response;
+  guint z, x, y;
+  gchar *etag;
+  guint delay = latency;
+
+  tile_server->n_requests++;
+
+  if (sscanf (path, "/%u/%u/%u.png", &z, &x, &y) != 3)
+    {
+      set_status (msg, SOUP_STATUS_NOT_FOUND);
+      return;
+    }
+
+  if (error_rate > 0 && g_random_double () < error_rate)
+    {
+      tile_server->n_errors++;
+      set_status (msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+    }
+  else
+    {
+      etag = g_strdup_printf ("\"%u-%u-%u\"", z, x, y);
+      if_none_match = soup_message_headers_get_one (request_headers, "If-None-Match");
+
+      if (!no_etag && g_strcmp0 (if_none_match, etag) == 0)
+        {
+          tile_server->n_not_modified++;
+          set_status (msg, SOUP_STATUS_NOT_MODIFIED);
+        }
+      else
+        {
+          set_status (msg, SOUP_STATUS_OK);
+          soup_server_message_set_response (msg, "image/png", SOUP_MEMORY_STATIC,
+              tile_server->data, tile_server->size);
+          if (bandwidth > 0)
+            delay += tile_server->size * 1000 / (bandwidth * 1024);
+        }
+
+      if (!no_etag)
+        soup_message_headers_append (response_headers, "ETag", etag);
+      g_free (etag);
+    }
+
+  if (delay == 0)
+    return;
+
+  response = g_slice_new (DelayedResponse);
+  response->server = server;
+  response->msg = g_object_ref (msg);
+  pause_message (server, msg);
+  g_timeout_add (delay, (GSourceFunc) respond_cb, response);
+}
+
+
+#ifdef CHAMPLAIN_LIBSOUP_3
+static void
+server_callback (SoupServer *server,
+    SoupServerMessage *msg,
+    const char *path,
+    G_GNUC_UNUSED GHashTable *query,
+    gpointer user_data)
+{
+  serve_tile (server, msg, path, user_data);
+}
+#else
+static void
+server_callback (SoupServer *server,
+    SoupMessage *msg,
+    const char *path,
+    G_GNUC_UNUSED GHashTable *query,
+    G_GNUC_UNUSED SoupClientContext *client,
+    gpointer user_data)
+{
+  serve_tile (server, msg, path, user_data);
+}
+#endif
+
+
+static gchar *
+start_server (TileServer *tile_server,
+    GError **error)
+{
+  GSList *uris;
+  gchar *uri_format;
+
+  if (!create_payload (tile_server, error))
+    return NULL;
+
+  tile_server->server = soup_server_new (NULL, NULL);
+  soup_server_add_handler (tile_server->server, NULL, server_callback, tile_server, NULL);
+  if (!soup_server_listen_local (tile_server->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, error))
+    return NULL;
+
+  uris = soup_server_get_uris (tile_server->server);
+#ifdef CHAMPLAIN_LIBSOUP_3
+  uri_format = g_strdup_printf ("http://127.0.0.1:%d/#Z#/#X#/#Y#.png",
+        g_uri_get_port (uris->data));
+  g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+#else
+  uri_format = g_strdup_printf ("http://127.0.0.1:%u/#Z#/#X#/#Y#.png",
+        ((SoupURI *) uris->data)->port);
+  g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+#endif
+
+  return uri_format;
+}
+
+
+static ChamplainMapSource *
+create_map_source (const gchar *uri_format,
+    const gchar *cache_dir)
+{
+  ChamplainMapSourceFactory *factory = champlain_map_source_factory_dup_default ();
+  ChamplainMapSourceChain *source_chain;
+  ChamplainNetworkTileSource *tile_source;
+
+  tile_source = champlain_network_tile_source_new_full ("bench",
+        "Benchmark",
+        NULL,
+        NULL,
+        0,
+        18,
+        TILE_SIZE,
+        CHAMPLAIN_MAP_PROJECTION_MERCATOR,
+        uri_format,
+        CHAMPLAIN_RENDERER (champlain_image_renderer_new ()));
+  champlain_network_tile_source_set_max_conns (tile_source, max_conns);
+  champlain_network_tile_source_set_adaptive_conns (tile_source, adaptive);
+  /* the tiles have to wait for the validation to be measured */
+  champlain_network_tile_source_set_background_revalidation (tile_source, FALSE);
+
+  source_chain = champlain_map_source_chain_new ();
+  champlain_map_source_chain_push (source_chain,
+      champlain_map_source_factory_create_error_source (factory, TILE_SIZE));
+  champlain_map_source_chain_push (source_chain, CHAMPLAIN_MAP_SOURCE (tile_source));
+
+  if (cache_dir)
+    {
+      champlain_map_source_chain_push (source_chain,
+          CHAMPLAIN_MAP_SOURCE (champlain_file_cache_new_full (100000000, cache_dir,
+                  CHAMPLAIN_RENDERER (champlain_image_renderer_new ()))));
+      champlain_map_source_chain_push (source_chain,
+          CHAMPLAIN_MAP_SOURCE (champlain_memory_cache_new_full (n_tiles,
+                  CHAMPLAIN_RENDERER (champlain_image_renderer_new ()))));
+    }
+
+  g_object_unref (factory);
+
+  return CHAMPLAIN_MAP_SOURCE (source_chain);
+}
+
+
+static void
+remove_dir (GFile *dir)
+{
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+
+  enumerator = g_file_enumerate_children (dir, G_FILE_ATTRIBUTE_STANDARD_NAME ","
+        G_FILE_ATTRIBUTE_STANDARD_TYPE, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+
+  while (enumerator && (info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL)
+    {
+      GFile *child = g_file_get_child (dir, g_file_info_get_name (info));
+
+      if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+        remove_dir (child);
+      else
+        g_file_delete (child, NULL, NULL);
+
+      g_object_unref (child);
+      g_object_unref (info);
+    }
+
+  g_clear_object (&enumerator);
+  g_file_delete (dir, NULL, NULL);
+}
+
+
+static gint
+compare_doubles (gconstpointer a,
+    gconstpointer b)
+{
+  gdouble da = *(const gdouble *) a;
+  gdouble db = *(const gdouble *) b;
+
+  return (da > db) - (da < db);
+}
+
+
+static gdouble
+percentile (GArray *sorted,
+    gdouble p)
+{
+  if (sorted->len == 0)
+    return 0;
+
+  return g_array_index (sorted, gdouble, MIN ((guint) (p * sorted->len), sorted->len - 1));
+}
+
+
+static void
+report_pass (Bench *bench)
+{
+  gdouble seconds = (g_get_monotonic_time () - bench->pass_start) / 1e6;
+
+  g_array_sort (bench->latencies, compare_doubles);
+
+  printf ("pass %u: %u tiles in %.3f s, %.1f tiles/s, %u failed; "
+      "latency p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+      bench->pass + 1,
+      bench->tiles->len,
+      seconds,
+      bench->tiles->len / seconds,
+      bench->n_failed,
+      percentile (bench->latencies, 0.5),
+      percentile (bench->latencies, 0.9),
+      percentile (bench->latencies, 0.99),
+      percentile (bench->latencies, 1.0));
+}
+
+
+static void start_pass (Bench *bench);
+
+static gboolean
+next_pass_cb (Bench *bench)
+{
+  g_ptr_array_set_size (bench->tiles, 0);
+
+  if (++bench->pass < (guint) n_passes)
+    start_pass (bench);
+  else
+    clutter_main_quit ();
+
+  return FALSE;
+}
+
+
+static void
+tile_rendered_cb (G_GNUC_UNUSED ChamplainTile *tile,
+    gpointer data,
+    G_GNUC_UNUSED guint size,
+    gboolean error,
+    TileData *tile_data)
+{
+  /* the error tile comes without data */
+  if (error || !data)
+    tile_data->failed = TRUE;
+}
+
+
+static void
+tile_state_cb (ChamplainTile *tile,
+    G_GNUC_UNUSED GParamSpec *pspec,
+    TileData *tile_data)
+{
+  Bench *bench = tile_data->bench;
+  gdouble latency_ms;
+
+  if (champlain_tile_get_state (tile) != CHAMPLAIN_STATE_DONE)
+    return;
+
+  latency_ms = (g_get_monotonic_time () - tile_data->start) / 1e3;
+  g_array_append_val (bench->latencies, latency_ms);
+  if (tile_data->failed)
+    bench->n_failed++;
+
+  g_signal_handlers_disconnect_by_data (tile, tile_data);
+  g_slice_free (TileData, tile_data);
+
+  if (--bench->n_pending == 0)
+    {
+      report_pass (bench);
+      /* let the sources finish with the last tile first */
+      g_idle_add ((GSourceFunc) next_pass_cb, bench);
+    }
+}
+
+
+static void
+start_pass (Bench *bench)
+{
+  guint side = 1;
+  gint i;
+
+  while (side * side < (guint) n_tiles)
+    side++;
+
+  g_array_set_size (bench->latencies, 0);
+  bench->n_failed = 0;
+  bench->n_pending = n_tiles;
+  bench->pass_start = g_get_monotonic_time ();
+
+  for (i = 0; i < n_tiles; i++)
+    {
+      ChamplainTile *tile;
+      TileData *tile_data;
+
+      tile = champlain_tile_new_full (i % side, i / side, TILE_SIZE, ZOOM_LEVEL);
+      g_ptr_array_add (bench->tiles, g_object_ref_sink (tile));
+
+      if (revalidate)
+        {
+          /* pretend the tile comes from the cache and has expired */
+          gchar *etag = g_strdup_printf ("\"%u-%u-%u\"", ZOOM_LEVEL, i % side, i / side);
+
+          champlain_tile_set_etag (tile, etag);
+          champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADED);
+          g_free (etag);
+        }
+      else
+        champlain_tile_set_state (tile, CHAMPLAIN_STATE_LOADING);
+
+      tile_data = g_slice_new0 (TileData);
+      tile_data->bench = bench;
+      tile_data->start = g_get_monotonic_time ();
+      g_signal_connect (tile, "notify::state", G_CALLBACK (tile_state_cb), tile_data);
+      g_signal_connect (tile, "render-complete", G_CALLBACK (tile_rendered_cb), tile_data);
+
+      champlain_map_source_fill_tile (bench->map_source, tile);
+    }
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  TileServer tile_server = { 0, };
+  Bench bench = { 0, };
+  GError *error = NULL;
+  gchar *uri_format;
+
+  if (clutter_init_with_args (&argc, &argv, "- benchmark the network tile source",
+          entries, NULL, &error) != CLUTTER_INIT_SUCCESS)
+    {
+      g_printerr ("%s\n", error ? error->message : "Unable to initialize Clutter");
+      return 1;
+    }
+
+  if (n_tiles <= 0 || n_passes <= 0)
+    return 0;
+
+  uri_format = start_server (&tile_server, &error);
+  if (!uri_format)
+    {
+      g_printerr ("Unable to start the tile server: %s\n", error->message);
+      return 1;
+    }
+
+  if (use_caches)
+    {
+      bench.cache_dir = g_dir_make_tmp ("champlain-bench-XXXXXX", &error);
+      if (!bench.cache_dir)
+        {
+          g_printerr ("Unable to create the cache directory: %s\n", error->message);
+          return 1;
+        }
+    }
+
+  bench.map_source = g_object_ref_sink (create_map_source (uri_format, bench.cache_dir));
+  bench.tiles = g_ptr_array_new_with_free_func (g_object_unref);
+  bench.latencies = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  printf ("%d tiles of %" G_GSIZE_FORMAT " bytes, %d ms latency, %d KiB/s, "
+      "%.0f%% errors, %d connections%s\n",
+      n_tiles, tile_server.size, latency, bandwidth, error_rate * 100, max_conns,
+      adaptive ? " (adaptive)" : "");
+
+  start_pass (&bench);
+  clutter_main ();
+
+  printf ("server: %u requests, %u not modified, %u errors\n",
+      tile_server.n_requests, tile_server.n_not_modified, tile_server.n_errors);
+
+  g_object_unref (bench.map_source);
+  g_ptr_array_free (bench.tiles, TRUE);
+  g_array_free (bench.latencies, TRUE);
+
+  if (bench.cache_dir)
+    {
+      GFile *dir = g_file_new_for_path (bench.cache_dir);
+
+      remove_dir (dir);
+      g_object_unref (dir);
+      g_free (bench.cache_dir);
+    }
+
+  g_object_unref (tile_server.server);
+  g_free (tile_server.data);
+  g_free (uri_format);
+
+  return 0;
+}
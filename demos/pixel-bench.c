@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2026 The libchamplain authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Benchmarks the pixel format conversions used by the renderers. Every
+ * kernel supported by the CPU converts --tiles tiles of --size pixels and
+ * is checked against the scalar one.
+ *
+ * The conversion functions are internal to the library, so they are built
+ * into this program directly.
+ */
+
+#include "champlain/champlain-pixel-convert.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static gint tile_size = 512;
+static gint n_tiles = 200;
+
+static GOptionEntry entries[] =
+{
+  { "size", 's', 0, G_OPTION_ARG_INT, &tile_size, "Tile size in pixels (512)", "PX" },
+  { "tiles", 't', 0, G_OPTION_ARG_INT, &n_tiles, "Tiles converted by every kernel (200)", "N" },
+  { NULL }
+};
+
+static const gchar *kernels[] = { "scalar", "sse2", "avx2", "neon" };
+
+typedef enum
+{
+  CONVERT_RGBA,
+  CONVERT_RGB,
+  CONVERT_SWAP
+} Conversion;
+
+static const gchar *conversion_names[] = {
+  "rgba -> argb premultiplied",
+  "rgb -> argb",
+  "swap red and blue"
+};
+
+
+static void
+convert_tile (Conversion conversion,
+    const guint8 *src,
+    guint8 *dst)
+{
+  gint y;
+
+  for (y = 0; y < tile_size; y++)
+    {
+      switch (conversion)
+        {
+        case CONVERT_RGBA:
+          champlain_pixel_convert_rgba_to_argb_pre (src + y * tile_size * 4,
+              dst + y * tile_size * 4, tile_size);
+          break;
+
+        case CONVERT_RGB:
+          champlain_pixel_convert_rgb_to_argb (src + y * tile_size * 3,
+              dst + y * tile_size * 4, tile_size);
+          break;
+
+        case CONVERT_SWAP:
+          champlain_pixel_convert_swap_red_blue (dst + y * tile_size * 4, tile_size);
+          break;
+        }
+    }
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  guint8 *src, *dst, *expected;
+  gsize n_bytes;
+  guint i, k, c;
+
+  context = g_option_context_new ("- benchmark the pixel format conversions");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (tile_size <= 0 || n_tiles <= 0)
+    return 0;
+
+  n_bytes = (gsize) tile_size * tile_size * 4;
+  src = g_malloc (n_bytes);
+  dst = g_malloc (n_bytes);
+  expected = g_malloc (n_bytes);
+
+  for (i = 0; i < n_bytes; i++)
+    src[i] = g_random_int_range (0, 256);
+
+  printf ("%d tiles of %dx%d pixels, best kernel: %s\n",
+      n_tiles, tile_size, tile_size, champlain_pixel_convert_get_kernel ());
+
+  for (c = CONVERT_RGBA; c <= CONVERT_SWAP; c++)
+    {
+      printf ("%s\n", conversion_names[c]);
+
+      champlain_pixel_convert_set_kernel ("scalar");
+      memcpy (expected, src, n_bytes);
+      convert_tile (c, src, expected);
+
+      for (k = 0; k < G_N_ELEMENTS (kernels); k++)
+        {
+          gint64 start, elapsed;
+          gint n;
+
+          if (!champlain_pixel_convert_set_kernel (kernels[k]))
+            continue;
+
+          memcpy (dst, src, n_bytes);
+          convert_tile (c, src, dst);
+          if (memcmp (dst, expected, n_bytes) != 0)
+            {
+              printf ("  %-8s results differ from the scalar kernel\n", kernels[k]);
+              continue;
+            }
+
+          start = g_get_monotonic_time ();
+          for (n = 0; n < n_tiles; n++)
+            convert_tile (c, src, dst);
+          elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+          printf ("  %-8s %8.1f us/tile %8.1f Mpixels/s\n", kernels[k],
+              (gdouble) elapsed / n_tiles,
+              (gdouble) tile_size * tile_size * n_tiles / elapsed);
+        }
+    }
+
+  g_free (src);
+  g_free (dst);
+  g_free (expected);
+
+  return 0;
+}